@@ -27,12 +27,10 @@
 #include <annotation_window_callbacks.h>
 #include <utils.h>
 #include <input.h>
-#include <broken.h>
 #include <background_window.h>
-#include <bezier_spline.h>
 #include <cursors.h>
 #include <iwb_loader.h>
-#include <fill.h>
+#include <stroke_journal.h>
 
 
 #ifdef _WIN32
@@ -44,89 +42,6 @@
 static AnnotateData *data;
 
 
-/* Create a new paint context. */
-static AnnotatePaintContext *
-annotate_paint_context_new        (AnnotatePaintType type)
-{
-  AnnotatePaintContext *context = (AnnotatePaintContext *) NULL;
-  context = g_malloc ((gsize) sizeof (AnnotatePaintContext));
-  context->type = type;
-
-  return context;
-}
-
-
-/* Calculate the direction in radiant. */
-static gdouble
-annotate_get_arrow_direction      (AnnotateDeviceData *devdata)
-{
-  /* Precondition: the list must be not null and the length might be greater than two. */
-  AnnotatePoint *point = (AnnotatePoint *) NULL;
-  AnnotatePoint *old_point = (AnnotatePoint *) NULL;
-  gdouble delta = 2.0;
-  gdouble ret = 0.0;
-  GSList *out_ptr = devdata->coord_list;
-  gdouble tollerance = annotate_get_thickness () * delta;
-
-  /* Build the relevant point list with the standard deviation algorithm. */
-  GSList *relevantpoint_list = build_meaningful_point_list (out_ptr, FALSE, tollerance);
-
-  old_point = (AnnotatePoint *) g_slist_nth_data (relevantpoint_list, 1);
-  point = (AnnotatePoint *) g_slist_nth_data (relevantpoint_list, 0);
-  /* Give the direction using the last two point. */
-  ret = atan2 (point->y-old_point->y, point->x-old_point->x);
-
-  /* Free the relevant point list. */
-  g_slist_foreach (relevantpoint_list, (GFunc) g_free, (gpointer) NULL);
-  g_slist_free (relevantpoint_list);
-  relevantpoint_list = (GSList *) NULL;
-
-  return ret;
-}
-
-
-/* Colour selector; if eraser than select the transparent colour else allocate the right colour. */
-static void
-select_color            ()
-{
-  if (!data->annotation_cairo_context)
-    {
-      return;
-    }
-
-  if (data->cur_context)
-    {
-      if (data->cur_context->type != ANNOTATE_ERASER) //pen or arrow tool
-        {
-          /* Select the colour. */
-          if (data->color)
-            {
-              if (data->debug)
-                {
-                  g_printerr ("Select colour %s\n", data->color);
-                }
-
-              cairo_set_source_color_from_string (data->annotation_cairo_context,
-                                                  data->color);
-            }
-
-          cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_SOURCE);
-        }
-      else
-        {
-
-          /* It is the eraser tool. */
-          if (data->debug)
-            {
-              g_printerr ("Select transparent colour to erase\n");
-            }
-
-          cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_CLEAR);
-        }
-    }
-}
-
-
 #ifdef _WIN32
 
 
@@ -204,198 +119,38 @@ annotate_acquire_input_grab  ()
 static void
 destroy_cairo           ()
 {
-  guint refcount =  (guint) cairo_get_reference_count (data->annotation_cairo_context);
+  guint refcount =  (guint) cairo_get_reference_count (data->canvas->cr);
 
   guint i = 0;
 
   for  (i=0; i<refcount; i++)
     {
-      cairo_destroy (data->annotation_cairo_context);
+      cairo_destroy (data->canvas->cr);
     }
 
-  data->annotation_cairo_context = (cairo_t *) NULL;
-}
-
+  canvas_set_cairo_context (data->canvas, (cairo_t *) NULL);
 
-/* This an ellipse taking the top left edge coordinates
- * and the width and the height of the bounded rectangle.
- */
-static void
-annotate_draw_ellipse   (AnnotateDeviceData *devdata,
-                         gdouble x,
-                         gdouble y,
-                         gdouble width,
-                         gdouble height,
-                         gdouble pressure)
-{
-  if (data->debug)
+  if (data->annotation_layer)
     {
-      g_printerr ("Draw ellipse: 2a=%f 2b=%f\n", width, height);
+      canvas_set_damage_func (data->canvas, (AnnotateDamageFunc) NULL, NULL);
+      cairo_surface_destroy (data->annotation_layer);
+      data->annotation_layer = (cairo_surface_t *) NULL;
     }
-
-  annotate_modify_color (devdata, data, pressure);
-
-  cairo_save (data->annotation_cairo_context);
-
-  /* The ellipse is done as a 360 degree arc translated. */
-  cairo_translate (data->annotation_cairo_context, x + width / 2., y + height / 2.);
-  cairo_scale (data->annotation_cairo_context, width / 2., height / 2.);
-  cairo_arc (data->annotation_cairo_context, 0., 0., 1., 0., 2 * M_PI);
-  cairo_restore (data->annotation_cairo_context);
-
 }
 
 
-/* Draw a curve using a cubic bezier splines passing to the list's coordinate. */
-static void
-annotate_draw_curve    (AnnotateDeviceData *devdata,
-                        GSList             *list)
-{
-  guint lenght = g_slist_length (list);
-
-  if (list)
-    {
-      guint i = 0;
-      for (i=0; i<lenght; i=i+3)
-        {
-          AnnotatePoint *first_point = (AnnotatePoint *) g_slist_nth_data (list, i);
-          if (!first_point)
-            {
-              return;
-            }
-          if (lenght == 1)
-            {
-              /* It is a point. */
-              annotate_draw_point (devdata, first_point->x, first_point->y, first_point->pressure);
-            }
-          else
-            {
-              AnnotatePoint *second_point = (AnnotatePoint *) g_slist_nth_data (list, i+1);
-              if (!second_point)
-                {
-                  return;
-                }
-              else
-                {
-                  AnnotatePoint *third_point = (AnnotatePoint *) g_slist_nth_data (list, i+2);
-                  if (!third_point)
-                    {
-                      /* draw line from first to second point */
-                      annotate_draw_line (devdata, second_point->x, second_point->y, FALSE);
-                      return;
-                    }
-                  annotate_modify_color (devdata, data, second_point->pressure);
-                  cairo_curve_to (data->annotation_cairo_context,
-                                  first_point->x,
-                                  first_point->y,
-                                  second_point->x,
-                                  second_point->y,
-                                  third_point->x,
-                                  third_point->y);
-                }
-            }
-        }
-    }
-}
-
-
-/* Rectify the line. */
-static void
-rectify            (AnnotateDeviceData *devdata,
-                    gboolean            closed_path)
-{
-  gdouble tollerance = annotate_get_thickness ();
-  GSList *broken_list = broken (devdata->coord_list, closed_path, TRUE, tollerance);
-
-  if (data->debug)
-    {
-      g_printerr ("rectify\n");
-    }
-
-  /* Restore the surface without the last path handwritten. */
-  annotate_restore_surface ();
-
-  annotate_draw_point_list (devdata, broken_list);
-
-  annotate_coord_dev_list_free (devdata);
-  devdata->coord_list = broken_list;
-  
-}
-
-
-/* Roundify the line. */
+/*
+ * The canvas has painted the area of the annotation layer; only this
+ * area of the window is composed again.
+ */
 static void
-roundify           (AnnotateDeviceData *devdata,
-                    gboolean            closed_path)
+on_canvas_damage        (const cairo_rectangle_int_t *area,
+                         gpointer                     user_data)
 {
-  gdouble tollerance = annotate_get_thickness ();
-
-  /* Build the meaningful point list with the standard deviation algorithm. */
-  GSList *meaningful_point_list = (GSList *) NULL;
+  AnnotateData *data = (AnnotateData *) user_data;
+  GdkRectangle rectangle = { area->x, area->y, area->width, area->height };
 
-  /* Restore the surface without the last path handwritten. */
-  annotate_restore_surface ();
-
-  meaningful_point_list = build_meaningful_point_list (devdata->coord_list, closed_path, tollerance);
-
-  if ( g_slist_length (meaningful_point_list) < 4)
-    {
-      /* Draw the point line as is and jump the bezier algorithm. */
-      annotate_draw_point_list (devdata, meaningful_point_list);
-    }
-  else if ((closed_path) && (is_similar_to_an_ellipse (meaningful_point_list, tollerance)))
-    {
-      GSList *rect_list = build_outbounded_rectangle (meaningful_point_list);
-
-      if (rect_list)
-        {
-          AnnotatePoint *point1 = (AnnotatePoint *) g_slist_nth_data (rect_list, 0);
-          AnnotatePoint *point2 = (AnnotatePoint *) g_slist_nth_data (rect_list, 1);
-          AnnotatePoint *point3 = (AnnotatePoint *) g_slist_nth_data (rect_list, 2);
-          gdouble p1p2 = get_distance(point1->x, point1->y, point2->x, point2->y);
-          gdouble p2p3 = get_distance(point2->x, point2->y, point3->x, point3->y);
-          gdouble e_threshold = 0.5;
-          gdouble a = 0;
-          gdouble b = 0;
-          if (p1p2>p2p3)
-            {
-              b = p2p3/2;
-              a = p1p2/2;
-            }
-          else
-            {
-              a = p2p3/2;
-              b = p1p2/2;
-            }
-          gdouble e = 1-powf((b/a), 2);
-          /* If the eccentricity is roundable to 0 it is a circle */
-          if ((e >= 0) && (e <= e_threshold))
-            {
-              /* Move the down right point in the right position to square the circle */
-              gdouble quad_distance = (p1p2+p2p3)/2;
-              point3->x = point1->x+quad_distance;
-              point3->y = point1->y+quad_distance;
-            }
-
-          annotate_draw_ellipse (devdata, point1->x, point1->y, point3->x-point1->x, point3->y-point1->y, point1->pressure);
-          g_slist_foreach (rect_list, (GFunc)g_free, NULL);
-          g_slist_free (rect_list);
-        }
-    }
-
-  else
-    {
-      /* It is not an ellipse; I use bezier to spline the path. */
-      GSList *splined_list = spline (meaningful_point_list);
-      annotate_draw_curve (devdata, splined_list);
-
-      annotate_coord_dev_list_free (devdata);
-      devdata->coord_list = splined_list;
-
-    }
-
-  g_slist_foreach (meaningful_point_list, (GFunc) g_free, (gpointer) NULL);
-  g_slist_free (meaningful_point_list);
+  gdk_window_invalidate_rect (gtk_widget_get_window (data->annotation_window), &rectangle, FALSE);
 }
 
 
@@ -477,8 +232,11 @@ setup_app          (GtkWidget* parent)
 }
 
 
-/* Create the directory where put the save-point files. */
-static void
+/*
+ * Create the directory where put the save-point files;
+ * the returned value must be free with the g_free.
+ */
+static gchar *
 create_savepoint_dir    ()
 {
   const gchar *tmpdir = g_get_tmp_dir ();
@@ -486,6 +244,7 @@ create_savepoint_dir    ()
   gchar *project_name = get_project_name ();
   gchar *ardesia_tmp_dir = g_build_filename (tmpdir, PACKAGE_NAME, (gchar *) 0);
   gchar *project_tmp_dir = g_build_filename (ardesia_tmp_dir, project_name, (gchar *) 0);
+  gchar *savepoint_dir = (gchar *) NULL;
 
   if (g_file_test (ardesia_tmp_dir, G_FILE_TEST_IS_DIR))
     {
@@ -493,60 +252,11 @@ create_savepoint_dir    ()
       rmdir_recursive (ardesia_tmp_dir);
     }
 
-  data->savepoint_dir = g_build_filename (project_tmp_dir, images, (gchar *) 0);
-  g_mkdir_with_parents (data->savepoint_dir, 0777);
+  savepoint_dir = g_build_filename (project_tmp_dir, images, (gchar *) 0);
+  g_mkdir_with_parents (savepoint_dir, 0777);
   g_free (ardesia_tmp_dir);
   g_free (project_tmp_dir);
-}
-
-
-/* Delete the save-point. */
-static void
-delete_savepoint        (AnnotateSavepoint *savepoint)
-{
-  if (savepoint)
-    {
-
-      if (data->debug)
-        {
-          g_printerr ("The save-point %s has been removed\n", savepoint->filename);
-        }
-
-      if (savepoint->filename)
-        {
-          g_remove (savepoint->filename);
-          g_free (savepoint->filename);
-          savepoint->filename = (gchar *) NULL;
-        }
-      data->savepoint_list = g_slist_remove (data->savepoint_list, savepoint);
-      g_free (savepoint);
-      savepoint = (AnnotateSavepoint *) NULL;
-    }
-}
-
-
-/* Free the list of the  save-point for the redo. */
-static void
-annotate_redolist_free       ()
-{
-  guint i = data->current_save_index;
-  GSList *stop_list = g_slist_nth (data->savepoint_list, i);
-  
-  while (data->savepoint_list != stop_list)
-    {
-      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) g_slist_nth_data (data->savepoint_list, 0);
-      delete_savepoint (savepoint);
-    }
-}
-
-
-/* Free the list of all the save-point. */
-static void
-annotate_savepoint_list_free ()
-{
-  g_slist_foreach (data->savepoint_list, (GFunc) delete_savepoint, (gpointer) NULL);
-
-  data->savepoint_list = (GSList *) NULL;
+  return savepoint_dir;
 }
 
 
@@ -560,84 +270,11 @@ delete_ardesia_tmp_dir       ()
 }
 
 
-/* Draw an arrow starting from the point 
- * whith the width and the direction in radiant
- */
-static void
-draw_arrow_in_point     (AnnotatePoint      *point,
-                         gdouble             width,
-                         gdouble             direction)
-{
-
-  gdouble width_cos = width * cos (direction);
-  gdouble width_sin = width * sin (direction);
-
-  /* Vertex of the arrow. */
-  gdouble arrow_head_0_x = point->x + width_cos;
-  gdouble arrow_head_0_y = point->y + width_sin;
-
-  /* Left point. */
-  gdouble arrow_head_1_x = point->x - width_cos + width_sin;
-  gdouble arrow_head_1_y = point->y -  width_cos - width_sin;
-
-  /* Origin. */
-  gdouble arrow_head_2_x = point->x - 0.8 * width_cos;
-  gdouble arrow_head_2_y = point->y - 0.8 * width_sin;
-
-  /* Right point. */
-  gdouble arrow_head_3_x = point->x - width_cos - width_sin;
-  gdouble arrow_head_3_y = point->y +  width_cos - width_sin;
-
-  cairo_stroke (data->annotation_cairo_context);
-  cairo_save (data->annotation_cairo_context);
-
-  /* Initialize cairo properties. */
-  cairo_set_line_join (data->annotation_cairo_context, CAIRO_LINE_JOIN_MITER);
-  cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_SOURCE);
-  cairo_set_line_width (data->annotation_cairo_context, width);
-
-  /* Draw the arrow. */
-  cairo_move_to (data->annotation_cairo_context, arrow_head_2_x, arrow_head_2_y);
-  cairo_line_to (data->annotation_cairo_context, arrow_head_1_x, arrow_head_1_y);
-  cairo_line_to (data->annotation_cairo_context, arrow_head_0_x, arrow_head_0_y);
-  cairo_line_to (data->annotation_cairo_context, arrow_head_3_x, arrow_head_3_y);
-
-  cairo_close_path (data->annotation_cairo_context);
-  cairo_fill_preserve (data->annotation_cairo_context);
-  cairo_stroke (data->annotation_cairo_context);
-  cairo_restore (data->annotation_cairo_context);
-
-  if (data->debug)
-    {
-      g_printerr ("with vertex at (x,y)= (%f : %f)\n",  arrow_head_0_x , arrow_head_0_y);
-    }
-}
-
-
 /* Configure pen option for cairo context. */
 void 
 annotate_configure_pen_options    (AnnotateData       *data)
 {
-
-  if (data->annotation_cairo_context)
-    {
-      cairo_new_path (data->annotation_cairo_context);
-      cairo_set_line_cap (data->annotation_cairo_context, CAIRO_LINE_CAP_ROUND);
-      cairo_set_line_join (data->annotation_cairo_context, CAIRO_LINE_JOIN_ROUND);
-      
-      if (data->cur_context->type == ANNOTATE_ERASER)
-        {
-          data->cur_context = data->default_eraser;
-          cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_CLEAR);
-          cairo_set_line_width (data->annotation_cairo_context, annotate_get_thickness ());
-        }
-      else
-        {
-          cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_SOURCE);
-          cairo_set_line_width (data->annotation_cairo_context, annotate_get_thickness ());
-        }
-    }
-    select_color ();
+  canvas_configure_pen_options (data->canvas);
 }
 
 
@@ -648,47 +285,8 @@ annotate_configure_pen_options    (AnnotateData       *data)
 void
 annotate_add_savepoint  ()
 {
-  AnnotateSavepoint *savepoint = g_malloc ((gsize) sizeof (AnnotateSavepoint));
-  cairo_surface_t *saved_surface = (cairo_surface_t *) NULL;
-  cairo_surface_t *source_surface = (cairo_surface_t *) NULL;
-  cairo_t *cr = (cairo_t *) NULL;
-
-  /* The story about the future is deleted. */
-  annotate_redolist_free ();
-
-  guint savepoint_index = g_slist_length (data->savepoint_list) + 1;
-  
-  savepoint->filename = g_strdup_printf ("%s%s%s_%d_vellum.png",
-                                          data->savepoint_dir,
-                                          G_DIR_SEPARATOR_S,
-                                          PACKAGE_NAME,
-                                          savepoint_index);
-
-  /* Add a new save-point. */
-  data->savepoint_list = g_slist_prepend (data->savepoint_list, savepoint);
-  data->current_save_index = 0;
-
-  /* Load a surface with the data->annotation_cairo_context content and write the file. */
-  saved_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                              gdk_screen_width (),
-                                              gdk_screen_height ());
-
-  source_surface = cairo_get_target (data->annotation_cairo_context);
-  cr = cairo_create (saved_surface);
-  cairo_set_source_surface (cr, source_surface, 0, 0);
-  cairo_paint (cr);
-  /* Postcondition: the saved_surface now contains the save-point image. */
-
-
-  /*  Will be create a file in the save-point folder with format PACKAGE_NAME_1.png. */
-  cairo_surface_write_to_png (saved_surface, savepoint->filename);
-  cairo_surface_destroy (saved_surface);
-  if (data->debug)
-    {
-      g_printerr ("The save point %s has been stored in file\n", savepoint->filename);
-    }
-
-  cairo_destroy (cr);
+  journal_stroke (data->canvas);
+  canvas_add_savepoint (data->canvas);
 }
 
 
@@ -696,8 +294,10 @@ annotate_add_savepoint  ()
 void
 initialize_annotation_cairo_context    (AnnotateData *data)
 {
-  if (data->annotation_cairo_context == NULL)
+  if (data->canvas->cr == NULL)
     {
+      cairo_t *cr = (cairo_t *) NULL;
+
       /* Initialize a transparent window. */
 #ifdef _WIN32
       /* The hdc has depth 32 and the technology is DT_RASDISPLAY. */
@@ -710,23 +310,47 @@ initialize_annotation_cairo_context    (AnnotateData *data)
        */
       cairo_surface_t *surface = cairo_win32_surface_create (hdc);
 
-      data->annotation_cairo_context = cairo_create (surface);
+      cr = cairo_create (surface);
 #else
-      data->annotation_cairo_context = gdk_cairo_create (gtk_widget_get_window (data->annotation_window));
+      if (is_background_layer ())
+        {
+          /*
+           * The canvas paints off screen, where the eraser does not clear
+           * the background, and the window composes the exposed areas.
+           */
+          data->annotation_layer = gdk_window_create_similar_surface (gtk_widget_get_window (data->annotation_window),
+                                                                      CAIRO_CONTENT_COLOR_ALPHA,
+                                                                      data->canvas->width,
+                                                                      data->canvas->height);
+
+          cr = cairo_create (data->annotation_layer);
+          canvas_set_damage_func (data->canvas, on_canvas_damage, data);
+        }
+      else
+        {
+          cr = gdk_cairo_create (gtk_widget_get_window (data->annotation_window));
+        }
 #endif
 
-  if (cairo_status (data->annotation_cairo_context) != CAIRO_STATUS_SUCCESS)
+  canvas_set_cairo_context (data->canvas, cr);
+
+  if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
     {
       g_printerr ("Failed to allocate the annotation cairo context"); 
       annotate_quit ();
       exit (EXIT_FAILURE);
     }
 
-  if (data->savepoint_list == NULL)
+  if (data->canvas->savepoint_list == NULL)
     {
       /* Clear the screen and create the first empty savepoint. */
       annotate_clear_screen ();
     }
+  else if (data->annotation_layer)
+    {
+      /* The layer is painted once; the exposures only compose it. */
+      annotate_restore_surface ();
+    }
 #ifndef _WIN32
       gtk_window_set_opacity (GTK_WINDOW (data->annotation_window), 1.0);
 #endif	
@@ -740,51 +364,20 @@ initialize_annotation_cairo_context    (AnnotateData *data)
 void
 annotate_restore_surface     ()
 {
+  canvas_restore_surface (data->canvas);
+}
 
-  if (data->debug)
-    {
-      g_printerr ("Restore surface\n");
-    }
-
-  if (data->annotation_cairo_context)
-    {
-      guint i = data->current_save_index;
-
-      if (g_slist_length (data->savepoint_list)==i)
-        {
-          cairo_new_path (data->annotation_cairo_context);
-          clear_cairo_context (data->annotation_cairo_context);
-          return;
-        }
-
-      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) g_slist_nth_data (data->savepoint_list, i);
-
-      if (!savepoint)
-        {
-          return;
-        }
-
-      cairo_new_path (data->annotation_cairo_context);
-      cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_SOURCE);
 
-      if (savepoint->filename)
-        {
-          /* Load the file in the annotation surface. */
-          cairo_surface_t *image_surface = cairo_image_surface_create_from_png (savepoint->filename);
-          if (data->debug)
-            {
-              g_printerr ("The save-point %s has been loaded from file\n", savepoint->filename);
-            }
-
-          if (image_surface)
-            {
-              cairo_set_source_surface (data->annotation_cairo_context, image_surface, 0, 0);
-              cairo_paint (data->annotation_cairo_context);
-              cairo_stroke (data->annotation_cairo_context);
-              cairo_surface_destroy (image_surface);
-            }
+/* Paint the background layer and the annotations over it. */
+void
+annotate_paint_layers   (cairo_t *cr)
+{
+  paint_background_layer (cr, data->canvas->width, data->canvas->height);
 
-        }
+  if (data->annotation_layer)
+    {
+      cairo_set_source_surface (cr, data->annotation_layer, 0.0, 0.0);
+      cairo_paint (cr);
     }
 }
 
@@ -797,11 +390,19 @@ get_annotation_window   ()
 }
 
 
+/* Get the annotation window data. */
+AnnotateData *
+get_annotation_data     ()
+{
+  return data;
+}
+
+
 /* Set colour. */
 void
 annotate_set_color      (gchar      *color)
 {
-  data->color = color;
+  data->canvas->color = color;
 }
 
 
@@ -809,7 +410,7 @@ annotate_set_color      (gchar      *color)
 void
 annotate_set_rectifier  (gboolean  rectify)
 {
-  data->rectify = rectify;
+  data->canvas->rectify = rectify;
 }
 
 
@@ -817,7 +418,7 @@ annotate_set_rectifier  (gboolean  rectify)
 void
 annotate_set_rounder    (gboolean roundify)
 {
-  data->roundify = roundify;
+  data->canvas->roundify = roundify;
 }
 
 
@@ -825,7 +426,7 @@ annotate_set_rounder    (gboolean roundify)
 void
 annotate_set_arrow      (gboolean    arrow)
 {
-  data->arrow = arrow;
+  data->canvas->arrow = arrow;
 }
 
 
@@ -833,7 +434,7 @@ annotate_set_arrow      (gboolean    arrow)
 void
 annotate_set_thickness  (gdouble thickness)
 {
-  data->thickness = thickness;
+  data->canvas->thickness = thickness;
 }
 
 
@@ -841,14 +442,7 @@ annotate_set_thickness  (gdouble thickness)
 gdouble
 annotate_get_thickness  ()
 {
-  if (data->cur_context->type == ANNOTATE_ERASER)
-    {
-      /* the eraser is bigger than pen */
-      gdouble corrective_factor = 2.5;
-      return data->thickness * corrective_factor;
-    }
-
-  return data->thickness;
+  return canvas_get_thickness (data->canvas);
 }
 
 
@@ -860,12 +454,7 @@ annotate_coord_list_prepend  (AnnotateDeviceData  *devdata,
                               gdouble              width,
                               gdouble              pressure)
 {
-  AnnotatePoint *point = g_malloc ((gsize) sizeof (AnnotatePoint));
-  point->x = x;
-  point->y = y;
-  point->width = width;
-  point->pressure = pressure;
-  devdata->coord_list = g_slist_prepend (devdata->coord_list, point);
+  devdata->coord_list = canvas_coord_list_prepend (devdata->coord_list, x, y, width, pressure);
 }
 
 
@@ -875,8 +464,7 @@ annotate_coord_dev_list_free (AnnotateDeviceData *devdata)
 {
   if (devdata->coord_list)
     {
-      g_slist_foreach (devdata->coord_list, (GFunc) g_free, (gpointer) NULL);
-      g_slist_free (devdata->coord_list);
+      canvas_coord_list_free (devdata->coord_list);
       devdata->coord_list = (GSList *) NULL;
     }
 }
@@ -888,90 +476,35 @@ annotate_modify_color   (AnnotateDeviceData *devdata,
                          AnnotateData       *data,
                          gdouble             pressure)
 {
-  /* Pressure value is from 0 to 1;this value modify the RGBA gradient. */
-  guint r,g,b,a;
-  gdouble old_pressure = pressure;
-
-  /* If you put an higher value you will have more contrast
-   * between the lighter and darker colour depending on pressure.
-   */
-  gdouble contrast = 96;
-  gdouble corrective = 0;
-
-  /* The pressure is greater than 0. */
-  if ( (!data->annotation_cairo_context) || (!data->color))
-    {
-      return;
-    }
-
-  if (pressure >= 1)
-    {
-      cairo_set_source_color_from_string (data->annotation_cairo_context,
-                                          data->color);
-    }
-  else if (pressure <= 0.1)
-    {
-      pressure = 0.1;
-    }
-
-  sscanf (data->color, "%02X%02X%02X%02X", &r, &g, &b, &a);
-
-  if (devdata->coord_list != NULL)
-    {
-      AnnotatePoint *last_point = (AnnotatePoint *) g_slist_nth_data (devdata->coord_list, 0);
-      old_pressure = last_point->pressure;
-    }
-
-  corrective = (1- ( 3 * pressure + old_pressure)/4) * contrast;
-  cairo_set_source_rgba (data->annotation_cairo_context,
-                         (r + corrective)/255,
-                         (g + corrective)/255,
-                         (b + corrective)/255,
-                         (gdouble) a/255);
+  canvas_modify_color (data->canvas, devdata->coord_list, pressure);
 }
 
+
 /* Paint the context over the annotation window. */
 void
 annotate_push_context (cairo_t * cr)
 {
-  cairo_surface_t* source_surface = (cairo_surface_t *) NULL;
-
   if (data->debug)
     {
       g_printerr ("The text window content has been painted over the annotation window\n");
     }
 
-  cairo_new_path (data->annotation_cairo_context);
-  source_surface = cairo_get_target (cr);
+  journal_text (cr);
+  canvas_push_context (data->canvas, cr);
+}
 
-#ifndef _WIN32
-  /*
-   * The over operator might put the new layer on the top of the old one
-   * overriding the intersections
-   * Seems that this operator does not work on windows
-   * in this operating system only the new layer remain after the merge.
-   *
-   */
-  cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_OVER);
-#else
-  /*
-   * @WORKAROUND using CAIRO_OPERATOR_ADD instead of CAIRO_OPERATOR_OVER
-   * I do this to use the text widget in windows 
-   * I use the CAIRO_OPERATOR_ADD that put the new layer
-   * on the top of the old;this function does not preserve the colour of
-   * the second layer but modify it respecting the first layer.
-   *
-   * Seems that the CAIRO_OPERATOR_OVER does not work because in the
-   * gtk cairo implementation the ARGB32 format is not supported.
-   *
-   */
-  cairo_set_operator (data->annotation_cairo_context, CAIRO_OPERATOR_ADD);
-#endif
 
-  cairo_set_source_surface (data->annotation_cairo_context, source_surface, 0, 0);
-  cairo_paint (data->annotation_cairo_context);
-  cairo_stroke (data->annotation_cairo_context);
-  annotate_add_savepoint ();
+/* Stop the area selection hiding the rubber band. */
+static void
+cancel_area_selection        ()
+{
+  if (data->area_frame)
+    {
+      gtk_widget_destroy (data->area_frame);
+      data->area_frame = (GtkWidget *) NULL;
+    }
+
+  data->area_selected = (AnnotateAreaSelected) NULL;
 }
 
 
@@ -982,29 +515,27 @@ annotate_select_pen          ()
   if (data->debug)
     {
       g_printerr ("The pen with colour %s has been selected\n",
-                  data->color);
+                  data->canvas->color);
     }
 
-  if (data->default_pen)
+  if (data->canvas->default_pen)
     {
-      data->cur_context = data->default_pen;
+      data->canvas->cur_context = data->canvas->default_pen;
       data->old_paint_type = ANNOTATE_PEN;
+      cancel_area_selection ();
 
       disallocate_cursor ();
 
       set_pen_cursor (&data->cursor,
-                      data->thickness,
-                      data->color,
-                      data->arrow);
+                      data->canvas->thickness,
+                      data->canvas->color,
+                      data->canvas->arrow);
 
       update_cursor ();
     }
 }
 
 
-
-
-
 /* Select the default filler tool. */
 void
 annotate_select_filler       ()
@@ -1012,13 +543,14 @@ annotate_select_filler       ()
   if (data->debug)
     {
       g_printerr ("The pen with colour %s has been selected\n",
-                  data->color);
+                  data->canvas->color);
     }
 
-  if (data->default_pen)
+  if (data->canvas->default_pen)
     {
-      data->cur_context = data->default_filler;
+      data->canvas->cur_context = data->canvas->default_filler;
       data->old_paint_type = ANNOTATE_FILLER;
+      cancel_area_selection ();
 
       disallocate_cursor ();
 
@@ -1029,6 +561,137 @@ annotate_select_filler       ()
 }
 
 
+/* Select an area with the rubber band. */
+void
+annotate_select_area         (AnnotateAreaSelected  callback,
+                              gpointer              user_data)
+{
+  if (data->debug)
+    {
+      g_printerr ("The area selection has been started\n");
+    }
+
+  data->area_selected = callback;
+  data->area_user_data = user_data;
+
+  disallocate_cursor ();
+
+  data->cursor = gdk_cursor_new (GDK_CROSSHAIR);
+
+  update_cursor ();
+}
+
+
+/* Get the rectangle between the two corners. */
+static void
+get_area_rectangle           (gdouble       x,
+                              gdouble       y,
+                              GdkRectangle *area)
+{
+  area->x = (gint) MIN (x, data->area_x);
+  area->y = (gint) MIN (y, data->area_y);
+  area->width = (gint) ABS (x - data->area_x);
+  area->height = (gint) ABS (y - data->area_y);
+}
+
+
+/*
+ * Show the border of the area; the window is shaped as a frame then
+ * the content under it is not covered and the input goes through.
+ */
+static void
+update_area_frame            (GdkRectangle *area)
+{
+  GdkRectangle inner = { area->x + AREA_FRAME_WIDTH,
+                         area->y + AREA_FRAME_WIDTH,
+                         area->width - 2 * AREA_FRAME_WIDTH,
+                         area->height - 2 * AREA_FRAME_WIDTH };
+  cairo_rectangle_int_t frame = { 0, 0, area->width, area->height };
+  cairo_region_t *region = (cairo_region_t *) NULL;
+  cairo_region_t *input = cairo_region_create ();
+
+  if ((area->width <= 0) || (area->height <= 0))
+    {
+      gtk_widget_hide (data->area_frame);
+      cairo_region_destroy (input);
+      return;
+    }
+
+  region = cairo_region_create_rectangle (&frame);
+
+  if ((inner.width > 0) && (inner.height > 0))
+    {
+      inner.x -= area->x;
+      inner.y -= area->y;
+      cairo_region_subtract_rectangle (region, &inner);
+    }
+
+  gtk_window_move (GTK_WINDOW (data->area_frame), area->x, area->y);
+  gtk_window_resize (GTK_WINDOW (data->area_frame), area->width, area->height);
+  gtk_widget_shape_combine_region (data->area_frame, region);
+  gtk_widget_input_shape_combine_region (data->area_frame, input);
+  gtk_widget_show (data->area_frame);
+
+  cairo_region_destroy (region);
+  cairo_region_destroy (input);
+}
+
+
+/* Start the rubber band in the point. */
+void
+annotate_area_begin          (gdouble  x,
+                              gdouble  y)
+{
+  GdkRGBA color;
+
+  data->area_x = x;
+  data->area_y = y;
+
+  if (!data->area_frame)
+    {
+      data->area_frame = gtk_window_new (GTK_WINDOW_POPUP);
+      gtk_window_set_keep_above (GTK_WINDOW (data->area_frame), TRUE);
+      gdk_rgba_parse (&color, AREA_FRAME_COLOR);
+      gtk_widget_override_background_color (data->area_frame, GTK_STATE_FLAG_NORMAL, &color);
+    }
+}
+
+
+/* Move the rubber band corner to the point. */
+void
+annotate_area_update         (gdouble  x,
+                              gdouble  y)
+{
+  GdkRectangle area;
+
+  if (data->area_frame)
+    {
+      get_area_rectangle (x, y, &area);
+      update_area_frame (&area);
+    }
+}
+
+
+/* Release the rubber band in the point and notify the area. */
+void
+annotate_area_end            (gdouble  x,
+                              gdouble  y)
+{
+  AnnotateAreaSelected callback = data->area_selected;
+  gboolean started = (data->area_frame != NULL);
+  GdkRectangle area;
+
+  get_area_rectangle (x, y, &area);
+  cancel_area_selection ();
+
+  /* The callback can select an other tool. */
+  if ((started) && (area.width > 1) && (area.height > 1))
+    {
+      callback (area.x, area.y, area.width, area.height, data->area_user_data);
+    }
+}
+
+
 /* Select the default eraser tool. */
 void
 annotate_select_eraser       ()
@@ -1038,8 +701,9 @@ annotate_select_eraser       ()
       g_printerr ("The eraser has been selected\n");
     }
 
-  data->cur_context = data->default_eraser;
+  data->canvas->cur_context = data->canvas->default_eraser;
   data->old_paint_type = ANNOTATE_ERASER;
+  cancel_area_selection ();
 
   disallocate_cursor ();
 
@@ -1100,24 +764,7 @@ annotate_draw_line      (AnnotateDeviceData  *devdata,
                          gdouble              y2,
                          gboolean             stroke)
 {
-  if (!stroke)
-    {
-      cairo_line_to (data->annotation_cairo_context, x2, y2);
-    }
-  else
-    {
-      AnnotatePoint *last_point = (AnnotatePoint *) g_slist_nth_data (devdata->coord_list, 0);
-      if (last_point)
-        {
-          cairo_move_to (data->annotation_cairo_context, last_point->x, last_point->y);
-        }
-      else
-        {
-          cairo_move_to (data->annotation_cairo_context, x2, y2);
-        }
-      cairo_line_to (data->annotation_cairo_context, x2, y2);
-      cairo_stroke (data->annotation_cairo_context);
-    }
+  canvas_draw_line (data->canvas, devdata->coord_list, x2, y2, stroke);
 }
 
 
@@ -1126,29 +773,7 @@ void
 annotate_draw_point_list     (AnnotateDeviceData *devdata,
                               GSList             *list)
 {
-  if (list)
-    {
-      guint i = 0;
-      guint lenght = g_slist_length (list);
-      for (i=0; i<lenght; i=i+1)
-        {
-          AnnotatePoint *point = (AnnotatePoint *) g_slist_nth_data (list, i);
-          if (!point)
-            {
-              return;
-            }
-            
-          if (lenght == 1)
-            {
-              /* It is a point. */
-              annotate_draw_point (devdata, point->x, point->y, point->pressure);
-              break;
-            }
-          annotate_modify_color (devdata, data, point->pressure);
-          /* Draw line between the two points. */
-          annotate_draw_line (devdata, point->x, point->y, FALSE);
-        }
-    }
+  canvas_draw_point_list (data->canvas, devdata->coord_list, list);
 }
 
 
@@ -1157,37 +782,7 @@ void
 annotate_draw_arrow     (AnnotateDeviceData  *devdata,
                          gdouble              distance)
 {
-  gdouble direction = 0;
-  gdouble pen_width = annotate_get_thickness ();
-  gdouble arrow_minimum_size = pen_width * 2;
-
-  AnnotatePoint *point = (AnnotatePoint *) g_slist_nth_data (devdata->coord_list, 0);
-
-  if (distance < arrow_minimum_size)
-    {
-      return;
-    }
-
-  if (data->debug)
-    {
-      g_printerr ("Draw arrow: ");
-    }
-
-  if (g_slist_length (devdata->coord_list) < 2)
-    {
-      /* If it has length lesser then two then is a point and it has no sense draw the arrow. */
-      return;
-    }
-
-  /* Postcondition length >= 2 */
-  direction = annotate_get_arrow_direction (devdata);
-
-  if (data->debug)
-    {
-      g_printerr ("Arrow direction %f\n", direction/M_PI*180);
-    }
-
-  draw_arrow_in_point (point, pen_width, direction);
+  canvas_draw_arrow (data->canvas, devdata->coord_list, distance);
 }
 
 
@@ -1198,30 +793,8 @@ annotate_fill                (AnnotateDeviceData *devdata,
                               gdouble             x,
                               gdouble             y)
 {
-  cairo_surface_t  *image_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                              gdk_screen_width (),
-                                              gdk_screen_height ());
-
-  cairo_surface_t *source_surface = cairo_get_target (data->annotation_cairo_context);
-  cairo_t *cr = cairo_create (image_surface);
-  cairo_set_source_surface (cr, source_surface, 0, 0);
-  cairo_paint (cr);
-  
-  select_color (devdata);
-  
-  if (data->debug)
-    {
-      g_printerr ("Fill with fill flood algorithm\n");
-    }
-         
-  flood_fill (data->annotation_cairo_context,
-              image_surface,
-              data->color,
-              x,
-              y);
-
-  annotate_add_savepoint ();
-  cairo_surface_destroy (image_surface);
+  canvas_fill (data->canvas, x, y);
+  journal_fill (data->canvas, x, y);
 }
 
 
@@ -1232,10 +805,7 @@ annotate_draw_point          (AnnotateDeviceData  *devdata,
                               gdouble              y,
                               gdouble              pressure)
 {
-  /* Modify a little bit the colour depending on pressure. */
-  annotate_modify_color (devdata, data, pressure);
-  cairo_move_to (data->annotation_cairo_context, x, y);
-  cairo_line_to (data->annotation_cairo_context, x, y);
+  canvas_draw_point (data->canvas, devdata->coord_list, x, y, pressure);
 }
 
 
@@ -1244,14 +814,7 @@ void
 annotate_shape_recognize     (AnnotateDeviceData  *devdata,
                               gboolean             closed_path)
 {
-  if (data->rectify)
-    {
-      rectify (devdata, closed_path);
-    }
-  else if (data->roundify)
-    {
-      roundify (devdata, closed_path);
-    }
+  canvas_shape_recognize (data->canvas, &devdata->coord_list, closed_path);
 }
 
 
@@ -1288,7 +851,7 @@ annotate_select_tool (AnnotateData *data,
   else
     {
       g_printerr ("Attempt to select non existent device!\n");
-      data->cur_context = data->default_pen;
+      data->canvas->cur_context = data->canvas->default_pen;
     }
 
   masterdata->lastslave = slavedevice;
@@ -1297,18 +860,6 @@ annotate_select_tool (AnnotateData *data,
 }
 
 
-/* Free the memory allocated by paint context */
-void
-annotate_paint_context_free (AnnotatePaintContext *context)
-{
-  if (context)
-    {
-      g_free (context);
-      context = (AnnotatePaintContext *) NULL;
-    }
-}
-
-
 /* Quit the annotation. */
 void
 annotate_quit           ()
@@ -1316,12 +867,6 @@ annotate_quit           ()
   
   if (data)
     {
-      if (data->color)
-        {
-          g_free (data->color);
-          data->color = NULL;
-        }
-
       /* Destroy cursors. */
       disallocate_cursor ();
       cursors_main_quit ();
@@ -1335,6 +880,8 @@ annotate_quit           ()
           data->invisible_cursor = (GdkCursor *) NULL;
         }
 
+      cancel_area_selection ();
+
       /* Free all. */
       if (data->annotation_window)
         {
@@ -1343,30 +890,12 @@ annotate_quit           ()
         }
   
       remove_input_devices (data);
-      annotate_savepoint_list_free ();
-
-      delete_ardesia_tmp_dir();
 
-      if (data->savepoint_dir)
-        {
-          g_free (data->savepoint_dir);
-          data->savepoint_dir = (gchar *) NULL;
-        }
+      /* Free the canvas and the save-points. */
+      canvas_free (data->canvas);
+      data->canvas = (AnnotateCanvas *) NULL;
 
-      if (data->default_pen)
-        {
-          annotate_paint_context_free (data->default_pen);
-        }
-
-     if (data->default_eraser)
-        {
-          annotate_paint_context_free (data->default_eraser);
-        }
-
-    if (data->default_filler)
-        {
-          annotate_paint_context_free (data->default_filler);
-        }
+      delete_ardesia_tmp_dir();
     }
 }
 
@@ -1388,6 +917,12 @@ annotate_release_input_grab  ()
    * at the moment this call works only on Linux
    */
   gtk_widget_input_shape_combine_region (data->annotation_window, NULL);
+
+  if ((is_background_layer ()) && (get_background_type () != 0))
+    {
+      /* The background layer hides the desktop then it keeps the input as its window did. */
+      return;
+    }
   
   const cairo_rectangle_int_t ann_rect = { 0, 0, 0, 0 };
   cairo_region_t *r = cairo_region_create_rectangle (&ann_rect);
@@ -1431,19 +966,8 @@ annotate_release_grab   ()
 void
 annotate_undo           ()
 {
-  if (data->debug)
-    {
-      g_printerr ("Undo\n");
-    }
-
-  if (data->savepoint_list)
-    {
-      if (data->current_save_index != g_slist_length (data->savepoint_list)-1)
-        {
-          data->current_save_index = data->current_save_index + 1;
-          annotate_restore_surface ();
-        }
-    }
+  canvas_undo (data->canvas);
+  journal_action (STROKE_JOURNAL_RECORD_UNDO);
 }
 
 
@@ -1451,19 +975,8 @@ annotate_undo           ()
 void
 annotate_redo           ()
 {
-  if (data->debug)
-    {
-      g_printerr ("Redo\n");
-    }
-
-  if (data->savepoint_list)
-    {
-      if (data->current_save_index != 0)
-        {
-          data->current_save_index = data->current_save_index - 1;
-          annotate_restore_surface ();
-        }
-    }
+  canvas_redo (data->canvas);
+  journal_action (STROKE_JOURNAL_RECORD_REDO);
 }
 
 
@@ -1471,16 +984,9 @@ annotate_redo           ()
 void
 annotate_clear_screen   ()
 {
-  if (data->debug)
-    {
-      g_printerr ("Clear screen\n");
-    }
-
-  cairo_new_path (data->annotation_cairo_context);
-  clear_cairo_context (data->annotation_cairo_context);
+  canvas_clear (data->canvas);
+  journal_action (STROKE_JOURNAL_RECORD_CLEAR);
   gtk_widget_queue_draw_area (data->annotation_window, 0, 0, gdk_screen_width (), gdk_screen_height ());
-  /* Add the empty savepoint. */
-  annotate_add_savepoint ();
 }
 
 
@@ -1490,42 +996,39 @@ annotate_init                (GtkWidget  *parent,
                               gchar      *iwb_file,
                               gboolean    debug)
 {
+  gchar *savepoint_dir = (gchar *) NULL;
+
   cursors_main ();
   data = g_malloc ((gsize) sizeof (AnnotateData));
-  gchar* color = g_strdup ("FF0000FF");
 
   /* Initialize the data structure. */
-  data->annotation_cairo_context = (cairo_t *) NULL;
-  data->savepoint_list = (GSList *) NULL;
-  data->current_save_index = 0;
+  data->annotation_window = (GtkWidget *) NULL;
+  data->annotation_layer = (cairo_surface_t *) NULL;
   data->cursor = (GdkCursor *) NULL;
   data->devdatatable = (GHashTable *) NULL;
   
-  data->color = color;
   data->is_grabbed = FALSE;
-  data->arrow = FALSE;
-  data->rectify = FALSE;
-  data->roundify = FALSE;
   data->old_paint_type = ANNOTATE_PEN;
 
   data->is_cursor_hidden = TRUE;
 
   data->debug = debug;
-  
-  /* Initialize the pen context. */
-  data->default_pen = annotate_paint_context_new (ANNOTATE_PEN);
-  data->default_eraser = annotate_paint_context_new (ANNOTATE_ERASER);
-  data->default_filler = annotate_paint_context_new (ANNOTATE_FILLER);
-  data->cur_context = data->default_pen;
+
+  data->area_selected = (AnnotateAreaSelected) NULL;
+  data->area_user_data = NULL;
+  data->area_frame = (GtkWidget *) NULL;
+
+  /* Initialize the canvas with the pen context. */
+  savepoint_dir = create_savepoint_dir ();
+  data->canvas = canvas_new (gdk_screen_width (), gdk_screen_height (), savepoint_dir);
+  g_free (savepoint_dir);
   
   setup_input_devices (data);
   allocate_invisible_cursor (&data->invisible_cursor);
-  
-  create_savepoint_dir ();
 
   if (iwb_file)
     {
-      data->savepoint_list = load_iwb (iwb_file);
+      data->canvas->savepoint_list = load_iwb (iwb_file);
     }
 
   setup_app (parent);
@@ -30,6 +30,8 @@
 
 #include <cairo.h>
 
+#include <canvas.h>
+
 #ifdef _WIN32
 #  include <cairo-win32.h>
 #  include <gdkwin32.h>
@@ -52,38 +54,10 @@
 #  define ANNOTATION_UI_FILE ANNOTATION_UI_FOLDER"/annotation_window.glade"
 #endif
 
+/* The border of the rubber band. */
+#define AREA_FRAME_WIDTH 2
+#define AREA_FRAME_COLOR "#3465A4"
 
-/* Enumeration containing tools. */
-typedef enum
-  {
-
-    ANNOTATE_PEN,
-
-    ANNOTATE_ERASER,
-    
-    ANNOTATE_FILLER,
-
-  } AnnotatePaintType;
-
-
-/* Paint context. */
-typedef struct
-{
-
-  /* Context type. */
-  AnnotatePaintType type;
-
-} AnnotatePaintContext;
-
-
-/* Structure to store the save-point. */
-typedef struct _AnnotateSavePoint
-{
-
-  /* The file name that represents the save-point. */
-  gchar *filename;
-
-} AnnotateSavepoint;
 
 typedef struct
 {
@@ -96,9 +70,20 @@ typedef struct
 
   /* The state. */
   guint        state;
+
+  /* Is the trace span of a stroke open? It is closed by the release. */
+  gboolean     stroke_traced;
 } AnnotateDeviceData;
 
 
+/* Called with the area selected with the rubber band in screen coordinates. */
+typedef void (*AnnotateAreaSelected) (gint      x,
+                                      gint      y,
+                                      gint      width,
+                                      gint      height,
+                                      gpointer  user_data);
+
+
 /* Annotation data used by the callbacks. */
 typedef struct
 {
@@ -106,48 +91,31 @@ typedef struct
   /* Gtkbuilder for annotation window. */
   GtkBuilder *annotation_window_gtk_builder;
 
-  /* Directory where store the save-point. */
-  gchar* savepoint_dir;
-
   /* The annotation window. */
   GtkWidget *annotation_window;
 
-  /* The cairo context attached to the window. */
-  cairo_t *annotation_cairo_context;
-
   /* The back buffer surface used to do the input shape combine region. */
   cairo_surface_t *annotation_backsurface;
 
+  /*
+   * The surface where the canvas paints when the window composes the
+   * annotations over the background layer; NULL if the canvas paints
+   * directly on the window, see is_background_layer.
+   */
+  cairo_surface_t *annotation_layer;
+
   /* Mouse cursor to be used. */
   GdkCursor *cursor;
 
   /* Mouse invisible cursor. */
   GdkCursor *invisible_cursor;
 
-  /* List of the savepoint. */
-  GSList  *savepoint_list;
-
-  /*
-   * The index of the position in the save-point list
-   * of the current picture shown.
-   */
-  guint    current_save_index;
-
   /* Hashtable that contains device dependant info. */
   GHashTable  *devdatatable;
 
-  /* Paint context for the pen. */
-  AnnotatePaintContext *default_pen;
+  /* The painting core where the strokes are drawn. */
+  AnnotateCanvas *canvas;
 
-  /* Paint context for the eraser. */
-  AnnotatePaintContext *default_eraser;
-  
-  /* Paint context for the filler. */
-  AnnotatePaintContext *default_filler;
-
-  /* Point to the current context. */
-  AnnotatePaintContext *cur_context;
-  
   /*
    * This store the old paint type tool;
    * it is used to switch from/to eraser/pen
@@ -155,18 +123,6 @@ typedef struct
    */
   AnnotatePaintType old_paint_type;
 
-  /* Tool thickness. */
-  gdouble thickness;
-
-  /* Is the rectify mode enabled? */
-  gboolean     rectify;
-  
-  /* Is the roundify mode enabled?*/
-  gboolean     roundify;
-
-  /* Arrow. */
-  gboolean     arrow;
-
   /* Is the cursor grabbed. */
   gboolean     is_grabbed;
 
@@ -176,8 +132,16 @@ typedef struct
   /* Is the debug enabled. */
   gboolean     debug;
 
-  /* Pen color. */
-  gchar *color;
+  /* Called when the area is selected; NULL if no area is being selected. */
+  AnnotateAreaSelected area_selected;
+  gpointer area_user_data;
+
+  /* The corner where the rubber band started. */
+  gdouble area_x;
+  gdouble area_y;
+
+  /* The window showing the border of the rubber band while dragging. */
+  GtkWidget *area_frame;
 
 } AnnotateData;
 
@@ -204,6 +168,11 @@ GtkWidget *
 get_annotation_window        ();
 
 
+/* Get the annotation window data. */
+AnnotateData *
+get_annotation_data          ();
+
+
 /* Set the cairo context that contains the background. */
 void
 set_annotation_cairo_background_context (cairo_t *background_cr);
@@ -214,6 +183,14 @@ void
 annotate_restore_surface     ();
 
 
+/*
+ * Paint the window on its cairo context: the background layer and the
+ * annotations over it; the context is clipped to the area exposed.
+ */
+void
+annotate_paint_layers        (cairo_t *cr);
+
+
 /* Get the cairo context that contains the background. */
 cairo_t *
 get_annotation_cairo_background_context ();
@@ -400,6 +377,33 @@ void
 annotate_select_filler       ();
 
 
+/*
+ * Select an area with the rubber band; the callback is called once
+ * the button is released and then the previous tool can be selected.
+ */
+void
+annotate_select_area         (AnnotateAreaSelected  callback,
+                              gpointer              user_data);
+
+
+/* Start the rubber band in the point. */
+void
+annotate_area_begin          (gdouble  x,
+                              gdouble  y);
+
+
+/* Move the rubber band corner to the point. */
+void
+annotate_area_update         (gdouble  x,
+                              gdouble  y);
+
+
+/* Release the rubber band in the point and notify the area. */
+void
+annotate_area_end            (gdouble  x,
+                              gdouble  y);
+
+
 /* Call the geometric shape recognizer. */
 void
 annotate_shape_recognize     (AnnotateDeviceData *devdata,
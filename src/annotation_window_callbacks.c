@@ -29,8 +29,12 @@
 
 #include <annotation_window_callbacks.h>
 #include <annotation_window.h>
+#include <background_window.h>
 #include <utils.h>
 #include <input.h>
+#include <input_recorder.h>
+#include <session_recorder.h>
+#include <trace.h>
 
 
 /* Return the pressure passing the event. */
@@ -81,7 +85,7 @@ on_configure       (GtkWidget      *widget,
       return FALSE;
     }
 
-  /* Postcondition; data->annotation_cairo_context is not NULL. */
+  /* Postcondition; data->canvas->cr is not NULL. */
   return TRUE;
 }
 
@@ -124,6 +128,13 @@ on_expose          (GtkWidget *widget,
       g_printerr ("DEBUG: Annotation window get expose event\n");
     }
 
+  if (is_background_layer ())
+    {
+      /* Only the exposed area is composed; the context is clipped to it. */
+      annotate_paint_layers (cr);
+      return TRUE;
+    }
+
   annotate_restore_surface ();
   return TRUE;
 }
@@ -148,8 +159,16 @@ on_button_press    (GtkWidget      *win,
   AnnotateDeviceData *masterdata = g_hash_table_lookup (data->devdatatable, master);
   
   gdouble pressure = 1.0;
+
+  record_input_event (data, (GdkEvent *) ev);
+
+  if ((data->area_selected) && (data->is_grabbed) && (ev))
+    {
+      annotate_area_begin (ev->x, ev->y);
+      return TRUE;
+    }
   
-  if (data->cur_context == data->default_filler)
+  if (data->canvas->cur_context == data->canvas->default_filler)
     {
       return FALSE;
     }
@@ -167,14 +186,7 @@ on_button_press    (GtkWidget      *win,
       return FALSE;
     }
 	
-  if (data->debug)
-    {
-      g_printerr ("Device '%s': Button %i Down at (x,y)= (%f : %f)\n",
-                  gdk_device_get_name (master),
-                  ev->button,
-                  ev->x,
-                  ev->y);
-    }
+  TRACE_INSTANT_ARGS ("button_press", "x", ev->x, "y", ev->y);
 
 #ifdef _WIN32
   if (inside_bar_window (ev->x_root, ev->y_root))
@@ -192,6 +204,15 @@ on_button_press    (GtkWidget      *win,
       return FALSE;
     }
 	
+  /* A press without release e.g. after an ungrab leaves the span open. */
+  if (!masterdata->stroke_traced)
+    {
+      TRACE_BEGIN ("stroke");
+      masterdata->stroke_traced = TRUE;
+    }
+
+  mark_session_stroke ();
+
   annotate_unhide_cursor ();
 
   initialize_annotation_cairo_context (data);
@@ -225,7 +246,20 @@ on_motion_notify   (GtkWidget       *win,
   AnnotateDeviceData *masterdata= g_hash_table_lookup (data->devdatatable, master);
   AnnotateDeviceData *slavedata = g_hash_table_lookup (data->devdatatable, slave);
 
-   if (data->cur_context == data->default_filler)
+  record_input_event (data, (GdkEvent *) ev);
+
+  /* The rubber band is moved only while the button is pressed. */
+  if (data->area_selected)
+    {
+      if ((data->is_grabbed) && (ev->state & GDK_BUTTON1_MASK))
+        {
+          annotate_area_update (ev->x, ev->y);
+        }
+
+      return TRUE;
+    }
+
+   if (data->canvas->cur_context == data->canvas->default_filler)
     {
       return FALSE;
     }
@@ -253,23 +287,13 @@ on_motion_notify   (GtkWidget       *win,
       return FALSE;
     }
 
-  if (data->debug)
-    {
-      g_printerr ("Device '%s': Move at (x,y)= (%f : %f)\n",
-                  gdk_device_get_name (master),
-                  ev->x,
-                  ev->y);
-    }
+  TRACE_INSTANT_ARGS ("motion", "x", ev->x, "y", ev->y);
   
 #ifdef _WIN32
   if (inside_bar_window (ev->x_root, ev->y_root))
     {
 
-      if (data->debug)
-        {
-          g_printerr ("Device '%s': Move on the bar then ungrab\n",
-                       gdk_device_get_name (master));
-        }
+      TRACE_INSTANT ("motion_on_bar");
 
       /* The point is inside the ardesia bar then ungrab. */
       annotate_release_grab ();
@@ -293,7 +317,7 @@ on_motion_notify   (GtkWidget       *win,
 
   annotate_configure_pen_options (data);
   
-  if (data->cur_context->type != ANNOTATE_ERASER)
+  if (data->canvas->cur_context->type != ANNOTATE_ERASER)
     {
       pressure = get_pressure ( (GdkEvent *) ev);
 
@@ -337,19 +361,13 @@ on_motion_notify   (GtkWidget       *win,
 }
 
 
-/* This shots when the button is released. */
-G_MODULE_EXPORT gboolean
-on_button_release  (GtkWidget       *win,
-                    GdkEventButton  *ev,
-                    gpointer         user_data)
+/* Handle the release of the button; the stroke span is closed by the caller. */
+static gboolean
+button_release     (AnnotateData        *data,
+                    AnnotateDeviceData  *masterdata,
+                    GdkDevice           *master,
+                    GdkEventButton      *ev)
 {
-  AnnotateData *data = (AnnotateData *) user_data;
-  
-  GdkDevice *master = gdk_event_get_device ( (GdkEvent *) ev);
-  
-  /* Get the data for this device. */
-  AnnotateDeviceData *masterdata= g_hash_table_lookup (data->devdatatable, master);
-  
   guint lenght = g_slist_length (masterdata->coord_list);
 
   if (!data->is_grabbed)
@@ -365,11 +383,12 @@ on_button_release  (GtkWidget       *win,
       return FALSE;
     }
 
-  if (data->debug)
+  TRACE_INSTANT_ARGS ("button_release", "x", ev->x, "y", ev->y);
+
+  if (data->area_selected)
     {
-      g_printerr ("Device '%s': Button %i Up at (x,y)= (%.2f : %.2f)\n",
-                  gdk_device_get_name (master),
-                   ev->button, ev->x, ev->y);
+      annotate_area_end (ev->x, ev->y);
+      return TRUE;
     }
 
 #ifdef _WIN32
@@ -386,7 +405,7 @@ on_button_release  (GtkWidget       *win,
     }
 #endif
 
-  if (data->cur_context == data->default_filler)
+  if (data->canvas->cur_context == data->canvas->default_filler)
     {
       annotate_fill (masterdata, data, ev->x, ev->y);
       return TRUE;
@@ -405,7 +424,7 @@ on_button_release  (GtkWidget       *win,
       gint score = 3;
       
       /* If is applied some handled drawing mode then the tool is more tollerant. */
-      if ((data->rectify || data->roundify))
+      if ((data->canvas->rectify || data->canvas->roundify))
         {
           score = 6;
         }
@@ -432,12 +451,12 @@ on_button_release  (GtkWidget       *win,
           annotate_coord_list_prepend (masterdata, first_point->x, first_point->y, annotate_get_thickness (), pressure);
         }
 
-      if (data->cur_context->type != ANNOTATE_ERASER)
+      if (data->canvas->cur_context->type != ANNOTATE_ERASER)
         {
           annotate_shape_recognize (masterdata, closed_path);
 
           /* If is selected an arrow type then I draw the arrow. */
-          if (data->arrow)
+          if (data->canvas->arrow)
             {
               /* Print arrow at the end of the path. */
               annotate_draw_arrow (masterdata, distance);
@@ -445,7 +464,8 @@ on_button_release  (GtkWidget       *win,
         }
     }
 
-  cairo_stroke (data->annotation_cairo_context);
+  canvas_damage_path (data->canvas);
+  cairo_stroke (data->canvas->cr);
 
   annotate_add_savepoint ();
 
@@ -455,6 +475,36 @@ on_button_release  (GtkWidget       *win,
 }
 
 
+/* This shots when the button is released. */
+G_MODULE_EXPORT gboolean
+on_button_release  (GtkWidget       *win,
+                    GdkEventButton  *ev,
+                    gpointer         user_data)
+{
+  AnnotateData *data = (AnnotateData *) user_data;
+  
+  GdkDevice *master = gdk_event_get_device ( (GdkEvent *) ev);
+  
+  /* Get the data for this device. */
+  AnnotateDeviceData *masterdata= g_hash_table_lookup (data->devdatatable, master);
+
+  gboolean ret = FALSE;
+
+  record_input_event (data, (GdkEvent *) ev);
+
+  ret = button_release (data, masterdata, master, ev);
+
+  /* Every return path closes the span opened by the press, if any. */
+  if (masterdata->stroke_traced)
+    {
+      TRACE_END ("stroke");
+      masterdata->stroke_traced = FALSE;
+    }
+
+  return ret;
+}
+
+
 /* On device added. */
 void on_device_removed  (GdkDeviceManager  *device_manager,
                          GdkDevice         *device,
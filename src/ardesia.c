@@ -27,6 +27,16 @@
 #include <background_window.h>
 #include <project_dialog.h>
 #include <bar.h>
+#include <input_recorder.h>
+#include <autosave.h>
+#include <pdf_saver.h>
+#include <recorder.h>
+#include <stroke_journal.h>
+#include <session_recorder.h>
+#include <trace.h>
+#include <iwb_loader.h>
+
+#include <gsf/gsf-utils.h>
 
 /*ch* External defined structure used to configure text input. (see text_window.c) */
 #include <text_window.h>
@@ -63,6 +73,21 @@ print_help         ()
   g_printf ("  \t\t\t\tmonospace\n");
   g_printf ("  --leftmargin,\t-l\t\tSet the left margin in text window to set after hitting Enter\n");
   g_printf ("  --tabsize,\t-t\t\tSet the tabsize in pixel in text window\n");
+  g_printf ("  --autosave,\t-a\t\tSeconds between two autosaves of the project; 0 disables it [default %d]\n",
+            AUTOSAVE_DEFAULT_INTERVAL);
+  g_printf ("  --pdf-codec,\t-c\t\tSet the compression of the pdf pages. Possible values are:\n");
+  g_printf ("  \t\t\t\tauto [default], jpeg with a background image\n");
+  g_printf ("  \t\t\t\tdeflate\n");
+  g_printf ("  \t\t\t\tjpeg\n");
+  g_printf ("  --pdf-vector,\t-x\t\tExport the annotations of the pdf pages as vector paths\n");
+  g_printf ("  --record-board,\t-b\tRecord in the screencast only the board: the background and the annotations\n");
+  g_printf ("  --record-vlc,\t-R\t\tRecord the screencast and the sound with the vlc script\n");
+  g_printf ("  --record-session,\t-s\tRecord the painting actions in the given file; render it with ardesia-render\n");
+  g_printf ("  --record-input,\t-r\tRecord the input events in the given file\n");
+  g_printf ("  --replay-input,\t-p\tReplay the input events stored in the given file\n");
+  g_printf ("  --replay-fast,\t-P\tReplay the input events as fast as possible and print the time\n");
+  g_printf ("  --single-window,\t-w\tCompose the background and the annotations in one window\n");
+  g_printf ("  --trace,\t-T\t\tWrite a Chrome trace-event file of the session in the given file\n");
   g_printf ("  --help    ,\t-h\t\tShows the help screen\n");
   g_printf ("  --version ,\t-v\t\tShows version information and exit\n");
   g_printf ("\n");
@@ -129,6 +154,17 @@ parse_options           (gint   argc,
   commandline->fontfamily = "serif";
   commandline->text_leftmargin = 0;
   commandline->text_tabsize = 80;
+  commandline->autosave_interval = AUTOSAVE_DEFAULT_INTERVAL;
+  commandline->pdf_codec = PDF_CODEC_AUTO;
+  commandline->pdf_vector = FALSE;
+  commandline->record_board = FALSE;
+  commandline->record_vlc = FALSE;
+  commandline->record_session = NULL;
+  commandline->record_input = NULL;
+  commandline->replay_input = NULL;
+  commandline->replay_fast = FALSE;
+  commandline->trace = NULL;
+  commandline->single_window = FALSE;
 
   /* Getopt_long stores the option index here. */
   while (1)
@@ -148,13 +184,24 @@ parse_options           (gint   argc,
       {"font", required_argument, 0, 'f'},
       {"leftmargin", required_argument, 0, 'l'},
       {"tabsize", required_argument, 0, 't'},
+      {"autosave", required_argument, 0, 'a'},
+      {"pdf-codec", required_argument, 0, 'c'},
+      {"pdf-vector", no_argument, 0, 'x'},
+      {"record-board", no_argument, 0, 'b'},
+      {"record-vlc", no_argument, 0, 'R'},
+      {"record-session", required_argument, 0, 's'},
+      {"record-input", required_argument, 0, 'r'},
+      {"replay-input", required_argument, 0, 'p'},
+      {"replay-fast", no_argument, 0, 'P'},
+      {"trace", required_argument, 0, 'T'},
+      {"single-window", no_argument, 0, 'w'},
       {0, 0, 0, 0}
       };
 
       gint option_index = 0;
       c = getopt_long (argc,
                        argv,
-                       "hdvVg:f:l:t:",
+                       "hdvVg:f:l:t:a:c:xbRs:r:p:PT:w",
                        long_options,
                        &option_index);
 
@@ -214,6 +261,54 @@ parse_options           (gint   argc,
           case 't':
             commandline->text_tabsize = atoi(optarg);
             break;
+          case 'a':
+            commandline->autosave_interval = MAX (atoi (optarg), 0);
+            break;
+          case 'c':
+            if (g_strcmp0 (optarg, "auto") == 0)
+              {
+                commandline->pdf_codec = PDF_CODEC_AUTO;
+              }
+            else if (g_strcmp0 (optarg, "deflate") == 0)
+              {
+                commandline->pdf_codec = PDF_CODEC_DEFLATE;
+              }
+            else if (g_strcmp0 (optarg, "jpeg") == 0)
+              {
+                commandline->pdf_codec = PDF_CODEC_JPEG;
+              }
+            else
+              {
+                print_help ();
+              }
+            break;
+          case 'x':
+            commandline->pdf_vector = TRUE;
+            break;
+          case 'b':
+            commandline->record_board = TRUE;
+            break;
+          case 'R':
+            commandline->record_vlc = TRUE;
+            break;
+          case 's':
+            commandline->record_session = optarg;
+            break;
+          case 'r':
+            commandline->record_input = optarg;
+            break;
+          case 'p':
+            commandline->replay_input = optarg;
+            break;
+          case 'P':
+            commandline->replay_fast = TRUE;
+            break;
+          case 'T':
+            commandline->trace = optarg;
+            break;
+          case 'w':
+            commandline->single_window = TRUE;
+            break;
           default:
             print_help ();
             break;
@@ -322,6 +417,9 @@ main                              (int    argc,
 
   gtk_init (&argc, &argv);
 
+  /* The iwb files are read and written with libgsf until the exit. */
+  gsf_init ();
+
 #ifndef _WIN32
   check_composite_manager ();
 #endif
@@ -334,6 +432,16 @@ main                              (int    argc,
   //create_segmentation_fault ();
 
   commandline = parse_options (argc, argv);
+
+  if (commandline->trace)
+    {
+      trace_start (commandline->trace);
+    }
+
+  set_pdf_codec (commandline->pdf_codec);
+  set_pdf_vector (commandline->pdf_vector);
+  set_recorder_board (commandline->record_board);
+  set_recorder_script (commandline->record_vlc);
 	
   /* Initialize new text configuration options. */
   text_config = g_malloc ((gsize) sizeof (TextConfig));
@@ -385,18 +493,31 @@ main                              (int    argc,
   set_iwb_filename (iwb_filename);
 
 
-  background_window = create_background_window ();
+#ifdef _WIN32
+  /* The layered annotation window uses a colour key then the background needs its own window. */
+  commandline->single_window = FALSE;
+#endif
 
-  if (background_window == NULL)
+  if (commandline->single_window)
     {
-      destroy_background_window ();
-      g_free (commandline);
-      exit (EXIT_FAILURE);
+      /* The annotation window paints the background under the annotations. */
+      create_background_layer ();
     }
+  else
+    {
+      background_window = create_background_window ();
+
+      if (background_window == NULL)
+        {
+          destroy_background_window ();
+          g_free (commandline);
+          exit (EXIT_FAILURE);
+        }
 
-  gtk_widget_show (background_window);
+      gtk_widget_show (background_window);
   
-  set_background_window (background_window);
+      set_background_window (background_window);
+    }
   
   /* Initialize the annotation window. */
   annotate_init (background_window, iwb_filename, commandline->debug);
@@ -412,6 +533,21 @@ main                              (int    argc,
     }
 
   /* Postcondition: the annotation window is valid. */
+
+  /* Recover the crashed session, if any, and start the autosave. */
+  start_autosave (commandline->autosave_interval);
+
+  /* The stroke journal holds what follows the last autosave; it is not kept without autosave. */
+  if (commandline->autosave_interval > 0)
+    {
+      start_stroke_journal ();
+    }
+
+  if (commandline->record_session)
+    {
+      start_session_recorder (commandline->record_session);
+    }
+
   gtk_window_set_keep_above (GTK_WINDOW (annotation_window), TRUE);
   
   gtk_widget_show (annotation_window);
@@ -428,8 +564,25 @@ main                              (int    argc,
 
   gtk_window_set_keep_above (GTK_WINDOW (ardesia_bar_window), TRUE);
   gtk_widget_show (ardesia_bar_window);
+
+  if (commandline->record_input)
+    {
+      start_input_recording (commandline->record_input);
+    }
+
+  if (commandline->replay_input)
+    {
+      start_input_replay (commandline->replay_input, !commandline->replay_fast);
+    }
+
   gtk_main ();
 
+  /* The pending threads have been joined quitting the bar. */
+  trace_stop ();
+
+  close_iwb_archive ();
+  gsf_shutdown ();
+
   g_free (project_name);
 
   remove_dir_if_empty(project_dir);
@@ -61,6 +61,39 @@ typedef struct
   gint text_leftmargin;
   gint text_tabsize;
 
+  /* File where the input events are recorded. */
+  gchar *record_input;
+
+  /* File with the input events to be replayed. */
+  gchar *replay_input;
+
+  /* Replay the input events as fast as possible? */
+  gboolean replay_fast;
+
+  /* File where the trace events are written. */
+  gchar *trace;
+
+  /* Seconds between two autosaves; zero disables the autosave. */
+  gint autosave_interval;
+
+  /* The codec of the pdf pages, see PdfCodec. */
+  gint pdf_codec;
+
+  /* Export the pdf annotations as vector paths? */
+  gboolean pdf_vector;
+
+  /* Record only the board in the screencast? */
+  gboolean record_board;
+
+  /* Record the screencast and the sound with the vlc script? */
+  gboolean record_vlc;
+
+  /* File where the painting actions of the session are recorded. */
+  gchar *record_session;
+
+  /* Paint the background in the annotation window instead of its own window? */
+  gboolean single_window;
+
 } CommandLine;
 
 
@@ -0,0 +1,921 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <utils.h>
+#include <autosave.h>
+#include <annotation_window.h>
+#include <iwb_saver.h>
+#include <stroke_journal.h>
+#include <trace.h>
+
+
+/* The journal file name. */
+static gchar *journal_filename = (gchar *) NULL;
+
+/* The journal opened in append mode; it is used only by the writer thread. */
+static FILE *journal_fp = (FILE *) NULL;
+
+/* Has a write to the journal failed since it has been opened? Used only by the writer. */
+static gboolean write_failed = FALSE;
+
+/* The keys of the save-points already queued to the journal starting from the oldest. */
+static GPtrArray *journaled = (GPtrArray *) NULL;
+
+/* The source id of the autosave timeout. */
+static guint autosave_source = 0;
+
+/* The commands for the writer thread. */
+static GAsyncQueue *autosave_queue = (GAsyncQueue *) NULL;
+
+/* The writer thread. */
+static GThread *autosave_writer = (GThread *) NULL;
+
+/* Has the writer failed? Then the autosave is disabled. */
+static gint autosave_failed = 0;
+
+
+/* What the writer thread has to do. */
+typedef enum
+  {
+
+    /* Append the batch of save-points. */
+    AUTOSAVE_COMMAND_WRITE,
+
+    /* Close and remove the journal; it restarts from a save. */
+    AUTOSAVE_COMMAND_RESET,
+
+    /* Close the journal and exit. */
+    AUTOSAVE_COMMAND_STOP,
+
+  } AutosaveCommandType;
+
+
+/* A command queued to the writer thread. */
+typedef struct
+{
+
+  AutosaveCommandType type;
+
+  /* The copies of the save-points to be appended and the index of the first one. */
+  GPtrArray *savepoints;
+  guint first;
+
+  /* The number of save-points written in the manifest. */
+  guint count;
+
+  /* Where the stroke journal waits the result of the sync, see rebase_stroke_journal. */
+  GAsyncQueue *synced;
+
+} AutosaveCommand;
+
+
+/*
+ * What identifies a journaled save-point; the references are kept
+ * then a different save-point can not reuse the same addresses. A
+ * save-point with a file is identified by its name, that is never
+ * reused, because its png can be dropped from memory.
+ */
+typedef struct
+{
+
+  /* The file of the save-point; NULL if it has none. */
+  gchar *filename;
+
+  /* The png of a save-point without file; NULL if it has not been made. */
+  GBytes *png;
+
+  /* The paths; NULL if it is only raster. */
+  GPtrArray *paths;
+
+} AutosaveKey;
+
+
+/* Make the key of the save-point. */
+static AutosaveKey *
+savepoint_key_new  (AnnotateSavepoint  *savepoint)
+{
+  AutosaveKey *key = g_malloc ((gsize) sizeof (AutosaveKey));
+  key->filename = g_strdup (savepoint->filename);
+  key->png = ((!savepoint->filename) && (savepoint->png)) ? g_bytes_ref (savepoint->png) : (GBytes *) NULL;
+  key->paths = savepoint->paths ? g_ptr_array_ref (savepoint->paths) : (GPtrArray *) NULL;
+  return key;
+}
+
+
+/* Free the key. */
+static void
+savepoint_key_free (AutosaveKey  *key)
+{
+  if (key->png)
+    {
+      g_bytes_unref (key->png);
+    }
+
+  if (key->paths)
+    {
+      g_ptr_array_unref (key->paths);
+    }
+
+  g_free (key->filename);
+  g_free (key);
+}
+
+
+/* Is the key the one of the save-point? */
+static gboolean
+savepoint_key_equal (AutosaveKey        *key,
+                     AnnotateSavepoint  *savepoint)
+{
+  if ((key->filename) || (savepoint->filename))
+    {
+      return ((g_strcmp0 (key->filename, savepoint->filename) == 0) && (key->paths == savepoint->paths));
+    }
+
+  return ((key->png == savepoint->png) && (key->paths == savepoint->paths));
+}
+
+
+/* Write the bytes; a short write is remembered in write_failed. */
+static void
+write_bytes        (gconstpointer  data,
+                    gsize          size)
+{
+  if ((size > 0) && (fwrite (data, 1, size, journal_fp) != size))
+    {
+      write_failed = TRUE;
+    }
+}
+
+
+/* Write a byte. */
+static void
+write_u8           (guint8   value)
+{
+  write_bytes (&value, sizeof (value));
+}
+
+
+/* Write a 32 bit integer. */
+static void
+write_u32          (guint32  value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+  write_bytes (&le_value, sizeof (le_value));
+}
+
+
+/* Write a 64 bit float. */
+static void
+write_f64          (gdouble  value)
+{
+  guint64 bits = 0;
+  memcpy (&bits, &value, sizeof (bits));
+  bits = GUINT64_TO_LE (bits);
+  write_bytes (&bits, sizeof (bits));
+}
+
+
+/* Write the record of the save-point made of paths. */
+static void
+write_paths        (guint32     index,
+                    GPtrArray  *paths)
+{
+  guint i = 0;
+
+  write_u8 (AUTOSAVE_RECORD_PATHS);
+  write_u32 (index);
+  write_u32 (paths->len);
+
+  for (i = 0; i < paths->len; i++)
+    {
+      AnnotatePath *path = (AnnotatePath *) g_ptr_array_index (paths, i);
+      gsize size = strlen (path->data);
+      gchar color[9];
+
+      g_snprintf (color, sizeof (color), "%-8.8s", path->color);
+      write_bytes (color, 8);
+      write_f64 (path->width);
+      write_u8 ((path->filled ? 1 : 0) | (path->erase ? 2 : 0));
+      write_u32 (size);
+      write_bytes (path->data, size);
+    }
+}
+
+
+/* Read size bytes moving the cursor; return false at the end of buffer. */
+static gboolean
+read_bytes         (const guchar  **cursor,
+                    const guchar   *end,
+                    gpointer        dest,
+                    gsize           size)
+{
+  if ((gsize) (end - *cursor) < size)
+    {
+      return FALSE;
+    }
+
+  memcpy (dest, *cursor, size);
+  *cursor = *cursor + size;
+  return TRUE;
+}
+
+
+/* Read a 32 bit integer. */
+static gboolean
+read_u32           (const guchar  **cursor,
+                    const guchar   *end,
+                    guint32        *value)
+{
+  if (!read_bytes (cursor, end, value, sizeof (guint32)))
+    {
+      return FALSE;
+    }
+
+  *value = GUINT32_FROM_LE (*value);
+  return TRUE;
+}
+
+
+/* Read a 64 bit float. */
+static gboolean
+read_f64           (const guchar  **cursor,
+                    const guchar   *end,
+                    gdouble        *value)
+{
+  guint64 bits = 0;
+
+  if (!read_bytes (cursor, end, &bits, sizeof (bits)))
+    {
+      return FALSE;
+    }
+
+  bits = GUINT64_FROM_LE (bits);
+  memcpy (value, &bits, sizeof (bits));
+  return TRUE;
+}
+
+
+/* Read the paths of a save-point; NULL if the record is truncated. */
+static GPtrArray *
+read_paths         (const guchar  **cursor,
+                    const guchar   *end)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func ((GDestroyNotify) canvas_path_free);
+  guint32 count = 0;
+  guint32 i = 0;
+
+  if (!read_u32 (cursor, end, &count))
+    {
+      g_ptr_array_unref (paths);
+      return (GPtrArray *) NULL;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      gchar color[9];
+      gdouble width = 0;
+      guint8 flags = 0;
+      guint32 size = 0;
+      gchar *data = (gchar *) NULL;
+      AnnotatePath *path = (AnnotatePath *) NULL;
+
+      if ((!read_bytes (cursor, end, color, 8)) ||
+          (!read_f64 (cursor, end, &width)) ||
+          (!read_bytes (cursor, end, &flags, sizeof (flags))) ||
+          (!read_u32 (cursor, end, &size)) ||
+          ((gsize) (end - *cursor) < size))
+        {
+          g_ptr_array_unref (paths);
+          return (GPtrArray *) NULL;
+        }
+
+      color[8] = '\0';
+      data = g_strndup ((const gchar *) *cursor, size);
+      *cursor = *cursor + size;
+
+      path = canvas_path_new (data, color, width, (flags & 1) != 0);
+      path->erase = ((flags & 2) != 0);
+      g_ptr_array_add (paths, path);
+      g_free (data);
+    }
+
+  return paths;
+}
+
+
+/* Get the canvas save-points starting from the oldest. */
+static GPtrArray *
+get_savepoints     ()
+{
+  GSList *list = get_annotation_data ()->canvas->savepoint_list;
+  guint length = g_slist_length (list);
+  GPtrArray *savepoints = g_ptr_array_sized_new (length);
+
+  g_ptr_array_set_size (savepoints, length);
+
+  /* The list starts with the last save-point. */
+  for (; list; list = list->next)
+    {
+      g_ptr_array_index (savepoints, --length) = list->data;
+    }
+
+  return savepoints;
+}
+
+
+/* Open the journal for append writing the header if it is a new file. */
+static gboolean
+open_journal       ()
+{
+  guint16 version = GUINT16_TO_LE (AUTOSAVE_VERSION);
+  guint16 reserved = 0;
+
+  journal_fp = g_fopen (journal_filename, "ab");
+  write_failed = FALSE;
+
+  if (!journal_fp)
+    {
+      g_warning ("Unable to open the autosave journal %s", journal_filename);
+      return FALSE;
+    }
+
+  fseek (journal_fp, 0, SEEK_END);
+
+  if (ftell (journal_fp) == 0)
+    {
+      write_bytes (AUTOSAVE_MAGIC, strlen (AUTOSAVE_MAGIC));
+      write_bytes (&version, sizeof (version));
+      write_bytes (&reserved, sizeof (reserved));
+    }
+
+  return TRUE;
+}
+
+
+/* Free the save-points that have not been recovered. */
+static void
+free_unused_savepoints (GPtrArray   *candidates,
+                        GHashTable  *used)
+{
+  guint i = 0;
+
+  for (i = 0; i < candidates->len; i++)
+    {
+      AnnotateSavepoint *savepoint = g_ptr_array_index (candidates, i);
+
+      if (!g_hash_table_contains (used, savepoint))
+        {
+          canvas_savepoint_free (savepoint);
+        }
+    }
+}
+
+
+/*
+ * Replay the journal over the save-points loaded from the iwb file;
+ * only the records confirmed by a manifest are recovered, then a
+ * batch truncated by the crash is ignored.
+ */
+static void
+recover_journal    ()
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  GError *error = (GError *) NULL;
+  gchar *contents = (gchar *) NULL;
+  gsize length = 0;
+  const guchar *cursor = (const guchar *) NULL;
+  const guchar *end = (const guchar *) NULL;
+  gchar magic[4];
+  guint16 version = 0;
+  guint16 reserved = 0;
+  GPtrArray *loaded = get_savepoints ();
+  GPtrArray *created = g_ptr_array_new ();
+  GPtrArray *savepoints = g_ptr_array_new ();
+  GPtrArray *confirmed = g_ptr_array_new ();
+  GHashTable *used = g_hash_table_new (g_direct_hash, g_direct_equal);
+  guint i = 0;
+
+  if (!g_file_get_contents (journal_filename, &contents, &length, &error))
+    {
+      g_warning ("Unable to read the autosave journal %s: %s", journal_filename, error->message);
+      g_error_free (error);
+      contents = (gchar *) NULL;
+      length = 0;
+    }
+
+  cursor = (const guchar *) contents;
+  end = cursor + length;
+
+  if ((!read_bytes (&cursor, end, magic, sizeof (magic)))            ||
+      (memcmp (magic, AUTOSAVE_MAGIC, sizeof (magic)) != 0)          ||
+      (!read_bytes (&cursor, end, &version, sizeof (version)))       ||
+      (GUINT16_FROM_LE (version) > AUTOSAVE_VERSION)                 ||
+      (!read_bytes (&cursor, end, &reserved, sizeof (reserved))))
+    {
+      gchar *corrupt = g_strdup_printf ("%s.corrupt", journal_filename);
+
+      /* The bad file is moved aside, or emptied, before the journal is opened again. */
+      g_warning ("The file %s is not a valid autosave journal; it is moved to %s", journal_filename, corrupt);
+      g_remove (corrupt);
+
+      if (g_rename (journal_filename, corrupt) != 0)
+        {
+          FILE *fp = g_fopen (journal_filename, "wb");
+
+          if (fp)
+            {
+              fclose (fp);
+            }
+        }
+
+      g_free (corrupt);
+      g_free (contents);
+      g_ptr_array_free (loaded, TRUE);
+      g_ptr_array_free (created, TRUE);
+      g_ptr_array_free (savepoints, TRUE);
+      g_ptr_array_free (confirmed, TRUE);
+      g_hash_table_destroy (used);
+      return;
+    }
+
+  while (cursor < end)
+    {
+      guint8 type = 0;
+      guint32 index = 0;
+      guint32 size = 0;
+
+      if ((!read_bytes (&cursor, end, &type, sizeof (type))) ||
+          (!read_u32 (&cursor, end, &index)))
+        {
+          break;
+        }
+
+      if (type == AUTOSAVE_RECORD_MANIFEST)
+        {
+          g_ptr_array_set_size (savepoints, MIN (index, savepoints->len));
+
+          /* The batch is complete. */
+          g_ptr_array_set_size (confirmed, 0);
+          for (i = 0; i < savepoints->len; i++)
+            {
+              g_ptr_array_add (confirmed, g_ptr_array_index (savepoints, i));
+            }
+
+          continue;
+        }
+
+      if ((type == AUTOSAVE_RECORD_PATHS) && (index > 0))
+        {
+          GPtrArray *paths = read_paths (&cursor, end);
+          AnnotateSavepoint *savepoint = (AnnotateSavepoint *) NULL;
+
+          if (!paths)
+            {
+              break;
+            }
+
+          g_ptr_array_set_size (savepoints, MIN (index - 1, savepoints->len));
+
+          savepoint = canvas_savepoint_new ((gchar *) NULL, (GBytes *) NULL);
+          savepoint->paths = paths;
+          g_ptr_array_add (created, savepoint);
+          g_ptr_array_add (savepoints, savepoint);
+          continue;
+        }
+
+      if ((type != AUTOSAVE_RECORD_SAVEPOINT) ||
+          (index == 0) ||
+          (!read_u32 (&cursor, end, &size)) ||
+          ((gsize) (end - cursor) < size))
+        {
+          break;
+        }
+
+      /* The save-points after this one have been discarded. */
+      g_ptr_array_set_size (savepoints, MIN (index - 1, savepoints->len));
+
+      if (size > 0)
+        {
+          GBytes *png = g_bytes_new (cursor, size);
+          AnnotateSavepoint *savepoint = canvas_savepoint_new ((gchar *) NULL, png);
+          g_bytes_unref (png);
+          g_ptr_array_add (created, savepoint);
+          g_ptr_array_add (savepoints, savepoint);
+          cursor = cursor + size;
+        }
+      else if (index <= loaded->len)
+        {
+          g_ptr_array_add (savepoints, g_ptr_array_index (loaded, index - 1));
+        }
+    }
+
+  g_free (contents);
+
+  g_slist_free (canvas->savepoint_list);
+  canvas->savepoint_list = (GSList *) NULL;
+
+  for (i = 0; i < confirmed->len; i++)
+    {
+      gpointer savepoint = g_ptr_array_index (confirmed, i);
+      g_hash_table_add (used, savepoint);
+      canvas->savepoint_list = g_slist_prepend (canvas->savepoint_list, savepoint);
+    }
+
+  free_unused_savepoints (loaded, used);
+  free_unused_savepoints (created, used);
+
+  /* The last save-point will be painted at the first expose. */
+  canvas->current_save_index = 0;
+
+  if (get_annotation_data ()->debug)
+    {
+      g_printerr ("Recovered %u save-points from the autosave journal %s\n",
+                  confirmed->len,
+                  journal_filename);
+    }
+
+  g_ptr_array_free (loaded, TRUE);
+  g_ptr_array_free (created, TRUE);
+  g_ptr_array_free (savepoints, TRUE);
+  g_ptr_array_free (confirmed, TRUE);
+  g_hash_table_destroy (used);
+}
+
+
+/* Close the journal, if it is open. */
+static void
+close_journal      ()
+{
+  if (journal_fp)
+    {
+      fclose (journal_fp);
+      journal_fp = (FILE *) NULL;
+    }
+}
+
+
+/*
+ * Append the batch to the journal and make it durable; the copies of
+ * the save-points are written here to keep the png and the sync out
+ * of the ui thread.
+ */
+static gboolean
+write_batch        (AutosaveCommand  *command)
+{
+  guint i = 0;
+
+  if ((!journal_fp) && (!open_journal ()))
+    {
+      return FALSE;
+    }
+
+  TRACE_BEGIN ("autosave");
+
+  for (i = 0; i < command->savepoints->len; i++)
+    {
+      AnnotateSavepoint *savepoint = g_ptr_array_index (command->savepoints, i);
+      guint32 index = command->first + i + 1;
+
+      /* The paths are much smaller than the image. */
+      if (savepoint->paths)
+        {
+          write_paths (index, savepoint->paths);
+        }
+      else
+        {
+          /* The png of a lazy save-point is in the iwb file; it may have been dropped from memory. */
+          GBytes *png = ((savepoint->png) || (!savepoint->load)) ? canvas_savepoint_get_png (savepoint) : (GBytes *) NULL;
+          gsize size = png ? g_bytes_get_size (png) : 0;
+
+          write_u8 (AUTOSAVE_RECORD_SAVEPOINT);
+          write_u32 (index);
+          write_u32 (size);
+
+          if (size > 0)
+            {
+              write_bytes (g_bytes_get_data (png, NULL), size);
+            }
+
+          if (png)
+            {
+              g_bytes_unref (png);
+            }
+        }
+    }
+
+  write_u8 (AUTOSAVE_RECORD_MANIFEST);
+  write_u32 (command->count);
+
+  /* The batch must be on the disk before the stroke journal is emptied. */
+  if ((fflush (journal_fp) != 0) || (ferror (journal_fp)) || (g_fsync (fileno (journal_fp)) != 0))
+    {
+      write_failed = TRUE;
+    }
+
+  TRACE_COUNTER ("autosave_savepoints", command->savepoints->len);
+  TRACE_END ("autosave");
+
+  return !write_failed;
+}
+
+
+/* Free the command. */
+static void
+autosave_command_free (AutosaveCommand  *command)
+{
+  if (command->savepoints)
+    {
+      g_ptr_array_free (command->savepoints, TRUE);
+    }
+
+  if (command->synced)
+    {
+      g_async_queue_unref (command->synced);
+    }
+
+  g_free (command);
+}
+
+
+/* The writer thread. */
+static gpointer
+autosave_writer_run (gpointer  user_data)
+{
+  gboolean stop = FALSE;
+
+  while (!stop)
+    {
+      AutosaveCommand *command = g_async_queue_pop (autosave_queue);
+
+      switch (command->type)
+        {
+        case AUTOSAVE_COMMAND_WRITE:
+          if ((g_atomic_int_get (&autosave_failed)) || (!write_batch (command)))
+            {
+              if (!g_atomic_int_get (&autosave_failed))
+                {
+                  g_warning ("Unable to write the autosave journal %s; the autosave is disabled", journal_filename);
+                  g_atomic_int_set (&autosave_failed, 1);
+                }
+
+              close_journal ();
+
+              /* The stroke journal is kept then. */
+              g_async_queue_push (command->synced, GINT_TO_POINTER (-1));
+            }
+          else
+            {
+              g_async_queue_push (command->synced, GINT_TO_POINTER (1));
+            }
+          break;
+
+        case AUTOSAVE_COMMAND_RESET:
+          close_journal ();
+          g_remove (journal_filename);
+          break;
+
+        case AUTOSAVE_COMMAND_STOP:
+          close_journal ();
+          stop = TRUE;
+          break;
+        }
+
+      autosave_command_free (command);
+    }
+
+  return NULL;
+}
+
+
+/* Queue a command to the writer taking the save-points. */
+static void
+push_command       (AutosaveCommandType  type,
+                    GPtrArray           *savepoints,
+                    guint                first,
+                    guint                count,
+                    GAsyncQueue         *synced)
+{
+  AutosaveCommand *command = g_malloc ((gsize) sizeof (AutosaveCommand));
+  command->type = type;
+  command->savepoints = savepoints;
+  command->first = first;
+  command->count = count;
+  command->synced = synced;
+  g_async_queue_push (autosave_queue, command);
+}
+
+
+/* Called by the autosave timeout. */
+static gboolean
+on_autosave_timeout (gpointer  user_data)
+{
+  autosave ();
+  return TRUE;
+}
+
+
+/*
+ * Recover the journal left by a crashed session, if any,
+ * and autosave every interval seconds; zero disables the autosave.
+ */
+void
+start_autosave     (guint     interval)
+{
+  GPtrArray *savepoints = (GPtrArray *) NULL;
+  gchar *iwb_file = get_iwb_export_filename (get_iwb_filename ());
+  guint i = 0;
+
+  journal_filename = g_strdup_printf ("%s.journal", iwb_file);
+  g_free (iwb_file);
+
+  if (file_exists (journal_filename))
+    {
+      recover_journal ();
+    }
+
+  /* The journal already contains the current save-points. */
+  savepoints = get_savepoints ();
+  journaled = g_ptr_array_new_with_free_func ((GDestroyNotify) savepoint_key_free);
+
+  for (i = 0; i < savepoints->len; i++)
+    {
+      AnnotateSavepoint *savepoint = g_ptr_array_index (savepoints, i);
+      g_ptr_array_add (journaled, savepoint_key_new (savepoint));
+    }
+
+  g_ptr_array_free (savepoints, TRUE);
+
+  /*
+   * The strokes painted after the last autosave are replayed; they
+   * are not in the autosave journal yet.
+   */
+  replay_stroke_journal ();
+
+  /* The writer is needed also by rebase_autosave when the autosave is disabled. */
+  g_atomic_int_set (&autosave_failed, 0);
+  autosave_queue = g_async_queue_new ();
+  autosave_writer = g_thread_new ("autosave_writer", autosave_writer_run, NULL);
+
+  if (interval > 0)
+    {
+      autosave_source = g_timeout_add_seconds (interval, on_autosave_timeout, NULL);
+    }
+}
+
+
+/*
+ * Queue to the writer the save-points changed since the last autosave;
+ * if forced the manifest is written also when nothing has changed.
+ */
+static void
+append_journal     (gboolean  forced)
+{
+  GPtrArray *savepoints = (GPtrArray *) NULL;
+  GPtrArray *batch = (GPtrArray *) NULL;
+  GAsyncQueue *synced = (GAsyncQueue *) NULL;
+  guint first = 0;
+  guint i = 0;
+
+  if ((!journaled) || (g_atomic_int_get (&autosave_failed)))
+    {
+      return;
+    }
+
+  savepoints = get_savepoints ();
+
+  /* Skip the save-points already in the journal. */
+  while ((first < savepoints->len) && (first < journaled->len) &&
+         (savepoint_key_equal ((AutosaveKey *) g_ptr_array_index (journaled, first),
+                               (AnnotateSavepoint *) g_ptr_array_index (savepoints, first))))
+    {
+      first++;
+    }
+
+  if ((!forced) && (first == savepoints->len) && (first == journaled->len))
+    {
+      g_ptr_array_free (savepoints, TRUE);
+      return;
+    }
+
+  g_ptr_array_set_size (journaled, first);
+  batch = g_ptr_array_new_with_free_func ((GDestroyNotify) canvas_savepoint_free);
+
+  /* The copies share the png and the paths; the history can change meanwhile. */
+  for (i = first; i < savepoints->len; i++)
+    {
+      AnnotateSavepoint *savepoint = g_ptr_array_index (savepoints, i);
+      g_ptr_array_add (batch, canvas_savepoint_copy (savepoint));
+      g_ptr_array_add (journaled, savepoint_key_new (savepoint));
+    }
+
+  /*
+   * The stroke journal is truncated when the writer has synced the
+   * batch; the rebase is queued now to be ordered with the strokes.
+   */
+  synced = g_async_queue_new ();
+  push_command (AUTOSAVE_COMMAND_WRITE, batch, first, savepoints->len, synced);
+  rebase_stroke_journal (synced);
+  g_async_queue_unref (synced);
+
+  g_ptr_array_free (savepoints, TRUE);
+}
+
+
+/* Queue to the journal the save-points changed since the last autosave. */
+void
+autosave           ()
+{
+  append_journal (FALSE);
+}
+
+
+/*
+ * The iwb file has been replaced by a save of the save-points, oldest
+ * first; the journal restarts from them with what has been painted
+ * since the save.
+ */
+void
+rebase_autosave    (GSList   *savepoints)
+{
+  GSList *list = (GSList *) NULL;
+
+  if (!journaled)
+    {
+      return;
+    }
+
+  push_command (AUTOSAVE_COMMAND_RESET, (GPtrArray *) NULL, 0, 0, (GAsyncQueue *) NULL);
+  g_ptr_array_set_size (journaled, 0);
+
+  for (list = savepoints; list; list = list->next)
+    {
+      g_ptr_array_add (journaled, savepoint_key_new ((AnnotateSavepoint *) list->data));
+    }
+
+  append_journal (TRUE);
+}
+
+
+/*
+ * Stop the autosave; if the project has been compacted in the iwb file
+ * the journal is removed.
+ */
+void
+stop_autosave      (gboolean  compacted)
+{
+  if (autosave_source)
+    {
+      g_source_remove (autosave_source);
+      autosave_source = 0;
+    }
+
+  /* The writer ends the batches queued so far. */
+  if (autosave_queue)
+    {
+      push_command (AUTOSAVE_COMMAND_STOP, (GPtrArray *) NULL, 0, 0, (GAsyncQueue *) NULL);
+      g_thread_join (autosave_writer);
+      autosave_writer = (GThread *) NULL;
+      g_async_queue_unref (autosave_queue);
+      autosave_queue = (GAsyncQueue *) NULL;
+    }
+
+  if (journaled)
+    {
+      g_ptr_array_free (journaled, TRUE);
+      journaled = (GPtrArray *) NULL;
+    }
+
+  if ((compacted) && (journal_filename))
+    {
+      g_remove (journal_filename);
+    }
+
+  g_free (journal_filename);
+  journal_filename = (gchar *) NULL;
+}
+
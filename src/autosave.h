@@ -0,0 +1,120 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Incremental autosave of the project.
+ *
+ * Periodically the save-points painted since the last autosave are
+ * appended to a journal beside the iwb file followed by a manifest
+ * with the number of save-points; the cost of an autosave depends only
+ * on what has changed. The records are written and synced by a writer
+ * thread; if a write fails the autosave is disabled and the stroke
+ * journal is kept. At quit the journal is compacted in the iwb and
+ * removed; if ardesia crashes the journal is replayed at the next start.
+ *
+ * The journal starts with the AUTOSAVE_MAGIC string followed by the
+ * format version (16 bit) and a reserved 16 bit field; then the records
+ * follow, each one starting with its AutosaveRecordType byte.
+ * All the numbers are stored in little endian.
+ */
+
+
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <glib.h>
+
+
+/* Magic string at the beginning of the autosave journal. */
+#define AUTOSAVE_MAGIC "ARDJ"
+
+/* Version of the autosave journal format. */
+#define AUTOSAVE_VERSION 3
+
+/* Default number of seconds between two autosaves. */
+#define AUTOSAVE_DEFAULT_INTERVAL 60
+
+
+/* Kind of record stored in the autosave journal. */
+typedef enum
+  {
+
+    /*
+     * The save-point with the given index (32 bit, starting from 1)
+     * followed by the png size (32 bit) and data; the save-points
+     * after it are discarded. A save-point with size zero is the one
+     * with the same index in the iwb file.
+     */
+    AUTOSAVE_RECORD_SAVEPOINT = 1,
+
+    /* The number of save-points (32 bit) at the time of the autosave. */
+    AUTOSAVE_RECORD_MANIFEST,
+
+    /*
+     * The save-point with the given index (32 bit) made of paths painted
+     * over the previous one, see canvas_add_vector_savepoint, followed by
+     * the number of paths (32 bit); each path is stored as the colour
+     * (8 hex digits), the width (64 bit float), the flags (8 bit, 1 if
+     * filled and 2 if erased since version 3), the size (32 bit) and
+     * the svg path data. The save-points after it are discarded. Since
+     * version 2.
+     */
+    AUTOSAVE_RECORD_PATHS,
+
+  } AutosaveRecordType;
+
+
+/*
+ * Recover the journal left by a crashed session, if any, replay the
+ * stroke journal and autosave every interval seconds; zero disables
+ * the autosave.
+ */
+void
+start_autosave     (guint     interval);
+
+
+/* Queue to the journal the save-points changed since the last autosave. */
+void
+autosave           ();
+
+
+/*
+ * The iwb file has been replaced by a save of the save-points, oldest
+ * first; the journal restarts from them with what has been painted
+ * since the save.
+ */
+void
+rebase_autosave    (GSList   *savepoints);
+
+
+/*
+ * Stop the autosave; if the project has been compacted in the iwb file
+ * the journal is removed.
+ */
+void
+stop_autosave      (gboolean  compacted);
+
+
+#endif
+
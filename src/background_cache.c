@@ -0,0 +1,392 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include <background_cache.h>
+#include <utils.h>
+
+
+/* A scaled image. */
+typedef struct
+{
+
+  /* The file name with its modification time and size and the target size. */
+  gchar *key;
+
+  gchar *filename;
+  gint width;
+  gint height;
+
+  /* The scaled image; NULL if it can not be loaded. */
+  cairo_surface_t *surface;
+
+  /* Is the image being decoded? */
+  gboolean pending;
+
+  /* Called in the main loop when the decoding finishes. */
+  GSourceFunc ready;
+  gpointer user_data;
+
+} BackgroundEntry;
+
+
+/* Protect the cache and signal the end of a decoding. */
+static GMutex cache_mutex;
+static GCond cache_cond;
+
+/* The entries; the most recently used first. */
+static GQueue cache = G_QUEUE_INIT;
+
+/* The worker decoding the images asked without waiting. */
+static GThreadPool *decoder = (GThreadPool *) NULL;
+
+
+/* Make the key of the image; NULL if the file does not exist. */
+static gchar *
+make_key                       (const gchar  *filename,
+                                gint          width,
+                                gint          height)
+{
+  GStatBuf info;
+
+  if (g_stat (filename, &info) != 0)
+    {
+      return (gchar *) NULL;
+    }
+
+  return g_strdup_printf ("%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %dx%d",
+                          filename,
+                          (gint64) info.st_mtime,
+                          (gint64) info.st_size,
+                          width,
+                          height);
+}
+
+
+/* Free the entry. */
+static void
+entry_free                     (BackgroundEntry  *entry)
+{
+  if (entry->surface)
+    {
+      cairo_surface_destroy (entry->surface);
+    }
+
+  g_free (entry->key);
+  g_free (entry->filename);
+  g_free (entry);
+}
+
+
+/* Find the entry moving it at the head; the lock must be held. */
+static BackgroundEntry *
+find_entry                     (const gchar  *key)
+{
+  GList *link = (GList *) NULL;
+
+  for (link = cache.head; link; link = link->next)
+    {
+      BackgroundEntry *entry = (BackgroundEntry *) link->data;
+
+      if (g_strcmp0 (entry->key, key) == 0)
+        {
+          g_queue_unlink (&cache, link);
+          g_queue_push_head_link (&cache, link);
+          return entry;
+        }
+    }
+
+  return (BackgroundEntry *) NULL;
+}
+
+
+/* Add a pending entry at the head; the lock must be held. */
+static BackgroundEntry *
+add_entry                      (gchar        *key,
+                                const gchar  *filename,
+                                gint          width,
+                                gint          height)
+{
+  BackgroundEntry *entry = g_malloc0 ((gsize) sizeof (BackgroundEntry));
+
+  entry->key = key;
+  entry->filename = g_strdup (filename);
+  entry->width = width;
+  entry->height = height;
+  entry->pending = TRUE;
+  g_queue_push_head (&cache, entry);
+
+  return entry;
+}
+
+
+/* Drop the least recently used images; the lock must be held. */
+static void
+trim_cache                     ()
+{
+  GList *link = cache.tail;
+  guint count = 0;
+  GList *l = (GList *) NULL;
+
+  for (l = cache.head; l; l = l->next)
+    {
+      count += ((BackgroundEntry *) l->data)->pending ? 0 : 1;
+    }
+
+  /* The pending entries are owned by their decoder. */
+  while ((link) && (count > BACKGROUND_CACHE_SIZE))
+    {
+      GList *previous = link->prev;
+      BackgroundEntry *entry = (BackgroundEntry *) link->data;
+
+      if (!entry->pending)
+        {
+          g_queue_delete_link (&cache, link);
+          entry_free (entry);
+          count--;
+        }
+
+      link = previous;
+    }
+}
+
+
+/* Is an image being decoded? The lock must be held. */
+static gboolean
+has_pending_entry              ()
+{
+  GList *link = (GList *) NULL;
+
+  for (link = cache.head; link; link = link->next)
+    {
+      if (((BackgroundEntry *) link->data)->pending)
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* Return a new reference to the surface of the entry, if any. */
+static cairo_surface_t *
+reference_surface              (BackgroundEntry  *entry)
+{
+  return entry->surface ? cairo_surface_reference (entry->surface) : (cairo_surface_t *) NULL;
+}
+
+
+/* Decode the image scaled; NULL if it can not be loaded. */
+static cairo_surface_t *
+decode_surface                 (const gchar  *filename,
+                                gint          width,
+                                gint          height)
+{
+  GdkPixbuf *pixbuf = load_background_pixbuf (filename, width, height);
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+
+  if (!pixbuf)
+    {
+      return surface;
+    }
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (surface);
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  g_object_unref (pixbuf);
+
+  return surface;
+}
+
+
+/* Store the decoded image waking up who is waiting for it. */
+static void
+finish_entry                   (BackgroundEntry  *entry,
+                                cairo_surface_t  *surface)
+{
+  g_mutex_lock (&cache_mutex);
+
+  entry->surface = surface;
+  entry->pending = FALSE;
+
+  if (entry->ready)
+    {
+      g_idle_add (entry->ready, entry->user_data);
+      entry->ready = (GSourceFunc) NULL;
+    }
+
+  g_cond_broadcast (&cache_cond);
+  trim_cache ();
+
+  g_mutex_unlock (&cache_mutex);
+}
+
+
+/* Decode an image in the worker thread. */
+static void
+decode_run                     (BackgroundEntry  *entry,
+                                gpointer          user_data)
+{
+  finish_entry (entry, decode_surface (entry->filename, entry->width, entry->height));
+}
+
+
+/*
+ * Get the image scaled to width and height decoding it if it is not
+ * in the cache; NULL if the image can not be loaded. The surface must
+ * be destroyed. It can be called by any thread.
+ */
+cairo_surface_t *
+load_background_surface        (const gchar  *filename,
+                                gint          width,
+                                gint          height)
+{
+  gchar *key = make_key (filename, width, height);
+  BackgroundEntry *entry = (BackgroundEntry *) NULL;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+  if (!key)
+    {
+      g_warning ("The background %s does not exist", filename);
+      return surface;
+    }
+
+  g_mutex_lock (&cache_mutex);
+
+  /* The image asked by the window might be on the way. */
+  while (((entry = find_entry (key))) && (entry->pending))
+    {
+      g_cond_wait (&cache_cond, &cache_mutex);
+    }
+
+  if (entry)
+    {
+      surface = reference_surface (entry);
+      g_mutex_unlock (&cache_mutex);
+      g_free (key);
+      return surface;
+    }
+
+  entry = add_entry (key, filename, width, height);
+  g_mutex_unlock (&cache_mutex);
+
+  surface = decode_surface (filename, width, height);
+
+  /* The cache takes its own reference. */
+  finish_entry (entry, surface ? cairo_surface_reference (surface) : surface);
+
+  return surface;
+}
+
+
+/*
+ * Get the image scaled to width and height if it is in the cache,
+ * otherwise return NULL and decode it in a worker thread; when it is
+ * ready the ready function is called in the main loop with user_data.
+ */
+cairo_surface_t *
+load_background_surface_async  (const gchar  *filename,
+                                gint          width,
+                                gint          height,
+                                GSourceFunc   ready,
+                                gpointer      user_data)
+{
+  gchar *key = make_key (filename, width, height);
+  BackgroundEntry *entry = (BackgroundEntry *) NULL;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+  if (!key)
+    {
+      g_warning ("The background %s does not exist", filename);
+      return surface;
+    }
+
+  g_mutex_lock (&cache_mutex);
+
+  entry = find_entry (key);
+
+  if (!entry)
+    {
+      entry = add_entry (key, filename, width, height);
+
+      if (!decoder)
+        {
+          decoder = g_thread_pool_new ((GFunc) decode_run, NULL, 1, FALSE, NULL);
+        }
+
+      g_thread_pool_push (decoder, entry, NULL);
+    }
+  else
+    {
+      g_free (key);
+    }
+
+  if (entry->pending)
+    {
+      entry->ready = ready;
+      entry->user_data = user_data;
+    }
+  else
+    {
+      surface = reference_surface (entry);
+    }
+
+  g_mutex_unlock (&cache_mutex);
+
+  return surface;
+}
+
+
+/* Wait the pending decoding and free the cache. */
+void
+clear_background_cache         ()
+{
+  if (decoder)
+    {
+      g_thread_pool_free (decoder, FALSE, TRUE);
+      decoder = (GThreadPool *) NULL;
+    }
+
+  g_mutex_lock (&cache_mutex);
+
+  /* An image waited by another thread is decoded first. */
+  while (has_pending_entry ())
+    {
+      g_cond_wait (&cache_cond, &cache_mutex);
+    }
+
+  g_queue_foreach (&cache, (GFunc) entry_free, NULL);
+  g_queue_clear (&cache);
+  g_mutex_unlock (&cache_mutex);
+}
+
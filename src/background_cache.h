@@ -0,0 +1,80 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Cache of the background images scaled to their destination.
+ *
+ * The images are decoded with the gdk-pixbuf loaders, then png, jpeg,
+ * svg and the other installed formats are supported, and scaled once
+ * at the size where they are painted. The entries are indexed by the
+ * file name, its modification time and size and the target size, then
+ * an image modified on disk is decoded again. The background window
+ * asks the image without waiting: it is decoded by a worker thread and
+ * the window is painted when it is ready; the exports ask it waiting.
+ */
+
+
+#ifndef BACKGROUND_CACHE_H
+#define BACKGROUND_CACHE_H
+
+#include <glib.h>
+#include <cairo.h>
+
+
+/* The scaled images kept in the cache. */
+#define BACKGROUND_CACHE_SIZE 4
+
+
+/*
+ * Get the image scaled to width and height decoding it if it is not
+ * in the cache; NULL if the image can not be loaded. The surface must
+ * be destroyed. It can be called by any thread.
+ */
+cairo_surface_t *
+load_background_surface        (const gchar  *filename,
+                                gint          width,
+                                gint          height);
+
+
+/*
+ * Get the image scaled to width and height if it is in the cache,
+ * otherwise return NULL and decode it in a worker thread; when it is
+ * ready the ready function is called in the main loop with user_data.
+ */
+cairo_surface_t *
+load_background_surface_async  (const gchar  *filename,
+                                gint          width,
+                                gint          height,
+                                GSourceFunc   ready,
+                                gpointer      user_data);
+
+
+/* Wait the pending decoding and free the cache. */
+void
+clear_background_cache         ();
+
+
+#endif
+
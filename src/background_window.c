@@ -30,41 +30,94 @@
 #include <background_window.h>
 #include <background_window_callbacks.h>
 #include <annotation_window.h>
+#include <session_recorder.h>
+#include <background_cache.h>
+#include <paper.h>
 
 
 /* The background data used internally and by the callbacks. */
 static BackgroundData *background_data;
 
 
-/* Load a file image in the window. */
+static void
+load_file               ();
+
+
+/* Repaint the annotation window that composes the background layer. */
+static void
+expose_background_layer ()
+{
+  AnnotateData *annotate_data = get_annotation_data ();
+
+  if ((annotate_data) && (annotate_data->annotation_window))
+    {
+      gtk_widget_queue_draw (annotate_data->annotation_window);
+    }
+}
+
+
+/* Forget the image of the layer; it is asked again to the cache at the next paint. */
+static void
+reset_layer_image       ()
+{
+  if (background_data->layer_image)
+    {
+      cairo_surface_destroy (background_data->layer_image);
+      background_data->layer_image = (cairo_surface_t *) NULL;
+    }
+
+  background_data->layer_image_requested = FALSE;
+}
+
+
+/* The image has been decoded; paint it if it is still the background. */
+static gboolean
+on_background_image_ready (gpointer  user_data)
+{
+  if ((background_data) && (background_data->background_type == 2))
+    {
+      load_file ();
+    }
+
+  return FALSE;
+}
+
+
+/*
+ * Load a file image in the window; the image scaled to the window is
+ * cached and the first time it is decoded without blocking the ui,
+ * then the window is painted when it is ready.
+ */
 static void
 load_file               ()
 {
+  if (background_data->is_layer)
+    {
+      /* The annotation window paints the new image at the next expose. */
+      reset_layer_image ();
+      expose_background_layer ();
+      return;
+    }
+
   if (background_data->background_cr)
     {
-      cairo_surface_t *surface = cairo_image_surface_create_from_png (background_data->background_image);
-      cairo_t *cr = cairo_create (surface);
+      GdkWindow *window = gtk_widget_get_window (background_data->background_window);
+      cairo_surface_t *surface = load_background_surface_async (background_data->background_image,
+                                                                gdk_window_get_width (window),
+                                                                gdk_window_get_height (window),
+                                                                on_background_image_ready,
+                                                                NULL);
+
+      if (!surface)
+        {
+          return;
+        }
 
       gtk_window_set_opacity (GTK_WINDOW (background_data->background_window), 1.0);
-	
-      gint new_height = 0;
-      gint new_width = 0;
-      new_height = gdk_window_get_height (gtk_widget_get_window (background_data->background_window));
-      new_width = gdk_window_get_width (gtk_widget_get_window (background_data->background_window));
-
-      cairo_surface_t *scaled_surface = scale_surface (surface, new_width, new_height );
-	
-      cairo_surface_destroy (surface);
-	
-      cairo_destroy (cr);
-	
-      cairo_set_source_surface (background_data->background_cr, scaled_surface, 0.0, 0.0);
-	
+
+      cairo_set_source_surface (background_data->background_cr, surface, 0.0, 0.0);
       cairo_paint (background_data->background_cr);
-      cairo_stroke (background_data->background_cr);
-	
-      cairo_surface_destroy (scaled_surface);
-	
+      cairo_surface_destroy (surface);
     }
 }
 
@@ -78,6 +131,12 @@ load_color              ()
   gint b = 0;
   gint a = 0;
 
+  if (background_data->is_layer)
+    {
+      expose_background_layer ();
+      return;
+    }
+
   if (background_data->background_cr)
     {
       sscanf (background_data->background_color, "%02X%02X%02X%02X", &r, &g, &b, &a);
@@ -116,6 +175,25 @@ load_color              ()
 }
 
 
+/* Paint the paper on the background window; the tile is rendered once. */
+static void
+load_paper              ()
+{
+  if (background_data->is_layer)
+    {
+      expose_background_layer ();
+      return;
+    }
+
+  if (background_data->background_cr)
+    {
+      gtk_window_set_opacity (GTK_WINDOW (background_data->background_window), 1.0);
+      cairo_set_operator (background_data->background_cr, CAIRO_OPERATOR_SOURCE);
+      paper_paint (background_data->background_cr, background_data->background_paper, 1.0);
+    }
+}
+
+
 /* Allocate internal structure. */
 static BackgroundData *
 allocate_background_data          ()
@@ -123,9 +201,14 @@ allocate_background_data          ()
   BackgroundData *background_data   = g_malloc ((gsize) sizeof (BackgroundData));
   background_data->background_color = (gchar *) NULL;
   background_data->background_image = (gchar *) NULL;
+  background_data->background_paper = (gchar *) NULL;
   background_data->background_cr          = (cairo_t *) NULL;
   background_data->background_window = (GtkWidget *) NULL;
   background_data->background_type = 0;
+  background_data->background_window_gtk_builder = (GtkBuilder *) NULL;
+  background_data->is_layer = FALSE;
+  background_data->layer_image = (cairo_surface_t *) NULL;
+  background_data->layer_image_requested = FALSE;
   return background_data;
 }
 
@@ -149,6 +232,14 @@ destroy_background_window         ()
           background_data->background_color = (gchar *) NULL;
         }
 
+      if (background_data->background_paper)
+        {
+          g_free (background_data->background_paper);
+          background_data->background_paper = (gchar *) NULL;
+        }
+
+      reset_layer_image ();
+
       if (background_data->background_window)
         {
           /* Destroy brutally the background window. */
@@ -169,6 +260,9 @@ destroy_background_window         ()
           background_data = (BackgroundData *) NULL;
         }
 
+      clear_background_cache ();
+      clear_paper_cache ();
+
     }
 }
 
@@ -176,6 +270,14 @@ destroy_background_window         ()
 /* Clear the background. */
 void clear_background_window      ()
 {
+  if (background_data->is_layer)
+    {
+      reset_layer_image ();
+      expose_background_layer ();
+      record_session_background ();
+      return;
+    }
+
   /*
    * @HACK Deny the mouse input to go below the window putting the opacity greater than 0
    * I avoid a complete transparent window because in some operating system this would become
@@ -185,6 +287,7 @@ void clear_background_window      ()
   gtk_window_set_opacity (GTK_WINDOW (background_data->background_window), BACKGROUND_OPACITY);
 
   clear_cairo_context (background_data->background_cr);
+  record_session_background ();
 }
 
 
@@ -233,6 +336,83 @@ create_background_window     ()
 }
 
 
+/* Create the background as a layer painted by the annotation window. */
+void
+create_background_layer      ()
+{
+  background_data = allocate_background_data ();
+  background_data->is_layer = TRUE;
+}
+
+
+/* Is the background a layer painted by the annotation window? */
+gboolean
+is_background_layer          ()
+{
+  return (background_data) && (background_data->is_layer);
+}
+
+
+/*
+ * Paint the background layer on the cairo context of the annotation
+ * window; it is transparent while the image is being decoded.
+ */
+void
+paint_background_layer       (cairo_t *cr,
+                              gint     width,
+                              gint     height)
+{
+  gint r = 0;
+  gint g = 0;
+  gint b = 0;
+  gint a = 0;
+
+  cairo_save (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_rgba (cr, 0, 0, 0, 0);
+
+  if ((background_data->background_type == 2) && (background_data->background_image))
+    {
+      if (!background_data->layer_image_requested)
+        {
+          background_data->layer_image = load_background_surface_async (background_data->background_image,
+                                                                        width,
+                                                                        height,
+                                                                        on_background_image_ready,
+                                                                        NULL);
+          background_data->layer_image_requested = TRUE;
+        }
+
+      if (background_data->layer_image)
+        {
+          cairo_set_source_surface (cr, background_data->layer_image, 0.0, 0.0);
+        }
+    }
+  else if ((background_data->background_type == 1) && (background_data->background_color))
+    {
+      sscanf (background_data->background_color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+      cairo_set_source_rgba (cr,
+                             (gdouble) r/256,
+                             (gdouble) g/256,
+                             (gdouble) b/256,
+                             (gdouble) a/256);
+    }
+  else if ((background_data->background_type == 3) && (background_data->background_paper))
+    {
+      cairo_pattern_t *pattern = paper_get_pattern (background_data->background_paper, 1.0);
+
+      if (pattern)
+        {
+          cairo_set_source (cr, pattern);
+          cairo_pattern_destroy (pattern);
+        }
+    }
+
+  cairo_paint (cr);
+  cairo_restore (cr);
+}
+
+
 /* Get the background type */
 gint
 get_background_type          ()
@@ -266,6 +446,14 @@ void
 set_background_type          (gint type)
 {
   background_data->background_type = type;
+
+  if (background_data->is_layer)
+    {
+      reset_layer_image ();
+      expose_background_layer ();
+    }
+
+  record_session_background ();
 }
 
 
@@ -283,6 +471,37 @@ update_background_image      (gchar *name)
 {
   set_background_image (name);
   load_file ();
+  record_session_background ();
+}
+
+
+/* Set the background paper. */
+void
+set_background_paper         (const gchar *paper)
+{
+  /* The paper can be the current one e.g. when the window is exposed. */
+  gchar *old_paper = background_data->background_paper;
+
+  background_data->background_paper = g_strdup (paper);
+  g_free (old_paper);
+}
+
+
+/* Update the background paper. */
+void
+update_background_paper      (const gchar *paper)
+{
+  set_background_paper (paper);
+  load_paper ();
+  record_session_background ();
+}
+
+
+/* Get the background paper */
+gchar *
+get_background_paper         ()
+{
+  return background_data->background_paper;
 }
 
 
@@ -300,6 +519,7 @@ update_background_color      (gchar* rgba)
 {
   set_background_color (rgba);
   load_color ();
+  record_session_background ();
 }
 
 
@@ -40,7 +40,7 @@ typedef struct
   /* Gtkbuilder for background window. */
   GtkBuilder *background_window_gtk_builder;
 
-  /* 0 no background, 1 color, 1 image*/
+  /* 0 no background, 1 color, 2 image, 3 paper*/
   gint background_type;
 
   /* Background colour selected. */
@@ -49,12 +49,27 @@ typedef struct
   /* Background image selected. */
   gchar *background_image;
 
+  /* Background paper selected e.g. "squared 32", see paper.h. */
+  gchar *background_paper;
+
   /* The background widget that represent the full window. */
   GtkWidget *background_window;
 
   /* cairo context to draw on the background window. */
   cairo_t *background_cr;
 
+  /*
+   * Is the background a layer painted by the annotation window instead
+   * of a window of its own? The compositor then blends only one window.
+   */
+  gboolean is_layer;
+
+  /* The image scaled to the annotation window for the layer; NULL until decoded. */
+  cairo_surface_t *layer_image;
+
+  /* Has the layer image been asked to the cache since the last change? */
+  gboolean layer_image_requested;
+
 }BackgroundData;
 
 
@@ -62,6 +77,26 @@ typedef struct
 GtkWidget *
 create_background_window     ();
 
+/*
+ * Create the background as a layer painted by the annotation window
+ * under the annotations; no window is created, see paint_background_layer.
+ */
+void
+create_background_layer      ();
+
+
+/* Is the background a layer painted by the annotation window? */
+gboolean
+is_background_layer     ();
+
+
+/* Paint the background layer on the cairo context of the annotation window. */
+void
+paint_background_layer  (cairo_t *cr,
+                         gint     width,
+                         gint     height);
+
+
 /* Set the background type. */
 void
 set_background_type     (gint type);
@@ -87,6 +122,21 @@ gchar *
 get_background_image    ();
 
 
+/* Set the background paper described as in paper.h. */
+void
+set_background_paper    (const gchar *paper);
+
+
+/* Update the background paper. */
+void
+update_background_paper (const gchar *paper);
+
+
+/* Get the background paper */
+gchar *
+get_background_paper    ();
+
+
 /* Set the background colour. */
 void
 set_background_color    (gchar *rgba);
@@ -112,7 +162,7 @@ void
 destroy_background_window    ();
 
 
-/* Get the background window. */
+/* Get the background window; NULL if the background is a layer. */
 GtkWidget *
 get_background_window   ();
 
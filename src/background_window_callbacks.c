@@ -83,6 +83,10 @@ back_event_expose                 (GtkWidget  *widget,
     {
       update_background_color (background_data->background_color);
     }
+  else if ((background_data->background_paper) && (get_background_type () == 3))
+    {
+      update_background_paper (background_data->background_paper);
+    }
   else
     {
       clear_background_window ();
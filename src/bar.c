@@ -26,6 +26,11 @@
 #include <utils.h>
 #include <bar.h>
 
+
+/* The gtk builder object of the bar window */
+GtkBuilder *bar_gtk_builder = (GtkBuilder *) NULL;
+
+
 /* 
  * Calculate the better position where put the bar.
  */
@@ -144,7 +149,7 @@ get_xdg_config_file (const char *name)
       file = g_build_filename(*dir, name, NULL);
       if (g_file_test(file, G_FILE_TEST_EXISTS) == TRUE)
           return file;
-          free(file);
+      free(file);
   }
   return NULL;
 }
@@ -37,6 +37,10 @@
 #include <info_dialog.h>
 #include <iwb_saver.h>
 #include <recorder.h>
+#include <input_recorder.h>
+#include <autosave.h>
+#include <stroke_journal.h>
+#include <session_recorder.h>
 #include <saver.h>
 #include <pdf_saver.h>
 #include <share_confirmation_dialog.h>
@@ -45,6 +49,9 @@
 /* Timer used to up-rise the window. */
 static gint timer = -1;
 
+/* Is the bar quitting? The quit waits for the export of the project. */
+static gboolean quitting = FALSE;
+
 
 /* Try to up-rise the window; 
  * this is used for the window manager 
@@ -135,11 +142,11 @@ add_alpha               (BarData *bar_data)
 {
   if (is_highlighter_toggle_tool_button_active ())
     {
-      strncpy (&bar_data->color[6], SEMI_OPAQUE_ALPHA, 2);
+      memcpy (&bar_data->color[6], SEMI_OPAQUE_ALPHA, 2);
     }
   else
     {
-      strncpy (&bar_data->color[6], OPAQUE_ALPHA, 2);
+      memcpy (&bar_data->color[6], OPAQUE_ALPHA, 2);
     }
 }
 
@@ -189,7 +196,7 @@ release_lock                 (BarData *bar_data)
       annotate_release_grab ();
 
       /* Try to up-rise the window. */
-      timer = g_timeout_add (BAR_TO_TOP_TIMEOUT, bar_to_top, get_background_window ());
+      timer = g_timeout_add (BAR_TO_TOP_TIMEOUT, bar_to_top, get_background_window () ? get_background_window () : get_annotation_window ());
 #ifdef _WIN32 // WIN32
       if (gtk_window_get_opacity (GTK_WINDOW (get_background_window ()))!=0)
         {
@@ -246,7 +253,7 @@ set_color                    (BarData  *bar_data,
 {
   take_pen_tool ();
   lock (bar_data);
-  strncpy (bar_data->color, selected_color, 6);
+  memcpy (bar_data->color, selected_color, 6);
   annotate_set_color (bar_data->color);
 }
 
@@ -334,6 +341,99 @@ on_bar_configure_event            (GtkWidget  *widget,
 }
 
 
+/* Show the progress of the export in the tool-tip of the button. */
+static void
+on_export_progress              (gdouble          fraction,
+                                 gpointer         user_data)
+{
+  gchar *tooltip = g_strdup_printf (gettext ("Saving the lesson... %d%%"), (gint) (fraction * 100));
+  gtk_tool_item_set_tooltip_text ((GtkToolItem *) user_data, tooltip);
+  g_free (tooltip);
+}
+
+
+/* The export of the quit has finished; quit. */
+static void
+on_quit_export_done             (gboolean         saved,
+                                 GSList          *savepoints,
+                                 gpointer         user_data)
+{
+  /*
+   * The export compacts the autosave and the stroke journals in the
+   * iwb file; if it has been cancelled they are recovered at the next start.
+   */
+  stop_stroke_journal (saved);
+  stop_autosave (saved);
+  quit_pdf_saver ();
+  quit_saver ();
+  start_share_dialog ();
+
+  annotate_quit ();
+
+  /* Destroy the background window this will call the destroy of all windows. */
+  destroy_background_window ();
+
+  /* Quit the gtk engine. */
+  gtk_main_quit ();
+}
+
+
+/* Export the project in background and quit at the end. */
+static void
+start_quit_export               (GtkToolButton   *quit_button)
+{
+  /* Push quit again to cancel the export. */
+  gtk_tool_button_set_stock_id (quit_button, "gtk-cancel");
+  gtk_tool_item_set_tooltip_text ((GtkToolItem *) quit_button, gettext ("Saving the lesson..."));
+
+  start_iwb_export (get_iwb_filename (), on_export_progress, on_quit_export_done, quit_button);
+}
+
+
+/* Make insensitive the buttons of the bar except the one passed. */
+static void
+disable_bar_buttons             (GtkWidget       *button)
+{
+  GList *children = gtk_container_get_children (GTK_CONTAINER (gtk_widget_get_parent (button)));
+  GList *list = (GList *) NULL;
+
+  for (list = children; list; list = list->next)
+    {
+      if (list->data != button)
+        {
+          gtk_widget_set_sensitive (GTK_WIDGET (list->data), FALSE);
+        }
+    }
+
+  g_list_free (children);
+}
+
+
+/* The save has finished; the journals restart from the saved save-points. */
+static void
+on_save_export_done             (gboolean         saved,
+                                 GSList          *savepoints,
+                                 gpointer         user_data)
+{
+  GtkToolButton *save_button = (GtkToolButton *) user_data;
+
+  gtk_tool_button_set_stock_id (save_button, "gtk-save");
+  gtk_tool_item_set_tooltip_text ((GtkToolItem *) save_button, gettext ("Save"));
+
+  if (quitting)
+    {
+      /* The save has been stopped by the quit; export the last save-points. */
+      start_quit_export (GTK_TOOL_BUTTON (gtk_builder_get_object (bar_gtk_builder, "buttonQuit")));
+      return;
+    }
+
+  if (saved)
+    {
+      rebase_autosave (savepoints);
+    }
+}
+
+
 /* Called when push the quit button */
 G_MODULE_EXPORT gboolean
 on_bar_quit                     (GtkToolButton   *toolbutton,
@@ -341,27 +441,118 @@ on_bar_quit                     (GtkToolButton   *toolbutton,
 {
   BarData *bar_data = (BarData *) func_data;
 
+  /* The quit is waiting for the export; cancel it and quit. */
+  if (quitting)
+    {
+      cancel_iwb_export ();
+      return FALSE;
+    }
+
+  quitting = TRUE;
+
   stop_recorder ();
+  stop_input_recording ();
+  stop_input_replay ();
+  stop_session_recorder ();
 
   bar_data->grab = FALSE;
   /* Release grab. */
   annotate_release_grab ();
 
-  export_iwb (get_iwb_filename ());
-  quit_pdf_saver ();
-  start_share_dialog ();
-
-  annotate_quit ();
+  /* Nothing can be painted while the last save-points are exported. */
+  disable_bar_buttons (GTK_WIDGET (toolbutton));
 
-  /* Destroy the background window this will call the destroy of all windows. */
-  destroy_background_window ();
+  if (is_iwb_export_running ())
+    {
+      /* The running save is out of date; the quit export starts when it stops. */
+      cancel_iwb_export ();
+    }
+  else
+    {
+      start_quit_export (toolbutton);
+    }
 
-  /* Quit the gtk engine. */
-  gtk_main_quit ();
   return FALSE;
 }
 
 
+/* Push save button; push it again to cancel the save. */
+G_MODULE_EXPORT void
+on_bar_save_activate              (GtkToolButton   *toolbutton,
+                                   gpointer         func_data)
+{
+  if (is_iwb_export_running ())
+    {
+      cancel_iwb_export ();
+      return;
+    }
+
+  /* The painting goes on while the save-points are exported. */
+  if (start_iwb_export (get_iwb_filename (), on_export_progress, on_save_export_done, toolbutton))
+    {
+      gtk_tool_button_set_stock_id (toolbutton, "gtk-stop");
+      gtk_tool_item_set_tooltip_text ((GtkToolItem *) toolbutton, gettext ("Saving the lesson..."));
+    }
+}
+
+
+/* Show the progress of the history export in the tool-tip of the button. */
+static void
+on_pdf_history_progress         (gdouble          fraction,
+                                 gpointer         user_data)
+{
+  gchar *tooltip = g_strdup_printf (gettext ("Exporting the lesson as pdf... %d%%"), (gint) (fraction * 100));
+  gtk_tool_item_set_tooltip_text ((GtkToolItem *) user_data, tooltip);
+  g_free (tooltip);
+}
+
+
+/* The history export has finished; restore the button. */
+static void
+on_pdf_history_done             (gboolean         saved,
+                                 gpointer         user_data)
+{
+  GtkToolButton *button = (GtkToolButton *) user_data;
+
+  gtk_tool_button_set_stock_id (button, "gtk-print");
+  gtk_tool_item_set_tooltip_text ((GtkToolItem *) button, gettext ("Export the lesson as pdf"));
+}
+
+
+/* Push the export history button; push it again to cancel the export. */
+G_MODULE_EXPORT void
+on_bar_export_history_activate    (GtkToolButton   *toolbutton,
+                                   gpointer         func_data)
+{
+  BarData *bar_data = (BarData *) func_data;
+  gboolean grab_value = bar_data->grab;
+
+  if (is_pdf_history_export_running ())
+    {
+      cancel_pdf_history_export ();
+      return;
+    }
+
+  bar_data->grab = FALSE;
+
+  /* Release grab. */
+  annotate_release_grab ();
+
+  /* The painting goes on while the boards are exported. */
+  if (start_pdf_history_export (GTK_WINDOW (get_bar_widget ()),
+                                on_pdf_history_progress,
+                                on_pdf_history_done,
+                                toolbutton))
+    {
+      gtk_tool_button_set_stock_id (toolbutton, "gtk-stop");
+      gtk_tool_item_set_tooltip_text ((GtkToolItem *) toolbutton, gettext ("Exporting the lesson as pdf..."));
+    }
+
+  bar_data->grab = grab_value;
+  start_tool (bar_data);
+}
+
+
 /* Called when push the info button. */
 G_MODULE_EXPORT gboolean
 on_bar_info                      (GtkToolButton   *toolbutton,
@@ -573,12 +764,46 @@ on_bar_screenshot_activate	      (GtkToolButton   *toolbutton,
   /* Release grab. */
   annotate_release_grab ();
   gdk_window_set_cursor (gtk_widget_get_window (get_annotation_window ()), (GdkCursor *) NULL);
-  start_save_image_dialog (toolbutton, GTK_WINDOW (get_bar_widget ()));
+  start_save_image_dialog (toolbutton, GTK_WINDOW (get_bar_widget ()), (GdkRectangle *) NULL);
   bar_data->grab = grab_value;
   start_tool (bar_data);
 }
 
 
+/* Save the area selected with the rubber band. */
+static void
+on_area_selected                  (gint      x,
+                                   gint      y,
+                                   gint      width,
+                                   gint      height,
+                                   gpointer  user_data)
+{
+  BarData *bar_data = (BarData *) user_data;
+  GdkRectangle area = { x, y, width, height };
+  gboolean grab_value = bar_data->grab;
+  bar_data->grab = FALSE;
+
+  /* Release grab. */
+  annotate_release_grab ();
+  gdk_window_set_cursor (gtk_widget_get_window (get_annotation_window ()), (GdkCursor *) NULL);
+  start_save_image_dialog ((GtkToolButton *) NULL, GTK_WINDOW (get_bar_widget ()), &area);
+  bar_data->grab = grab_value;
+  start_tool (bar_data);
+}
+
+
+/* Push save area button: select the area and save it. */
+G_MODULE_EXPORT void
+on_bar_screenshot_area_activate   (GtkToolButton   *toolbutton,
+                                   gpointer         func_data)
+{
+  BarData *bar_data = (BarData *) func_data;
+  lock (bar_data);
+  annotate_select_area (on_area_selected, bar_data);
+  annotate_acquire_grab ();
+}
+
+
 /* Add page to pdf. */
 G_MODULE_EXPORT void
 on_bar_add_pdf_activate	          (GtkToolButton   *toolbutton,
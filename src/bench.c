@@ -0,0 +1,757 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Micro-benchmarks of the painting core hot paths.
+ *
+ * Each benchmark is run for some rounds and the median time per
+ * operation is printed in JSON together with the number of heap
+ * allocations per operation; run it with "make bench".
+ *
+ * Only the benchmark thread is measured: the save-point files are
+ * written by the canvas writer thread, that is waited before each
+ * operation, then savepoint_save gives the cost paid by the ui thread.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <time.h>
+#include <getopt.h>
+
+#include <glib/gprintf.h>
+
+#include <canvas.h>
+#include <broken.h>
+#include <bezier_spline.h>
+#include <fill.h>
+
+
+/* Seed used to generate the synthetic strokes. */
+#define BENCH_SEED 20091216
+
+/* Default number of measured rounds for each benchmark. */
+#define BENCH_ROUNDS 5
+
+/* Default minimum duration of a round in seconds. */
+#define BENCH_MIN_TIME 0.2
+
+/* Maximum number of operations in a round. */
+#define BENCH_MAX_ITERATIONS 10000000
+
+
+/* A benchmark. */
+typedef struct
+{
+
+  /* Name printed in the report. */
+  const gchar *name;
+
+  /* Allocate the benchmark state. */
+  gpointer (*setup)    (gconstpointer param);
+
+  /* Parameter passed to the setup. */
+  gconstpointer param;
+
+  /* Prepare the state before each operation; it is not measured. */
+  void     (*reset)    (gpointer state);
+
+  /* The measured operation. */
+  void     (*run)      (gpointer state);
+
+  /* Free the benchmark state. */
+  void     (*teardown) (gpointer state);
+
+} Benchmark;
+
+
+/* The result of a benchmark. */
+typedef struct
+{
+  guint64 iterations;
+  gdouble ns_per_op;
+  gdouble ns_per_op_min;
+  gdouble allocs_per_op;
+  gdouble bytes_per_op;
+} BenchmarkResult;
+
+
+/*
+ * The counters are per thread; the allocations of the other threads,
+ * e.g. the save-point writer, are not counted.
+ */
+
+/* Are the allocations counted? */
+static __thread gboolean count_allocations = FALSE;
+
+/* Number of allocations done while counting. */
+static __thread guint64 allocation_count = 0;
+
+/* Number of bytes allocated while counting. */
+static __thread guint64 allocation_bytes = 0;
+
+
+#ifdef __GLIBC__
+
+/*
+ * Count the heap allocations overriding the malloc family;
+ * the glib, cairo and libpng allocations are counted too.
+ */
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+
+void *
+malloc             (size_t size)
+{
+  if (count_allocations)
+    {
+      allocation_count++;
+      allocation_bytes += size;
+    }
+
+  return __libc_malloc (size);
+}
+
+
+void *
+calloc             (size_t nmemb,
+                    size_t size)
+{
+  if (count_allocations)
+    {
+      allocation_count++;
+      allocation_bytes += nmemb * size;
+    }
+
+  return __libc_calloc (nmemb, size);
+}
+
+
+void *
+realloc            (void   *ptr,
+                    size_t  size)
+{
+  if (count_allocations)
+    {
+      allocation_count++;
+      allocation_bytes += size;
+    }
+
+  return __libc_realloc (ptr, size);
+}
+
+#endif
+
+
+/* Get the monotonic time in nanoseconds. */
+static guint64
+get_time_ns        ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Create a stroke along a noisy ellipse; the newest point is the first one. */
+static GSList *
+create_stroke      (guint    points,
+                    gdouble  cx,
+                    gdouble  cy,
+                    gdouble  rx,
+                    gdouble  ry,
+                    gdouble  noise)
+{
+  GRand *rand = g_rand_new_with_seed (BENCH_SEED);
+  GSList *list = (GSList *) NULL;
+  guint i = 0;
+
+  for (i=0; i<points; i++)
+    {
+      gdouble angle = 2 * M_PI * i / points;
+      gdouble x = cx + rx * cos (angle) + g_rand_double_range (rand, -noise, noise);
+      gdouble y = cy + ry * sin (angle) + g_rand_double_range (rand, -noise, noise);
+      gdouble pressure = g_rand_double_range (rand, 0.4, 1.0);
+      list = canvas_coord_list_prepend (list, x, y, 5.0, pressure);
+    }
+
+  g_rand_free (rand);
+  return list;
+}
+
+
+/* Paint the synthetic drawing used by the fill and the save-point benchmarks. */
+static void
+paint_synthetic_drawing (cairo_t *cr,
+                         gint     width,
+                         gint     height,
+                         gboolean shapes)
+{
+  gint i = 0;
+
+  clear_cairo_context (cr);
+
+  if (!shapes)
+    {
+      return;
+    }
+
+  cairo_set_line_width (cr, 5.0);
+  cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+
+  /* A big frame around the area filled by the benchmark. */
+  cairo_set_source_rgba (cr, 1.0, 0.0, 0.0, 1.0);
+  cairo_rectangle (cr, width * 0.1, height * 0.1, width * 0.8, height * 0.8);
+  cairo_stroke (cr);
+
+  /* Some handwritten like shapes inside the frame. */
+  for (i=0; i<24; i++)
+    {
+      gdouble x = width * (0.15 + 0.7 * (i % 6) / 6);
+      gdouble y = height * (0.15 + 0.7 * (i / 6) / 4);
+      cairo_set_source_rgba (cr, 0.0, (i % 3) / 2.0, 1.0, 1.0);
+
+      if (i % 2)
+        {
+          cairo_arc (cr, x + width * 0.05, y + height * 0.07, height * 0.05, 0, 2 * M_PI);
+        }
+      else
+        {
+          cairo_move_to (cr, x, y);
+          cairo_curve_to (cr, x + width * 0.03, y + height * 0.15, x + width * 0.06, y - height * 0.02, x + width * 0.09, y + height * 0.12);
+        }
+
+      cairo_stroke (cr);
+    }
+}
+
+
+/* Parameters of the flood fill benchmarks. */
+typedef struct
+{
+  gint width;
+  gint height;
+  gboolean shapes;
+} FillParam;
+
+
+/* State of the flood fill benchmarks. */
+typedef struct
+{
+  cairo_surface_t *pristine;
+  cairo_surface_t *work;
+  cairo_surface_t *target;
+  cairo_t *target_cr;
+  gint width;
+  gint height;
+} FillState;
+
+
+static gpointer
+fill_setup         (gconstpointer param)
+{
+  const FillParam *fill_param = (const FillParam *) param;
+  FillState *state = g_malloc0 ((gsize) sizeof (FillState));
+  cairo_t *cr = (cairo_t *) NULL;
+
+  state->width = fill_param->width;
+  state->height = fill_param->height;
+  state->pristine = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, state->width, state->height);
+  state->work = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, state->width, state->height);
+  state->target = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, state->width, state->height);
+  state->target_cr = cairo_create (state->target);
+
+  cr = cairo_create (state->pristine);
+  paint_synthetic_drawing (cr, state->width, state->height, fill_param->shapes);
+  cairo_destroy (cr);
+  cairo_surface_flush (state->pristine);
+
+  return state;
+}
+
+
+static void
+fill_reset         (gpointer data)
+{
+  FillState *state = (FillState *) data;
+  gsize size = (gsize) cairo_image_surface_get_stride (state->pristine) * state->height;
+
+  cairo_surface_flush (state->work);
+  memcpy (cairo_image_surface_get_data (state->work),
+          cairo_image_surface_get_data (state->pristine),
+          size);
+  cairo_surface_mark_dirty (state->work);
+}
+
+
+static void
+fill_run           (gpointer data)
+{
+  FillState *state = (FillState *) data;
+  flood_fill (state->target_cr, state->work, "0000FFFF", state->width / 2 + 7, state->height / 2 + 3);
+}
+
+
+static void
+fill_teardown      (gpointer data)
+{
+  FillState *state = (FillState *) data;
+  cairo_destroy (state->target_cr);
+  cairo_surface_destroy (state->target);
+  cairo_surface_destroy (state->work);
+  cairo_surface_destroy (state->pristine);
+  g_free (state);
+}
+
+
+/* State of the shape recognizer benchmarks. */
+typedef struct
+{
+  GSList *stroke;
+  GSList *meaningful;
+} ShapeState;
+
+
+static gpointer
+shape_setup        (gconstpointer param)
+{
+  ShapeState *state = g_malloc0 ((gsize) sizeof (ShapeState));
+  guint points = GPOINTER_TO_UINT (param);
+
+  state->stroke = create_stroke (points, 960, 540, 300, 200, 3.0);
+  state->meaningful = build_meaningful_point_list (state->stroke, TRUE, 5.0);
+
+  return state;
+}
+
+
+static void
+shape_teardown     (gpointer data)
+{
+  ShapeState *state = (ShapeState *) data;
+  canvas_coord_list_free (state->stroke);
+  canvas_coord_list_free (state->meaningful);
+  g_free (state);
+}
+
+
+static gpointer
+spline_setup       (gconstpointer param)
+{
+  ShapeState *state = g_malloc0 ((gsize) sizeof (ShapeState));
+  guint points = GPOINTER_TO_UINT (param);
+
+  /* The spline input is already a meaningful point list. */
+  state->meaningful = create_stroke (points, 960, 540, 300, 200, 0.0);
+
+  return state;
+}
+
+
+static void
+spline_run         (gpointer data)
+{
+  ShapeState *state = (ShapeState *) data;
+  canvas_coord_list_free (spline (state->meaningful));
+}
+
+
+static void
+meaningful_run     (gpointer data)
+{
+  ShapeState *state = (ShapeState *) data;
+  canvas_coord_list_free (build_meaningful_point_list (state->stroke, TRUE, 5.0));
+}
+
+
+static void
+broken_run         (gpointer data)
+{
+  ShapeState *state = (ShapeState *) data;
+  canvas_coord_list_free (broken (state->stroke, TRUE, TRUE, 5.0));
+}
+
+
+static void
+ellipse_run        (gpointer data)
+{
+  ShapeState *state = (ShapeState *) data;
+  is_similar_to_an_ellipse (state->meaningful, 5.0);
+}
+
+
+/* State of the canvas benchmarks. */
+typedef struct
+{
+  AnnotateCanvas *canvas;
+  cairo_surface_t *surface;
+  gchar *savepoint_dir;
+  GSList *stroke;
+} CanvasState;
+
+
+static gpointer
+canvas_setup       (gconstpointer param)
+{
+  const FillParam *canvas_param = (const FillParam *) param;
+  CanvasState *state = g_malloc0 ((gsize) sizeof (CanvasState));
+  cairo_t *cr = (cairo_t *) NULL;
+
+  state->savepoint_dir = g_dir_make_tmp ("ardesia-bench-XXXXXX", NULL);
+  state->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                               canvas_param->width,
+                                               canvas_param->height);
+  cr = cairo_create (state->surface);
+  paint_synthetic_drawing (cr, canvas_param->width, canvas_param->height, canvas_param->shapes);
+
+  state->canvas = canvas_new (canvas_param->width,
+                              canvas_param->height,
+                              state->savepoint_dir);
+  canvas_set_cairo_context (state->canvas, cr);
+  state->canvas->thickness = 5.0;
+
+  return state;
+}
+
+
+static void
+canvas_teardown    (gpointer data)
+{
+  CanvasState *state = (CanvasState *) data;
+  cairo_t *cr = state->canvas->cr;
+
+  canvas_free (state->canvas);
+  cairo_destroy (cr);
+  cairo_surface_destroy (state->surface);
+  canvas_coord_list_free (state->stroke);
+  g_rmdir (state->savepoint_dir);
+  g_free (state->savepoint_dir);
+  g_free (state);
+}
+
+
+static void
+savepoint_save_reset (gpointer data)
+{
+  CanvasState *state = (CanvasState *) data;
+  canvas_clear_history (state->canvas);
+
+  /* The files of the previous operation are not written in the measured time. */
+  canvas_wait_files (state->canvas);
+}
+
+
+static void
+savepoint_save_run (gpointer data)
+{
+  CanvasState *state = (CanvasState *) data;
+  canvas_add_savepoint (state->canvas);
+}
+
+
+static gpointer
+savepoint_restore_setup (gconstpointer param)
+{
+  CanvasState *state = (CanvasState *) canvas_setup (param);
+  canvas_add_savepoint (state->canvas);
+  canvas_wait_files (state->canvas);
+  return state;
+}
+
+
+static void
+savepoint_restore_run (gpointer data)
+{
+  CanvasState *state = (CanvasState *) data;
+  canvas_restore_surface (state->canvas);
+}
+
+
+static gpointer
+modify_color_setup (gconstpointer param)
+{
+  CanvasState *state = (CanvasState *) canvas_setup (param);
+  state->stroke = canvas_coord_list_prepend (NULL, 10, 10, 5.0, 0.8);
+  return state;
+}
+
+
+static void
+modify_color_run   (gpointer data)
+{
+  CanvasState *state = (CanvasState *) data;
+  canvas_modify_color (state->canvas, state->stroke, 0.6);
+}
+
+
+static const FillParam canvas_empty_1080p = { 1920, 1080, FALSE };
+static const FillParam canvas_shapes_1080p = { 1920, 1080, TRUE };
+static const FillParam canvas_shapes_4k = { 3840, 2160, TRUE };
+static const FillParam canvas_tiny = { 16, 16, FALSE };
+
+
+/* The benchmark suite. */
+static const Benchmark benchmarks[] =
+{
+  { "flood_fill/1080p_empty", fill_setup, &canvas_empty_1080p, fill_reset, fill_run, fill_teardown },
+  { "flood_fill/1080p_shapes", fill_setup, &canvas_shapes_1080p, fill_reset, fill_run, fill_teardown },
+  { "flood_fill/4k_shapes", fill_setup, &canvas_shapes_4k, fill_reset, fill_run, fill_teardown },
+  { "spline/32", spline_setup, GUINT_TO_POINTER (32), NULL, spline_run, shape_teardown },
+  { "spline/256", spline_setup, GUINT_TO_POINTER (256), NULL, spline_run, shape_teardown },
+  { "build_meaningful_point_list/1000", shape_setup, GUINT_TO_POINTER (1000), NULL, meaningful_run, shape_teardown },
+  { "broken/1000", shape_setup, GUINT_TO_POINTER (1000), NULL, broken_run, shape_teardown },
+  { "is_similar_to_an_ellipse/1000", shape_setup, GUINT_TO_POINTER (1000), NULL, ellipse_run, shape_teardown },
+  { "savepoint_save/1080p", canvas_setup, &canvas_shapes_1080p, savepoint_save_reset, savepoint_save_run, canvas_teardown },
+  { "savepoint_save/4k", canvas_setup, &canvas_shapes_4k, savepoint_save_reset, savepoint_save_run, canvas_teardown },
+  { "savepoint_restore/1080p", savepoint_restore_setup, &canvas_shapes_1080p, NULL, savepoint_restore_run, canvas_teardown },
+  { "savepoint_restore/4k", savepoint_restore_setup, &canvas_shapes_4k, NULL, savepoint_restore_run, canvas_teardown },
+  { "canvas_modify_color", modify_color_setup, &canvas_tiny, NULL, modify_color_run, canvas_teardown },
+};
+
+
+/* Run count operations and return the measured time in nanoseconds. */
+static guint64
+run_round          (const Benchmark *benchmark,
+                    gpointer         state,
+                    guint64          count)
+{
+  guint64 elapsed = 0;
+  guint64 i = 0;
+
+  if (!benchmark->reset)
+    {
+      guint64 start = get_time_ns ();
+
+      count_allocations = TRUE;
+      for (i=0; i<count; i++)
+        {
+          benchmark->run (state);
+        }
+      count_allocations = FALSE;
+
+      return get_time_ns () - start;
+    }
+
+  /* Only the operation is measured; the reset is excluded. */
+  for (i=0; i<count; i++)
+    {
+      guint64 start = 0;
+
+      benchmark->reset (state);
+
+      start = get_time_ns ();
+      count_allocations = TRUE;
+      benchmark->run (state);
+      count_allocations = FALSE;
+      elapsed += get_time_ns () - start;
+    }
+
+  return elapsed;
+}
+
+
+/* Compare two doubles for qsort. */
+static gint
+compare_doubles    (gconstpointer a,
+                    gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+  return (da > db) - (da < db);
+}
+
+
+/* Run the benchmark and fill the result. */
+static void
+run_benchmark      (const Benchmark  *benchmark,
+                    guint             rounds,
+                    gdouble           min_time,
+                    BenchmarkResult  *result)
+{
+  gpointer state = benchmark->setup (benchmark->param);
+  guint64 count = 1;
+  guint64 min_ns = (guint64) (min_time * 1e9);
+  gdouble *samples = g_new0 (gdouble, rounds);
+  guint i = 0;
+
+  /* Warm up and find how many operations fill a round. */
+  while (count < BENCH_MAX_ITERATIONS)
+    {
+      guint64 elapsed = run_round (benchmark, state, count);
+
+      if (elapsed >= min_ns)
+        {
+          break;
+        }
+
+      if (elapsed * 10 < min_ns)
+        {
+          count = count * 10;
+        }
+      else
+        {
+          count = (guint64) ceil (count * 1.2 * min_ns / MAX (elapsed, 1));
+        }
+    }
+
+  count = MIN (count, BENCH_MAX_ITERATIONS);
+
+  allocation_count = 0;
+  allocation_bytes = 0;
+
+  for (i=0; i<rounds; i++)
+    {
+      samples[i] = (gdouble) run_round (benchmark, state, count) / count;
+    }
+
+  qsort (samples, rounds, sizeof (gdouble), compare_doubles);
+
+  result->iterations = count * rounds;
+  result->ns_per_op = samples[rounds / 2];
+  result->ns_per_op_min = samples[0];
+  result->allocs_per_op = (gdouble) allocation_count / result->iterations;
+  result->bytes_per_op = (gdouble) allocation_bytes / result->iterations;
+
+  g_free (samples);
+  benchmark->teardown (state);
+}
+
+
+/* Print the command line help. */
+static void
+print_help         ()
+{
+  g_printf ("Usage: ardesia-bench [options]\n\n");
+  g_printf ("Run the micro-benchmarks of the painting core and print the result in JSON\n\n");
+  g_printf ("options:\n");
+  g_printf ("  --filter,\t-f\t\tRun only the benchmarks whose name contains the string\n");
+  g_printf ("  --rounds,\t-r\t\tNumber of measured rounds [default %d]\n", BENCH_ROUNDS);
+  g_printf ("  --min-time,\t-t\t\tMinimum duration of a round in seconds [default %.1f]\n", BENCH_MIN_TIME);
+  g_printf ("  --list,\t-l\t\tList the benchmarks and exit\n");
+  g_printf ("  --help,\t-h\t\tShows the help screen\n");
+  exit (EXIT_SUCCESS);
+}
+
+
+int
+main               (int    argc,
+                    char  *argv[])
+{
+  const gchar *filter = (const gchar *) NULL;
+  guint rounds = BENCH_ROUNDS;
+  gdouble min_time = BENCH_MIN_TIME;
+  gboolean first = TRUE;
+  guint i = 0;
+  gint c = 0;
+
+  /* Make the glib slices visible to the allocation counter. */
+  g_setenv ("G_SLICE", "always-malloc", TRUE);
+
+  while (1)
+    {
+      static struct option long_options[] =
+      {
+      {"help", no_argument,           0, 'h'},
+      {"list", no_argument,           0, 'l'},
+      {"filter", required_argument,   0, 'f'},
+      {"rounds", required_argument,   0, 'r'},
+      {"min-time", required_argument, 0, 't'},
+      {0, 0, 0, 0}
+      };
+
+      gint option_index = 0;
+      c = getopt_long (argc, argv, "hlf:r:t:", long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+        {
+          break;
+        }
+
+      switch (c)
+        {
+          case 'l':
+            for (i=0; i<G_N_ELEMENTS (benchmarks); i++)
+              {
+                g_printf ("%s\n", benchmarks[i].name);
+              }
+            exit (EXIT_SUCCESS);
+          case 'f':
+            filter = optarg;
+            break;
+          case 'r':
+            rounds = MAX (atoi (optarg), 1);
+            break;
+          case 't':
+            min_time = MAX (g_ascii_strtod (optarg, NULL), 0.001);
+            break;
+          default:
+            print_help ();
+        }
+    }
+
+  g_printf ("{\n");
+  g_printf ("  \"package\": \"%s\",\n", PACKAGE_STRING);
+  g_printf ("  \"rounds\": %u,\n", rounds);
+#ifdef __GLIBC__
+  g_printf ("  \"allocations_counted\": true,\n");
+#else
+  g_printf ("  \"allocations_counted\": false,\n");
+#endif
+  g_printf ("  \"benchmarks\": [");
+
+  for (i=0; i<G_N_ELEMENTS (benchmarks); i++)
+    {
+      const Benchmark *benchmark = &benchmarks[i];
+      BenchmarkResult result;
+
+      if ((filter) && (!strstr (benchmark->name, filter)))
+        {
+          continue;
+        }
+
+      run_benchmark (benchmark, rounds, min_time, &result);
+
+      g_printf ("%s\n    {\"name\": \"%s\", \"iterations\": %" G_GUINT64_FORMAT
+                ", \"ns_per_op\": %.1f, \"ns_per_op_min\": %.1f"
+                ", \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+                first ? "" : ",",
+                benchmark->name,
+                result.iterations,
+                result.ns_per_op,
+                result.ns_per_op_min,
+                result.allocs_per_op,
+                result.bytes_per_op);
+      fflush (stdout);
+      first = FALSE;
+    }
+
+  g_printf ("\n  ]\n}\n");
+  return EXIT_SUCCESS;
+}
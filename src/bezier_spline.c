@@ -23,8 +23,7 @@
 
 
 #include <bezier_spline.h>
-#include <annotation_window.h>
-#include <utils.h>
+#include <canvas.h>
 
 
 /* Spline the lines with a bezier curves. */
@@ -22,8 +22,7 @@
  */
 
 
-#include <utils.h>
-#include <annotation_window.h>
+#include <canvas.h>
 #include <broken.h>
 
 
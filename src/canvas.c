@@ -0,0 +1,2057 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+#include <canvas.h>
+#include <broken.h>
+#include <bezier_spline.h>
+#include <fill.h>
+#include <trace.h>
+
+
+/* Cursor used to decode a png kept in memory. */
+typedef struct
+{
+  const guchar *data;
+  gsize size;
+  gsize offset;
+} PngReader;
+
+
+/* A save-point file to be written, or removed if there is no png; no file stops the writer. */
+typedef struct
+{
+  gchar *filename;
+  GBytes *png;
+} SavepointFileCommand;
+
+
+/* Append the png data produced by cairo to the byte array. */
+static cairo_status_t
+png_write_to_byte_array      (void                *closure,
+                              const unsigned char *data,
+                              unsigned int         length)
+{
+  g_byte_array_append ((GByteArray *) closure, data, length);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+
+/* Feed cairo with the png data kept in memory. */
+static cairo_status_t
+png_read_from_bytes          (void          *closure,
+                              unsigned char *data,
+                              unsigned int   length)
+{
+  PngReader *reader = (PngReader *) closure;
+
+  if (reader->offset + length > reader->size)
+    {
+      return CAIRO_STATUS_READ_ERROR;
+    }
+
+  memcpy (data, reader->data + reader->offset, length);
+  reader->offset += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+
+/* Encode the surface as a png kept in memory. */
+GBytes *
+canvas_surface_to_png        (cairo_surface_t   *surface)
+{
+  GByteArray *png = g_byte_array_new ();
+  cairo_surface_write_to_png_stream (surface, png_write_to_byte_array, png);
+  return g_byte_array_free_to_bytes (png);
+}
+
+
+/* Decode the png kept in memory. */
+cairo_surface_t *
+canvas_png_to_surface        (GBytes            *png)
+{
+  PngReader reader;
+  reader.data = g_bytes_get_data (png, &reader.size);
+  reader.offset = 0;
+  return cairo_image_surface_create_from_png_stream (png_read_from_bytes, &reader);
+}
+
+
+/* Load the image of the save-point from memory, from its source or from its file. */
+static cairo_surface_t *
+savepoint_load_surface       (AnnotateSavepoint *savepoint)
+{
+  GBytes *png = canvas_savepoint_get_png (savepoint);
+
+  if (png)
+    {
+      cairo_surface_t *surface = canvas_png_to_surface (png);
+      g_bytes_unref (png);
+      return surface;
+    }
+
+  if (savepoint->filename)
+    {
+      return cairo_image_surface_create_from_png (savepoint->filename);
+    }
+
+  return (cairo_surface_t *) NULL;
+}
+
+
+/* Append the command with the point to the svg path data. */
+static void
+path_append_point            (GString     *path,
+                              const gchar *command,
+                              gdouble      x,
+                              gdouble      y)
+{
+  gchar x_buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar y_buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* The svg numbers use always the dot as decimal separator. */
+  g_string_append_printf (path,
+                          "%s%s %s ",
+                          command,
+                          g_ascii_formatd (x_buffer, sizeof (x_buffer), "%.2f", x),
+                          g_ascii_formatd (y_buffer, sizeof (y_buffer), "%.2f", y));
+}
+
+
+/* Record the line from (x1,y1) to (x2,y2) in the stroke path. */
+static void
+path_line                    (AnnotateCanvas *canvas,
+                              gdouble         x1,
+                              gdouble         y1,
+                              gdouble         x2,
+                              gdouble         y2)
+{
+  /* The freehand segments are joined when they are contiguous. */
+  if ((canvas->path->len == 0) || (canvas->path_x != x1) || (canvas->path_y != y1))
+    {
+      path_append_point (canvas->path, "M", x1, y1);
+    }
+
+  path_append_point (canvas->path, "L", x2, y2);
+  canvas->path_x = x2;
+  canvas->path_y = y2;
+}
+
+
+/* Record the line to (x,y) continuing the stroke path. */
+static void
+path_line_to                 (AnnotateCanvas *canvas,
+                              gdouble         x,
+                              gdouble         y)
+{
+  path_append_point (canvas->path, canvas->path->len == 0 ? "M" : "L", x, y);
+  canvas->path_x = x;
+  canvas->path_y = y;
+}
+
+
+/* Record the cubic bezier curve continuing the stroke path. */
+static void
+path_curve_to                (AnnotateCanvas *canvas,
+                              gdouble         x1,
+                              gdouble         y1,
+                              gdouble         x2,
+                              gdouble         y2,
+                              gdouble         x3,
+                              gdouble         y3)
+{
+  /* Like cairo the curve without a current point starts in (x1,y1). */
+  if (canvas->path->len == 0)
+    {
+      path_append_point (canvas->path, "M", x1, y1);
+    }
+
+  path_append_point (canvas->path, "C", x1, y1);
+  path_append_point (canvas->path, "", x2, y2);
+  path_append_point (canvas->path, "", x3, y3);
+  canvas->path_x = x3;
+  canvas->path_y = y3;
+}
+
+
+/* Forget the paths recorded since the last save-point. */
+static void
+path_reset                   (AnnotateCanvas *canvas)
+{
+  g_string_truncate (canvas->path, 0);
+  g_string_truncate (canvas->arrow_path, 0);
+}
+
+
+/* Build the cairo path from the svg path data; it stops at the first error. */
+void
+canvas_draw_path_data        (cairo_t      *cr,
+                              const gchar  *data)
+{
+  const gchar *cursor = data;
+  gchar command = 'M';
+
+  while (*cursor)
+    {
+      gdouble values[6];
+      gint count = 0;
+      gint i = 0;
+
+      while ((*cursor == ' ') || (*cursor == ','))
+        {
+          cursor++;
+        }
+
+      if (*cursor == '\0')
+        {
+          break;
+        }
+
+      if (g_ascii_isalpha (*cursor))
+        {
+          command = *cursor++;
+        }
+      else if ((command == 'Z') || (command == 'z'))
+        {
+          /* The close takes no numbers. */
+          return;
+        }
+
+      if ((command == 'Z') || (command == 'z'))
+        {
+          cairo_close_path (cr);
+          continue;
+        }
+
+      count = (command == 'C') ? 6 : 2;
+
+      for (i = 0; i < count; i++)
+        {
+          gchar *end = (gchar *) NULL;
+
+          while ((*cursor == ' ') || (*cursor == ','))
+            {
+              cursor++;
+            }
+
+          values[i] = g_ascii_strtod (cursor, &end);
+
+          if (end == cursor)
+            {
+              return;
+            }
+
+          cursor = end;
+        }
+
+      switch (command)
+        {
+        case 'M':
+          cairo_move_to (cr, values[0], values[1]);
+          /* The pairs following a move are lines. */
+          command = 'L';
+          break;
+        case 'L':
+          cairo_line_to (cr, values[0], values[1]);
+          break;
+        case 'C':
+          cairo_curve_to (cr, values[0], values[1], values[2], values[3], values[4], values[5]);
+          break;
+        default:
+          return;
+        }
+    }
+}
+
+
+/*
+ * Return the svg path data with the x coordinates multiplied by scale_x
+ * and the y ones by scale_y; the result must be freed.
+ */
+gchar *
+canvas_scale_path_data       (const gchar  *data,
+                              gdouble       scale_x,
+                              gdouble       scale_y)
+{
+  GString *scaled = g_string_new ("");
+  const gchar *cursor = data;
+  gint coordinate = 0;
+
+  while (*cursor)
+    {
+      gchar *end = (gchar *) NULL;
+      gdouble value = 0;
+      gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+      if ((*cursor == ' ') || (*cursor == ','))
+        {
+          cursor++;
+          continue;
+        }
+
+      /* All the commands take pairs of coordinates. */
+      if (g_ascii_isalpha (*cursor))
+        {
+          g_string_append_c (scaled, *cursor++);
+          coordinate = 0;
+          continue;
+        }
+
+      value = g_ascii_strtod (cursor, &end);
+
+      if (end == cursor)
+        {
+          break;
+        }
+
+      cursor = end;
+      value *= (coordinate % 2 == 0) ? scale_x : scale_y;
+      coordinate++;
+
+      g_string_append (scaled, g_ascii_formatd (buffer, sizeof (buffer), "%.2f", value));
+      g_string_append_c (scaled, ' ');
+    }
+
+  return g_string_free (scaled, FALSE);
+}
+
+
+/* Paint the paths of the save-point as the pen and the eraser do. */
+static void
+draw_savepoint_paths         (cairo_t           *cr,
+                              AnnotateSavepoint *savepoint)
+{
+  guint i = 0;
+
+  cairo_save (cr);
+
+  for (i = 0; i < savepoint->paths->len; i++)
+    {
+      AnnotatePath *path = (AnnotatePath *) g_ptr_array_index (savepoint->paths, i);
+
+      cairo_set_operator (cr, path->erase ? CAIRO_OPERATOR_CLEAR : CAIRO_OPERATOR_SOURCE);
+      cairo_new_path (cr);
+      canvas_draw_path_data (cr, path->data);
+      cairo_set_source_color_from_string (cr, path->color);
+      cairo_set_line_width (cr, path->width);
+
+      if (path->filled)
+        {
+          cairo_set_line_join (cr, CAIRO_LINE_JOIN_MITER);
+          cairo_fill_preserve (cr);
+        }
+      else
+        {
+          cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+          cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+        }
+
+      cairo_stroke (cr);
+    }
+
+  cairo_restore (cr);
+}
+
+
+/* Is the image of the save-point available without the previous ones? */
+static gboolean
+savepoint_has_image          (AnnotateSavepoint *savepoint)
+{
+  return ((savepoint->png) || (savepoint->load) || (savepoint->filename));
+}
+
+
+/*
+ * Load the image of the save-point in the list link; the save-points
+ * made only of paths are painted over the last previous image.
+ */
+cairo_surface_t *
+canvas_savepoint_render      (GSList         *link,
+                              gint            width,
+                              gint            height)
+{
+  GSList *chain = (GSList *) NULL;
+  GSList *list = (GSList *) NULL;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+
+  /* The list starts with the last save-point; the chain with the oldest one. */
+  for (list = link; list; list = list->next)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+
+      if ((savepoint_has_image (savepoint)) || (!savepoint->paths))
+        {
+          surface = savepoint_load_surface (savepoint);
+          break;
+        }
+
+      chain = g_slist_prepend (chain, savepoint);
+    }
+
+  if (!chain)
+    {
+      return surface;
+    }
+
+  if (!surface)
+    {
+      surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                            width,
+                                            height);
+    }
+
+  cr = cairo_create (surface);
+
+  for (list = chain; list; list = list->next)
+    {
+      draw_savepoint_paths (cr, (AnnotateSavepoint *) list->data);
+    }
+
+  cairo_destroy (cr);
+  g_slist_free (chain);
+
+  return surface;
+}
+
+
+/* Create a new paint context. */
+static AnnotatePaintContext *
+canvas_paint_context_new     (AnnotatePaintType type)
+{
+  AnnotatePaintContext *context = (AnnotatePaintContext *) NULL;
+  context = g_malloc ((gsize) sizeof (AnnotatePaintContext));
+  context->type = type;
+
+  return context;
+}
+
+
+/* Free the memory allocated by paint context */
+static void
+canvas_paint_context_free    (AnnotatePaintContext *context)
+{
+  if (context)
+    {
+      g_free (context);
+      context = (AnnotatePaintContext *) NULL;
+    }
+}
+
+
+/* Calculate the direction in radiant. */
+static gdouble
+canvas_get_arrow_direction   (AnnotateCanvas *canvas,
+                              GSList         *coord_list)
+{
+  /* Precondition: the list must be not null and the length might be greater than two. */
+  AnnotatePoint *point = (AnnotatePoint *) NULL;
+  AnnotatePoint *old_point = (AnnotatePoint *) NULL;
+  gdouble delta = 2.0;
+  gdouble ret = 0.0;
+  gdouble tollerance = canvas_get_thickness (canvas) * delta;
+
+  /* Build the relevant point list with the standard deviation algorithm. */
+  GSList *relevantpoint_list = build_meaningful_point_list (coord_list, FALSE, tollerance);
+
+  old_point = (AnnotatePoint *) g_slist_nth_data (relevantpoint_list, 1);
+  point = (AnnotatePoint *) g_slist_nth_data (relevantpoint_list, 0);
+  /* Give the direction using the last two point. */
+  ret = atan2 (point->y-old_point->y, point->x-old_point->x);
+
+  /* Free the relevant point list. */
+  g_slist_foreach (relevantpoint_list, (GFunc) g_free, (gpointer) NULL);
+  g_slist_free (relevantpoint_list);
+  relevantpoint_list = (GSList *) NULL;
+
+  return ret;
+}
+
+
+/* Colour selector; if eraser than select the transparent colour else allocate the right colour. */
+static void
+select_color                 (AnnotateCanvas *canvas)
+{
+  if (!canvas->cr)
+    {
+      return;
+    }
+
+  if (canvas->cur_context)
+    {
+      if (canvas->cur_context->type != ANNOTATE_ERASER) //pen or arrow tool
+        {
+          /* Select the colour. */
+          if (canvas->color)
+            {
+              TRACE_INSTANT ("select_color");
+              cairo_set_source_color_from_string (canvas->cr, canvas->color);
+            }
+
+          cairo_set_operator (canvas->cr, CAIRO_OPERATOR_SOURCE);
+        }
+      else
+        {
+
+          /* It is the eraser tool. */
+          TRACE_INSTANT ("select_eraser");
+
+          cairo_set_operator (canvas->cr, CAIRO_OPERATOR_CLEAR);
+        }
+    }
+}
+
+
+/* This an ellipse taking the top left edge coordinates
+ * and the width and the height of the bounded rectangle.
+ */
+static void
+canvas_draw_ellipse          (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         x,
+                              gdouble         y,
+                              gdouble         width,
+                              gdouble         height,
+                              gdouble         pressure)
+{
+  /* The ellipse is recorded as four bezier curves. */
+  gdouble kappa = 0.5522847498;
+  gdouble rx = width / 2.;
+  gdouble ry = height / 2.;
+  gdouble cx = x + rx;
+  gdouble cy = y + ry;
+
+  TRACE_INSTANT_ARGS ("draw_ellipse", "width", width, "height", height);
+
+  canvas_modify_color (canvas, coord_list, pressure);
+
+  path_append_point (canvas->path, "M", cx + rx, cy);
+  path_curve_to (canvas, cx + rx, cy + kappa * ry, cx + kappa * rx, cy + ry, cx, cy + ry);
+  path_curve_to (canvas, cx - kappa * rx, cy + ry, cx - rx, cy + kappa * ry, cx - rx, cy);
+  path_curve_to (canvas, cx - rx, cy - kappa * ry, cx - kappa * rx, cy - ry, cx, cy - ry);
+  path_curve_to (canvas, cx + kappa * rx, cy - ry, cx + rx, cy - kappa * ry, cx + rx, cy);
+  g_string_append (canvas->path, "Z ");
+
+  cairo_save (canvas->cr);
+
+  /* The ellipse is done as a 360 degree arc translated. */
+  cairo_translate (canvas->cr, x + width / 2., y + height / 2.);
+  cairo_scale (canvas->cr, width / 2., height / 2.);
+  cairo_arc (canvas->cr, 0., 0., 1., 0., 2 * M_PI);
+  cairo_restore (canvas->cr);
+
+}
+
+
+/* Draw a curve using a cubic bezier splines passing to the list's coordinate. */
+static void
+canvas_draw_curve            (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              GSList         *list)
+{
+  guint lenght = g_slist_length (list);
+
+  if (list)
+    {
+      guint i = 0;
+      for (i=0; i<lenght; i=i+3)
+        {
+          AnnotatePoint *first_point = (AnnotatePoint *) g_slist_nth_data (list, i);
+          if (!first_point)
+            {
+              return;
+            }
+          if (lenght == 1)
+            {
+              /* It is a point. */
+              canvas_draw_point (canvas, coord_list, first_point->x, first_point->y, first_point->pressure);
+            }
+          else
+            {
+              AnnotatePoint *second_point = (AnnotatePoint *) g_slist_nth_data (list, i+1);
+              if (!second_point)
+                {
+                  return;
+                }
+              else
+                {
+                  AnnotatePoint *third_point = (AnnotatePoint *) g_slist_nth_data (list, i+2);
+                  if (!third_point)
+                    {
+                      /* draw line from first to second point */
+                      canvas_draw_line (canvas, coord_list, second_point->x, second_point->y, FALSE);
+                      return;
+                    }
+                  canvas_modify_color (canvas, coord_list, second_point->pressure);
+                  path_curve_to (canvas,
+                                 first_point->x,
+                                 first_point->y,
+                                 second_point->x,
+                                 second_point->y,
+                                 third_point->x,
+                                 third_point->y);
+                  cairo_curve_to (canvas->cr,
+                                  first_point->x,
+                                  first_point->y,
+                                  second_point->x,
+                                  second_point->y,
+                                  third_point->x,
+                                  third_point->y);
+                }
+            }
+        }
+    }
+}
+
+
+/* Rectify the line. */
+static void
+rectify                      (AnnotateCanvas *canvas,
+                              GSList        **coord_list,
+                              gboolean        closed_path)
+{
+  gdouble tollerance = canvas_get_thickness (canvas);
+  GSList *broken_list = (GSList *) NULL;
+
+  TRACE_BEGIN ("rectify");
+
+  broken_list = broken (*coord_list, closed_path, TRUE, tollerance);
+
+  /* Restore the surface without the last path handwritten. */
+  canvas_restore_surface (canvas);
+
+  canvas_draw_point_list (canvas, *coord_list, broken_list);
+
+  canvas_coord_list_free (*coord_list);
+  *coord_list = broken_list;
+
+  TRACE_END ("rectify");
+}
+
+
+/* Roundify the line. */
+static void
+roundify                     (AnnotateCanvas *canvas,
+                              GSList        **coord_list,
+                              gboolean        closed_path)
+{
+  gdouble tollerance = canvas_get_thickness (canvas);
+
+  /* Build the meaningful point list with the standard deviation algorithm. */
+  GSList *meaningful_point_list = (GSList *) NULL;
+
+  /* Restore the surface without the last path handwritten. */
+  canvas_restore_surface (canvas);
+
+  meaningful_point_list = build_meaningful_point_list (*coord_list, closed_path, tollerance);
+
+  if ( g_slist_length (meaningful_point_list) < 4)
+    {
+      /* Draw the point line as is and jump the bezier algorithm. */
+      canvas_draw_point_list (canvas, *coord_list, meaningful_point_list);
+    }
+  else if ((closed_path) && (is_similar_to_an_ellipse (meaningful_point_list, tollerance)))
+    {
+      GSList *rect_list = build_outbounded_rectangle (meaningful_point_list);
+
+      if (rect_list)
+        {
+          AnnotatePoint *point1 = (AnnotatePoint *) g_slist_nth_data (rect_list, 0);
+          AnnotatePoint *point2 = (AnnotatePoint *) g_slist_nth_data (rect_list, 1);
+          AnnotatePoint *point3 = (AnnotatePoint *) g_slist_nth_data (rect_list, 2);
+          gdouble p1p2 = get_distance(point1->x, point1->y, point2->x, point2->y);
+          gdouble p2p3 = get_distance(point2->x, point2->y, point3->x, point3->y);
+          gdouble e_threshold = 0.5;
+          gdouble a = 0;
+          gdouble b = 0;
+          if (p1p2>p2p3)
+            {
+              b = p2p3/2;
+              a = p1p2/2;
+            }
+          else
+            {
+              a = p2p3/2;
+              b = p1p2/2;
+            }
+          gdouble e = 1-powf((b/a), 2);
+          /* If the eccentricity is roundable to 0 it is a circle */
+          if ((e >= 0) && (e <= e_threshold))
+            {
+              /* Move the down right point in the right position to square the circle */
+              gdouble quad_distance = (p1p2+p2p3)/2;
+              point3->x = point1->x+quad_distance;
+              point3->y = point1->y+quad_distance;
+            }
+
+          canvas_draw_ellipse (canvas, *coord_list, point1->x, point1->y, point3->x-point1->x, point3->y-point1->y, point1->pressure);
+          g_slist_foreach (rect_list, (GFunc)g_free, NULL);
+          g_slist_free (rect_list);
+        }
+    }
+
+  else
+    {
+      /* It is not an ellipse; I use bezier to spline the path. */
+      GSList *splined_list = spline (meaningful_point_list);
+      canvas_draw_curve (canvas, *coord_list, splined_list);
+
+      canvas_coord_list_free (*coord_list);
+      *coord_list = splined_list;
+
+    }
+
+  g_slist_foreach (meaningful_point_list, (GFunc) g_free, (gpointer) NULL);
+  g_slist_free (meaningful_point_list);
+}
+
+
+/*
+ * Get the stored png identical to the new one, if any, else store it;
+ * the new reference is taken and the shared one is returned.
+ */
+static GBytes *
+share_png                    (AnnotateCanvas *canvas,
+                              GBytes         *png)
+{
+  gpointer shared = (gpointer) NULL;
+  gpointer count = (gpointer) NULL;
+
+  if (g_hash_table_lookup_extended (canvas->png_table, png, &shared, &count))
+    {
+      TRACE_INSTANT ("savepoint_shared");
+
+      g_bytes_unref (png);
+
+      /* The key is kept and the passed reference is released. */
+      g_hash_table_insert (canvas->png_table,
+                           g_bytes_ref ((GBytes *) shared),
+                           GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+
+      return g_bytes_ref ((GBytes *) shared);
+    }
+
+  g_hash_table_insert (canvas->png_table, g_bytes_ref (png), GUINT_TO_POINTER (1));
+  canvas->png_bytes += g_bytes_get_size (png);
+  return png;
+}
+
+
+/* Number of save-points sharing the png of the save-point; 0 if it is not stored. */
+static guint
+savepoint_png_count          (AnnotateCanvas    *canvas,
+                              AnnotateSavepoint *savepoint)
+{
+  gpointer shared = (gpointer) NULL;
+  gpointer count = (gpointer) NULL;
+
+  if ((savepoint->png) &&
+      (g_hash_table_lookup_extended (canvas->png_table, savepoint->png, &shared, &count)) &&
+      (shared == savepoint->png))
+    {
+      return GPOINTER_TO_UINT (count);
+    }
+
+  return 0;
+}
+
+
+/* Release the png of the save-point stored in the canvas. */
+static void
+release_png                  (AnnotateCanvas    *canvas,
+                              AnnotateSavepoint *savepoint)
+{
+  guint count = savepoint_png_count (canvas, savepoint);
+
+  if (count == 1)
+    {
+      canvas->png_bytes -= g_bytes_get_size (savepoint->png);
+      g_hash_table_remove (canvas->png_table, savepoint->png);
+    }
+  else if (count > 1)
+    {
+      g_hash_table_insert (canvas->png_table,
+                           g_bytes_ref (savepoint->png),
+                           GUINT_TO_POINTER (count - 1));
+    }
+}
+
+
+/* Write and remove the save-point files in the order they are queued. */
+static gpointer
+savepoint_file_writer        (AnnotateCanvas *canvas)
+{
+  while (TRUE)
+    {
+      SavepointFileCommand *command = g_async_queue_pop (canvas->file_queue);
+
+      if (!command->filename)
+        {
+          g_free (command);
+          break;
+        }
+
+      if (command->png)
+        {
+          TRACE_BEGIN ("savepoint_write");
+
+          if (!g_file_set_contents (command->filename,
+                                    g_bytes_get_data (command->png, NULL),
+                                    g_bytes_get_size (command->png),
+                                    NULL))
+            {
+              g_warning ("Unable to write the save-point %s", command->filename);
+            }
+
+          TRACE_END ("savepoint_write");
+
+          g_bytes_unref (command->png);
+          g_atomic_int_add (&canvas->pending_files, -1);
+        }
+      else
+        {
+          g_remove (command->filename);
+        }
+
+      g_free (command->filename);
+      g_free (command);
+    }
+
+  return NULL;
+}
+
+
+/*
+ * Queue the save-point file to the writer thread, that is started on
+ * the first use; the file is removed if there is no png.
+ */
+static void
+push_savepoint_file          (AnnotateCanvas *canvas,
+                              const gchar    *filename,
+                              GBytes         *png)
+{
+  SavepointFileCommand *command = g_malloc ((gsize) sizeof (SavepointFileCommand));
+
+  if (!canvas->file_writer)
+    {
+      canvas->file_queue = g_async_queue_new ();
+      canvas->file_writer = g_thread_new ("savepoint-writer",
+                                          (GThreadFunc) savepoint_file_writer,
+                                          canvas);
+    }
+
+  command->filename = g_strdup (filename);
+  command->png = png ? g_bytes_ref (png) : (GBytes *) NULL;
+
+  if (png)
+    {
+      g_atomic_int_inc (&canvas->pending_files);
+    }
+
+  g_async_queue_push (canvas->file_queue, command);
+}
+
+
+/*
+ * Drop the png of the oldest save-points past CANVAS_PNG_BUDGET; they
+ * are read again from their files. Only the images not shared are
+ * dropped, and only when all the files have been written.
+ */
+static void
+drop_old_pngs                (AnnotateCanvas *canvas)
+{
+  GSList *list = (GSList *) NULL;
+  gsize kept = 0;
+  guint dropped = 0;
+
+  if ((canvas->png_bytes <= CANVAS_PNG_BUDGET) ||
+      (g_atomic_int_get (&canvas->pending_files) > 0))
+    {
+      return;
+    }
+
+  /* The list starts with the last save-point. */
+  for (list = canvas->savepoint_list; list; list = list->next)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+      gsize size = 0;
+
+      if (!savepoint->png)
+        {
+          continue;
+        }
+
+      size = g_bytes_get_size (savepoint->png);
+
+      if ((kept + size <= CANVAS_PNG_BUDGET) ||
+          (!savepoint->filename) ||
+          (savepoint_png_count (canvas, savepoint) != 1))
+        {
+          kept += size;
+          continue;
+        }
+
+      release_png (canvas, savepoint);
+      g_bytes_unref (savepoint->png);
+      savepoint->png = (GBytes *) NULL;
+      dropped++;
+    }
+
+  TRACE_COUNTER ("savepoints_dropped", dropped);
+}
+
+
+/* Make the paths of a save-point with the stroke recorded since the last one. */
+static GPtrArray *
+take_paths                   (AnnotateCanvas *canvas)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func ((GDestroyNotify) canvas_path_free);
+
+  if (canvas->path->len > 0)
+    {
+      AnnotatePath *path = canvas_path_new (canvas->path->str,
+                                            canvas->color,
+                                            canvas_get_thickness (canvas),
+                                            FALSE);
+
+      path->erase = (canvas->cur_context->type == ANNOTATE_ERASER);
+      g_ptr_array_add (paths, path);
+    }
+
+  if (canvas->arrow_path->len > 0)
+    {
+      g_ptr_array_add (paths,
+                       canvas_path_new (canvas->arrow_path->str,
+                                        canvas->color,
+                                        canvas_get_thickness (canvas),
+                                        TRUE));
+    }
+
+  return paths;
+}
+
+
+/* Delete the save-point. */
+static void
+delete_savepoint             (AnnotateSavepoint *savepoint,
+                              AnnotateCanvas    *canvas)
+{
+  if (savepoint)
+    {
+
+      TRACE_INSTANT ("delete_savepoint");
+
+      /* The file of a dropped png can still be read by a copy. */
+      if ((savepoint->filename) && (savepoint->png))
+        {
+          push_savepoint_file (canvas, savepoint->filename, (GBytes *) NULL);
+        }
+
+      release_png (canvas, savepoint);
+      canvas->savepoint_list = g_slist_remove (canvas->savepoint_list, savepoint);
+      canvas_savepoint_free (savepoint);
+      savepoint = (AnnotateSavepoint *) NULL;
+    }
+}
+
+
+/* Free the list of the  save-point for the redo. */
+static void
+canvas_redolist_free         (AnnotateCanvas *canvas)
+{
+  guint i = canvas->current_save_index;
+  GSList *stop_list = g_slist_nth (canvas->savepoint_list, i);
+
+  while (canvas->savepoint_list != stop_list)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) g_slist_nth_data (canvas->savepoint_list, 0);
+      delete_savepoint (savepoint, canvas);
+    }
+}
+
+
+/* Draw an arrow starting from the point
+ * whith the width and the direction in radiant
+ */
+static void
+draw_arrow_in_point          (AnnotateCanvas *canvas,
+                              AnnotatePoint  *point,
+                              gdouble         width,
+                              gdouble         direction)
+{
+
+  gdouble width_cos = width * cos (direction);
+  gdouble width_sin = width * sin (direction);
+
+  /* Vertex of the arrow. */
+  gdouble arrow_head_0_x = point->x + width_cos;
+  gdouble arrow_head_0_y = point->y + width_sin;
+
+  /* Left point. */
+  gdouble arrow_head_1_x = point->x - width_cos + width_sin;
+  gdouble arrow_head_1_y = point->y -  width_cos - width_sin;
+
+  /* Origin. */
+  gdouble arrow_head_2_x = point->x - 0.8 * width_cos;
+  gdouble arrow_head_2_y = point->y - 0.8 * width_sin;
+
+  /* Right point. */
+  gdouble arrow_head_3_x = point->x - width_cos - width_sin;
+  gdouble arrow_head_3_y = point->y +  width_cos - width_sin;
+
+  canvas_damage_path (canvas);
+  cairo_stroke (canvas->cr);
+  cairo_save (canvas->cr);
+
+  /* Initialize cairo properties. */
+  cairo_set_line_join (canvas->cr, CAIRO_LINE_JOIN_MITER);
+  cairo_set_operator (canvas->cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_line_width (canvas->cr, width);
+
+  /* Draw the arrow. */
+  cairo_move_to (canvas->cr, arrow_head_2_x, arrow_head_2_y);
+  cairo_line_to (canvas->cr, arrow_head_1_x, arrow_head_1_y);
+  cairo_line_to (canvas->cr, arrow_head_0_x, arrow_head_0_y);
+  cairo_line_to (canvas->cr, arrow_head_3_x, arrow_head_3_y);
+
+  cairo_close_path (canvas->cr);
+  canvas_damage_path (canvas);
+  cairo_fill_preserve (canvas->cr);
+  cairo_stroke (canvas->cr);
+  cairo_restore (canvas->cr);
+
+  g_string_truncate (canvas->arrow_path, 0);
+  path_append_point (canvas->arrow_path, "M", arrow_head_2_x, arrow_head_2_y);
+  path_append_point (canvas->arrow_path, "L", arrow_head_1_x, arrow_head_1_y);
+  path_append_point (canvas->arrow_path, "L", arrow_head_0_x, arrow_head_0_y);
+  path_append_point (canvas->arrow_path, "L", arrow_head_3_x, arrow_head_3_y);
+  g_string_append (canvas->arrow_path, "Z");
+
+  TRACE_INSTANT_ARGS ("draw_arrow", "x", arrow_head_0_x, "y", arrow_head_0_y);
+}
+
+
+/** Get the distance between two points. */
+gdouble
+get_distance       (gdouble x1,
+                    gdouble y1,
+                    gdouble x2,
+                    gdouble y2)
+{
+  /* Apply the Pitagora theorem to calculate the distance. */
+  gdouble x_delta = fabs (x2-x1);
+  gdouble y_delta = fabs (y2-y1);
+  gdouble quad_sum = pow (x_delta, 2);
+  quad_sum = quad_sum + pow (y_delta, 2);
+  return sqrt (quad_sum);
+}
+
+
+/* Clear cairo context. */
+void
+clear_cairo_context     (cairo_t  *cr)
+{
+  if (cr)
+    {
+      cairo_save (cr);
+      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+      cairo_paint (cr);
+      cairo_restore (cr);
+    }
+}
+
+
+/* Set the cairo surface colour to the RGBA string. */
+void
+cairo_set_source_color_from_string     (cairo_t  *cr,
+                                        gchar    *color)
+{
+  if (cr)
+    {
+      guint r,g,b,a;
+      sscanf (color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+
+      cairo_set_source_rgba (cr,
+                             1.0 * r / 255,
+                             1.0 * g / 255,
+                             1.0 * b / 255,
+                             1.0 * a / 255);
+
+    }
+}
+
+
+/* Allocate a new point belonging to the stroke passing the values. */
+AnnotatePoint *
+allocate_point     (gdouble  x,
+                    gdouble  y,
+                    gdouble  width,
+                    gdouble  pressure)
+{
+  AnnotatePoint *point =  g_malloc ( (gsize) sizeof (AnnotatePoint));
+  point->x = x;
+  point->y = y;
+  point->width = width;
+  point->pressure = pressure;
+  return point;
+}
+
+
+/* Allocate a path with the svg data painted with colour and width. */
+AnnotatePath *
+canvas_path_new              (const gchar       *data,
+                              const gchar       *color,
+                              gdouble            width,
+                              gboolean           filled)
+{
+  AnnotatePath *path = g_malloc ((gsize) sizeof (AnnotatePath));
+  path->data = g_strdup (data);
+  path->color = g_strdup (color);
+  path->width = width;
+  path->filled = filled;
+  path->erase = FALSE;
+  return path;
+}
+
+
+/* Free the path. */
+void
+canvas_path_free             (AnnotatePath      *path)
+{
+  g_free (path->data);
+  g_free (path->color);
+  g_free (path);
+}
+
+
+/*
+ * Allocate a save-point made of a png, kept in memory and/or in the file;
+ * the paths of a vector save-point are set by the caller.
+ */
+AnnotateSavepoint *
+canvas_savepoint_new         (const gchar       *filename,
+                              GBytes            *png)
+{
+  AnnotateSavepoint *savepoint = g_malloc ((gsize) sizeof (AnnotateSavepoint));
+  savepoint->filename = g_strdup (filename);
+  savepoint->png = png ? g_bytes_ref (png) : (GBytes *) NULL;
+  savepoint->source = (gchar *) NULL;
+  savepoint->load = NULL;
+  savepoint->paths = (GPtrArray *) NULL;
+  return savepoint;
+}
+
+
+/*
+ * Copy the save-point sharing its png, paths and file; the file of a
+ * save-point whose png has been dropped is kept until the exit, then
+ * the copy stays valid when the original is deleted.
+ */
+AnnotateSavepoint *
+canvas_savepoint_copy        (AnnotateSavepoint *savepoint)
+{
+  AnnotateSavepoint *copy = canvas_savepoint_new (savepoint->filename, savepoint->png);
+  copy->source = g_strdup (savepoint->source);
+  copy->load = savepoint->load;
+  copy->paths = savepoint->paths ? g_ptr_array_ref (savepoint->paths) : (GPtrArray *) NULL;
+  return copy;
+}
+
+
+/* Free the save-point without removing its file. */
+void
+canvas_savepoint_free        (AnnotateSavepoint *savepoint)
+{
+  if (savepoint->png)
+    {
+      g_bytes_unref (savepoint->png);
+    }
+
+  if (savepoint->paths)
+    {
+      g_ptr_array_unref (savepoint->paths);
+    }
+
+  g_free (savepoint->filename);
+  g_free (savepoint->source);
+  g_free (savepoint);
+}
+
+
+/*
+ * Get the png of the save-point loading it on demand from its source
+ * or its file if needed; the returned reference must be released.
+ */
+GBytes *
+canvas_savepoint_get_png     (AnnotateSavepoint *savepoint)
+{
+  if (savepoint->png)
+    {
+      return g_bytes_ref (savepoint->png);
+    }
+
+  if (savepoint->load)
+    {
+      return savepoint->load (savepoint);
+    }
+
+  if (savepoint->filename)
+    {
+      gchar *contents = (gchar *) NULL;
+      gsize length = 0;
+
+      if (g_file_get_contents (savepoint->filename, &contents, &length, NULL))
+        {
+          return g_bytes_new_take (contents, length);
+        }
+    }
+
+  return (GBytes *) NULL;
+}
+
+
+/*
+ * Does the save-point made of paths clear part of the previous ones?
+ * Its paths can not be exported as vectors then.
+ */
+gboolean
+canvas_savepoint_erases      (AnnotateSavepoint *savepoint)
+{
+  guint i = 0;
+
+  if (!savepoint->paths)
+    {
+      return FALSE;
+    }
+
+  for (i = 0; i < savepoint->paths->len; i++)
+    {
+      if (((AnnotatePath *) g_ptr_array_index (savepoint->paths, i))->erase)
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* Create a new canvas. */
+AnnotateCanvas *
+canvas_new                   (gint            width,
+                              gint            height,
+                              const gchar    *savepoint_dir)
+{
+  AnnotateCanvas *canvas = g_malloc ((gsize) sizeof (AnnotateCanvas));
+
+  canvas->cr = (cairo_t *) NULL;
+  canvas->width = width;
+  canvas->height = height;
+  canvas->savepoint_dir = g_strdup (savepoint_dir);
+  canvas->savepoint_list = (GSList *) NULL;
+  canvas->current_save_index = 0;
+  canvas->thickness = 0;
+  canvas->rectify = FALSE;
+  canvas->roundify = FALSE;
+  canvas->arrow = FALSE;
+  canvas->color = g_strdup ("FF0000FF");
+  canvas->path = g_string_new ("");
+  canvas->path_x = 0;
+  canvas->path_y = 0;
+  canvas->arrow_path = g_string_new ("");
+  canvas->png_table = g_hash_table_new_full ((GHashFunc) g_bytes_hash,
+                                             (GEqualFunc) g_bytes_equal,
+                                             (GDestroyNotify) g_bytes_unref,
+                                             NULL);
+  canvas->png_bytes = 0;
+  canvas->savepoint_serial = 0;
+  canvas->file_queue = (GAsyncQueue *) NULL;
+  canvas->file_writer = (GThread *) NULL;
+  canvas->pending_files = 0;
+  canvas->damage = (cairo_region_t *) NULL;
+  canvas->damage_func = (AnnotateDamageFunc) NULL;
+  canvas->damage_data = NULL;
+
+  /* Initialize the pen context. */
+  canvas->default_pen = canvas_paint_context_new (ANNOTATE_PEN);
+  canvas->default_eraser = canvas_paint_context_new (ANNOTATE_ERASER);
+  canvas->default_filler = canvas_paint_context_new (ANNOTATE_FILLER);
+  canvas->cur_context = canvas->default_pen;
+
+  return canvas;
+}
+
+
+/* Attach the cairo context where the canvas paints. */
+void
+canvas_set_cairo_context     (AnnotateCanvas *canvas,
+                              cairo_t        *cr)
+{
+  canvas->cr = cr;
+}
+
+
+/*
+ * Wait the save-point files queued to the writer thread, the removals
+ * included; the writer is started again on the next use.
+ */
+void
+canvas_wait_files            (AnnotateCanvas *canvas)
+{
+  if (canvas->file_writer)
+    {
+      push_savepoint_file (canvas, (gchar *) NULL, (GBytes *) NULL);
+      g_thread_join (canvas->file_writer);
+      g_async_queue_unref (canvas->file_queue);
+      canvas->file_writer = (GThread *) NULL;
+      canvas->file_queue = (GAsyncQueue *) NULL;
+    }
+}
+
+
+/* Free the canvas deleting all the save-points. */
+void
+canvas_free                  (AnnotateCanvas *canvas)
+{
+  if (!canvas)
+    {
+      return;
+    }
+
+  canvas_clear_history (canvas);
+
+  /* Wait the files queued, the removals of the history included. */
+  canvas_wait_files (canvas);
+
+  if (canvas->color)
+    {
+      g_free (canvas->color);
+      canvas->color = (gchar *) NULL;
+    }
+
+  if (canvas->savepoint_dir)
+    {
+      g_free (canvas->savepoint_dir);
+      canvas->savepoint_dir = (gchar *) NULL;
+    }
+
+  g_string_free (canvas->path, TRUE);
+  g_string_free (canvas->arrow_path, TRUE);
+  g_hash_table_destroy (canvas->png_table);
+  canvas_track_damage (canvas, FALSE);
+
+  canvas_paint_context_free (canvas->default_pen);
+  canvas_paint_context_free (canvas->default_eraser);
+  canvas_paint_context_free (canvas->default_filler);
+
+  g_free (canvas);
+}
+
+
+/* Get the line thickness of the current tool. */
+gdouble
+canvas_get_thickness         (AnnotateCanvas *canvas)
+{
+  if (canvas->cur_context->type == ANNOTATE_ERASER)
+    {
+      /* the eraser is bigger than pen */
+      gdouble corrective_factor = 2.5;
+      return canvas->thickness * corrective_factor;
+    }
+
+  return canvas->thickness;
+}
+
+
+/* Configure pen option for cairo context. */
+void
+canvas_configure_pen_options (AnnotateCanvas *canvas)
+{
+
+  if (canvas->cr)
+    {
+      cairo_new_path (canvas->cr);
+      cairo_set_line_cap (canvas->cr, CAIRO_LINE_CAP_ROUND);
+      cairo_set_line_join (canvas->cr, CAIRO_LINE_JOIN_ROUND);
+
+      if (canvas->cur_context->type == ANNOTATE_ERASER)
+        {
+          canvas->cur_context = canvas->default_eraser;
+          cairo_set_operator (canvas->cr, CAIRO_OPERATOR_CLEAR);
+          cairo_set_line_width (canvas->cr, canvas_get_thickness (canvas));
+        }
+      else
+        {
+          cairo_set_operator (canvas->cr, CAIRO_OPERATOR_SOURCE);
+          cairo_set_line_width (canvas->cr, canvas_get_thickness (canvas));
+        }
+    }
+    select_color (canvas);
+}
+
+
+/* Modify colour according to the pressure. */
+void
+canvas_modify_color          (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         pressure)
+{
+  /* Pressure value is from 0 to 1;this value modify the RGBA gradient. */
+  guint r,g,b,a;
+  gdouble old_pressure = pressure;
+
+  /* If you put an higher value you will have more contrast
+   * between the lighter and darker colour depending on pressure.
+   */
+  gdouble contrast = 96;
+  gdouble corrective = 0;
+
+  /* The pressure is greater than 0. */
+  if ( (!canvas->cr) || (!canvas->color))
+    {
+      return;
+    }
+
+  if (pressure >= 1)
+    {
+      cairo_set_source_color_from_string (canvas->cr, canvas->color);
+    }
+  else if (pressure <= 0.1)
+    {
+      pressure = 0.1;
+    }
+
+  sscanf (canvas->color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+
+  if (coord_list != NULL)
+    {
+      AnnotatePoint *last_point = (AnnotatePoint *) coord_list->data;
+      old_pressure = last_point->pressure;
+    }
+
+  corrective = (1- ( 3 * pressure + old_pressure)/4) * contrast;
+  cairo_set_source_rgba (canvas->cr,
+                         (r + corrective)/255,
+                         (g + corrective)/255,
+                         (b + corrective)/255,
+                         (gdouble) a/255);
+}
+
+
+/* Add to the list of the painted point the point (x,y). */
+GSList *
+canvas_coord_list_prepend    (GSList         *coord_list,
+                              gdouble         x,
+                              gdouble         y,
+                              gdouble         width,
+                              gdouble         pressure)
+{
+  return g_slist_prepend (coord_list, allocate_point (x, y, width, pressure));
+}
+
+
+/* Free the coordinate list. */
+void
+canvas_coord_list_free       (GSList         *coord_list)
+{
+  g_slist_foreach (coord_list, (GFunc) g_free, (gpointer) NULL);
+  g_slist_free (coord_list);
+}
+
+
+/* Draw line from the last point drawn to (x2,y2);
+ * if stroke is false the cairo path is not forgotten
+ */
+void
+canvas_draw_line             (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         x2,
+                              gdouble         y2,
+                              gboolean        stroke)
+{
+  if (!stroke)
+    {
+      path_line_to (canvas, x2, y2);
+      cairo_line_to (canvas->cr, x2, y2);
+    }
+  else
+    {
+      AnnotatePoint *last_point = (AnnotatePoint *) g_slist_nth_data (coord_list, 0);
+      if (last_point)
+        {
+          path_line (canvas, last_point->x, last_point->y, x2, y2);
+          cairo_move_to (canvas->cr, last_point->x, last_point->y);
+        }
+      else
+        {
+          path_line (canvas, x2, y2, x2, y2);
+          cairo_move_to (canvas->cr, x2, y2);
+        }
+      cairo_line_to (canvas->cr, x2, y2);
+      canvas_damage_path (canvas);
+      cairo_stroke (canvas->cr);
+    }
+}
+
+
+/* Draw a point in x,y respecting the context. */
+void
+canvas_draw_point            (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         x,
+                              gdouble         y,
+                              gdouble         pressure)
+{
+  /* A point without previous coordinates starts a new stroke. */
+  if (!coord_list)
+    {
+      path_reset (canvas);
+    }
+
+  path_line (canvas, x, y, x, y);
+
+  /* Modify a little bit the colour depending on pressure. */
+  canvas_modify_color (canvas, coord_list, pressure);
+  cairo_move_to (canvas->cr, x, y);
+  cairo_line_to (canvas->cr, x, y);
+}
+
+
+/* Draw the point list. */
+void
+canvas_draw_point_list       (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              GSList         *list)
+{
+  if (list)
+    {
+      guint i = 0;
+      guint lenght = g_slist_length (list);
+      for (i=0; i<lenght; i=i+1)
+        {
+          AnnotatePoint *point = (AnnotatePoint *) g_slist_nth_data (list, i);
+          if (!point)
+            {
+              return;
+            }
+
+          if (lenght == 1)
+            {
+              /* It is a point. */
+              canvas_draw_point (canvas, coord_list, point->x, point->y, point->pressure);
+              break;
+            }
+          canvas_modify_color (canvas, coord_list, point->pressure);
+          /* Draw line between the two points. */
+          canvas_draw_line (canvas, coord_list, point->x, point->y, FALSE);
+        }
+    }
+}
+
+
+/* Draw an arrow using some polygons. */
+void
+canvas_draw_arrow            (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         distance)
+{
+  gdouble direction = 0;
+  gdouble pen_width = canvas_get_thickness (canvas);
+  gdouble arrow_minimum_size = pen_width * 2;
+
+  AnnotatePoint *point = (AnnotatePoint *) g_slist_nth_data (coord_list, 0);
+
+  if (distance < arrow_minimum_size)
+    {
+      return;
+    }
+
+  if (g_slist_length (coord_list) < 2)
+    {
+      /* If it has length lesser then two then is a point and it has no sense draw the arrow. */
+      return;
+    }
+
+  /* Postcondition length >= 2 */
+  direction = canvas_get_arrow_direction (canvas, coord_list);
+
+  draw_arrow_in_point (canvas, point, pen_width, direction);
+}
+
+
+/*
+ * Paint the svg path data with the current tool as it would have been
+ * painted by hand; the filled paths are arrow heads.
+ */
+void
+canvas_paint_path            (AnnotateCanvas *canvas,
+                              const gchar    *data,
+                              gboolean        filled)
+{
+  GString *path = filled ? canvas->arrow_path : canvas->path;
+
+  if (path->len > 0)
+    {
+      g_string_append_c (path, ' ');
+    }
+
+  g_string_append (path, data);
+
+  canvas_configure_pen_options (canvas);
+  canvas_draw_path_data (canvas->cr, data);
+  canvas_damage_path (canvas);
+
+  if (filled)
+    {
+      cairo_set_line_join (canvas->cr, CAIRO_LINE_JOIN_MITER);
+      cairo_fill_preserve (canvas->cr);
+    }
+
+  cairo_stroke (canvas->cr);
+}
+
+
+/* Call the geometric shape recognizer. */
+void
+canvas_shape_recognize       (AnnotateCanvas *canvas,
+                              GSList        **coord_list,
+                              gboolean        closed_path)
+{
+  if (canvas->rectify)
+    {
+      rectify (canvas, coord_list, closed_path);
+    }
+  else if (canvas->roundify)
+    {
+      roundify (canvas, coord_list, closed_path);
+    }
+}
+
+
+/* Fill the contiguos area around point with coordinates (x,y). */
+void
+canvas_fill                  (AnnotateCanvas *canvas,
+                              gdouble         x,
+                              gdouble         y)
+{
+  cairo_surface_t *image_surface = (cairo_surface_t *) NULL;
+  cairo_surface_t *source_surface = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+
+  TRACE_BEGIN ("fill");
+
+  image_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                              canvas->width,
+                                              canvas->height);
+
+  source_surface = cairo_get_target (canvas->cr);
+  cr = cairo_create (image_surface);
+  cairo_set_source_surface (cr, source_surface, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  select_color (canvas);
+
+  flood_fill (canvas->cr,
+              image_surface,
+              canvas->color,
+              x,
+              y);
+
+  canvas_damage_all (canvas);
+
+  canvas_add_savepoint (canvas);
+  cairo_surface_destroy (image_surface);
+
+  TRACE_END ("fill");
+}
+
+
+/* Paint the context over the canvas. */
+void
+canvas_push_context          (AnnotateCanvas *canvas,
+                              cairo_t        *cr)
+{
+  cairo_surface_t* source_surface = (cairo_surface_t *) NULL;
+
+  cairo_new_path (canvas->cr);
+  source_surface = cairo_get_target (cr);
+
+#ifndef _WIN32
+  /*
+   * The over operator might put the new layer on the top of the old one
+   * overriding the intersections
+   * Seems that this operator does not work on windows
+   * in this operating system only the new layer remain after the merge.
+   *
+   */
+  cairo_set_operator (canvas->cr, CAIRO_OPERATOR_OVER);
+#else
+  /*
+   * @WORKAROUND using CAIRO_OPERATOR_ADD instead of CAIRO_OPERATOR_OVER
+   * I do this to use the text widget in windows
+   * I use the CAIRO_OPERATOR_ADD that put the new layer
+   * on the top of the old;this function does not preserve the colour of
+   * the second layer but modify it respecting the first layer.
+   *
+   * Seems that the CAIRO_OPERATOR_OVER does not work because in the
+   * gtk cairo implementation the ARGB32 format is not supported.
+   *
+   */
+  cairo_set_operator (canvas->cr, CAIRO_OPERATOR_ADD);
+#endif
+
+  cairo_set_source_surface (canvas->cr, source_surface, 0, 0);
+  cairo_paint (canvas->cr);
+  cairo_stroke (canvas->cr);
+  canvas_damage_all (canvas);
+  canvas_add_savepoint (canvas);
+}
+
+
+/*
+ * Add a save point made only of the paths recorded since the last one;
+ * no image is made and it will be rebuilt painting the paths over the
+ * previous save-point when it is restored.
+ */
+void
+canvas_add_vector_savepoint  (AnnotateCanvas *canvas)
+{
+  AnnotateSavepoint *savepoint = (AnnotateSavepoint *) NULL;
+
+  TRACE_BEGIN ("vector_savepoint");
+
+  /* The story about the future is deleted. */
+  canvas_redolist_free (canvas);
+
+  savepoint = canvas_savepoint_new ((gchar *) NULL, (GBytes *) NULL);
+  savepoint->paths = take_paths (canvas);
+  path_reset (canvas);
+
+  canvas->savepoint_list = g_slist_prepend (canvas->savepoint_list, savepoint);
+  canvas->current_save_index = 0;
+
+  TRACE_END ("vector_savepoint");
+}
+
+
+/*
+ * Add a save point for the undo/redo;
+ * this code must be called at the end of each painting action.
+ */
+void
+canvas_add_savepoint         (AnnotateCanvas *canvas)
+{
+  AnnotateSavepoint *savepoint = (AnnotateSavepoint *) NULL;
+  cairo_surface_t *saved_surface = (cairo_surface_t *) NULL;
+  cairo_surface_t *source_surface = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+  guint savepoint_index = 0;
+
+  TRACE_BEGIN ("savepoint");
+
+  /* The story about the future is deleted. */
+  canvas_redolist_free (canvas);
+
+  savepoint_index = g_slist_length (canvas->savepoint_list) + 1;
+
+  /* The name is never reused; a copy can still read the file of a deleted save-point. */
+  savepoint = canvas_savepoint_new ((gchar *) NULL, (GBytes *) NULL);
+  savepoint->filename = g_strdup_printf ("%s%s%s_%u_vellum.png",
+                                          canvas->savepoint_dir,
+                                          G_DIR_SEPARATOR_S,
+                                          PACKAGE_NAME,
+                                          ++canvas->savepoint_serial);
+
+  /* The pen strokes are stored also as paths to be exported as vectors. */
+  if ((canvas->cur_context->type == ANNOTATE_PEN) && (canvas->path->len > 0))
+    {
+      savepoint->paths = take_paths (canvas);
+    }
+
+  path_reset (canvas);
+
+  /* Add a new save-point. */
+  canvas->savepoint_list = g_slist_prepend (canvas->savepoint_list, savepoint);
+  canvas->current_save_index = 0;
+
+  /* Load a surface with the canvas content and write the file. */
+  saved_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                              canvas->width,
+                                              canvas->height);
+
+  source_surface = cairo_get_target (canvas->cr);
+  cr = cairo_create (saved_surface);
+  cairo_set_source_surface (cr, source_surface, 0, 0);
+  cairo_paint (cr);
+  /* Postcondition: the saved_surface now contains the save-point image. */
+
+
+  /*
+   * The png is kept in memory for the undo and the export and it is
+   * written in background in the save-point folder with format
+   * PACKAGE_NAME_1_vellum.png.
+   */
+  savepoint->png = share_png (canvas, canvas_surface_to_png (saved_surface));
+
+  /* An image already stored is shared and its file is not written again. */
+  if (savepoint_png_count (canvas, savepoint) == 1)
+    {
+      push_savepoint_file (canvas, savepoint->filename, savepoint->png);
+    }
+  else
+    {
+      g_free (savepoint->filename);
+      savepoint->filename = (gchar *) NULL;
+    }
+
+  drop_old_pngs (canvas);
+
+  cairo_surface_destroy (saved_surface);
+  cairo_destroy (cr);
+
+  TRACE_COUNTER ("savepoints", savepoint_index);
+  TRACE_END ("savepoint");
+}
+
+
+/* Draw the current save point on the canvas restoring the surface. */
+void
+canvas_restore_surface       (AnnotateCanvas *canvas)
+{
+  if (canvas->cr)
+    {
+      guint i = canvas->current_save_index;
+
+      /* The strokes painted after the save-point are discarded. */
+      path_reset (canvas);
+      canvas_damage_all (canvas);
+
+      if (g_slist_length (canvas->savepoint_list)==i)
+        {
+          cairo_new_path (canvas->cr);
+          clear_cairo_context (canvas->cr);
+          return;
+        }
+
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) g_slist_nth_data (canvas->savepoint_list, i);
+
+      if (!savepoint)
+        {
+          return;
+        }
+
+      cairo_new_path (canvas->cr);
+      cairo_set_operator (canvas->cr, CAIRO_OPERATOR_SOURCE);
+
+      if ((savepoint_has_image (savepoint)) || (savepoint->paths))
+        {
+          cairo_surface_t *image_surface = (cairo_surface_t *) NULL;
+
+          TRACE_BEGIN ("restore_surface");
+
+          /* Load the save-point in the canvas surface. */
+          image_surface = canvas_savepoint_render (g_slist_nth (canvas->savepoint_list, i),
+                                                   canvas->width,
+                                                   canvas->height);
+
+          if (image_surface)
+            {
+              cairo_set_source_surface (canvas->cr, image_surface, 0, 0);
+              cairo_paint (canvas->cr);
+              cairo_stroke (canvas->cr);
+              cairo_surface_destroy (image_surface);
+            }
+
+          TRACE_END ("restore_surface");
+        }
+    }
+}
+
+
+/* Undo reverting to the last save point. */
+void
+canvas_undo                  (AnnotateCanvas *canvas)
+{
+  TRACE_INSTANT ("undo");
+
+  if (canvas->savepoint_list)
+    {
+      if (canvas->current_save_index != g_slist_length (canvas->savepoint_list)-1)
+        {
+          canvas->current_save_index = canvas->current_save_index + 1;
+          canvas_restore_surface (canvas);
+        }
+    }
+}
+
+
+/* Redo to the last save point. */
+void
+canvas_redo                  (AnnotateCanvas *canvas)
+{
+  TRACE_INSTANT ("redo");
+
+  if (canvas->savepoint_list)
+    {
+      if (canvas->current_save_index != 0)
+        {
+          canvas->current_save_index = canvas->current_save_index - 1;
+          canvas_restore_surface (canvas);
+        }
+    }
+}
+
+
+/* Delete all the save-points of the canvas. */
+void
+canvas_clear_history         (AnnotateCanvas *canvas)
+{
+  while (canvas->savepoint_list)
+    {
+      delete_savepoint ((AnnotateSavepoint *) canvas->savepoint_list->data, canvas);
+    }
+
+  canvas->current_save_index = 0;
+}
+
+
+/* Clear the canvas and make an empty savepoint. */
+void
+canvas_clear                 (AnnotateCanvas *canvas)
+{
+  TRACE_INSTANT ("clear");
+
+  cairo_new_path (canvas->cr);
+  clear_cairo_context (canvas->cr);
+  canvas_damage_all (canvas);
+
+  /* Add the empty savepoint. */
+  canvas_add_savepoint (canvas);
+}
+
+
+/* Start or stop to collect the area painted on the canvas. */
+void
+canvas_track_damage          (AnnotateCanvas *canvas,
+                              gboolean        track)
+{
+  if ((track) && (!canvas->damage))
+    {
+      canvas->damage = cairo_region_create ();
+    }
+  else if ((!track) && (canvas->damage))
+    {
+      cairo_region_destroy (canvas->damage);
+      canvas->damage = (cairo_region_t *) NULL;
+    }
+}
+
+
+/* Add the area to the damage and tell it to the listener. */
+static void
+add_damage                   (AnnotateCanvas        *canvas,
+                              cairo_rectangle_int_t *rectangle)
+{
+  if (canvas->damage)
+    {
+      cairo_region_union_rectangle (canvas->damage, rectangle);
+    }
+
+  if (canvas->damage_func)
+    {
+      canvas->damage_func (rectangle, canvas->damage_data);
+    }
+}
+
+
+/* Call the function with each area painted on the canvas; NULL to stop. */
+void
+canvas_set_damage_func       (AnnotateCanvas     *canvas,
+                              AnnotateDamageFunc  func,
+                              gpointer            user_data)
+{
+  canvas->damage_func = func;
+  canvas->damage_data = user_data;
+}
+
+
+/* Add the area covered by the stroke of the current path to the damage. */
+void
+canvas_damage_path           (AnnotateCanvas *canvas)
+{
+  if (((canvas->damage) || (canvas->damage_func)) && (canvas->cr))
+    {
+      gdouble x1 = 0;
+      gdouble y1 = 0;
+      gdouble x2 = 0;
+      gdouble y2 = 0;
+      cairo_rectangle_int_t rectangle;
+
+      cairo_stroke_extents (canvas->cr, &x1, &y1, &x2, &y2);
+      cairo_user_to_device (canvas->cr, &x1, &y1);
+      cairo_user_to_device (canvas->cr, &x2, &y2);
+
+      /* One more pixel for the antialiasing. */
+      rectangle.x = (gint) floor (MIN (x1, x2)) - 1;
+      rectangle.y = (gint) floor (MIN (y1, y2)) - 1;
+      rectangle.width = (gint) ceil (MAX (x1, x2)) + 1 - rectangle.x;
+      rectangle.height = (gint) ceil (MAX (y1, y2)) + 1 - rectangle.y;
+
+      add_damage (canvas, &rectangle);
+    }
+}
+
+
+/* Add all the canvas to the damage. */
+void
+canvas_damage_all            (AnnotateCanvas *canvas)
+{
+  cairo_rectangle_int_t rectangle = { 0, 0, canvas->width, canvas->height };
+  add_damage (canvas, &rectangle);
+}
+
+
+/*
+ * Take the area painted since the last call and start a new one;
+ * it is NULL if the damage is not tracked, else it must be destroyed.
+ */
+cairo_region_t *
+canvas_take_damage           (AnnotateCanvas *canvas)
+{
+  cairo_region_t *damage = canvas->damage;
+
+  if (damage)
+    {
+      canvas->damage = cairo_region_create ();
+    }
+
+  return damage;
+}
+
+
@@ -0,0 +1,561 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * The canvas is the painting core of ardesia: it draws the strokes,
+ * recognizes the shapes, fills the areas and keeps the undo history
+ * on any cairo context. It depends only on glib and cairo and then
+ * it can be used without a display e.g. on a cairo image surface.
+ */
+
+
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cairo.h>
+
+
+/*
+ * The bytes of the save-point images kept in memory; past it the
+ * oldest ones are dropped and read again from their files on demand.
+ */
+#define CANVAS_PNG_BUDGET (64 * 1024 * 1024)
+
+
+/* Struct to store the painted point. */
+typedef struct
+{
+  gdouble x;
+  gdouble y;
+  gdouble width;
+  gdouble pressure;
+} AnnotatePoint;
+
+
+/* Enumeration containing tools. */
+typedef enum
+  {
+
+    ANNOTATE_PEN,
+
+    ANNOTATE_ERASER,
+
+    ANNOTATE_FILLER,
+
+  } AnnotatePaintType;
+
+
+/* Paint context. */
+typedef struct
+{
+
+  /* Context type. */
+  AnnotatePaintType type;
+
+} AnnotatePaintContext;
+
+
+/* A vector path painted by the pen or by the eraser. */
+typedef struct
+{
+
+  /* The svg path data; only the M, L, C and Z commands are used. */
+  gchar *data;
+
+  /* The RGBA colour e.g. FF0000FF. */
+  gchar *color;
+
+  /* The line width. */
+  gdouble width;
+
+  /* Is the path filled e.g. the arrow head? */
+  gboolean filled;
+
+  /* Does the path clear the canvas as the eraser? */
+  gboolean erase;
+
+} AnnotatePath;
+
+
+/* Called with each area painted on the canvas, see canvas_set_damage_func. */
+typedef void (*AnnotateDamageFunc) (const cairo_rectangle_int_t *area,
+                                    gpointer                     user_data);
+
+
+/* Structure to store the save-point. */
+typedef struct _AnnotateSavePoint
+{
+
+  /*
+   * The file name that represents the save-point; it is written in
+   * background and read when the png has been dropped from memory.
+   */
+  gchar *filename;
+
+  /*
+   * The png encoded image of the save-point kept in memory;
+   * it is NULL if the save-point has been loaded from file.
+   */
+  GBytes *png;
+
+  /*
+   * Where the png can be loaded on demand e.g. the member of an
+   * archive; it is used by the load function.
+   */
+  gchar *source;
+
+  /* Load the png from the source; NULL if the save-point is not lazy. */
+  GBytes *(*load) (struct _AnnotateSavePoint *savepoint);
+
+  /*
+   * The paths painted over the previous save-point to obtain this one;
+   * NULL if the save-point is only raster e.g. a fill or a text. When
+   * there is no image the save-point is rebuilt from the previous one.
+   */
+  GPtrArray *paths;
+
+} AnnotateSavepoint;
+
+
+/* The painting state shared by all the frontends. */
+typedef struct
+{
+
+  /* The cairo context where the strokes are painted. */
+  cairo_t *cr;
+
+  /* The size of the canvas. */
+  gint width;
+  gint height;
+
+  /* Directory where store the save-point. */
+  gchar *savepoint_dir;
+
+  /* List of the savepoint. */
+  GSList  *savepoint_list;
+
+  /*
+   * The index of the position in the save-point list
+   * of the current picture shown.
+   */
+  guint    current_save_index;
+
+  /* Paint context for the pen. */
+  AnnotatePaintContext *default_pen;
+
+  /* Paint context for the eraser. */
+  AnnotatePaintContext *default_eraser;
+
+  /* Paint context for the filler. */
+  AnnotatePaintContext *default_filler;
+
+  /* Point to the current context. */
+  AnnotatePaintContext *cur_context;
+
+  /* Tool thickness. */
+  gdouble thickness;
+
+  /* Is the rectify mode enabled? */
+  gboolean     rectify;
+
+  /* Is the roundify mode enabled?*/
+  gboolean     roundify;
+
+  /* Arrow. */
+  gboolean     arrow;
+
+  /* Pen color. */
+  gchar *color;
+
+  /* The svg path data of the stroke painted since the last save-point. */
+  GString *path;
+
+  /* The current point of the path. */
+  gdouble path_x;
+  gdouble path_y;
+
+  /* The svg path data of the arrow head of the stroke. */
+  GString *arrow_path;
+
+  /*
+   * The png images of the save-points indexed by content with the
+   * number of save-points sharing each one; the identical images,
+   * e.g. the empty page after each clear, are stored once.
+   */
+  GHashTable *png_table;
+
+  /* The bytes of the images in png_table. */
+  gsize png_bytes;
+
+  /* The number of save-points made; it gives each file a new name. */
+  guint savepoint_serial;
+
+  /* The thread writing and removing the save-point files in order. */
+  GAsyncQueue *file_queue;
+  GThread *file_writer;
+
+  /* The files queued and not written yet; no png is dropped meanwhile. */
+  gint pending_files;
+
+  /*
+   * The area painted since the last canvas_take_damage; it is NULL
+   * when nobody tracks the damage, see canvas_track_damage.
+   */
+  cairo_region_t *damage;
+
+  /*
+   * Called as soon as an area is painted e.g. to expose it in the
+   * window that composes the canvas; NULL if nobody listens.
+   */
+  AnnotateDamageFunc damage_func;
+  gpointer damage_data;
+
+} AnnotateCanvas;
+
+
+/* Distance between two points using the Pitagora theorem. */
+gdouble
+get_distance            (gdouble  x1,
+                         gdouble  y1,
+                         gdouble  x2,
+                         gdouble  y2);
+
+
+/* Clear cairo context. */
+void
+clear_cairo_context     (cairo_t  *cr);
+
+
+/* Set the cairo surface color to the RGBA string. */
+void
+cairo_set_source_color_from_string     (cairo_t  *cr,
+                                        gchar    *color);
+
+
+/* Allocate a new point belonging to the path passing the values. */
+AnnotatePoint *
+allocate_point     (gdouble  x,
+                    gdouble  y,
+                    gdouble  width,
+                    gdouble  pressure);
+
+
+/* Allocate a path with the svg data painted with colour and width. */
+AnnotatePath *
+canvas_path_new              (const gchar       *data,
+                              const gchar       *color,
+                              gdouble            width,
+                              gboolean           filled);
+
+
+/* Free the path. */
+void
+canvas_path_free             (AnnotatePath      *path);
+
+
+/* Build the cairo path from the svg path data; it stops at the first error. */
+void
+canvas_draw_path_data        (cairo_t           *cr,
+                              const gchar       *data);
+
+
+/*
+ * Return the svg path data with the x coordinates multiplied by scale_x
+ * and the y ones by scale_y; the result must be freed.
+ */
+gchar *
+canvas_scale_path_data       (const gchar       *data,
+                              gdouble            scale_x,
+                              gdouble            scale_y);
+
+
+/*
+ * Allocate a save-point made of a png, kept in memory and/or in the file;
+ * the paths of a vector save-point are set by the caller.
+ */
+AnnotateSavepoint *
+canvas_savepoint_new         (const gchar       *filename,
+                              GBytes            *png);
+
+
+/*
+ * Copy the save-point sharing its png, paths and file; the file of a
+ * save-point whose png has been dropped is kept until the exit, then
+ * the copy stays valid when the original is deleted.
+ */
+AnnotateSavepoint *
+canvas_savepoint_copy        (AnnotateSavepoint *savepoint);
+
+
+/* Free the save-point without removing its file. */
+void
+canvas_savepoint_free        (AnnotateSavepoint *savepoint);
+
+
+/*
+ * Get the png of the save-point loading it on demand from its source
+ * or its file if needed; the returned reference must be released. It is NULL for
+ * a save-point made only of paths, see canvas_restore_surface.
+ */
+GBytes *
+canvas_savepoint_get_png     (AnnotateSavepoint *savepoint);
+
+
+/*
+ * Does the save-point made of paths clear part of the previous ones?
+ * Its paths can not be exported as vectors then.
+ */
+gboolean
+canvas_savepoint_erases      (AnnotateSavepoint *savepoint);
+
+
+/* Encode the surface as a png kept in memory; the reference must be released. */
+GBytes *
+canvas_surface_to_png        (cairo_surface_t   *surface);
+
+
+/* Decode the png kept in memory; the surface status tells if it failed. */
+cairo_surface_t *
+canvas_png_to_surface        (GBytes            *png);
+
+
+/*
+ * Render the save-point in the list link, newest first, painting the
+ * save-points made only of paths over the last previous image; it can
+ * run in any thread on a list of copies. The surface must be destroyed.
+ */
+cairo_surface_t *
+canvas_savepoint_render      (GSList            *link,
+                              gint               width,
+                              gint               height);
+
+
+/*
+ * Create a new canvas of the given size storing the save-points
+ * in the savepoint_dir directory; the cairo context must be
+ * attached with canvas_set_cairo_context before to paint.
+ */
+AnnotateCanvas *
+canvas_new                   (gint            width,
+                              gint            height,
+                              const gchar    *savepoint_dir);
+
+
+/* Attach the cairo context where the canvas paints. */
+void
+canvas_set_cairo_context     (AnnotateCanvas *canvas,
+                              cairo_t        *cr);
+
+
+/* Free the canvas deleting all the save-points. */
+void
+canvas_free                  (AnnotateCanvas *canvas);
+
+
+/*
+ * Wait the save-point files queued to the writer thread, the removals
+ * included; the writer is started again on the next use.
+ */
+void
+canvas_wait_files            (AnnotateCanvas *canvas);
+
+
+/* Get the line thickness of the current tool. */
+gdouble
+canvas_get_thickness         (AnnotateCanvas *canvas);
+
+
+/* Configure pen option for cairo context. */
+void
+canvas_configure_pen_options (AnnotateCanvas *canvas);
+
+
+/* Modify colour according to the pressure. */
+void
+canvas_modify_color          (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         pressure);
+
+
+/*
+ * Add to the coordinate list the point (x,y)
+ * storing the line width and the pressure;
+ * return the new start of the list.
+ */
+GSList *
+canvas_coord_list_prepend    (GSList         *coord_list,
+                              gdouble         x,
+                              gdouble         y,
+                              gdouble         width,
+                              gdouble         pressure);
+
+
+/* Free the coordinate list. */
+void
+canvas_coord_list_free       (GSList         *coord_list);
+
+
+/* Draw line from the last point of coord_list to (x2,y2). */
+void
+canvas_draw_line             (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         x2,
+                              gdouble         y2,
+                              gboolean        stroke);
+
+
+/* Draw a point in x,y respecting the context. */
+void
+canvas_draw_point            (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         x,
+                              gdouble         y,
+                              gdouble         pressure);
+
+
+/* Draw the point list. */
+void
+canvas_draw_point_list       (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              GSList         *list);
+
+
+/* Draw an arrow at the end of the stroke. */
+void
+canvas_draw_arrow            (AnnotateCanvas *canvas,
+                              GSList         *coord_list,
+                              gdouble         distance);
+
+
+/*
+ * Paint the svg path data with the current tool as it would have been
+ * painted by hand; the filled paths are arrow heads.
+ */
+void
+canvas_paint_path            (AnnotateCanvas *canvas,
+                              const gchar    *data,
+                              gboolean        filled);
+
+
+/*
+ * Call the geometric shape recognizer;
+ * the coordinate list is replaced with the recognized shape.
+ */
+void
+canvas_shape_recognize       (AnnotateCanvas *canvas,
+                              GSList        **coord_list,
+                              gboolean        closed_path);
+
+
+/* Fill the contiguos area around point with coordinates (x,y). */
+void
+canvas_fill                  (AnnotateCanvas *canvas,
+                              gdouble         x,
+                              gdouble         y);
+
+
+/* Paint the context over the canvas. */
+void
+canvas_push_context          (AnnotateCanvas *canvas,
+                              cairo_t        *cr);
+
+
+/* Add a save point for the undo/redo. */
+void
+canvas_add_savepoint         (AnnotateCanvas *canvas);
+
+
+/*
+ * Add a save point made only of the paths recorded since the last one;
+ * no image is made and it will be rebuilt painting the paths over the
+ * previous save-point when it is restored.
+ */
+void
+canvas_add_vector_savepoint  (AnnotateCanvas *canvas);
+
+
+/* Draw the current save point on the canvas restoring the surface. */
+void
+canvas_restore_surface       (AnnotateCanvas *canvas);
+
+
+/* Undo to the last save point. */
+void
+canvas_undo                  (AnnotateCanvas *canvas);
+
+
+/* Redo to the last save point. */
+void
+canvas_redo                  (AnnotateCanvas *canvas);
+
+
+/* Delete all the save-points of the canvas. */
+void
+canvas_clear_history         (AnnotateCanvas *canvas);
+
+
+/* Clear the canvas and make an empty savepoint. */
+void
+canvas_clear                 (AnnotateCanvas *canvas);
+
+
+/* Start or stop to collect the area painted on the canvas. */
+void
+canvas_track_damage          (AnnotateCanvas *canvas,
+                              gboolean        track);
+
+
+/* Call the function with each area painted on the canvas; NULL to stop. */
+void
+canvas_set_damage_func       (AnnotateCanvas     *canvas,
+                              AnnotateDamageFunc  func,
+                              gpointer            user_data);
+
+
+/* Add the area covered by the stroke of the current path to the damage. */
+void
+canvas_damage_path           (AnnotateCanvas *canvas);
+
+
+/* Add all the canvas to the damage. */
+void
+canvas_damage_all            (AnnotateCanvas *canvas);
+
+
+/*
+ * Take the area painted since the last call and start a new one;
+ * it is NULL if the damage is not tracked, else it must be destroyed.
+ */
+cairo_region_t *
+canvas_take_damage           (AnnotateCanvas *canvas);
+
+
+#endif
@@ -27,7 +27,7 @@
 #endif
 
 #include <fill.h>
-#include <utils.h>
+#include <canvas.h>
 
 /*
  * Get color of the surface at point with coordinates (x,y).
@@ -203,7 +203,7 @@ flood_fill                   (cairo_t          *annotation_cairo_context,
 
   guint r, g, b, a;
   sscanf (filled_color, "%02X%02X%02X%02X", &r, &g, &b, &a);
-  gint filled_colorint = RGBA_TO_UINT(r, g, b, a);
+  guint32 filled_colorint = RGBA_TO_UINT(r, g, b, a);
 
   if (filled_colorint == fill_info.orig_color)
     {
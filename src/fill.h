@@ -27,15 +27,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 
-#ifdef _WIN32
-#  include <cairo-win32.h>
-#else
-#  ifdef __APPLE__
-#    include <cairo-quartz.h>
-#  else
-#    include <cairo-xlib.h>
-#  endif
-#endif
+#include <cairo.h>
 
 
 /* Stack size used for flood fill algorithm. */
@@ -39,6 +39,7 @@ add_input_mode_device   (AnnotateData    *data,
   AnnotateDeviceData *devdata = (AnnotateDeviceData *) NULL;
   devdata  = g_malloc ((gsize) sizeof (AnnotateDeviceData));
   devdata->coord_list = (GSList *) NULL;
+  devdata->stroke_traced = FALSE;
   g_hash_table_insert (data->devdatatable, device, devdata);
   
   if (!gdk_device_set_mode (device, mode))
@@ -0,0 +1,889 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Record the input events reaching the annotation window in a compact
+ * binary file and replay them through the same callbacks.
+ *
+ * The file starts with the INPUT_RECORDER_MAGIC string followed by the
+ * format version (16 bit) and a reserved 16 bit field; then the records
+ * follow, each one starting with its InputRecordType byte.
+ * All the numbers are stored in little endian.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <utils.h>
+#include <input_recorder.h>
+#include <annotation_window_callbacks.h>
+
+
+/* Maximum number of devices that can be referenced by a recording. */
+#define INPUT_RECORDER_MAX_DEVICES 256
+
+/* Milliseconds between the checks for the annotation window to be mapped. */
+#define INPUT_REPLAY_WAIT_TIMEOUT 100
+
+
+/* The file where the events are being recorded. */
+static FILE *record_fp = (FILE *) NULL;
+
+/* The devices already declared in the recording file. */
+static GPtrArray *record_devices = (GPtrArray *) NULL;
+
+/* The last context stored in the recording file. */
+static InputRecord *record_context = (InputRecord *) NULL;
+
+/* The records loaded from the replay file. */
+static GArray *replay_records = (GArray *) NULL;
+
+/* The devices resolved for the replay indexed as in the file. */
+static GPtrArray *replay_devices = (GPtrArray *) NULL;
+
+/* The index of the next record to be replayed. */
+static guint replay_index = 0;
+
+/* The source id of the pending replay timeout. */
+static guint replay_source = 0;
+
+/* Are the events paced with the recorded timestamps? */
+static gboolean replay_realtime = FALSE;
+
+/* Timer used to measure the replay. */
+static GTimer *replay_timer = (GTimer *) NULL;
+
+/*
+ * Colour buffer passed to the annotation window;
+ * it is owned by the annotation window as the bar colour is.
+ */
+static gchar *replay_color = (gchar *) NULL;
+
+
+/* Write a byte. */
+static void
+write_u8           (guint8   value)
+{
+  fwrite (&value, sizeof (value), 1, record_fp);
+}
+
+
+/* Write a 32 bit integer. */
+static void
+write_u32          (guint32  value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+  fwrite (&le_value, sizeof (le_value), 1, record_fp);
+}
+
+
+/* Write a double. */
+static void
+write_double       (gdouble  value)
+{
+  union { gdouble d; guint64 u; } bits;
+  bits.d = value;
+  bits.u = GUINT64_TO_LE (bits.u);
+  fwrite (&bits.u, sizeof (bits.u), 1, record_fp);
+}
+
+
+/* Read size bytes moving the cursor; return false at the end of buffer. */
+static gboolean
+read_bytes         (const guchar  **cursor,
+                    const guchar   *end,
+                    gpointer        dest,
+                    gsize           size)
+{
+  if ((gsize) (end - *cursor) < size)
+    {
+      return FALSE;
+    }
+
+  memcpy (dest, *cursor, size);
+  *cursor = *cursor + size;
+  return TRUE;
+}
+
+
+/* Read a byte. */
+static gboolean
+read_u8            (const guchar  **cursor,
+                    const guchar   *end,
+                    guint8         *value)
+{
+  return read_bytes (cursor, end, value, sizeof (guint8));
+}
+
+
+/* Read a 32 bit integer. */
+static gboolean
+read_u32           (const guchar  **cursor,
+                    const guchar   *end,
+                    guint32        *value)
+{
+  if (!read_bytes (cursor, end, value, sizeof (guint32)))
+    {
+      return FALSE;
+    }
+
+  *value = GUINT32_FROM_LE (*value);
+  return TRUE;
+}
+
+
+/* Read a double. */
+static gboolean
+read_double        (const guchar  **cursor,
+                    const guchar   *end,
+                    gdouble        *value)
+{
+  union { gdouble d; guint64 u; } bits;
+
+  if (!read_bytes (cursor, end, &bits.u, sizeof (bits.u)))
+    {
+      return FALSE;
+    }
+
+  bits.u = GUINT64_FROM_LE (bits.u);
+  *value = bits.d;
+  return TRUE;
+}
+
+
+/* Return the index of the device declaring it in the file the first time. */
+static guint8
+get_record_device_index (GdkDevice *device)
+{
+  const gchar *name = gdk_device_get_name (device);
+  guint i = 0;
+  gsize len = 0;
+
+  for (i=0; i<record_devices->len; i++)
+    {
+      if (g_ptr_array_index (record_devices, i) == device)
+        {
+          return (guint8) i;
+        }
+    }
+
+  if (record_devices->len >= INPUT_RECORDER_MAX_DEVICES)
+    {
+      /* Too many devices; reuse the first one. */
+      return 0;
+    }
+
+  g_ptr_array_add (record_devices, device);
+
+  len = MIN (strlen (name), 255);
+  write_u8 (INPUT_RECORD_DEVICE);
+  write_u8 ((guint8) i);
+  write_u8 ((guint8) len);
+  fwrite (name, sizeof (gchar), len, record_fp);
+
+  return (guint8) i;
+}
+
+
+/* Store the tool, colour and thickness if they changed since the last event. */
+static void
+record_context_if_changed (AnnotateData *data)
+{
+  InputRecord context;
+  guint8 flags = 0;
+
+  if (data->canvas->rectify)
+    {
+      flags |= INPUT_RECORD_RECTIFY;
+    }
+
+  if (data->canvas->roundify)
+    {
+      flags |= INPUT_RECORD_ROUNDIFY;
+    }
+
+  if (data->canvas->arrow)
+    {
+      flags |= INPUT_RECORD_ARROW;
+    }
+
+  context.tool = data->canvas->cur_context->type;
+  context.thickness = data->canvas->thickness;
+  context.mode_flags = flags;
+  g_strlcpy (context.color, data->canvas->color ? data->canvas->color : "00000000", sizeof (context.color));
+
+  if ((record_context)                                  &&
+      (record_context->tool == context.tool)            &&
+      (record_context->thickness == context.thickness)  &&
+      (record_context->mode_flags == context.mode_flags) &&
+      (g_strcmp0 (record_context->color, context.color) == 0))
+    {
+      return;
+    }
+
+  if (!record_context)
+    {
+      record_context = g_malloc ((gsize) sizeof (InputRecord));
+    }
+
+  *record_context = context;
+
+  write_u8 (INPUT_RECORD_CONTEXT);
+  write_u8 ((guint8) context.tool);
+  fwrite (context.color, sizeof (gchar), 8, record_fp);
+  write_double (context.thickness);
+  write_u8 (context.mode_flags);
+}
+
+
+/* Start to record the input events in the file. */
+gboolean
+start_input_recording        (gchar  *filename)
+{
+  guint16 version = GUINT16_TO_LE (INPUT_RECORDER_VERSION);
+  guint16 reserved = 0;
+
+  stop_input_recording ();
+
+  record_fp = g_fopen (filename, "wb");
+
+  if (!record_fp)
+    {
+      g_warning ("Unable to open the input recording file %s", filename);
+      return FALSE;
+    }
+
+  fwrite (INPUT_RECORDER_MAGIC, sizeof (gchar), strlen (INPUT_RECORDER_MAGIC), record_fp);
+  fwrite (&version, sizeof (version), 1, record_fp);
+  fwrite (&reserved, sizeof (reserved), 1, record_fp);
+
+  record_devices = g_ptr_array_new ();
+  return TRUE;
+}
+
+
+/* Record the event reaching the annotation window; the recording is suspended during a replay. */
+void
+record_input_event           (AnnotateData  *data,
+                              GdkEvent      *ev)
+{
+  InputRecordType type = INPUT_RECORD_MOTION_NOTIFY;
+  GdkDevice *master = (GdkDevice *) NULL;
+  GdkDevice *slave = (GdkDevice *) NULL;
+  GdkModifierType state = 0;
+  gdouble x = 0.0;
+  gdouble y = 0.0;
+  gdouble pressure = 1.0;
+  guint8 event_flags = 0;
+  guint8 button = 0;
+  guint8 master_index = 0;
+  guint8 slave_index = 0;
+
+  /* The replayed events are not recorded again while the replay runs. */
+  if ((!record_fp) || (!ev) || (replay_records))
+    {
+      return;
+    }
+
+  switch (ev->type)
+    {
+      case GDK_BUTTON_PRESS:
+        type = INPUT_RECORD_BUTTON_PRESS;
+        button = (guint8) ev->button.button;
+        break;
+      case GDK_BUTTON_RELEASE:
+        type = INPUT_RECORD_BUTTON_RELEASE;
+        button = (guint8) ev->button.button;
+        break;
+      case GDK_MOTION_NOTIFY:
+        type = INPUT_RECORD_MOTION_NOTIFY;
+        break;
+      default:
+        return;
+    }
+
+  master = gdk_event_get_device (ev);
+  slave = gdk_event_get_source_device (ev);
+
+  if (!master)
+    {
+      return;
+    }
+
+  if (!slave)
+    {
+      slave = master;
+    }
+
+  master_index = get_record_device_index (master);
+  slave_index = get_record_device_index (slave);
+
+  record_context_if_changed (data);
+
+  gdk_event_get_coords (ev, &x, &y);
+  gdk_event_get_state (ev, &state);
+
+  if (gdk_event_get_axis (ev, GDK_AXIS_PRESSURE, &pressure))
+    {
+      event_flags |= INPUT_RECORD_HAS_PRESSURE;
+    }
+
+  write_u8 ((guint8) type);
+  write_u8 (master_index);
+  write_u8 (slave_index);
+  write_u32 (gdk_event_get_time (ev));
+  write_double (x);
+  write_double (y);
+  write_u8 (event_flags);
+
+  if (event_flags & INPUT_RECORD_HAS_PRESSURE)
+    {
+      write_double (pressure);
+    }
+
+  write_u32 ((guint32) state);
+  write_u8 (button);
+}
+
+
+/* Stop to record the input events and close the file. */
+void
+stop_input_recording         ()
+{
+  if (record_fp)
+    {
+      fclose (record_fp);
+      record_fp = (FILE *) NULL;
+    }
+
+  if (record_devices)
+    {
+      g_ptr_array_free (record_devices, TRUE);
+      record_devices = (GPtrArray *) NULL;
+    }
+
+  if (record_context)
+    {
+      g_free (record_context);
+      record_context = (InputRecord *) NULL;
+    }
+}
+
+
+/* Parse a record; return false if the buffer is truncated or corrupted. */
+static gboolean
+parse_record       (const guchar  **cursor,
+                    const guchar   *end,
+                    InputRecord    *record)
+{
+  guint8 type = 0;
+  guint8 value = 0;
+
+  memset (record, 0, sizeof (InputRecord));
+
+  if (!read_u8 (cursor, end, &type))
+    {
+      return FALSE;
+    }
+
+  record->type = (InputRecordType) type;
+
+  switch (record->type)
+    {
+      case INPUT_RECORD_DEVICE:
+        {
+          guint8 len = 0;
+          if ((!read_u8 (cursor, end, &record->master)) ||
+              (!read_u8 (cursor, end, &len)))
+            {
+              return FALSE;
+            }
+          record->name = g_malloc0 ((gsize) len + 1);
+          return read_bytes (cursor, end, record->name, len);
+        }
+
+      case INPUT_RECORD_CONTEXT:
+        if ((!read_u8 (cursor, end, &value))                 ||
+            (!read_bytes (cursor, end, record->color, 8))    ||
+            (!read_double (cursor, end, &record->thickness)) ||
+            (!read_u8 (cursor, end, &record->mode_flags)))
+          {
+            return FALSE;
+          }
+        record->tool = (AnnotatePaintType) value;
+        return TRUE;
+
+      case INPUT_RECORD_BUTTON_PRESS:
+      case INPUT_RECORD_MOTION_NOTIFY:
+      case INPUT_RECORD_BUTTON_RELEASE:
+        if ((!read_u8 (cursor, end, &record->master))      ||
+            (!read_u8 (cursor, end, &record->slave))       ||
+            (!read_u32 (cursor, end, &record->time))       ||
+            (!read_double (cursor, end, &record->x))       ||
+            (!read_double (cursor, end, &record->y))       ||
+            (!read_u8 (cursor, end, &record->event_flags)))
+          {
+            return FALSE;
+          }
+
+        record->pressure = 1.0;
+        if ((record->event_flags & INPUT_RECORD_HAS_PRESSURE) &&
+            (!read_double (cursor, end, &record->pressure)))
+          {
+            return FALSE;
+          }
+
+        return ((read_u32 (cursor, end, &record->state)) &&
+                (read_u8 (cursor, end, &record->button)));
+
+      default:
+        g_warning ("Unknown input record type %d", type);
+        return FALSE;
+    }
+}
+
+
+/* Load all the records stored in the file. */
+static GArray *
+load_input_records (gchar *filename)
+{
+  GError *error = (GError *) NULL;
+  gchar *contents = (gchar *) NULL;
+  gsize length = 0;
+  const guchar *cursor = (const guchar *) NULL;
+  const guchar *end = (const guchar *) NULL;
+  gchar magic[4];
+  guint16 version = 0;
+  guint16 reserved = 0;
+  GArray *records = (GArray *) NULL;
+
+  if (!g_file_get_contents (filename, &contents, &length, &error))
+    {
+      g_warning ("Unable to read the input recording %s: %s", filename, error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  cursor = (const guchar *) contents;
+  end = cursor + length;
+
+  if ((!read_bytes (&cursor, end, magic, sizeof (magic)))            ||
+      (memcmp (magic, INPUT_RECORDER_MAGIC, sizeof (magic)) != 0)    ||
+      (!read_bytes (&cursor, end, &version, sizeof (version)))       ||
+      (GUINT16_FROM_LE (version) != INPUT_RECORDER_VERSION)          ||
+      (!read_bytes (&cursor, end, &reserved, sizeof (reserved))))
+    {
+      g_warning ("The file %s is not a valid input recording", filename);
+      g_free (contents);
+      return NULL;
+    }
+
+  records = g_array_new (FALSE, FALSE, sizeof (InputRecord));
+
+  while (cursor < end)
+    {
+      InputRecord record;
+
+      if (!parse_record (&cursor, end, &record))
+        {
+          g_warning ("The input recording %s is truncated; replaying the first %u records",
+                     filename,
+                     records->len);
+          g_free (record.name);
+          break;
+        }
+
+      g_array_append_val (records, record);
+    }
+
+  g_free (contents);
+  return records;
+}
+
+
+/* Find the device with the name; fall back to the client pointer. */
+static GdkDevice *
+resolve_device     (AnnotateData *data,
+                    const gchar  *name)
+{
+  GdkDeviceManager *device_manager = gdk_display_get_device_manager (gdk_display_get_default ());
+  GList *masters = gdk_device_manager_list_devices (device_manager, GDK_DEVICE_TYPE_MASTER);
+  GList *slaves = gdk_device_manager_list_devices (device_manager, GDK_DEVICE_TYPE_SLAVE);
+  GList *devices = g_list_concat (masters, slaves);
+  GList *item = (GList *) NULL;
+  GdkDevice *device = (GdkDevice *) NULL;
+
+  for (item = devices; item; item = item->next)
+    {
+      GdkDevice *candidate = (GdkDevice *) item->data;
+
+      if ((g_strcmp0 (gdk_device_get_name (candidate), name) == 0) &&
+          (g_hash_table_lookup (data->devdatatable, candidate)))
+        {
+          device = candidate;
+          break;
+        }
+    }
+
+  g_list_free (devices);
+
+  if (!device)
+    {
+      device = gdk_device_manager_get_client_pointer (device_manager);
+
+      if (data->debug)
+        {
+          g_printerr ("Replay: device '%s' not found; using '%s'\n",
+                      name,
+                      gdk_device_get_name (device));
+        }
+    }
+
+  return device;
+}
+
+
+/* Apply the recorded tool, colour and thickness to the annotation window. */
+static void
+apply_context      (InputRecord *record)
+{
+  if (!replay_color)
+    {
+      replay_color = g_malloc0 ((gsize) sizeof (record->color));
+    }
+
+  g_strlcpy (replay_color, record->color, sizeof (record->color));
+
+  annotate_set_color (replay_color);
+  annotate_set_thickness (record->thickness);
+  annotate_set_rectifier (record->mode_flags & INPUT_RECORD_RECTIFY);
+  annotate_set_rounder (record->mode_flags & INPUT_RECORD_ROUNDIFY);
+  annotate_set_arrow (record->mode_flags & INPUT_RECORD_ARROW);
+
+  switch (record->tool)
+    {
+      case ANNOTATE_ERASER:
+        annotate_select_eraser ();
+        break;
+      case ANNOTATE_FILLER:
+        annotate_select_filler ();
+        break;
+      default:
+        annotate_select_pen ();
+        break;
+    }
+}
+
+
+/* Build the axes array with the recorded pressure for the device. */
+static gdouble *
+create_event_axes  (GdkDevice   *device,
+                    InputRecord *record)
+{
+  gint n_axes = gdk_device_get_n_axes (device);
+  gdouble *axes = (gdouble *) NULL;
+  gint i = 0;
+
+  if ((!(record->event_flags & INPUT_RECORD_HAS_PRESSURE)) || (n_axes <= 0))
+    {
+      return NULL;
+    }
+
+  axes = g_new0 (gdouble, n_axes);
+
+  for (i=0; i<n_axes; i++)
+    {
+      GdkAxisUse use = gdk_device_get_axis_use (device, i);
+
+      if (use == GDK_AXIS_X)
+        {
+          axes[i] = record->x;
+        }
+      else if (use == GDK_AXIS_Y)
+        {
+          axes[i] = record->y;
+        }
+      else if (use == GDK_AXIS_PRESSURE)
+        {
+          axes[i] = record->pressure;
+        }
+    }
+
+  return axes;
+}
+
+
+/* Create the gdk event equivalent to the recorded one. */
+static GdkEvent *
+create_event       (InputRecord *record,
+                    GdkWindow   *window,
+                    GdkDevice   *master,
+                    GdkDevice   *slave)
+{
+  GdkEvent *event = (GdkEvent *) NULL;
+
+  if (record->type == INPUT_RECORD_MOTION_NOTIFY)
+    {
+      event = gdk_event_new (GDK_MOTION_NOTIFY);
+      event->motion.time = record->time;
+      event->motion.x = record->x;
+      event->motion.y = record->y;
+      event->motion.x_root = record->x;
+      event->motion.y_root = record->y;
+      event->motion.state = record->state;
+      event->motion.is_hint = FALSE;
+      event->motion.axes = create_event_axes (master, record);
+    }
+  else
+    {
+      GdkEventType type = GDK_BUTTON_PRESS;
+
+      if (record->type == INPUT_RECORD_BUTTON_RELEASE)
+        {
+          type = GDK_BUTTON_RELEASE;
+        }
+
+      event = gdk_event_new (type);
+      event->button.time = record->time;
+      event->button.x = record->x;
+      event->button.y = record->y;
+      event->button.x_root = record->x;
+      event->button.y_root = record->y;
+      event->button.state = record->state;
+      event->button.button = record->button;
+      event->button.axes = create_event_axes (master, record);
+    }
+
+  event->any.window = g_object_ref (window);
+  event->any.send_event = TRUE;
+  gdk_event_set_device (event, master);
+  gdk_event_set_source_device (event, slave);
+
+  return event;
+}
+
+
+/* Feed the record through the annotation window callbacks. */
+static void
+dispatch_record    (InputRecord *record)
+{
+  AnnotateData *data = get_annotation_data ();
+  GtkWidget *window = get_annotation_window ();
+  GdkDevice *master = (GdkDevice *) NULL;
+  GdkDevice *slave = (GdkDevice *) NULL;
+  GdkEvent *event = (GdkEvent *) NULL;
+
+  switch (record->type)
+    {
+      case INPUT_RECORD_DEVICE:
+        g_ptr_array_index (replay_devices, record->master) = resolve_device (data, record->name);
+        return;
+
+      case INPUT_RECORD_CONTEXT:
+        apply_context (record);
+        return;
+
+      default:
+        break;
+    }
+
+  master = (GdkDevice *) g_ptr_array_index (replay_devices, record->master);
+  slave = (GdkDevice *) g_ptr_array_index (replay_devices, record->slave);
+
+  if ((!master) || (!slave))
+    {
+      g_warning ("Replay: event references an undeclared device; skipped");
+      return;
+    }
+
+  event = create_event (record, gtk_widget_get_window (window), master, slave);
+
+  switch (record->type)
+    {
+      case INPUT_RECORD_BUTTON_PRESS:
+        on_button_press (window, (GdkEventButton *) event, data);
+        break;
+      case INPUT_RECORD_MOTION_NOTIFY:
+        on_motion_notify (window, (GdkEventMotion *) event, data);
+        break;
+      case INPUT_RECORD_BUTTON_RELEASE:
+        on_button_release (window, (GdkEventButton *) event, data);
+        break;
+      default:
+        break;
+    }
+
+  gdk_event_free (event);
+}
+
+
+/* Is the record an input event? */
+static gboolean
+is_event_record    (InputRecord *record)
+{
+  return ((record->type == INPUT_RECORD_BUTTON_PRESS)  ||
+          (record->type == INPUT_RECORD_MOTION_NOTIFY) ||
+          (record->type == INPUT_RECORD_BUTTON_RELEASE));
+}
+
+
+/* The replay is completed; print how long it took. */
+static void
+finish_input_replay ()
+{
+  g_printerr ("Replayed %u records in %.3f seconds\n",
+              replay_index,
+              g_timer_elapsed (replay_timer, NULL));
+
+  stop_input_replay ();
+}
+
+
+/* Dispatch the records until the next event that must wait. */
+static gboolean
+replay_next_records (gpointer user_data)
+{
+  replay_source = 0;
+
+  while (replay_index < replay_records->len)
+    {
+      InputRecord *record = &g_array_index (replay_records, InputRecord, replay_index);
+      InputRecord *next = (InputRecord *) NULL;
+      guint i = 0;
+
+      dispatch_record (record);
+      replay_index++;
+
+      if ((!replay_realtime) || (!is_event_record (record)))
+        {
+          continue;
+        }
+
+      /* Search the next event to know how much wait. */
+      for (i=replay_index; i<replay_records->len; i++)
+        {
+          next = &g_array_index (replay_records, InputRecord, i);
+          if (is_event_record (next))
+            {
+              break;
+            }
+          next = (InputRecord *) NULL;
+        }
+
+      if ((next) && (next->time > record->time))
+        {
+          replay_source = g_timeout_add (next->time - record->time, replay_next_records, NULL);
+          return FALSE;
+        }
+    }
+
+  finish_input_replay ();
+  return FALSE;
+}
+
+
+/* Start to replay when the annotation window is ready to paint. */
+static gboolean
+start_replay_when_ready (gpointer user_data)
+{
+  GtkWidget *window = get_annotation_window ();
+
+  if ((!window) || (!gtk_widget_get_mapped (window)))
+    {
+      /* Try again later. */
+      return TRUE;
+    }
+
+  replay_source = 0;
+  annotate_acquire_grab ();
+  g_timer_start (replay_timer);
+  replay_next_records (NULL);
+  return FALSE;
+}
+
+
+/*
+ * Replay the input events stored in the file through the annotation
+ * window callbacks; if realtime is false the events are fed as fast
+ * as possible and the elapsed time is printed at the end.
+ */
+gboolean
+start_input_replay           (gchar     *filename,
+                              gboolean   realtime)
+{
+  stop_input_replay ();
+
+  replay_records = load_input_records (filename);
+
+  if (!replay_records)
+    {
+      return FALSE;
+    }
+
+  replay_devices = g_ptr_array_new ();
+  g_ptr_array_set_size (replay_devices, INPUT_RECORDER_MAX_DEVICES);
+  replay_index = 0;
+  replay_realtime = realtime;
+  replay_timer = g_timer_new ();
+  replay_source = g_timeout_add (INPUT_REPLAY_WAIT_TIMEOUT, start_replay_when_ready, NULL);
+
+  return TRUE;
+}
+
+
+/* Stop the replay and free the loaded records. */
+void
+stop_input_replay            ()
+{
+  if (replay_source)
+    {
+      g_source_remove (replay_source);
+      replay_source = 0;
+    }
+
+  if (replay_records)
+    {
+      guint i = 0;
+      for (i=0; i<replay_records->len; i++)
+        {
+          g_free (g_array_index (replay_records, InputRecord, i).name);
+        }
+      g_array_free (replay_records, TRUE);
+      replay_records = (GArray *) NULL;
+    }
+
+  if (replay_devices)
+    {
+      g_ptr_array_free (replay_devices, TRUE);
+      replay_devices = (GPtrArray *) NULL;
+    }
+
+  if (replay_timer)
+    {
+      g_timer_destroy (replay_timer);
+      replay_timer = (GTimer *) NULL;
+    }
+}
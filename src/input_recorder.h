@@ -0,0 +1,151 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef INPUT_RECORDER_H
+#define INPUT_RECORDER_H
+
+#include <glib.h>
+
+#include <gtk/gtk.h>
+
+#include <annotation_window.h>
+
+
+/* Magic string at the beginning of an input recording file. */
+#define INPUT_RECORDER_MAGIC "ARDI"
+
+/* Version of the input recording file format. */
+#define INPUT_RECORDER_VERSION 1
+
+
+/* Kind of record stored in the input recording file. */
+typedef enum
+  {
+
+    /* Declare the name of a device used by the next events. */
+    INPUT_RECORD_DEVICE = 1,
+
+    /* The tool, colour, thickness or shape mode changed. */
+    INPUT_RECORD_CONTEXT,
+
+    INPUT_RECORD_BUTTON_PRESS,
+
+    INPUT_RECORD_MOTION_NOTIFY,
+
+    INPUT_RECORD_BUTTON_RELEASE,
+
+  } InputRecordType;
+
+
+/* Flags stored in the context record. */
+#define INPUT_RECORD_RECTIFY  (1 << 0)
+#define INPUT_RECORD_ROUNDIFY (1 << 1)
+#define INPUT_RECORD_ARROW    (1 << 2)
+
+/* The recorded event carries a pressure axis. */
+#define INPUT_RECORD_HAS_PRESSURE (1 << 0)
+
+
+/* A single record of the input recording. */
+typedef struct
+{
+
+  /* Kind of record. */
+  InputRecordType type;
+
+  /* Index of the master device (device record: index declared). */
+  guint8 master;
+
+  /* Index of the slave device. */
+  guint8 slave;
+
+  /* Device name (only for the device record). */
+  gchar *name;
+
+  /* Event time in milliseconds. */
+  guint32 time;
+
+  /* Event coordinates. */
+  gdouble x;
+  gdouble y;
+
+  /* Pressure axis value. */
+  gdouble pressure;
+
+  /* Event flags e.g. INPUT_RECORD_HAS_PRESSURE. */
+  guint8 event_flags;
+
+  /* Modifier and button state. */
+  guint32 state;
+
+  /* Button number. */
+  guint8 button;
+
+  /* Tool in use (context record). */
+  AnnotatePaintType tool;
+
+  /* Pen colour in RGBA format (context record). */
+  gchar color[9];
+
+  /* Tool thickness (context record). */
+  gdouble thickness;
+
+  /* Shape recognizer and arrow flags (context record). */
+  guint8 mode_flags;
+
+} InputRecord;
+
+
+/* Start to record the input events in the file. */
+gboolean
+start_input_recording        (gchar          *filename);
+
+
+/* Record the event reaching the annotation window; the recording is suspended during a replay. */
+void
+record_input_event           (AnnotateData   *data,
+                              GdkEvent       *ev);
+
+
+/* Stop to record the input events and close the file. */
+void
+stop_input_recording         ();
+
+
+/*
+ * Replay the input events stored in the file through the annotation
+ * window callbacks; if realtime is false the events are fed as fast
+ * as possible and the elapsed time is printed at the end.
+ */
+gboolean
+start_input_replay           (gchar          *filename,
+                              gboolean        realtime);
+
+
+/* Stop the replay and free the loaded records. */
+void
+stop_input_replay            ();
+
+
+#endif
@@ -22,201 +22,728 @@
 #include <iwb_loader.h>
 #include <annotation_window.h>
 #include <background_window.h>
-#include <gsf/gsf-output-stdio.h>
+#include <trace.h>
 #include <gsf/gsf-input-stdio.h>
 #include <gsf/gsf-utils.h>
 #include <gsf/gsf-infile.h>
 #include <gsf/gsf-infile-zip.h>
 
 
-/* Add the background image reference. */
+/*
+ * The archive of the loaded iwb file; the save-points are read
+ * from it on demand.
+ */
+static GsfInfile *iwb_archive = (GsfInfile *) NULL;
+
+/* Serialize the reads of the archive; they come also from the export threads. */
+static GMutex iwb_archive_mutex;
+
+/* The number of save-points read from the archive kept in memory. */
+#define IWB_CACHED_SAVEPOINTS 8
+
+/*
+ * The png of the last save-points read from the archive by member path
+ * and the paths, the most recent first; the undo and the redo read the
+ * same ones again. They are protected by the archive mutex.
+ */
+static GHashTable *iwb_cache = (GHashTable *) NULL;
+static GQueue iwb_cache_order = G_QUEUE_INIT;
+
+/* Incremented when the archive is closed; a png read before is not cached. */
+static guint iwb_archive_generation = 0;
+
+
+/* Read the whole member of the archive with the path e.g. images/ardesia_1_vellum.png. */
+static GBytes *
+read_archive_member (const gchar *path)
+{
+  GBytes *data = (GBytes *) NULL;
+
+  g_mutex_lock (&iwb_archive_mutex);
+
+  if (iwb_archive)
+    {
+      gchar **names = g_strsplit (path, "/", -1);
+      GsfInput *member = gsf_infile_child_by_aname (iwb_archive, (const char **) names);
+
+      if (member)
+        {
+          gsize size = (gsize) gsf_input_size (member);
+          guint8 *buffer = g_malloc (size);
+
+          if ((size == 0) || (gsf_input_read (member, size, buffer)))
+            {
+              data = g_bytes_new_take (buffer, size);
+            }
+          else
+            {
+              g_free (buffer);
+            }
+
+          g_object_unref (member);
+        }
+
+      g_strfreev (names);
+    }
+
+  g_mutex_unlock (&iwb_archive_mutex);
+
+  return data;
+}
+
+
+/* Get the cached png of the member and make it the most recent; the archive mutex must be held. */
+static GBytes *
+lookup_cache (const gchar *path)
+{
+  GBytes *png = (GBytes *) NULL;
+  GList *link = (GList *) NULL;
+
+  if (!iwb_cache)
+    {
+      return (GBytes *) NULL;
+    }
+
+  png = (GBytes *) g_hash_table_lookup (iwb_cache, path);
+
+  if (!png)
+    {
+      return (GBytes *) NULL;
+    }
+
+  link = g_queue_find_custom (&iwb_cache_order, path, (GCompareFunc) g_strcmp0);
+  g_queue_unlink (&iwb_cache_order, link);
+  g_queue_push_head_link (&iwb_cache_order, link);
+
+  return g_bytes_ref (png);
+}
+
+
+/* Cache the png of the member dropping the oldest one; the archive mutex must be held. */
+static void
+insert_cache (const gchar *path,
+              GBytes      *png)
+{
+  gchar *key = (gchar *) NULL;
+
+  if (!iwb_cache)
+    {
+      iwb_cache = g_hash_table_new_full (g_str_hash,
+                                         g_str_equal,
+                                         g_free,
+                                         (GDestroyNotify) g_bytes_unref);
+    }
+
+  if (g_hash_table_contains (iwb_cache, path))
+    {
+      return;
+    }
+
+  /* The key is owned by the table and shared with the queue. */
+  key = g_strdup (path);
+  g_hash_table_insert (iwb_cache, key, g_bytes_ref (png));
+  g_queue_push_head (&iwb_cache_order, key);
+
+  while (iwb_cache_order.length > IWB_CACHED_SAVEPOINTS)
+    {
+      g_hash_table_remove (iwb_cache, g_queue_pop_tail (&iwb_cache_order));
+    }
+}
+
+
+/* Load the png of the save-point from the archive on demand. */
+static GBytes *
+load_savepoint_from_archive (AnnotateSavepoint *savepoint)
+{
+  GBytes *png = (GBytes *) NULL;
+  guint generation = 0;
+
+  g_mutex_lock (&iwb_archive_mutex);
+  png = lookup_cache (savepoint->source);
+  generation = iwb_archive_generation;
+  g_mutex_unlock (&iwb_archive_mutex);
+
+  if (png)
+    {
+      return png;
+    }
+
+  TRACE_BEGIN ("iwb_load_savepoint");
+  png = read_archive_member (savepoint->source);
+  TRACE_END ("iwb_load_savepoint");
+
+  if (!png)
+    {
+      g_warning ("Unable to load the save-point %s from the iwb file", savepoint->source);
+      return (GBytes *) NULL;
+    }
+
+  g_mutex_lock (&iwb_archive_mutex);
+
+  /* The archive may have been replaced meanwhile; its members are not cached then. */
+  if ((iwb_archive) && (generation == iwb_archive_generation))
+    {
+      insert_cache (savepoint->source, png);
+    }
+
+  g_mutex_unlock (&iwb_archive_mutex);
+
+  return png;
+}
+
+
+/*
+ * Say if the href stays inside the project dir once extracted; an
+ * absolute path or a ".." component would write outside of it.
+ */
+static gboolean
+is_safe_href            (const gchar  *href)
+{
+  gchar **components = (gchar **) NULL;
+  gboolean safe = TRUE;
+  gint i = 0;
+
+  if ((!href) || (href[0] == '\0') || (g_path_is_absolute (href)) ||
+      (href[0] == '/') || (href[0] == '\\') || (strchr (href, ':')))
+    {
+      return FALSE;
+    }
+
+  components = g_strsplit_set (href, "/\\", -1);
+
+  for (i = 0; components[i]; i++)
+    {
+      if (g_strcmp0 (components[i], "..") == 0)
+        {
+          safe = FALSE;
+          break;
+        }
+    }
+
+  g_strfreev (components);
+  return safe;
+}
+
+
+/* Add the background image reference; the image is extracted in the project dir. */
 static void
 add_background_image_reference (gchar   *project_tmp_dir,
                                 xmlChar *href)
 {
+  gchar *background_path = (gchar *) NULL;
+  gchar *background_dir = (gchar *) NULL;
+  GBytes *image = (GBytes *) NULL;
+
+  if (!is_safe_href ((gchar *) href))
+    {
+      g_warning ("The background image %s is outside the iwb file; it is ignored", (gchar *) href);
+      return;
+    }
+
   /* It is an image */
-  gchar *background_path = "";
   background_path = g_build_filename (project_tmp_dir, href, (gchar *) 0);
+  background_dir = g_path_get_dirname (background_path);
+  image = read_archive_member ((gchar *) href);
+
+  g_mkdir_with_parents (background_dir, 0777);
+  g_free (background_dir);
+
+  if (image)
+    {
+      g_file_set_contents (background_path,
+                           g_bytes_get_data (image, NULL),
+                           g_bytes_get_size (image),
+                           NULL);
+      g_bytes_unref (image);
+    }
+
   set_background_type (2);
   update_background_image (background_path);
 }
 
 
-/* Add the background color reference. */
-static void
-add_background_color_reference (xmlXPathContextPtr  context,
-                                xmlChar            *ref)
+/* The namespaces used in the iwb content. */
+#define IWB_NAMESPACE "http://www.becta.org.uk/iwb"
+#define SVG_NAMESPACE "http://www.w3.org/2000/svg"
+
+
+/* An svg image, rect or group of paths of the iwb content indexed by its id. */
+typedef struct
 {
-  xmlChar *xpath = (xmlChar *) g_strdup_printf ("/iwb/svg:svg/svg:rect[@id='%s']", (gchar *) ref);
-  xmlXPathObjectPtr result = xmlXPathEvalExpression (xpath, context);
-  xmlNodePtr node = result->nodesetval->nodeTab[0];
 
-  /* e.g. rbg(255,255,255) */
-  xmlChar *fill = xmlGetProp (node, (xmlChar *) "fill");
-  gint open_bracket_index = g_substrlastpos ((const gchar *)fill, "(");
-  gint comma_index = g_substrlastpos ((const gchar *)fill, ",");
-  gint close_bracket_index = g_substrlastpos ((const gchar *)fill, ")");
+  /* The xlink:href of the image; NULL for a rect. */
+  gchar *href;
 
-  gchar *blue = g_substr ((const gchar *)fill, comma_index+1, close_bracket_index-1);
+  /* The paths of the group; NULL for an image or a rect. */
+  GPtrArray *paths;
 
-  guint16 bd =  (guint16) g_ascii_strtoull (blue, NULL, 10);
-  g_free(blue);
+  /* The fill of the rect e.g. rgb(255,255,255). */
+  gchar *fill;
 
-  gchar *remain_string = g_substr ((const gchar *)fill, open_bracket_index+1, comma_index-1);
+  /* The fill-opacity of the rect. */
+  gchar *fill_opacity;
 
-  g_free ( (gchar*) fill);
+} IwbShape;
 
-  /* e.g. 255,255 */
-  comma_index = g_substrlastpos ((const gchar *)remain_string, ",");
 
-  gchar *red = g_substr ((const gchar *)remain_string, 0, comma_index-1);
+/* An iwb:element referencing a shape. */
+typedef struct
+{
 
-  guint16 rd =  (guint16) g_ascii_strtoull (red, NULL, 10);
+  /* The id of the shape. */
+  gchar *ref;
 
-  g_free(red);
+  /* Is it the background? */
+  gboolean background;
 
-  gchar *green = g_substr ((const gchar *)remain_string, comma_index+1, strlen (remain_string)-1);
+} IwbReference;
 
-  guint16 gd =  (guint16) g_ascii_strtoull (green, NULL, 10);
 
-  g_free(green);
+/* Free the shape. */
+static void
+free_shape (IwbShape *shape)
+{
+  if (shape->paths)
+    {
+      g_ptr_array_unref (shape->paths);
+    }
 
-  g_free(remain_string);
+  g_free (shape->href);
+  g_free (shape->fill);
+  g_free (shape->fill_opacity);
+  g_free (shape);
+}
 
-  /* e.g. 255 */
-  xmlChar *alpha = xmlGetProp (node, (xmlChar *) "fill-opacity");
-  guint16 ad =  (guint16) g_ascii_strtoull ((gchar *) alpha, NULL, 10);
 
-  /* FFFFFFFF */
+/* Free the reference. */
+static void
+free_reference (IwbReference *reference)
+{
+  g_free (reference->ref);
+  g_free (reference);
+}
 
-  gchar *rgba = g_strdup_printf ("%02x%02x%02x%02x",
-                                 rd,
-                                 gd,
-                                 bd,
-                                 ad);
 
-  if (g_strcmp0 (rgba, "00000000") != 0)
+/*
+ * Get the attribute of the current element matching the local name
+ * whatever is its namespace, e.g. href for xlink:href; NULL if missing.
+ */
+static gchar *
+get_attribute (xmlTextReaderPtr  reader,
+               const gchar      *local_name)
+{
+  gchar *value = (gchar *) NULL;
+  gint ret = xmlTextReaderMoveToFirstAttribute (reader);
+
+  while (ret == 1)
     {
-       set_background_type (1);
-       update_background_color (rgba);
+      if (xmlStrEqual (xmlTextReaderConstLocalName (reader), (xmlChar *) local_name))
+        {
+          value = g_strdup ((gchar *) xmlTextReaderConstValue (reader));
+          break;
+        }
+
+      ret = xmlTextReaderMoveToNextAttribute (reader);
     }
-  else
-    { 
-       update_background_color (rgba);
-       set_background_color ("000000FF");
+
+  xmlTextReaderMoveToElement (reader);
+  return value;
+}
+
+
+/* Index the svg image or rect by its id. */
+static void
+add_shape (xmlTextReaderPtr   reader,
+           GHashTable        *shapes,
+           gboolean           is_image)
+{
+  gchar *id = get_attribute (reader, "id");
+  IwbShape *shape = (IwbShape *) NULL;
+
+  if (!id)
+    {
+      return;
     }
 
+  shape = g_malloc0 ((gsize) sizeof (IwbShape));
 
-  g_free( (gchar *) alpha);
-  g_free( (gchar *) xpath);
+  if (is_image)
+    {
+      shape->href = get_attribute (reader, "href");
+    }
+  else
+    {
+      shape->fill = get_attribute (reader, "fill");
+      shape->fill_opacity = get_attribute (reader, "fill-opacity");
+    }
+
+  g_hash_table_replace (shapes, id, shape);
 }
 
 
-/* Follow the ref and load the associated save-point. */
-void
-load_background_by_reference (gchar               *project_tmp_dir,
-                              xmlXPathContextPtr   context,
-                              xmlChar             *ref)
+/* Parse the svg colour e.g. rgb(255,0,0) with the opacity in the RGBA string. */
+static gchar *
+parse_color (const gchar *rgb,
+             const gchar *opacity)
 {
-  xmlChar *xpath = (xmlChar *) g_strdup_printf ("/iwb/svg:svg/svg:image[@id='%s']", (gchar *) ref);
-  xmlXPathObjectPtr result = xmlXPathEvalExpression (xpath, context);
+  guint r = 0;
+  guint g = 0;
+  guint b = 0;
+  gdouble a = 1.0;
 
-  if (result->nodesetval)
+  if ((!rgb) || (sscanf (rgb, "rgb(%u,%u,%u)", &r, &g, &b) != 3))
     {
-      xmlNodePtr node = result->nodesetval->nodeTab[0];
-      xmlChar *href = xmlGetProp (node, (xmlChar *) "href");
+      return (gchar *) NULL;
+    }
 
-      if (!href)
-        {
-          add_background_color_reference (context, ref);
-        }
-      else
-        {
-          add_background_image_reference (project_tmp_dir, href);
-        }
+  if (opacity)
+    {
+      a = CLAMP (g_ascii_strtod (opacity, NULL), 0.0, 1.0);
     }
-  /* Cleanup of XPath data. */
-  xmlXPathFreeObject (result);
-  g_free ((gchar *) xpath);
+
+  return g_strdup_printf ("%02X%02X%02X%02X",
+                          MIN (r, 255),
+                          MIN (g, 255),
+                          MIN (b, 255),
+                          (guint) (a * 255 + 0.5));
 }
 
 
-/* Follow the ref and load the associated save-point. */
-GSList *
-load_savepoint_by_reference (GSList              *savepoint_list,
-                             gchar               *project_tmp_dir,
-                             xmlXPathContextPtr   context,
-                             xmlChar             *ref)
+/* Read the svg path painted by the pen; NULL if it is not valid. */
+static AnnotatePath *
+read_path (xmlTextReaderPtr reader)
 {
-  xmlChar *xpath = (xmlChar *) g_strdup_printf ("/iwb/svg:svg/svg:image[@id='%s']", (gchar *) ref);
-  xmlXPathObjectPtr result = xmlXPathEvalExpression (xpath, context); 
-  AnnotateSavepoint *savepoint = g_malloc ( (gsize) sizeof (AnnotateSavepoint));
-  xmlNodePtr node = result->nodesetval->nodeTab[0];
-  xmlChar *href = xmlGetProp (node, (xmlChar *) "href");
-  g_free ((gchar *) xpath);
+  AnnotatePath *path = (AnnotatePath *) NULL;
+  gchar *data = get_attribute (reader, "d");
+  gchar *stroke = get_attribute (reader, "stroke");
+  gchar *stroke_opacity = get_attribute (reader, "stroke-opacity");
+  gchar *stroke_width = get_attribute (reader, "stroke-width");
+  gchar *fill = get_attribute (reader, "fill");
+  gchar *color = parse_color (stroke, stroke_opacity);
+
+  if ((data) && (color))
+    {
+      path = canvas_path_new (data,
+                              color,
+                              stroke_width ? g_ascii_strtod (stroke_width, NULL) : 1.0,
+                              (fill) && (g_strcmp0 (fill, "none") != 0));
+    }
 
-  savepoint->filename  = g_build_filename (project_tmp_dir, href, (gchar *) 0);
-  
-  xmlFree (href);
+  g_free (data);
+  g_free (stroke);
+  g_free (stroke_opacity);
+  g_free (stroke_width);
+  g_free (fill);
+  g_free (color);
 
-  /* Add to the save-point list. */
-  savepoint_list = g_slist_prepend (savepoint_list, savepoint);
+  return path;
+}
 
-  /* Cleanup of XPath data. */
-  xmlXPathFreeObject (result);
 
-  return savepoint_list;
+/*
+ * Index the group of paths by its id and return it to collect
+ * the paths; NULL if it can not contain paths.
+ */
+static IwbShape *
+add_group (xmlTextReaderPtr   reader,
+           GHashTable        *shapes)
+{
+  gchar *id = get_attribute (reader, "id");
+  IwbShape *shape = (IwbShape *) NULL;
+
+  if ((!id) || (xmlTextReaderIsEmptyElement (reader)))
+    {
+      g_free (id);
+      return (IwbShape *) NULL;
+    }
+
+  shape = g_malloc0 ((gsize) sizeof (IwbShape));
+  shape->paths = g_ptr_array_new_with_free_func ((GDestroyNotify) canvas_path_free);
+  g_hash_table_replace (shapes, id, shape);
+
+  return shape;
 }
 
 
-/* Decompress infile in dest_dir. */
+/* Add the path to the group. */
 static void
-decompress_infile (GsfInfile *infile,
-                   gchar     *dest_dir)
+add_path (xmlTextReaderPtr   reader,
+          IwbShape          *group)
 {
-  GError   *err = (GError *) NULL;
-  int j = 0;
+  AnnotatePath *path = read_path (reader);
 
-  for (j = 0; j < gsf_infile_num_children (infile); j++)
+  if (path)
     {
-      GsfInput *child = gsf_infile_child_by_index (infile, j);
-      char const* filename = gsf_input_name (child);
-      gboolean is_dir = gsf_infile_num_children (GSF_INFILE (child)) >= 0;
+      g_ptr_array_add (group->paths, path);
+    }
+}
+
+
+/* Store the iwb:element in the document order. */
+static void
+add_reference (xmlTextReaderPtr   reader,
+               GPtrArray         *references)
+{
+  gchar *ref = get_attribute (reader, "ref");
+  gchar *background = (gchar *) NULL;
+  IwbReference *reference = (IwbReference *) NULL;
+
+  if (!ref)
+    {
+      return;
+    }
 
-      if (is_dir)
+  background = get_attribute (reader, "background");
+
+  reference = g_malloc ((gsize) sizeof (IwbReference));
+  reference->ref = ref;
+  reference->background = (g_strcmp0 (background, "true") == 0);
+  g_ptr_array_add (references, reference);
+
+  g_free (background);
+}
+
+
+/*
+ * Parse the iwb content in a single streaming pass indexing the shapes
+ * by id and collecting the references; return FALSE if it is malformed.
+ */
+static gboolean
+parse_iwb_content (GBytes      *content,
+                   GHashTable  *shapes,
+                   GPtrArray   *references)
+{
+  xmlTextReaderPtr reader = xmlReaderForMemory (g_bytes_get_data (content, NULL),
+                                                (int) g_bytes_get_size (content),
+                                                "content.xml",
+                                                NULL,
+                                                XML_PARSE_NONET);
+  gint ret = 0;
+
+  /* The group of paths being read and its depth. */
+  IwbShape *group = (IwbShape *) NULL;
+  gint group_depth = 0;
+
+  if (reader == NULL)
+    {
+      return FALSE;
+    }
+
+  while ((ret = xmlTextReaderRead (reader)) == 1)
+    {
+      const xmlChar *name = (const xmlChar *) NULL;
+      const xmlChar *ns = (const xmlChar *) NULL;
+      gint type = xmlTextReaderNodeType (reader);
+
+      if ((type == XML_READER_TYPE_END_ELEMENT) &&
+          (group) &&
+          (xmlTextReaderDepth (reader) == group_depth))
         {
-          gchar *dir_path = g_build_filename (dest_dir, filename, (gchar *) 0);
-          decompress_infile (GSF_INFILE (child), dir_path);
-          g_free (dir_path);
+          group = (IwbShape *) NULL;
+          continue;
         }
-      else
+
+      if (type != XML_READER_TYPE_ELEMENT)
         {
-          gchar *file_path = g_build_filename (dest_dir, filename, (gchar *) 0);
-          GsfOutput *output = GSF_OUTPUT (gsf_output_stdio_new (file_path, &err));
-          gsf_input_copy (child, output);
-          gsf_output_close (output);
-          g_object_unref (output);
-          g_free (file_path);
+          continue;
         }
 
-      g_object_unref (G_OBJECT (child));
+      name = xmlTextReaderConstLocalName (reader);
+      ns = xmlTextReaderConstNamespaceUri (reader);
+
+      if (xmlStrEqual (ns, (xmlChar *) SVG_NAMESPACE))
+        {
+          if (xmlStrEqual (name, (xmlChar *) "image"))
+            {
+              add_shape (reader, shapes, TRUE);
+            }
+          else if (xmlStrEqual (name, (xmlChar *) "rect"))
+            {
+              add_shape (reader, shapes, FALSE);
+            }
+          else if ((xmlStrEqual (name, (xmlChar *) "g")) && (!group))
+            {
+              group = add_group (reader, shapes);
+              group_depth = xmlTextReaderDepth (reader);
+            }
+          else if ((xmlStrEqual (name, (xmlChar *) "path")) && (group))
+            {
+              add_path (reader, group);
+            }
+        }
+      else if ((xmlStrEqual (ns, (xmlChar *) IWB_NAMESPACE)) &&
+               (xmlStrEqual (name, (xmlChar *) "element")))
+        {
+          add_reference (reader, references);
+        }
+    }
+
+  xmlFreeTextReader (reader);
+
+  return (ret == 0);
+}
+
+
+/* Add the background color reference. */
+static void
+add_background_color_reference (IwbShape *shape)
+{
+  guint r = 0;
+  guint g = 0;
+  guint b = 0;
+  guint a = 0;
+  gchar *rgba = (gchar *) NULL;
+
+  /* e.g. rgb(255,255,255) */
+  if ((!shape->fill) ||
+      (sscanf (shape->fill, "rgb(%u,%u,%u)", &r, &g, &b) != 3))
+    {
+      g_warning ("Invalid background color in the iwb file");
+      return;
+    }
+
+  /* e.g. 255 */
+  if (shape->fill_opacity)
+    {
+      a = (guint) g_ascii_strtoull (shape->fill_opacity, NULL, 10);
     }
+
+  /* FFFFFFFF */
+  rgba = g_strdup_printf ("%02x%02x%02x%02x",
+                          MIN (r, 255),
+                          MIN (g, 255),
+                          MIN (b, 255),
+                          MIN (a, 255));
+
+  if (g_strcmp0 (rgba, "00000000") != 0)
+    {
+       set_background_type (1);
+       update_background_color (rgba);
+    }
+  else
+    { 
+       update_background_color (rgba);
+       set_background_color ("000000FF");
+    }
+
+  g_free (rgba);
 }
 
 
-/* Decompress the iwb file; it is a zip file. */
+/* Load the background shape. */
 static void
-decompress_iwb (gchar *iwbfile,
-                gchar *project_tmp_dir)
+load_background (gchar     *project_tmp_dir,
+                 IwbShape  *shape)
+{
+  if (!shape->href)
+    {
+      add_background_color_reference (shape);
+    }
+  else
+    {
+      add_background_image_reference (project_tmp_dir, (xmlChar *) shape->href);
+    }
+}
+
+
+/*
+ * Add the save-point of the shape; a group of paths is painted
+ * over the previous save-point when it is restored.
+ */
+static GSList *
+load_savepoint (GSList    *savepoint_list,
+                IwbShape  *shape)
+{
+  AnnotateSavepoint *savepoint = (AnnotateSavepoint *) NULL;
+
+  if (shape->paths)
+    {
+      savepoint = canvas_savepoint_new ((gchar *) NULL, (GBytes *) NULL);
+      savepoint->paths = g_ptr_array_ref (shape->paths);
+      return g_slist_prepend (savepoint_list, savepoint);
+    }
+
+  if (!shape->href)
+    {
+      g_warning ("The iwb save-point has not an image");
+      return savepoint_list;
+    }
+
+  savepoint = canvas_savepoint_new ((gchar *) NULL, (GBytes *) NULL);
+
+  /* The png will be read from the archive on the first access. */
+  savepoint->source = g_strdup (shape->href);
+  savepoint->load = load_savepoint_from_archive;
+
+  /* Add to the save-point list. */
+  return g_slist_prepend (savepoint_list, savepoint);
+}
+
+
+/*
+ * Close the archive opened by load_iwb; the lazy save-points
+ * that have not been read yet cannot be loaded anymore.
+ */
+void
+close_iwb_archive ()
+{
+  g_mutex_lock (&iwb_archive_mutex);
+
+  if (iwb_archive)
+    {
+      g_object_unref (iwb_archive);
+      iwb_archive = (GsfInfile *) NULL;
+    }
+
+  /* The member paths are reused by the next archive. */
+  iwb_archive_generation++;
+  g_queue_clear (&iwb_cache_order);
+
+  if (iwb_cache)
+    {
+      g_hash_table_remove_all (iwb_cache);
+    }
+
+  g_mutex_unlock (&iwb_archive_mutex);
+}
+
+
+/* Is the archive of the lazy save-points open? */
+gboolean
+is_iwb_archive_open ()
+{
+  gboolean open = FALSE;
+
+  g_mutex_lock (&iwb_archive_mutex);
+  open = (iwb_archive != NULL);
+  g_mutex_unlock (&iwb_archive_mutex);
+
+  return open;
+}
+
+
+/*
+ * Open the archive of the iwb file, it is a zip file, to read the lazy
+ * save-points; the archive already opened is closed.
+ */
+gboolean
+open_iwb_archive (gchar *iwbfile)
 {
   GError   *err = (GError *) NULL;
   GsfInput   *input = (GsfInput *) NULL;
   GsfInfile  *infile = (GsfInfile *) NULL;
-  
-  gsf_init ();
+
+  close_iwb_archive ();
 
   input = gsf_input_stdio_new (iwbfile, &err);
 
+  if (input == NULL)
+    {
+      g_warning ("Error opening iwb file %s: %s", iwbfile, err->message);
+      g_error_free (err);
+      return FALSE;
+    }
+
   infile = gsf_infile_zip_new (input, &err);
   g_object_unref (G_OBJECT (input));
 
@@ -224,70 +751,56 @@ decompress_iwb (gchar *iwbfile,
     {
       g_warning ("Error decompressing iwb file %s: %s", iwbfile, err->message);
       g_error_free (err);
-      return;
+      return FALSE;
     }
 
-  decompress_infile (infile, project_tmp_dir);
-  g_object_unref (G_OBJECT (infile));
-  gsf_shutdown ();
-}
+  g_mutex_lock (&iwb_archive_mutex);
+  iwb_archive = infile;
+  g_mutex_unlock (&iwb_archive_mutex);
 
-
-/* Add iwb name spaces to the xmlXPathContext. */
-static xmlXPathContextPtr register_namespaces (xmlXPathContextPtr context)
-{
-  xmlXPathRegisterNs (context, (xmlChar *) "iwb", (xmlChar *) "http://www.becta.org.uk/iwb");
-  xmlXPathRegisterNs (context, (xmlChar *) "xlink", (xmlChar *) "http://www.w3.org/1999/xlink");
-  xmlXPathRegisterNs (context, (xmlChar *) "svg", (xmlChar *) "http://www.w3.org/2000/svg");
-  return context;
+  return TRUE;
 }
 
 
-/* Load save-points from iwb. */
+/* Load save-points from the references resolving the ids through the index. */
 static GSList *
-load_savepoints_by_iwb (GSList             *savepoint_list,
-                        gchar              *project_tmp_dir,
-                        xmlXPathContextPtr  context)
+load_savepoints_by_iwb (GSList      *savepoint_list,
+                        gchar       *project_tmp_dir,
+                        GHashTable  *shapes,
+                        GPtrArray   *references)
 {
-  xmlChar *xpath_get_element = (xmlChar *) "/iwb/iwb:element";
-  xmlXPathObjectPtr result = xmlXPathEvalExpression (xpath_get_element, context);
-  gint i =0;
-
-  if (xmlXPathNodeSetIsEmpty (result->nodesetval))
-    {
-      return savepoint_list;
-    }
+  guint i = 0;
 
   /* Surf for all the iwb element. */
-  for (i=0; i < result->nodesetval->nodeNr; i++)
+  for (i = 0; i < references->len; i++)
     {
-      xmlNodePtr node = result->nodesetval->nodeTab[i];
-      xmlChar *ref = xmlGetProp (node, (xmlChar *) "ref");
-      xmlChar *background = xmlGetProp (node, (xmlChar *) "background");
+      IwbReference *reference = (IwbReference *) g_ptr_array_index (references, i);
+      IwbShape *shape = (IwbShape *) g_hash_table_lookup (shapes, reference->ref);
 
-      if (background)
+      if (!shape)
         {
-          if (g_strcmp0 ( (gchar *) background, "true") == 0)
-            { 
-              load_background_by_reference (project_tmp_dir, context, ref);
-              xmlFree (background);
-            }
+          g_warning ("The iwb element %s references nothing", reference->ref);
+          continue;
+        }
+
+      if (reference->background)
+        {
+          load_background (project_tmp_dir, shape);
         }
       else
         {
-          /* Follow the ref and take xlink href filename. */
-          savepoint_list = load_savepoint_by_reference (savepoint_list, project_tmp_dir, context, ref);
+          savepoint_list = load_savepoint (savepoint_list, shape);
         }
-      xmlFree (ref);
     }
 
-  /* Cleanup of XPath data. */
-  xmlXPathFreeObject (result);
   return savepoint_list;
 }
 
 
-/* Load an iwb file and create the list of save-point. */
+/*
+ * Load an iwb file and create the list of save-point;
+ * return NULL if the file can not be read or it is malformed.
+ */
 GSList *
 load_iwb (gchar *iwbfile)
 {
@@ -297,57 +810,62 @@ load_iwb (gchar *iwbfile)
   gchar  *project_name = get_project_name ();
   gchar  *project_tmp_dir = g_build_filename (ardesia_tmp_dir, project_name, (gchar *) 0);
   gchar  *content_filename = "content.xml";
-  gchar  *content_filepath = g_build_filename (project_tmp_dir, content_filename, (gchar *) 0);
-  xmlDocPtr doc = (xmlDocPtr) NULL; // the resulting document tree
-  xmlXPathContextPtr context = (xmlXPathContextPtr) NULL;
-
-  decompress_iwb (iwbfile, project_tmp_dir);
-  
-  /* Initialize libxml. */
-  xmlInitParser ();
+  GBytes *content = (GBytes *) NULL;
+  GHashTable *shapes = (GHashTable *) NULL;
+  GPtrArray *references = (GPtrArray *) NULL;
 
-  /*
-   * This initialize the library and check potential ABI mismatches
-   * between the version it was compiled for and the actual shared
-   * library used.
-   */
-  LIBXML_TEST_VERSION
+  TRACE_BEGIN ("load_iwb");
 
-    /*
-     * Build an XML tree from a the file.
-     */
-    doc = xmlParseFile (content_filepath);
-
-  if (doc == NULL)
+  /* Only the xml content is read now; the images are read on demand. */
+  if (open_iwb_archive (iwbfile))
     {
-      printf ("Failed to parse %s\n", content_filepath);
-      exit (EXIT_FAILURE);
+      content = read_archive_member (content_filename);
     }
 
-  context = xmlXPathNewContext (doc);
-
-  if (context == NULL)
+  if (content)
     {
-      xmlFreeDoc (doc); 
-      printf ("Error: unable to create new XPath context\n");
-      exit (EXIT_FAILURE);
-    }
+      /*
+       * This initialize the library and check potential ABI mismatches
+       * between the version it was compiled for and the actual shared
+       * library used.
+       */
+      LIBXML_TEST_VERSION
 
-  context = register_namespaces (context);
+      shapes = g_hash_table_new_full (g_str_hash,
+                                      g_str_equal,
+                                      g_free,
+                                      (GDestroyNotify) free_shape);
 
-  savepoint_list = load_savepoints_by_iwb (savepoint_list, project_tmp_dir, context);
+      references = g_ptr_array_new_with_free_func ((GDestroyNotify) free_reference);
 
-  g_remove (content_filepath);
+      if (parse_iwb_content (content, shapes, references))
+        {
+          savepoint_list = load_savepoints_by_iwb (savepoint_list, project_tmp_dir, shapes, references);
+        }
+      else
+        {
+          g_warning ("Failed to parse %s in %s", content_filename, iwbfile);
+        }
 
-  xmlXPathFreeContext (context);
+      g_hash_table_destroy (shapes);
+      g_ptr_array_free (references, TRUE);
+      g_bytes_unref (content);
 
-  xmlFreeDoc (doc);
-  doc = NULL;
+      /*
+       * Cleanup function for the XML library.
+       */
+      xmlCleanupParser ();
+    }
+  else
+    {
+      g_warning ("Failed to read %s in %s", content_filename, iwbfile);
+    }
 
-  /*
-   * Cleanup function for the XML library.
-   */
-  xmlCleanupParser ();
+  /* Without save-points there is nothing to read from the archive. */
+  if (!savepoint_list)
+    {
+      close_iwb_archive ();
+    }
 
   g_free (ardesia_tmp_dir);
   ardesia_tmp_dir = NULL;
@@ -355,10 +873,7 @@ load_iwb (gchar *iwbfile)
   g_free (project_tmp_dir);
   project_tmp_dir = NULL;
 
-  g_free (content_filepath);
-  content_filepath = NULL;
+  TRACE_END ("load_iwb");
 
   return savepoint_list;
 }
-
-
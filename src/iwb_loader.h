@@ -21,12 +21,34 @@
 #include <glib.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
 
 
-/* Load an iwb file and create the list of save-point. */
+/*
+ * Load an iwb file and create the list of save-point;
+ * return NULL if the file can not be read or it is malformed.
+ */
 GSList *
 load_iwb (gchar *iwb_filename);
 
 
+/*
+ * Open the archive of the iwb file, it is a zip file, to read the lazy
+ * save-points; the archive already opened is closed.
+ */
+gboolean
+open_iwb_archive (gchar *iwbfile);
+
+
+/*
+ * Close the archive opened by load_iwb; the lazy save-points
+ * that have not been read yet cannot be loaded anymore.
+ */
+void
+close_iwb_archive ();
+
+
+/* Is the archive of the lazy save-points open? */
+gboolean
+is_iwb_archive_open ();
+
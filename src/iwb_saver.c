@@ -24,16 +24,26 @@
 
 #include <utils.h>
 #include <iwb_saver.h>
+#include <iwb_loader.h>
+#include <annotation_window.h>
 #include <background_window.h>
+#include <trace.h>
 #include <gsf/gsf-utils.h>
 #include <gsf/gsf-output-stdio.h>
-#include <gsf/gsf-input-stdio.h>
 #include <gsf/gsf-outfile.h>
 #include <gsf/gsf-outfile-zip.h>
 
+#include <fcntl.h>
 
-/* The file pointer to the iwb file. */
-static FILE *fp = NULL;
+
+/* The xml content of the iwb file; it is built in memory. */
+static GString *content = (GString *) NULL;
+
+/*
+ * The image file of each save-point in the iwb, oldest first; NULL for
+ * the save-points made of paths. The identical images share the file.
+ */
+static GPtrArray *savepoint_images = (GPtrArray *) NULL;
 
 
 /* Add the xml header. */
@@ -45,12 +55,12 @@ add_header ()
   gchar *xlink_ns    = "http://www.w3.org/1999/xlink";
   gchar *iwb_version = "1.0";
 
-  fprintf (fp,
-           "<iwb xmlns:iwb=\"%s\" xmlns:svg=\"%s\" xmlns:xlink=\"%s\" version=\"%s\">\n",
-           becta_ns,
-           svg_ns,
-           xlink_ns,
-           iwb_version);
+  g_string_append_printf (content,
+                          "<iwb xmlns:iwb=\"%s\" xmlns:svg=\"%s\" xmlns:xlink=\"%s\" version=\"%s\">\n",
+                          becta_ns,
+                          svg_ns,
+                          xlink_ns,
+                          iwb_version);
 
 }
 
@@ -59,7 +69,7 @@ add_header ()
 static void
 close_iwb ()
 {
-  fprintf (fp, "</iwb>\n");
+  g_string_append (content, "</iwb>\n");
 }
 
 
@@ -70,12 +80,12 @@ open_svg ()
   gint width  = gdk_screen_width ();
   gint height = gdk_screen_height ();
 
-  fprintf (fp,
-           "\t<svg:svg width=\"%d\" height=\"%d\" viewbox=\"0 0 %d %d\">\n",
-           width,
-           height,
-           width,
-           height);
+  g_string_append_printf (content,
+                          "\t<svg:svg width=\"%d\" height=\"%d\" viewbox=\"0 0 %d %d\">\n",
+                          width,
+                          height,
+                          width,
+                          height);
 
 }
 
@@ -84,27 +94,36 @@ open_svg ()
 static void
 close_svg ()
 {
-  fprintf (fp,"\t</svg:svg>\n");
+  g_string_append (content, "\t</svg:svg>\n");
 }
 
 
-/* Add the savepoint element. */
+/* Get the name of the image file with the index. */
+static gchar *
+get_image_name (gint index)
+{
+  return g_strdup_printf ("%s_%d_vellum.png", PACKAGE_NAME, index);
+}
+
+
+/* Add the savepoint element referencing the image in the images folder. */
 static void
-add_savepoint (gint index)
+add_savepoint (gint         index,
+               const gchar *image)
 {
   gint width = gdk_screen_width ();
   gint height = gdk_screen_height ();
   gchar *id = g_strdup_printf ("id%d", index +1);
-  gchar *file = g_strdup_printf ("images/%s_%d_vellum.png", PACKAGE_NAME, index);
+  gchar *file = g_strdup_printf ("images/%s", image);
 
   open_svg ();
 
-  fprintf (fp,
-           "\t\t<svg:image id=\"%s\" xlink:href=\"%s\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\"/>\n",
-           id,
-           file,
-           width,
-           height);
+  g_string_append_printf (content,
+                          "\t\t<svg:image id=\"%s\" xlink:href=\"%s\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\"/>\n",
+                          id,
+                          file,
+                          width,
+                          height);
 
   g_free (file);
   file = NULL;
@@ -113,39 +132,92 @@ add_savepoint (gint index)
 }
 
 
+/* Add the path element with the pen style. */
+static void
+add_path (AnnotatePath *path)
+{
+  guint r = 0;
+  guint g = 0;
+  guint b = 0;
+  guint a = 0;
+  gchar opacity[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar width[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar *rgb = (gchar *) NULL;
+
+  sscanf (path->color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+  rgb = g_strdup_printf ("rgb(%d,%d,%d)", r, g, b);
+
+  g_ascii_formatd (opacity, sizeof (opacity), "%.3f", a / 255.0);
+  g_ascii_formatd (width, sizeof (width), "%.2f", path->width);
+
+  g_string_append_printf (content,
+                          "\t\t\t<svg:path d=\"%s\" fill=\"%s\" fill-opacity=\"%s\" stroke=\"%s\" stroke-opacity=\"%s\" stroke-width=\"%s\" stroke-linecap=\"%s\" stroke-linejoin=\"%s\"/>\n",
+                          path->data,
+                          path->filled ? rgb : "none",
+                          opacity,
+                          rgb,
+                          opacity,
+                          width,
+                          path->filled ? "butt" : "round",
+                          path->filled ? "miter" : "round");
+
+  g_free (rgb);
+}
+
+
+/*
+ * Add the savepoint element made of paths; the paths are painted
+ * over the previous savepoints, that are referenced before it,
+ * then no image is stored.
+ */
+static void
+add_vector_savepoint (gint               index,
+                      AnnotateSavepoint *savepoint)
+{
+  gchar *id = g_strdup_printf ("id%d", index +1);
+  guint i = 0;
+
+  open_svg ();
+
+  g_string_append_printf (content, "\t\t<svg:g id=\"%s\">\n", id);
+
+  for (i = 0; i < savepoint->paths->len; i++)
+    {
+      add_path ((AnnotatePath *) g_ptr_array_index (savepoint->paths, i));
+    }
+
+  g_string_append (content, "\t\t</svg:g>\n");
+
+  g_free (id);
+  close_svg ();
+}
+
+
+/*
+ * Is the background an image to be stored in the iwb? The paper is
+ * stored as an image also because the iwb format has no pattern.
+ */
+static gboolean
+has_background_image (gchar *background_image)
+{
+  return (((background_image) && (get_background_type ()==2)) || (get_background_type ()==3));
+}
+
+
 /* Add the background element. */
 static void
-add_background (gchar *img_dir_path,
-                gchar *background_image)
+add_background (gchar *background_image)
 {
   gint width  = gdk_screen_width ();
   gint height = gdk_screen_height ();
-  gchar *image_destination_path = (gchar *) NULL;
-
-  image_destination_path = g_build_filename (img_dir_path, "ardesia_0_vellum.png", (gchar *) 0);
 
   /* Background image valid and set to image type */
-  if ((background_image) && (get_background_type ()==2))
+  if (has_background_image (background_image))
     {
-      /* if the background is oupdated */
-      if (g_strcmp0 (background_image, image_destination_path) != 0)
-        {
-          /* copy the file in ardesia_0_vellum.png under image_path overriding it */
-          GFile *image_destination = g_file_new_for_path(image_destination_path);
-          GFile *image_source = g_file_new_for_path(background_image);
-
-          g_file_copy (image_source,
-                       image_destination,
-                       G_FILE_COPY_OVERWRITE,
-                       NULL,
-                       NULL,
-                       NULL,
-                       NULL);
-
-          g_object_unref (image_source);
-          g_object_unref (image_destination);
-        }
-      add_savepoint (0);
+      /* The image will be stored as ardesia_0_vellum.png. */
+      gchar *image = get_image_name (0);
+      add_savepoint (0, image);
+      g_free (image);
     }
   else
     {
@@ -165,17 +237,15 @@ add_background (gchar *img_dir_path,
       gchar *rgb  =  g_strdup_printf ("rgb(%d,%d,%d)", r, g, b);
 
       open_svg ();
-      fprintf (fp,
-               "\t\t<svg:rect id=\"id1\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" fill=\"%s\" fill-opacity=\"%d\"/>\n",
-               width,
-               height,
-               rgb,
-               a);
+      g_string_append_printf (content,
+                              "\t\t<svg:rect id=\"id1\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" fill=\"%s\" fill-opacity=\"%d\"/>\n",
+                              width,
+                              height,
+                              rgb,
+                              a);
       close_svg ();
       g_free(rgb);
     }
-
-  g_free(image_destination_path);
 }
 
 
@@ -183,20 +253,86 @@ add_background (gchar *img_dir_path,
 static void
 add_background_reference ()
 {
-  fprintf (fp,
-           "\t<iwb:element ref=\"id1\" background=\"true\"/>\n");
+  g_string_append (content,
+                   "\t<iwb:element ref=\"id1\" background=\"true\"/>\n");
+}
+
+
+/*
+ * Give the image file to each save-point; the save-points sharing the
+ * png in memory or loaded from the same file share the image file.
+ * The save-points made of paths have no image, unless they erase.
+ */
+static void
+assign_savepoint_images (GSList *savepoints)
+{
+  GHashTable *pngs = g_hash_table_new (g_direct_hash, g_direct_equal);
+  GHashTable *sources = g_hash_table_new (g_str_hash, g_str_equal);
+  GSList *list = (GSList *) NULL;
+  gint i=1;
+
+  savepoint_images = g_ptr_array_new_with_free_func (g_free);
+
+  for (list = savepoints; list; list = list->next, i++)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+      gchar *image = (gchar *) NULL;
+
+      if ((savepoint->paths) && (!canvas_savepoint_erases (savepoint)))
+        {
+          g_ptr_array_add (savepoint_images, NULL);
+          continue;
+        }
+
+      if (savepoint->png)
+        {
+          image = (gchar *) g_hash_table_lookup (pngs, savepoint->png);
+        }
+      else if (savepoint->source)
+        {
+          image = (gchar *) g_hash_table_lookup (sources, savepoint->source);
+        }
+
+      image = image ? g_strdup (image) : get_image_name (i);
+
+      if (savepoint->png)
+        {
+          g_hash_table_insert (pngs, savepoint->png, image);
+        }
+      else if (savepoint->source)
+        {
+          g_hash_table_insert (sources, savepoint->source, image);
+        }
+
+      g_ptr_array_add (savepoint_images, image);
+    }
+
+  g_hash_table_destroy (pngs);
+  g_hash_table_destroy (sources);
 }
 
 
 /* Add the savepoint elements. */
 static void
-add_savepoints (gint savepoint_number)
+add_savepoints (GSList *savepoints)
 {
-  /* For each i call add_savepoint. */
+  /* For each i call add_savepoint or add_vector_savepoint. */
+  GSList *list = (GSList *) NULL;
   gint i=1;
-  for (i=1; i<=savepoint_number; i++)
+
+  for (list = savepoints; list; list = list->next, i++)
     {
-      add_savepoint (i);
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+      gchar *image = (gchar *) g_ptr_array_index (savepoint_images, i - 1);
+
+      if (image)
+        {
+          add_savepoint (i, image);
+        }
+      else
+        {
+          add_vector_savepoint (i, savepoint);
+        }
     }
 }
 
@@ -206,7 +342,7 @@ static void
 add_savepoint_reference (gint index)
 {
   gchar *id = g_strdup_printf ("id%d", index +1);
-  fprintf (fp,"\t<iwb:element ref=\"%s\" locked=\"true\"/>\n", id);
+  g_string_append_printf (content, "\t<iwb:element ref=\"%s\" locked=\"true\"/>\n", id);
   g_free (id);
 }
 
@@ -224,184 +360,751 @@ add_savepoint_references (gint savepoint_number)
 }
 
 
-/* Create the iwb xml content file. */
+/* Create the iwb xml content in memory; the save-points are the oldest first. */
 static void
-create_xml_content (gchar *content_filename,
-                    gchar *img_dir_path,
-                    gchar *background_image)
+create_xml_content (gchar  *background_image,
+                    GSList *savepoints)
 {
-  int savepoint_number = -1;
-  GDir *img_dir;  
-
-  fp = fopen (content_filename, "w");
+  content = g_string_new ("");
 
   add_header ();
-  add_background (img_dir_path, background_image);
+  add_background (background_image);
+  add_savepoints (savepoints);
+  add_background_reference ();
+  add_savepoint_references (g_slist_length (savepoints));
+  close_iwb ();
+}
 
-  if (!background_image)
-    {
-      savepoint_number = 0;
-    }
 
-  img_dir = g_dir_open (img_dir_path, 0, NULL);
+/* An entry of the images folder in the iwb zip. */
+typedef struct
+{
+
+  /* Name of the entry in the images folder. */
+  gchar *name;
+
+  /* The save-point to load if the image is not in memory. */
+  AnnotateSavepoint *savepoint;
+
+  /* The file to read if the image is neither in memory nor a save-point. */
+  gchar *filename;
+
+  /*
+   * The save-point in the copies, newest first, when its image is
+   * rendered painting its paths over the previous ones; NULL otherwise.
+   */
+  GSList *link;
 
-  while (g_dir_read_name (img_dir))
+  /* The content of the entry; NULL if it can not be read. */
+  GBytes *data;
+
+  /* Is the entry ready to be written? */
+  gboolean ready;
+
+} IwbEntry;
+
+
+/* The state shared by the export threads. */
+typedef struct
+{
+
+  /* The iwb file name. */
+  gchar *iwb_file;
+
+  /* The file written aside; it replaces the iwb file at the end. */
+  gchar *zip_filename;
+
+  /* The copies of the save-points taken at the start, oldest first. */
+  GSList *savepoints;
+
+  /* The same copies newest first, as canvas_savepoint_render wants them. */
+  GSList *history;
+
+  /* The size of the canvas. */
+  gint width;
+  gint height;
+
+  /* The canvas save-points that have been copied, oldest first. */
+  GPtrArray *originals;
+
+  /* The image file of each save-point, see assign_savepoint_images. */
+  GPtrArray *images;
+
+  /* The xml content. */
+  GString *content;
+
+  /* The images in the order in which they are written. */
+  GPtrArray *entries;
+
+  /* Protect the ready flag of the entries. */
+  GMutex mutex;
+  GCond cond;
+
+  /* Number of entries written; it is read by the progress timeout. */
+  gint written;
+
+  /* Has the writer finished? */
+  gint done;
+
+  /* Has the export been cancelled? */
+  gint cancelled;
+
+  /* Has the iwb been written? */
+  gboolean saved;
+
+  /* The threads loading the images and writing the zip. */
+  GThreadPool *pool;
+  GThread *writer;
+
+  /* Called in the main loop while the export runs and at the end. */
+  IwbExportProgress progress;
+  IwbExportDone done_callback;
+  gpointer user_data;
+
+} IwbExport;
+
+
+/* The export running in background, if any. */
+static IwbExport *running_export = (IwbExport *) NULL;
+
+
+/*
+ * Is the buffer a png or a jpeg? They are already deflated and
+ * compressing them again wastes time without reducing the size.
+ */
+static gboolean
+is_compressed_image (GBytes *data)
+{
+  gsize size = 0;
+  const guchar *buffer = g_bytes_get_data (data, &size);
+
+  if ((size >= 8) && (memcmp (buffer, "\211PNG\r\n\032\n", 8) == 0))
     {
-      savepoint_number++;
+      return TRUE;
     }
 
-  g_dir_close (img_dir);
-
-  add_savepoints (savepoint_number);
-  add_background_reference ();
-  add_savepoint_references (savepoint_number);
-  close_iwb ();
-  fclose (fp);
+  return ((size >= 3) && (buffer[0] == 0xFF) && (buffer[1] == 0xD8) && (buffer[2] == 0xFF));
 }
 
 
-/* Add the filename under path to the gst_outfile. */
-static void add_file_to_gst_outfile (GsfOutfile   *out_file,
-                                     gchar        *path,
-                                     const gchar  *file_name)
+/* Write the buffer as the file_name child of the gsf_outfile. */
+static void
+add_bytes_to_gsf_outfile (GsfOutfile   *out_file,
+                          const gchar  *file_name,
+                          GBytes       *data)
 {
-  GError   *err = (GError *) NULL;
-  gchar *file_path = g_build_filename (path, file_name, NULL);
-  GsfInput *input = GSF_INPUT (gsf_input_stdio_new (file_path, &err));
-  GsfOutput  *child  = gsf_outfile_new_child (out_file, file_name, FALSE);
-
-  gsf_input_copy (input, child);
+  gint compression = is_compressed_image (data) ? GSF_ZIP_STORED : GSF_ZIP_DEFLATED;
+  GsfOutput *child = gsf_outfile_new_child_full (out_file,
+                                                 file_name,
+                                                 FALSE,
+                                                 "compression-level", compression,
+                                                 (gchar *) NULL);
+
+  gsf_output_write (child, g_bytes_get_size (data), g_bytes_get_data (data, NULL));
   gsf_output_close (child);
   g_object_unref (child);
-  g_object_unref (input);
+}
+
 
-  g_free (file_path);
+/* The entry can be written; wake up the writer. */
+static void
+set_entry_ready (IwbExport  *export,
+                 IwbEntry   *entry)
+{
+  g_mutex_lock (&export->mutex);
+  entry->ready = TRUE;
+  g_cond_broadcast (&export->cond);
+  g_mutex_unlock (&export->mutex);
 }
 
 
-/* Add all the files in the folder under the working_dir to the gst_outfile. */
+/* Load the entry save-point or file; it runs in the thread pool. */
 static void
-add_folder_to_gst_outfile  (GsfOutfile  *gst_outfile,
-                            gchar       *working_dir,
-                            gchar       *folder)
+load_entry (IwbEntry   *entry,
+            IwbExport  *export)
 {
-  GsfOutfile *gst_dir = GSF_OUTFILE (gsf_outfile_new_child  (gst_outfile, folder, TRUE));
-  gchar *path = g_build_filename (working_dir, folder, NULL);
-  GDir *dir = g_dir_open (path, 0, NULL);
+  gchar *buffer = (gchar *) NULL;
+  gsize size = 0;
+  GError *err = (GError *) NULL;
+
+  TRACE_BEGIN ("iwb_load_entry");
 
-  if (dir)
+  /* The writer stops at the next entry. */
+  if (g_atomic_int_get (&export->cancelled))
+    {
+      entry->data = (GBytes *) NULL;
+    }
+  else if (entry->link)
     {
-      const gchar *file = (const gchar *) NULL;
+      cairo_surface_t *surface = canvas_savepoint_render (entry->link, export->width, export->height);
 
-      while ( (file = g_dir_read_name (dir)))
+      if ((surface) && (cairo_surface_status (surface) == CAIRO_STATUS_SUCCESS))
         {
-          add_file_to_gst_outfile (gst_dir, path, file);
+          entry->data = canvas_surface_to_png (surface);
         }
 
-      g_dir_close (dir);
+      if (surface)
+        {
+          cairo_surface_destroy (surface);
+        }
+    }
+  else if (entry->savepoint)
+    {
+      entry->data = canvas_savepoint_get_png (entry->savepoint);
+    }
+  else if (g_file_get_contents (entry->filename, &buffer, &size, &err))
+    {
+      entry->data = g_bytes_new_take (buffer, size);
+    }
+  else
+    {
+      g_warning ("Error reading %s: %s\n", entry->filename, err->message);
+      g_error_free (err);
     }
 
-  gsf_output_close ((GsfOutput *) gst_dir);
-  g_object_unref (gst_dir);
-  g_free (path);
+  TRACE_END ("iwb_load_entry");
+
+  set_entry_ready (export, entry);
 }
 
 
-/* Create the iwb file. */
+/* Wait until the entry has been prepared by the thread pool or the export is cancelled. */
 static void
-create_iwb (gchar *zip_filename,
-            gchar *working_dir,
-            gchar *images_folder,
-            gchar *content_filename)
+wait_entry (IwbExport  *export,
+            IwbEntry   *entry)
+{
+  g_mutex_lock (&export->mutex);
+
+  while ((!entry->ready) && (!g_atomic_int_get (&export->cancelled)))
+    {
+      g_cond_wait (&export->cond, &export->mutex);
+    }
+
+  g_mutex_unlock (&export->mutex);
+}
+
+
+/* Flush the file to the disk; return false on error. */
+static gboolean
+sync_file          (const gchar  *filename)
+{
+  gboolean synced = FALSE;
+  gint fd = g_open (filename, O_RDWR, 0);
+
+  if (fd < 0)
+    {
+      return FALSE;
+    }
+
+  synced = (g_fsync (fd) == 0);
+  g_close (fd, NULL);
+
+  return synced;
+}
+
+
+/*
+ * Write the iwb zip; it is the only writer and it runs in its own
+ * thread storing the entries in order as soon as they are ready.
+ */
+static gpointer
+write_iwb (IwbExport *export)
 {
   GError   *err = (GError *) NULL;
   GsfOutfile *gst_outfile  = (GsfOutfile *) NULL;
+  GsfOutfile *gst_dir  = (GsfOutfile *) NULL;
   GsfOutput  *gst_output = (GsfOutput *) NULL;
+  GBytes *xml = (GBytes *) NULL;
+  gboolean closed = FALSE;
+  guint i = 0;
 
-  gsf_init ();
+  TRACE_BEGIN ("iwb_write");
 
-  gst_output = gsf_output_stdio_new (zip_filename, &err);
+  gst_output = gsf_output_stdio_new (export->zip_filename, &err);
   if (gst_output == NULL) 
     {
       g_warning ("Error saving iwb: %s\n", err->message);
       g_error_free (err);
-      return;
+      g_atomic_int_set (&export->done, 1);
+      TRACE_END ("iwb_write");
+      return NULL;
     }
 
   gst_outfile  = gsf_outfile_zip_new (gst_output, &err);
+  g_object_unref (G_OBJECT (gst_output));
   if (gst_outfile == NULL)
     {
       g_warning ("Error in gsf_outfile_zip_new: %s\n", err->message);
       g_error_free (err);
-      return;
+      g_atomic_int_set (&export->done, 1);
+      TRACE_END ("iwb_write");
+      return NULL;
     }
 
-  g_object_unref (G_OBJECT (gst_output));
+  gst_dir = GSF_OUTFILE (gsf_outfile_new_child  (gst_outfile, "images", TRUE));
+
+  for (i = 0; i < export->entries->len; i++)
+    {
+      IwbEntry *entry = (IwbEntry *) g_ptr_array_index (export->entries, i);
+
+      wait_entry (export, entry);
+
+      if (g_atomic_int_get (&export->cancelled))
+        {
+          break;
+        }
+
+      if (entry->data)
+        {
+          add_bytes_to_gsf_outfile (gst_dir, entry->name, entry->data);
+        }
+
+      g_atomic_int_inc (&export->written);
+    }
 
-  add_folder_to_gst_outfile (gst_outfile, working_dir, images_folder);
+  gsf_output_close ((GsfOutput *) gst_dir);
+  g_object_unref (gst_dir);
 
-  add_file_to_gst_outfile (gst_outfile, working_dir, content_filename);
+  xml = g_bytes_new_static (export->content->str, export->content->len);
+  add_bytes_to_gsf_outfile (gst_outfile, "content.xml", xml);
+  g_bytes_unref (xml);
 
-  gsf_output_close ((GsfOutput *) gst_outfile);
+  closed = gsf_output_close ((GsfOutput *) gst_outfile);
   g_object_unref (G_OBJECT (gst_outfile));
 
-  gsf_shutdown ();  
+  /* The new file must be on the disk before it replaces the old one. */
+  if ((closed) && (!sync_file (export->zip_filename)))
+    {
+      g_warning ("Error syncing %s", export->zip_filename);
+      closed = FALSE;
+    }
+
+  TRACE_END ("iwb_write");
+
+  export->saved = (closed) && (!g_atomic_int_get (&export->cancelled));
+  g_atomic_int_set (&export->done, 1);
+  return NULL;
 }
 
 
-/* Export in the iwb format. */
-void
-export_iwb (gchar *iwb_location)
+/*
+ * Add the image entry; if the save-point is not in memory it will
+ * be loaded by the pool, as the file when there is no save-point.
+ */
+static IwbEntry *
+add_entry          (IwbExport          *export,
+                    GThreadPool        *pool,
+                    const gchar        *name,
+                    AnnotateSavepoint  *savepoint,
+                    const gchar        *filename)
 {
-  const gchar *tmpdir = g_get_tmp_dir ();
-  gchar *images = "images";
-  gchar *background_image = get_background_image();
-  gchar *project_name = get_project_name ();
-  gchar *ardesia_tmp_dir = g_build_filename (tmpdir, PACKAGE_NAME, (gchar *) 0);
-  gchar *project_tmp_dir = g_build_filename (ardesia_tmp_dir, project_name, (gchar *) 0);
-  gchar *img_dir_path = g_build_filename (project_tmp_dir, images, (gchar *) 0);
-  gchar *first_savepoint_file = g_strdup_printf ("%s%s%s_2_vellum.png", img_dir_path, G_DIR_SEPARATOR_S, PACKAGE_NAME);
-
-  /* if exist the file I continue to save */
-  if ((file_exists(first_savepoint_file)) || (background_image))
-    {
-      gchar *iwb_file = (gchar *) NULL;
-      gchar *content_filename = "content.xml";
-      gchar *content_filepath = g_build_filename (project_tmp_dir, content_filename, (gchar *) 0);
-      
-      /* If the iwb location is null means that it is a new project. */
-      if (iwb_location == NULL)
+  IwbEntry *entry = g_malloc ((gsize) sizeof (IwbEntry));
+
+  entry->name = g_strdup (name);
+  entry->savepoint = savepoint;
+  entry->filename = g_strdup (filename);
+  entry->link = (GSList *) NULL;
+  entry->data = (GBytes *) NULL;
+  entry->ready = FALSE;
+
+  g_ptr_array_add (export->entries, entry);
+
+  if ((savepoint) && (savepoint->png))
+    {
+      entry->data = g_bytes_ref (savepoint->png);
+      entry->ready = TRUE;
+    }
+  else if ((savepoint) && ((savepoint->load) || (savepoint->filename)))
+    {
+      g_thread_pool_push (pool, entry, NULL);
+    }
+  else if ((!savepoint) && (filename))
+    {
+      g_thread_pool_push (pool, entry, NULL);
+    }
+  else if ((savepoint) && (savepoint->paths))
+    {
+      /* It is rendered from the previous save-points, see create_iwb. */
+    }
+  else
+    {
+      entry->ready = TRUE;
+    }
+
+  return entry;
+}
+
+
+/* Free the image entry. */
+static void
+free_entry (IwbEntry *entry)
+{
+  if (entry->data)
+    {
+      g_bytes_unref (entry->data);
+    }
+
+  g_free (entry->name);
+  g_free (entry->filename);
+  g_free (entry);
+}
+
+
+/*
+ * Start writing the iwb file; the images not kept in memory are read
+ * by a thread pool and one thread writes the zip in order.
+ */
+static void
+create_iwb (IwbExport  *export,
+            gchar      *background_image)
+{
+  GHashTable *added = g_hash_table_new (g_str_hash, g_str_equal);
+  GSList *list = (GSList *) NULL;
+  guint length = g_slist_length (export->savepoints);
+  gint index = 0;
+
+  export->pool = g_thread_pool_new ((GFunc) load_entry,
+                                    export,
+                                    g_get_num_processors (),
+                                    FALSE,
+                                    NULL);
+
+  if (get_background_type () == 3)
+    {
+      /* The paper is rendered at the screen size; its tile is cached. */
+      gchar *image = get_image_name (0);
+      IwbEntry *entry = add_entry (export, export->pool, image, (AnnotateSavepoint *) NULL, (gchar *) NULL);
+      cairo_surface_t *paper = create_background_surface ((gchar *) NULL,
+                                                          (gchar *) NULL,
+                                                          get_background_paper (),
+                                                          gdk_screen_width (),
+                                                          gdk_screen_height ());
+
+      entry->data = canvas_surface_to_png (paper);
+      cairo_surface_destroy (paper);
+      g_free (image);
+    }
+  else if (has_background_image (background_image))
+    {
+      gchar *image = get_image_name (0);
+      add_entry (export, export->pool, image, (AnnotateSavepoint *) NULL, background_image);
+      g_free (image);
+    }
+
+  for (list = export->savepoints; list; list = list->next, index++)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+      gchar *image = (gchar *) g_ptr_array_index (export->images, index);
+
+      /* The paths are in the xml content and a shared image is written once. */
+      if ((image) && (!g_hash_table_contains (added, image)))
         {
-          /* It will be putted in the project dir. */
-          gchar *extension = "iwb";
-          gchar *iwb_name =  g_strdup_printf("%s.%s", get_project_name (), extension);
+          IwbEntry *entry = add_entry (export, export->pool, image, savepoint, (gchar *) NULL);
+          g_hash_table_add (added, image);
+
+          /* The paths of the eraser can not be stored; the page is rendered. */
+          if ((savepoint->paths) && (!savepoint->png) && (!savepoint->filename) && (!savepoint->load))
+            {
+              /* The history starts with the last save-point. */
+              entry->link = g_slist_nth (export->history, length - 1 - index);
+              g_thread_pool_push (export->pool, entry, NULL);
+            }
+        }
+    }
+
+  g_hash_table_destroy (added);
+
+  export->writer = g_thread_new ("iwb-writer", (GThreadFunc) write_iwb, export);
+}
+
+
+/*
+ * Replace the iwb file with the written one; the lazy save-points
+ * still on the canvas are moved to the images of the new file.
+ * If the replace fails the old file is left untouched.
+ */
+static gboolean
+replace_iwb (IwbExport  *export)
+{
+  GSList *savepoint_list = get_annotation_data ()->canvas->savepoint_list;
+  gboolean replaced = FALSE;
+  gboolean lazy = FALSE;
+  guint i = 0;
+
+#ifdef _WIN32
+  gboolean archive_open = is_iwb_archive_open ();
+
+  /* On windows an open file can not be replaced. */
+  close_iwb_archive ();
+
+  replaced = replace_file (export->zip_filename, export->iwb_file);
+
+  /* The old file is still there and the lazy save-points read it again. */
+  if ((!replaced) && (archive_open))
+    {
+      open_iwb_archive (export->iwb_file);
+    }
+#else
+  replaced = replace_file (export->zip_filename, export->iwb_file);
+#endif
 
-          /* The zip file is the iwb file located in the ardesia workspace. */
-          iwb_file = g_build_filename (get_project_dir (), iwb_name, (gchar *) 0);
-          g_free(iwb_name);
+  if (!replaced)
+    {
+      g_warning ("Error renaming %s in %s", export->zip_filename, export->iwb_file);
+      return FALSE;
+    }
+
+  close_iwb_archive ();
+
+  for (i = 0; i < export->originals->len; i++)
+    {
+      AnnotateSavepoint *savepoint = g_ptr_array_index (export->originals, i);
+      gchar *image = (gchar *) g_ptr_array_index (export->images, i);
+
+      if ((image) && (savepoint->load) && (g_slist_find (savepoint_list, savepoint)))
+        {
+          g_free (savepoint->source);
+          savepoint->source = g_strdup_printf ("images/%s", image);
+          lazy = TRUE;
+        }
+    }
+
+  if (lazy)
+    {
+      open_iwb_archive (export->iwb_file);
+    }
+
+  return TRUE;
+}
+
+
+/* Free the export. */
+static void
+free_export (IwbExport  *export)
+{
+  g_slist_free (export->history);
+  g_slist_free_full (export->savepoints, (GDestroyNotify) canvas_savepoint_free);
+
+  if (export->originals)
+    {
+      g_ptr_array_free (export->originals, TRUE);
+    }
+
+  if (export->images)
+    {
+      g_ptr_array_free (export->images, TRUE);
+    }
+
+  if (export->content)
+    {
+      g_string_free (export->content, TRUE);
+    }
+
+  g_ptr_array_free (export->entries, TRUE);
+  g_mutex_clear (&export->mutex);
+  g_cond_clear (&export->cond);
+  g_free (export->zip_filename);
+  g_free (export->iwb_file);
+  g_free (export);
+}
+
+
+/* Join the threads, replace the iwb file and notify the end of the export. */
+static void
+finish_export (IwbExport  *export)
+{
+  gboolean saved = TRUE;
+
+  if (export->writer)
+    {
+      g_thread_join (export->writer);
+      g_thread_pool_free (export->pool, TRUE, TRUE);
+
+      saved = export->saved;
+
+      if (saved)
+        {
+          saved = replace_iwb (export);
+        }
+
+      if (saved)
+        {
+          /* Add to the list of the artefacts created in the session. */
+          add_artifact (export->iwb_file);
         }
       else
         {
-          g_remove (iwb_location);
-          iwb_file = g_strdup_printf ("%s", iwb_location);
+          g_remove (export->zip_filename);
         }
 
-      g_remove (content_filepath);
+      TRACE_END ("export_iwb");
+    }
+
+  running_export = (IwbExport *) NULL;
+
+  if (export->done_callback)
+    {
+      export->done_callback (saved, export->savepoints, export->user_data);
+    }
 
-      create_xml_content (content_filepath, img_dir_path, background_image);
+  free_export (export);
+}
 
-      create_iwb (iwb_file, project_tmp_dir, "images", content_filename);
 
-      /* Add to the list of the artefacts created in the session. */
-      add_artifact (iwb_file);
-      g_free (iwb_file);
-      g_free (content_filepath);
+/* Report the progress and finish the export when the writer is done. */
+static gboolean
+on_export_progress (IwbExport *export)
+{
+  gint written = g_atomic_int_get (&export->written);
+
+  if (g_atomic_int_get (&export->done))
+    {
+      finish_export (export);
+      return FALSE;
+    }
+
+  if (export->progress)
+    {
+      export->progress ((gdouble) written / MAX (export->entries->len, 1), export->user_data);
     }
 
-  g_free (first_savepoint_file);
-  g_free (ardesia_tmp_dir);
-  g_free (project_tmp_dir);
-  g_free (img_dir_path);
+  return TRUE;
 }
 
 
+/* Get the file where the project will be exported in the iwb format. */
+gchar *
+get_iwb_export_filename (gchar *iwb_location)
+{
+  gchar *iwb_file = (gchar *) NULL;
+
+  /* If the iwb location is null means that it is a new project. */
+  if (iwb_location == NULL)
+    {
+      /* It will be putted in the project dir. */
+      gchar *extension = "iwb";
+      gchar *iwb_name =  g_strdup_printf("%s.%s", get_project_name (), extension);
+
+      /* The zip file is the iwb file located in the ardesia workspace. */
+      iwb_file = g_build_filename (get_project_dir (), iwb_name, (gchar *) 0);
+      g_free(iwb_name);
+    }
+  else
+    {
+      iwb_file = g_strdup_printf ("%s", iwb_location);
+    }
+
+  return iwb_file;
+}
+
+
+/*
+ * Start exporting in background the save-points painted until now;
+ * they are copied then the painting can go on meanwhile. Return FALSE
+ * if an other export is running.
+ */
+gboolean
+start_iwb_export (gchar              *iwb_location,
+                  IwbExportProgress   progress,
+                  IwbExportDone       done,
+                  gpointer            user_data)
+{
+  gchar *background_image = get_background_image();
+  GSList *savepoint_list = get_annotation_data ()->canvas->savepoint_list;
+  gint savepoint_number = g_slist_length (savepoint_list);
+  IwbExport *export = (IwbExport *) NULL;
+  GSList *reversed = (GSList *) NULL;
+  GSList *list = (GSList *) NULL;
+
+  if (running_export)
+    {
+      return FALSE;
+    }
+
+  export = g_malloc0 ((gsize) sizeof (IwbExport));
+  export->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) free_entry);
+  export->progress = progress;
+  export->done_callback = done;
+  export->user_data = user_data;
+  g_mutex_init (&export->mutex);
+  g_cond_init (&export->cond);
+
+  /* The first save-point is the empty page; save only if something has been painted. */
+  if ((savepoint_number > 1) || (background_image) || (get_background_type () == 3))
+    {
+      TRACE_BEGIN ("export_iwb");
+
+      export->iwb_file = get_iwb_export_filename (iwb_location);
+
+      /*
+       * The save-points loaded lazily are read from the old iwb,
+       * then the new one is written aside and replaces it at the end.
+       */
+      export->zip_filename = g_strdup_printf ("%s.tmp", export->iwb_file);
+
+      /*
+       * The save-point list starts with the last one; the save-points
+       * are copied because they can be deleted while the export runs.
+       */
+      reversed = g_slist_reverse (g_slist_copy (savepoint_list));
+      export->originals = g_ptr_array_new ();
+
+      for (list = reversed; list; list = list->next)
+        {
+          AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+          g_ptr_array_add (export->originals, savepoint);
+          export->savepoints = g_slist_prepend (export->savepoints, canvas_savepoint_copy (savepoint));
+        }
+
+      export->history = g_slist_copy (export->savepoints);
+      export->savepoints = g_slist_reverse (export->savepoints);
+      export->width = get_annotation_data ()->canvas->width;
+      export->height = get_annotation_data ()->canvas->height;
+      g_slist_free (reversed);
+
+      assign_savepoint_images (export->savepoints);
+      create_xml_content (background_image, export->savepoints);
+
+      /* The xml content and the image names belong to the export now. */
+      export->content = content;
+      content = (GString *) NULL;
+      export->images = savepoint_images;
+      savepoint_images = (GPtrArray *) NULL;
+
+      create_iwb (export, background_image);
+    }
+  else
+    {
+      g_atomic_int_set (&export->done, 1);
+    }
+
+  running_export = export;
+  g_timeout_add (100, (GSourceFunc) on_export_progress, export);
+
+  return TRUE;
+}
+
+
+/* Cancel the running export; the iwb file is left untouched. */
+void
+cancel_iwb_export ()
+{
+  if (running_export)
+    {
+      g_atomic_int_set (&running_export->cancelled, 1);
+
+      /* Wake up the writer waiting for an entry. */
+      g_mutex_lock (&running_export->mutex);
+      g_cond_broadcast (&running_export->cond);
+      g_mutex_unlock (&running_export->mutex);
+    }
+}
+
+
+/* Is an export running? */
+gboolean
+is_iwb_export_running ()
+{
+  return (running_export != NULL);
+}
+
@@ -25,8 +25,46 @@
 #include <zlib.h>
 
 
-/* Export in the iwb format. */
+/* Get the file where the project will be exported in the iwb format. */
+gchar *
+get_iwb_export_filename (gchar *iwb_location);
+
+
+/* Called in the main loop with the completed fraction of the export. */
+typedef void (*IwbExportProgress) (gdouble   fraction,
+                                   gpointer  user_data);
+
+
+/*
+ * Called in the main loop at the end of the export; saved is FALSE if
+ * the file can not be written or the export has been cancelled. The
+ * copies of the exported save-points, oldest first, are valid during
+ * the call.
+ */
+typedef void (*IwbExportDone)     (gboolean  saved,
+                                   GSList   *savepoints,
+                                   gpointer  user_data);
+
+
+/*
+ * Start exporting in background the save-points painted until now;
+ * they are copied then the painting can go on meanwhile. Return FALSE
+ * if an other export is running.
+ */
+gboolean
+start_iwb_export (gchar              *iwb_location,
+                  IwbExportProgress   progress,
+                  IwbExportDone       done,
+                  gpointer            user_data);
+
+
+/* Cancel the running export; the iwb file is left untouched. */
 void
-export_iwb (gchar *folder);
+cancel_iwb_export ();
+
+
+/* Is an export running? */
+gboolean
+is_iwb_export_running ();
 
 
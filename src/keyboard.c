@@ -30,8 +30,10 @@
 #include <keyboard.h>
 #include <stdlib.h>
 
+#ifdef _WIN32
 /* The pid of the virtual keyboard process. */
 static GPid virtual_keyboard_pid;
+#endif
 
 
 /* Start the virtual keyboard. */
@@ -0,0 +1,244 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <paper.h>
+
+#include <stdio.h>
+#include <math.h>
+
+
+/* The names of the kinds of paper used in the description. */
+static const gchar *paper_names[PAPER_KINDS] = { "squared", "ruled", "dotted", "staff" };
+
+
+/* Guard of the cache; the tiles are asked by the exports also. */
+static GMutex cache_mutex;
+
+/* The patterns indexed by kind and spacing in pixel; NULL if empty. */
+static GHashTable *cache = (GHashTable *) NULL;
+
+
+/* Make the description of the paper e.g. "squared 32"; it must be freed. */
+gchar *
+paper_spec_new          (PaperKind     kind,
+                         gint          spacing)
+{
+  return g_strdup_printf ("%s %d",
+                          paper_names[CLAMP (kind, 0, PAPER_KINDS - 1)],
+                          CLAMP (spacing, PAPER_MIN_SPACING, PAPER_MAX_SPACING));
+}
+
+
+/* Parse the description of the paper; FALSE if the kind is not known. */
+gboolean
+paper_spec_parse        (const gchar  *spec,
+                         PaperKind    *kind,
+                         gint         *spacing)
+{
+  gchar name[16] = "";
+  gint value = PAPER_DEFAULT_SPACING;
+  gint i = 0;
+
+  if ((!spec) || (sscanf (spec, "%15s %d", name, &value) < 1))
+    {
+      return FALSE;
+    }
+
+  for (i = 0; i < PAPER_KINDS; i++)
+    {
+      if (g_strcmp0 (name, paper_names[i]) == 0)
+        {
+          *kind = (PaperKind) i;
+          *spacing = CLAMP (value, PAPER_MIN_SPACING, PAPER_MAX_SPACING);
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* Fill the horizontal line of the tile at y; the lines are whole pixels to stay sharp. */
+static void
+fill_row                (cairo_t  *cr,
+                         gint      width,
+                         gdouble   y,
+                         gint      line_width)
+{
+  cairo_rectangle (cr, 0, floor (y), width, line_width);
+  cairo_fill (cr);
+}
+
+
+/*
+ * Render the tile of the paper with the spacing in pixel; the tile is
+ * a period of the paper and the pattern repeats it in both directions.
+ */
+static cairo_surface_t *
+render_tile             (PaperKind  kind,
+                         gint       spacing,
+                         gint       line_width)
+{
+  /* The staff has five lines and a space of five lines to the next staff. */
+  gint height = (kind == PAPER_STAFF) ? spacing * 10 : spacing;
+  cairo_surface_t *tile = cairo_image_surface_create (CAIRO_FORMAT_RGB24, spacing, height);
+  cairo_t *cr = cairo_create (tile);
+  gint i = 0;
+
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_paint (cr);
+
+  switch (kind)
+    {
+      case PAPER_SQUARED:
+        cairo_set_source_rgb (cr, 0.65, 0.78, 0.90);
+        fill_row (cr, spacing, 0, line_width);
+        cairo_rectangle (cr, 0, 0, line_width, spacing);
+        cairo_fill (cr);
+        break;
+      case PAPER_RULED:
+        cairo_set_source_rgb (cr, 0.65, 0.78, 0.90);
+        fill_row (cr, spacing, spacing - line_width, line_width);
+        break;
+      case PAPER_DOTTED:
+        cairo_set_source_rgb (cr, 0.55, 0.55, 0.60);
+        cairo_arc (cr, spacing / 2.0, spacing / 2.0, line_width * 1.25, 0, 2 * M_PI);
+        cairo_fill (cr);
+        break;
+      case PAPER_STAFF:
+        cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
+        for (i = 0; i < 5; i++)
+          {
+            fill_row (cr, spacing, spacing * (i + 3), line_width);
+          }
+        break;
+      default:
+        break;
+    }
+
+  cairo_destroy (cr);
+  return tile;
+}
+
+
+/* Get the repeating pattern of the paper; NULL if the description is not valid. */
+cairo_pattern_t *
+paper_get_pattern       (const gchar  *spec,
+                         gdouble       scale)
+{
+  PaperKind kind = PAPER_SQUARED;
+  gint spacing = PAPER_DEFAULT_SPACING;
+  gint line_width = 1;
+  gchar *key = (gchar *) NULL;
+  cairo_pattern_t *pattern = (cairo_pattern_t *) NULL;
+
+  if (!paper_spec_parse (spec, &kind, &spacing))
+    {
+      return pattern;
+    }
+
+  /* The tile is rendered at the final size; it is never scaled. */
+  spacing = MAX ((gint) floor (spacing * scale + 0.5), PAPER_MIN_SPACING);
+  line_width = MAX ((gint) floor (scale + 0.5), 1);
+  key = g_strdup_printf ("%d %d", kind, spacing);
+
+  g_mutex_lock (&cache_mutex);
+
+  if (!cache)
+    {
+      cache = g_hash_table_new_full (g_str_hash,
+                                     g_str_equal,
+                                     g_free,
+                                     (GDestroyNotify) cairo_pattern_destroy);
+    }
+
+  pattern = g_hash_table_lookup (cache, key);
+
+  if (!pattern)
+    {
+      cairo_surface_t *tile = render_tile (kind, spacing, line_width);
+
+      pattern = cairo_pattern_create_for_surface (tile);
+      cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
+      cairo_pattern_set_filter (pattern, CAIRO_FILTER_NEAREST);
+      cairo_surface_destroy (tile);
+
+      /* The spacing is seldom changed; a full cache is simply emptied. */
+      if (g_hash_table_size (cache) >= PAPER_CACHE_SIZE)
+        {
+          g_hash_table_remove_all (cache);
+        }
+
+      g_hash_table_insert (cache, key, pattern);
+      key = (gchar *) NULL;
+    }
+
+  cairo_pattern_reference (pattern);
+
+  g_mutex_unlock (&cache_mutex);
+
+  g_free (key);
+  return pattern;
+}
+
+
+/* Paint the paper on the clip of the context. */
+void
+paper_paint             (cairo_t      *cr,
+                         const gchar  *spec,
+                         gdouble       scale)
+{
+  cairo_pattern_t *pattern = paper_get_pattern (spec, scale);
+
+  if (pattern)
+    {
+      cairo_save (cr);
+      cairo_set_source (cr, pattern);
+      cairo_paint (cr);
+      cairo_restore (cr);
+      cairo_pattern_destroy (pattern);
+    }
+}
+
+
+/* Free the cached tiles. */
+void
+clear_paper_cache       ()
+{
+  g_mutex_lock (&cache_mutex);
+
+  if (cache)
+    {
+      g_hash_table_destroy (cache);
+      cache = (GHashTable *) NULL;
+    }
+
+  g_mutex_unlock (&cache_mutex);
+}
+
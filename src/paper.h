@@ -0,0 +1,115 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Procedural paper backgrounds: squared, ruled, dotted and music staff.
+ *
+ * The paper is described by a string with the kind and the spacing in
+ * pixel, e.g. "squared 32", and it is painted as a repeating pattern of
+ * a small tile; the tile is rendered once for each kind and spacing
+ * and kept in a cache, then no image is decoded or scaled and the paper
+ * is sharp at any resolution. It depends only on glib and cairo.
+ */
+
+
+#ifndef PAPER_H
+#define PAPER_H
+
+#include <glib.h>
+#include <cairo.h>
+
+
+/* Kind of paper; the order is the one of the preference dialog. */
+typedef enum
+  {
+
+    /* Squared paper; the spacing is the side of the squares. */
+    PAPER_SQUARED,
+
+    /* Ruled paper; the spacing is the distance between the lines. */
+    PAPER_RULED,
+
+    /* Dot grid; the spacing is the distance between the dots. */
+    PAPER_DOTTED,
+
+    /* Music staff; the spacing is the distance between the staff lines. */
+    PAPER_STAFF,
+
+    PAPER_KINDS
+
+  } PaperKind;
+
+
+/* The spacing in pixel used if it is not given. */
+#define PAPER_DEFAULT_SPACING 32
+
+/* The smallest and the biggest spacing in pixel. */
+#define PAPER_MIN_SPACING 4
+#define PAPER_MAX_SPACING 256
+
+/* The tiles kept in the cache; they are a few kilobytes each. */
+#define PAPER_CACHE_SIZE 8
+
+
+/* Make the description of the paper e.g. "squared 32"; it must be freed. */
+gchar *
+paper_spec_new          (PaperKind     kind,
+                         gint          spacing);
+
+
+/*
+ * Parse the description of the paper; a missing spacing is the default
+ * one. Return FALSE if the kind is not known.
+ */
+gboolean
+paper_spec_parse        (const gchar  *spec,
+                         PaperKind    *kind,
+                         gint         *spacing);
+
+
+/*
+ * Get the repeating pattern of the paper with the spacing multiplied by
+ * scale, anchored at the user origin; NULL if the description is not
+ * valid, else it must be destroyed. It can be called by any thread.
+ */
+cairo_pattern_t *
+paper_get_pattern       (const gchar  *spec,
+                         gdouble       scale);
+
+
+/* Paint the paper on the clip of the context, see paper_get_pattern. */
+void
+paper_paint             (cairo_t      *cr,
+                         const gchar  *spec,
+                         gdouble       scale);
+
+
+/* Free the cached tiles. */
+void
+clear_paper_cache       ();
+
+
+#endif
+
@@ -30,16 +30,74 @@
 #include <utils.h>
 #include <saver.h>
 #include <keyboard.h>
+#include <background_window.h>
+#include <trace.h>
+#include <glib/gstdio.h>
+
+
+/* The pages tree object; the catalog is object 1. */
+#define PDF_PAGES_OBJECT 2
 
 
 /* internal structure allocated once. */
 static PdfData *pdf_data;
 
+/* Queued to stop the thread. */
+static gint stop_request;
+
+/* The codec of the page images. */
+static PdfCodec pdf_codec = PDF_CODEC_AUTO;
+
+/* Are the pages exported as vectors? */
+static gboolean pdf_vector = FALSE;
+
+
+/* A page waiting to be written. */
+typedef struct
+{
+
+  /* The screenshot; NULL if it has been already encoded or it is a vector page. */
+  GdkPixbuf *pixbuf;
+
+  /* The encoded image; NULL until the thread encodes it. */
+  GByteArray *image;
+
+  /* The codec; it is never PDF_CODEC_AUTO. */
+  PdfCodec codec;
+
+  gint width;
+  gint height;
+
+  /* The bytes counted in the queue. */
+  gsize size;
+
+  /* Is it a vector page? Then the fields below are used. */
+  gboolean vector;
+
+  /* The background colour; NULL if the background is an image. */
+  gchar *background_color;
+
+  /* The background image file. */
+  gchar *background_image;
+
+  /* A copy of the last save-point that is not made of paths; NULL if there is none. */
+  AnnotateSavepoint *base;
 
-/* Start the dialog that ask the file name where is being exported the pdf. */
+  /* The paths of the save-points painted over the base, oldest first. */
+  GSList *paths;
+
+} PdfPage;
+
+
+/*
+ * Start the dialog that ask the file name where is being exported the
+ * pdf; the extra widget, if any, is shown under the file chooser.
+ */
 static gboolean
 start_save_pdf_dialog (GtkWindow *parent,
-                       GdkPixbuf *pixbuf)
+                       GdkPixbuf *pixbuf,
+                       PdfData   *pdf,
+                       GtkWidget *extra_widget)
 {
   gboolean ret = TRUE;
   GtkWidget *preview = NULL;
@@ -73,6 +131,11 @@ start_save_pdf_dialog (GtkWindow *parent,
   gtk_file_chooser_set_preview_widget (GTK_FILE_CHOOSER (chooser), preview);
   g_object_unref (preview_pixbuf);
 
+  if (extra_widget)
+    {
+      gtk_file_chooser_set_extra_widget (GTK_FILE_CHOOSER (chooser), extra_widget);
+    }
+
   gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (chooser), get_project_dir ());
 
   filename = get_default_filename ();
@@ -88,16 +151,16 @@ start_save_pdf_dialog (GtkWindow *parent,
 
       if (!g_str_has_suffix (filename, supported_extension))
         {
-          pdf_data->filename = g_strdup_printf ("%s%s",filename,supported_extension);
+          pdf->filename = g_strdup_printf ("%s%s",filename,supported_extension);
         }
       else
         {
-          pdf_data->filename = g_strdup_printf ("%s",filename);
+          pdf->filename = g_strdup_printf ("%s",filename);
         }
 
       g_free (filename);
 
-      if (file_exists (pdf_data->filename))
+      if (file_exists (pdf->filename))
         {
           gint result = show_override_dialog (GTK_WINDOW (chooser));
           if ( result == GTK_RESPONSE_NO)
@@ -114,7 +177,52 @@ start_save_pdf_dialog (GtkWindow *parent,
       gtk_widget_destroy (chooser);
       chooser = NULL;
     }
-  return ret;
+
+  /* The dialog has been cancelled. */
+  return (ret) && (pdf->filename);
+}
+
+
+/* Allocate the pdf writer state. */
+static PdfData *
+pdf_data_new ()
+{
+  PdfData *pdf = (PdfData *) g_malloc ( (gsize) sizeof (PdfData));
+  pdf->thread = NULL;
+  pdf->queue = NULL;
+  pdf->queued_bytes = 0;
+  pdf->filename = NULL;
+  pdf->fp = NULL;
+  pdf->length = 0;
+  pdf->offsets = g_array_new (FALSE, TRUE, sizeof (gint64));
+  pdf->objects = PDF_PAGES_OBJECT + 1;
+  pdf->kids = g_array_new (FALSE, FALSE, sizeof (guint));
+  pdf->background_image = NULL;
+  pdf->background_object = 0;
+  pdf->base_png = NULL;
+  pdf->base_background = NULL;
+  pdf->base_object = 0;
+  pdf->xref_offset = 0;
+  pdf->unsynced_pages = 0;
+  return pdf;
+}
+
+
+/* Free the pdf writer state; the file must be already closed. */
+static void
+pdf_data_free (PdfData *pdf)
+{
+  if (pdf->base_png)
+    {
+      g_bytes_unref (pdf->base_png);
+    }
+
+  g_array_free (pdf->offsets, TRUE);
+  g_array_free (pdf->kids, TRUE);
+  g_free (pdf->background_image);
+  g_free (pdf->base_background);
+  g_free (pdf->filename);
+  g_free (pdf);
 }
 
 
@@ -125,13 +233,10 @@ init_pdf_saver (GtkWindow *parent,
 {
   gboolean ret = FALSE;
 
-  pdf_data = (PdfData *) g_malloc ( (gsize) sizeof (PdfData));
-  pdf_data->thread = NULL;
-  pdf_data->input_filelist = NULL;
-  pdf_data->filename = NULL;
+  pdf_data = pdf_data_new ();
 
   /* Start the widget to ask the file name where save the pdf. */
-  ret = start_save_pdf_dialog (parent, pixbuf);
+  ret = start_save_pdf_dialog (parent, pixbuf, pdf_data, (GtkWidget *) NULL);
 
   if (!ret)
     {
@@ -145,139 +250,1539 @@ init_pdf_saver (GtkWindow *parent,
 }
 
 
-/* Save the surfaces in the pdf file. */
+/* Write the buffer in the pdf file counting the written bytes. */
 static void
-pdf_save ()
+pdf_write (PdfData     *pdf,
+           const gchar *data,
+           gsize        size)
 {
-  gint height = gdk_screen_height ();
-  gint width = gdk_screen_width ();
+  fwrite (data, 1, size, pdf->fp);
+  pdf->length += size;
+}
 
-  /* create the cairo surface for pdf */
-  cairo_surface_t *pdf_surface = cairo_pdf_surface_create (pdf_data->filename, width, height);
-  cairo_t *pdf_cr = cairo_create (pdf_surface);
 
-  gint lenght = g_slist_length (pdf_data->input_filelist);
-  
-  gint i;
+/* Write the formatted string in the pdf file. */
+static void
+pdf_printf (PdfData     *pdf,
+            const gchar *format,
+            ...)
+{
+  va_list args;
+  gchar *string = (gchar *) NULL;
 
-  for (i=lenght-1; i>=0; i--)
+  va_start (args, format);
+  string = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  pdf_write (pdf, string, strlen (string));
+  g_free (string);
+}
+
+
+/* Start the object with the number storing its offset. */
+static void
+pdf_begin_object (PdfData *pdf,
+                  guint    number)
+{
+  if (pdf->offsets->len <= number)
     {
-      gchar *current_filename = (gchar *) g_slist_nth_data (pdf_data->input_filelist, i);
-      /* load the file name content */
-      GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file (current_filename, NULL);
-      gdk_cairo_set_source_pixbuf (pdf_cr, pixbuf, 0, 0);
-      cairo_paint (pdf_cr);
-      cairo_show_page (pdf_cr);
-      g_object_unref (pixbuf);
+      g_array_set_size (pdf->offsets, number + 1);
     }
 
-  cairo_surface_flush (pdf_surface);
-  /* destroy */
-  cairo_surface_destroy (pdf_surface);
-  cairo_destroy (pdf_cr);
+  g_array_index (pdf->offsets, gint64, number) = pdf->length;
+  pdf_printf (pdf, "%u 0 obj\n", number);
+}
+
+
+/* Start a new object; return its number. */
+static guint
+pdf_new_object (PdfData *pdf)
+{
+  guint number = pdf->objects++;
+  pdf_begin_object (pdf, number);
+  return number;
 }
 
 
-/* Wait if there is a pending thread. */
-static
-void wait_for_pdf_save_pending_thread ()
+/* Write the cross-reference entries of count objects starting from first. */
+static void
+pdf_write_xref_entries (PdfData *pdf,
+                        guint    first,
+                        guint    count)
 {
-  if (pdf_data->thread)
+  guint i = 0;
+
+  pdf_printf (pdf, "%u %u\n", first, count);
+
+  for (i = first; i < first + count; i++)
     {
-      g_thread_join (pdf_data->thread);
-      pdf_data->thread = NULL;
+      if (i == 0)
+        {
+          /* The head of the free objects list. */
+          pdf_printf (pdf, "0000000000 65535 f\r\n");
+        }
+      else
+        {
+          pdf_printf (pdf, "%010" G_GINT64_FORMAT " 00000 n\r\n", g_array_index (pdf->offsets, gint64, i));
+        }
     }
 }
 
 
-/* Add the screenshot to pdf. */
-void
-add_pdf_page (GtkWindow *parent)
+/*
+ * Close the incremental update with the pages tree listing all the
+ * pages, the cross-reference section of the objects added since
+ * first_object and the trailer; after it the file is a complete pdf.
+ */
+static void
+pdf_write_update (PdfData *pdf,
+                  guint    first_object)
 {
-  GdkPixbuf *pixbuf = grab_screenshot ();
-  cairo_surface_t *saved_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                                               gdk_screen_width (),
-                                                               gdk_screen_height ());
+  guint size = pdf->objects;
+  gint64 xref_offset = 0;
+  guint i = 0;
 
-  cairo_t *cr = cairo_create (saved_surface);
-  const gchar *tmp_dir = g_get_tmp_dir ();
-  gchar *default_filename = get_default_filename ();
-  gchar *screenshoot_name = g_strdup_printf ("%s_screenshoot.png", default_filename);
-  gchar *filename  = g_build_filename (tmp_dir, screenshoot_name, (gchar *) 0);
-  GError *err = NULL ;
+  /* The new pages tree replaces the one of the previous update. */
+  pdf_begin_object (pdf, PDF_PAGES_OBJECT);
+  pdf_printf (pdf, "<< /Type /Pages /Count %u /Kids [", pdf->kids->len);
 
-  g_free (screenshoot_name);
-  
-  g_free (default_filename);
+  for (i = 0; i < pdf->kids->len; i++)
+    {
+      pdf_printf (pdf, " %u 0 R", g_array_index (pdf->kids, guint, i));
+    }
 
-  /* Load a surface with the data->annotation_cairo_context content and write the file. */
-  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
-  cairo_paint (cr);
-  cairo_surface_write_to_png (saved_surface, filename);
-  cairo_surface_destroy (saved_surface); 
-  cairo_destroy (cr);
+  pdf_printf (pdf, " ] >>\nendobj\n");
 
-  if (pdf_data == NULL)
+  xref_offset = pdf->length;
+  pdf_printf (pdf, "xref\n");
+
+  if (pdf->xref_offset == 0)
+    {
+      /* The first section has the catalog and the free list head too. */
+      pdf_write_xref_entries (pdf, 0, size);
+      pdf_printf (pdf, "trailer\n<< /Size %u /Root 1 0 R >>\n", size);
+    }
+  else
+    {
+      pdf_write_xref_entries (pdf, PDF_PAGES_OBJECT, 1);
+      pdf_write_xref_entries (pdf, first_object, size - first_object);
+      pdf_printf (pdf, "trailer\n<< /Size %u /Root 1 0 R /Prev %" G_GINT64_FORMAT " >>\n",
+                  size,
+                  pdf->xref_offset);
+    }
+
+  pdf_printf (pdf, "startxref\n%" G_GINT64_FORMAT "\n%%%%EOF\n", xref_offset);
+  pdf->xref_offset = xref_offset;
+}
+
+
+/* Get the rgb pixels of the screenshot; the screen is opaque and the alpha is dropped. */
+static GdkPixbuf *
+get_rgb_pixbuf (GdkPixbuf *pixbuf)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  GdkPixbuf *rgb = (GdkPixbuf *) NULL;
+  gint y = 0;
+
+  if (!gdk_pixbuf_get_has_alpha (pixbuf))
+    {
+      return g_object_ref (pixbuf);
+    }
+
+  rgb = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+
+  for (y = 0; y < height; y++)
     {
-      if (!g_thread_supported ())
+      const guchar *src = gdk_pixbuf_get_pixels (pixbuf) + y * gdk_pixbuf_get_rowstride (pixbuf);
+      guchar *dest = gdk_pixbuf_get_pixels (rgb) + y * gdk_pixbuf_get_rowstride (rgb);
+      gint x = 0;
+
+      for (x = 0; x < width; x++, src += 4, dest += 3)
         {
-          /* Initialize internal mutex "gdk_threads_mutex". */
-          g_thread_init (NULL);
-          gdk_threads_init ();
-          g_printerr ("g_thread supported\n");
+          dest[0] = src[0];
+          dest[1] = src[1];
+          dest[2] = src[2];
         }
-      if (!init_pdf_saver (parent, pixbuf))
+    }
+
+  return rgb;
+}
+
+
+/*
+ * Encode the screenshot as the stream of a pdf image; the jpeg is used
+ * as it is by the DCTDecode filter, for the FlateDecode filter with the
+ * png predictors it is the content of the IDAT chunks of the png.
+ */
+static GByteArray *
+encode_page_image (GdkPixbuf *pixbuf,
+                   PdfCodec   codec)
+{
+  GdkPixbuf *rgb = get_rgb_pixbuf (pixbuf);
+  gchar *buffer = (gchar *) NULL;
+  gsize size = 0;
+  gsize offset = 8;
+  GError *err = (GError *) NULL;
+  GByteArray *data = (GByteArray *) NULL;
+  gboolean encoded = FALSE;
+
+  TRACE_BEGIN ("encode_pdf_page");
+
+  if (codec == PDF_CODEC_JPEG)
+    {
+      encoded = gdk_pixbuf_save_to_buffer (rgb, &buffer, &size, "jpeg", &err,
+                                           "quality", PDF_JPEG_QUALITY, (gchar *) NULL);
+    }
+  else
+    {
+      encoded = gdk_pixbuf_save_to_buffer (rgb, &buffer, &size, "png", &err, (gchar *) NULL);
+    }
+
+  g_object_unref (rgb);
+
+  if (!encoded)
+    {
+      g_warning ("Error encoding the pdf page: %s", err->message);
+      g_error_free (err);
+      TRACE_END ("encode_pdf_page");
+      return (GByteArray *) NULL;
+    }
+
+  if (codec == PDF_CODEC_JPEG)
+    {
+      TRACE_END ("encode_pdf_page");
+      return g_byte_array_new_take ((guint8 *) buffer, size);
+    }
+
+  data = g_byte_array_new ();
+
+  /* Skip the signature and concatenate the IDAT chunks. */
+  while (offset + 12 <= size)
+    {
+      const guchar *chunk = (const guchar *) buffer + offset;
+      guint32 length = ((guint32) chunk[0] << 24) | ((guint32) chunk[1] << 16) |
+                       ((guint32) chunk[2] << 8) | (guint32) chunk[3];
+
+      if (offset + 12 + length > size)
         {
-          g_object_unref (pixbuf);
-          return;
+          break;
+        }
+
+      if (memcmp (chunk + 4, "IDAT", 4) == 0)
+        {
+          g_byte_array_append (data, chunk + 8, length);
         }
+
+      offset += 12 + length;
     }
 
-  g_object_unref (pixbuf);
-  pdf_data->input_filelist = g_slist_prepend (pdf_data->input_filelist, filename);
+  g_free (buffer);
+  TRACE_END ("encode_pdf_page");
+  return data;
+}
+
 
-  wait_for_pdf_save_pending_thread ();
+/* Write the encoded image as an image object; return its number. */
+static guint
+pdf_write_image (PdfData    *pdf,
+                 GByteArray *image,
+                 PdfCodec    codec,
+                 gint        width,
+                 gint        height)
+{
+  guint number = pdf_new_object (pdf);
+
+  pdf_printf (pdf, "<< /Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace /DeviceRGB /BitsPerComponent 8",
+              width,
+              height);
 
-  /* Start save thread. */
-  if ( (pdf_data->thread = g_thread_create ( (GThreadFunc) pdf_save, (void *) NULL, TRUE, &err)) == NULL)
+  if (codec == PDF_CODEC_JPEG)
+    {
+      pdf_printf (pdf, " /Filter /DCTDecode");
+    }
+  else
     {
-      g_printerr ("Thread create failed: %s!!\n", err->message );
-      g_error_free (err) ;
+      pdf_printf (pdf, " /Filter /FlateDecode /DecodeParms << /Predictor 15 /Colors 3 /BitsPerComponent 8 /Columns %d >>",
+                  width);
     }
 
+  pdf_printf (pdf, " /Length %u >>\nstream\n", image->len);
+  pdf_write (pdf, (const gchar *) image->data, image->len);
+  pdf_printf (pdf, "\nendstream\nendobj\n");
+
+  return number;
 }
 
 
-/* Quit the pdf saver. */
-void
-quit_pdf_saver ()
+/*
+ * Write the content stream and the page object with the resources;
+ * then close the update, the page is a checkpoint and the pdf survives
+ * a crash of ardesia. The file is synced every PDF_SYNC_PAGES pages.
+ */
+static void
+pdf_write_page (PdfData      *pdf,
+                guint         first_object,
+                gint          width,
+                gint          height,
+                const gchar  *content,
+                const gchar  *resources)
 {
-  if (pdf_data)
+  guint content_object = pdf_new_object (pdf);
+  guint page_object = 0;
+
+  pdf_printf (pdf, "<< /Length %u >>\nstream\n%s\nendstream\nendobj\n", (guint) strlen (content), content);
+
+  page_object = pdf_new_object (pdf);
+  pdf_printf (pdf, "<< /Type /Page /Parent %u 0 R /MediaBox [0 0 %d %d] /Resources << %s >> /Contents %u 0 R >>\nendobj\n",
+              PDF_PAGES_OBJECT,
+              width,
+              height,
+              resources,
+              content_object);
+
+  g_array_append_val (pdf->kids, page_object);
+  pdf_write_update (pdf, first_object);
+
+  fflush (pdf->fp);
+
+  if (++pdf->unsynced_pages >= PDF_SYNC_PAGES)
+    {
+      g_fsync (fileno (pdf->fp));
+      pdf->unsynced_pages = 0;
+    }
+}
+
+
+/* Append the screenshot page. */
+static void
+pdf_append_raster_page (PdfData *pdf,
+                        PdfPage *page)
+{
+  guint first_object = pdf->objects;
+  guint image_object = 0;
+  gchar *content = (gchar *) NULL;
+  gchar *resources = (gchar *) NULL;
+
+  if (!page->image)
+    {
+      page->image = encode_page_image (page->pixbuf, page->codec);
+    }
+
+  if (!page->image)
+    {
+      return;
+    }
+
+  image_object = pdf_write_image (pdf, page->image, page->codec, page->width, page->height);
+
+  /* The image fills the page; a pixel is a point as in the screen size page. */
+  content = g_strdup_printf ("q %d 0 0 %d 0 0 cm /Im0 Do Q\n", page->width, page->height);
+  resources = g_strdup_printf ("/XObject << /Im0 %u 0 R >>", image_object);
+
+  pdf_write_page (pdf, first_object, page->width, page->height, content, resources);
+
+  g_free (content);
+  g_free (resources);
+}
+
+
+/* Append the decimal number to the content. */
+static void
+append_number (GString *content,
+               gdouble  value)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  g_string_append_printf (content, "%s ", g_ascii_formatd (buffer, sizeof (buffer), "%.3f", value));
+}
+
+
+/*
+ * Append the svg path data as pdf path operators; only the absolute
+ * M, L, C and Z commands are used by the canvas.
+ */
+static void
+append_path_data (GString     *content,
+                  const gchar *data)
+{
+  const gchar *cursor = data;
+  gchar command = 'M';
+
+  while (*cursor)
     {
-      wait_for_pdf_save_pending_thread ();
+      gint count = 0;
+      gint i = 0;
+
+      while ((*cursor == ' ') || (*cursor == ','))
+        {
+          cursor++;
+        }
+
+      if (*cursor == '\0')
+        {
+          break;
+        }
+
+      if (g_ascii_isalpha (*cursor))
+        {
+          command = *cursor++;
+        }
+
+      if ((command == 'Z') || (command == 'z'))
+        {
+          g_string_append (content, "h ");
+          continue;
+        }
+
+      count = (command == 'C') ? 6 : 2;
 
-      /* Free the list and all the buffers inside it. */
-      while (pdf_data->input_filelist)
+      for (i = 0; i < count; i++)
         {
-          gchar *filename = (gchar *) g_slist_nth_data (pdf_data->input_filelist, 0);
-          if (filename)
+          gchar *end = (gchar *) NULL;
+          gdouble value = 0;
+
+          while ((*cursor == ' ') || (*cursor == ','))
+            {
+              cursor++;
+            }
+
+          value = g_ascii_strtod (cursor, &end);
+
+          if (end == cursor)
             {
-              g_remove (filename);
-              pdf_data->input_filelist = g_slist_remove (pdf_data->input_filelist, filename);
-              g_free (filename);
-              filename = NULL;
+              return;
             }
+
+          append_number (content, value);
+          cursor = end;
         }
 
-      if (pdf_data->filename)
+      g_string_append (content, (command == 'M') ? "m\n" : (command == 'C') ? "c\n" : "l\n");
+    }
+}
+
+
+/*
+ * Append the colour in RGBA format as the stroke and fill colour; the
+ * alpha is set with an extended graphic state added to the resources.
+ */
+static void
+append_color (GString     *content,
+              GString     *states,
+              const gchar *color)
+{
+  guint r = 0;
+  guint g = 0;
+  guint b = 0;
+  guint a = 255;
+
+  sscanf (color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+
+  append_number (content, r / 255.0);
+  append_number (content, g / 255.0);
+  append_number (content, b / 255.0);
+  g_string_append (content, "RG ");
+  append_number (content, r / 255.0);
+  append_number (content, g / 255.0);
+  append_number (content, b / 255.0);
+  g_string_append (content, "rg ");
+
+  if (a < 255)
+    {
+      gchar name[16];
+      gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+      g_snprintf (name, sizeof (name), "/Ga%u <<", a);
+
+      /* Each alpha is defined once. */
+      if (!strstr (states->str, name))
         {
-          g_free (pdf_data->filename);
-          pdf_data->filename = NULL;
+          g_string_append_printf (states, "%s /CA %s /ca %s >> ",
+                                  name,
+                                  g_ascii_formatd (buffer, sizeof (buffer), "%.3f", a / 255.0),
+                                  buffer);
         }
 
-      g_free (pdf_data);
-      pdf_data = NULL;
+      g_string_append_printf (content, "/Ga%u gs ", a);
+    }
+}
+
+
+/* Append the paths painted by the pen as the pdf strokes. */
+static void
+append_paths (GString   *content,
+              GString   *states,
+              GPtrArray *paths)
+{
+  guint i = 0;
+
+  for (i = 0; i < paths->len; i++)
+    {
+      AnnotatePath *path = (AnnotatePath *) g_ptr_array_index (paths, i);
+
+      g_string_append (content, "q ");
+      append_color (content, states, path->color);
+      append_number (content, path->width);
+      g_string_append (content, path->filled ? "w 0 J 0 j\n" : "w 1 J 1 j\n");
+      append_path_data (content, path->data);
+      g_string_append (content, path->filled ? "B Q\n" : "S Q\n");
+    }
+}
+
+
+/* Compose the annotations over the background and encode the result. */
+static GByteArray *
+encode_composed_image (cairo_surface_t *background,
+                       cairo_surface_t *annotations,
+                       PdfCodec         codec)
+{
+  gint width = cairo_image_surface_get_width (background);
+  gint height = cairo_image_surface_get_height (background);
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create (surface);
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+  GByteArray *image = (GByteArray *) NULL;
+
+  cairo_set_source_surface (cr, background, 0, 0);
+  cairo_paint (cr);
+
+  if (annotations)
+    {
+      cairo_set_source_surface (cr, annotations, 0, 0);
+      cairo_paint (cr);
+    }
+
+  cairo_destroy (cr);
+
+  pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0, width, height);
+  cairo_surface_destroy (surface);
+
+  image = encode_page_image (pixbuf, codec);
+  g_object_unref (pixbuf);
+
+  return image;
+}
+
+
+/* Is the surface fully transparent? */
+static gboolean
+is_transparent (cairo_surface_t *surface)
+{
+  gint width = cairo_image_surface_get_width (surface);
+  gint height = cairo_image_surface_get_height (surface);
+  gint stride = cairo_image_surface_get_stride (surface);
+  const guchar *pixels = cairo_image_surface_get_data (surface);
+  gint y = 0;
+
+  cairo_surface_flush (surface);
+
+  for (y = 0; y < height; y++)
+    {
+      const guint32 *row = (const guint32 *) (pixels + y * stride);
+      gint x = 0;
+
+      for (x = 0; x < width; x++)
+        {
+          if (row[x] >> 24)
+            {
+              return FALSE;
+            }
+        }
     }
+
+  return TRUE;
 }
 
 
+/*
+ * Write the image under the paths; it is the background with the base
+ * annotations, if any, and it is shared with the previous page when
+ * they are the same. Return the object number; zero if there is no image.
+ */
+static guint
+pdf_write_base_image (PdfData *pdf,
+                      PdfPage *page)
+{
+  GBytes *png = page->base ? canvas_savepoint_get_png (page->base) : (GBytes *) NULL;
+  cairo_surface_t *base = (cairo_surface_t *) NULL;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+  GByteArray *image = (GByteArray *) NULL;
+  const gchar *background = page->background_image ? page->background_image : page->background_color;
+  guint number = 0;
+
+  if ((png) && (pdf->base_png) && (g_bytes_equal (png, pdf->base_png)) &&
+      (g_strcmp0 (background, pdf->base_background) == 0))
+    {
+      g_bytes_unref (png);
+      return pdf->base_object;
+    }
+
+  if (png)
+    {
+      base = canvas_png_to_surface (png);
+
+      /* The empty page has no annotation to be composed. */
+      if ((cairo_surface_status (base) != CAIRO_STATUS_SUCCESS) || (is_transparent (base)))
+        {
+          cairo_surface_destroy (base);
+          base = (cairo_surface_t *) NULL;
+        }
+    }
+
+  if (!base)
+    {
+      if (png)
+        {
+          g_bytes_unref (png);
+        }
+
+      /* The colour is painted as a rectangle. */
+      if (!page->background_image)
+        {
+          return 0;
+        }
+
+      /* The background image is written once. */
+      if (g_strcmp0 (page->background_image, pdf->background_image) != 0)
+        {
+          pixbuf = load_background_pixbuf (page->background_image, page->width, page->height);
+
+          if (pixbuf)
+            {
+              image = encode_page_image (pixbuf, page->codec);
+              g_object_unref (pixbuf);
+            }
+
+          g_free (pdf->background_image);
+          pdf->background_image = g_strdup (page->background_image);
+          pdf->background_object = image ? pdf_write_image (pdf, image, page->codec, page->width, page->height) : 0;
+
+          if (image)
+            {
+              g_byte_array_unref (image);
+            }
+        }
+
+      return pdf->background_object;
+    }
+
+  surface = create_background_surface (page->background_color, page->background_image, (gchar *) NULL, page->width, page->height);
+  image = encode_composed_image (surface, base, page->codec);
+  cairo_surface_destroy (surface);
+  cairo_surface_destroy (base);
+
+  if (image)
+    {
+      number = pdf_write_image (pdf, image, page->codec, page->width, page->height);
+      g_byte_array_unref (image);
+    }
+
+  if (pdf->base_png)
+    {
+      g_bytes_unref (pdf->base_png);
+    }
+
+  pdf->base_png = png;
+  pdf->base_object = number;
+  g_free (pdf->base_background);
+  pdf->base_background = g_strdup (background);
+
+  return number;
+}
+
+
+/* Append the page with the background and the annotations as paths. */
+static void
+pdf_append_vector_page (PdfData *pdf,
+                        PdfPage *page)
+{
+  guint first_object = pdf->objects;
+  guint image_object = pdf_write_base_image (pdf, page);
+  GString *content = g_string_new ("");
+  GString *states = g_string_new ("");
+  GString *resources = g_string_new ("");
+  GSList *list = (GSList *) NULL;
+
+  if (image_object)
+    {
+      g_string_append_printf (content, "q %d 0 0 %d 0 0 cm /Im0 Do Q\n", page->width, page->height);
+      g_string_append_printf (resources, "/XObject << /Im0 %u 0 R >> ", image_object);
+    }
+  else if (page->background_color)
+    {
+      g_string_append (content, "q ");
+      append_color (content, states, page->background_color);
+      g_string_append_printf (content, "0 0 %d %d re f Q\n", page->width, page->height);
+    }
+
+  /* The canvas has the origin in the top left corner. */
+  g_string_append_printf (content, "q 1 0 0 -1 0 %d cm\n", page->height);
+
+  for (list = page->paths; list; list = list->next)
+    {
+      append_paths (content, states, (GPtrArray *) list->data);
+    }
+
+  g_string_append (content, "Q\n");
+
+  if (states->len > 0)
+    {
+      g_string_append_printf (resources, "/ExtGState << %s>>", states->str);
+    }
+
+  pdf_write_page (pdf, first_object, page->width, page->height, content->str, resources->str);
+
+  g_string_free (content, TRUE);
+  g_string_free (states, TRUE);
+  g_string_free (resources, TRUE);
+}
+
+
+/* Free the page. */
+static void
+pdf_page_free (PdfPage *page)
+{
+  if (page->pixbuf)
+    {
+      g_object_unref (page->pixbuf);
+    }
+
+  if (page->image)
+    {
+      g_byte_array_unref (page->image);
+    }
+
+  if (page->base)
+    {
+      canvas_savepoint_free (page->base);
+    }
+
+  g_slist_free_full (page->paths, (GDestroyNotify) g_ptr_array_unref);
+  g_free (page->background_color);
+  g_free (page->background_image);
+  g_free (page);
+}
+
+
+/* Create the pdf file with the header and the catalog; the pages tree is written by each update. */
+static gboolean
+pdf_open (PdfData *pdf)
+{
+  pdf->fp = g_fopen (pdf->filename, "wb");
+
+  if (!pdf->fp)
+    {
+      g_warning ("Unable to open the pdf file %s", pdf->filename);
+      return FALSE;
+    }
+
+  pdf_printf (pdf, "%%PDF-1.4\n%%\342\343\317\323\n");
+  pdf_begin_object (pdf, 1);
+  pdf_printf (pdf, "<< /Type /Catalog /Pages %u 0 R >>\nendobj\n", PDF_PAGES_OBJECT);
+
+  return TRUE;
+}
+
+
+/* Sync and close the pdf file. */
+static void
+pdf_close (PdfData *pdf)
+{
+  if (pdf->fp)
+    {
+      if (pdf->unsynced_pages > 0)
+        {
+          fflush (pdf->fp);
+          g_fsync (fileno (pdf->fp));
+          pdf->unsynced_pages = 0;
+        }
+
+      fclose (pdf->fp);
+      pdf->fp = NULL;
+    }
+}
+
+
+/* The thread appending the pages in the order they have been added. */
+static gpointer
+pdf_writer (PdfData *pdf)
+{
+  pdf_open (pdf);
+
+  while (TRUE)
+    {
+      PdfPage *page = (PdfPage *) g_async_queue_pop (pdf->queue);
+
+      if (page == (PdfPage *) &stop_request)
+        {
+          break;
+        }
+
+      if (pdf->fp)
+        {
+          TRACE_BEGIN ("export_pdf_page");
+
+          if (page->vector)
+            {
+              pdf_append_vector_page (pdf, page);
+            }
+          else
+            {
+              pdf_append_raster_page (pdf, page);
+            }
+
+          TRACE_END ("export_pdf_page");
+        }
+
+      g_atomic_int_add (&pdf->queued_bytes, - (gint) page->size);
+      pdf_page_free (page);
+    }
+
+  pdf_close (pdf);
+
+  return NULL;
+}
+
+
+/* Set the codec of the page images. */
+void
+set_pdf_codec (PdfCodec codec)
+{
+  pdf_codec = codec;
+}
+
+
+/*
+ * Export the pages with the background image written once and the
+ * annotations as vector paths instead of the screenshot.
+ */
+void
+set_pdf_vector (gboolean vector)
+{
+  pdf_vector = vector;
+}
+
+
+/*
+ * Take the background and the annotations shown on the canvas: the
+ * paths of the save-points painted after the last one that is not
+ * made of paths, which is the base. The paths of the eraser are not
+ * vectors; the base is the image of their save-point then.
+ */
+static void
+take_vector_page (PdfPage *page)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  GSList *list = g_slist_nth (canvas->savepoint_list, canvas->current_save_index);
+
+  page->vector = TRUE;
+
+  if (get_background_type () == 2)
+    {
+      page->background_image = g_strdup (get_background_image ());
+    }
+  else
+    {
+      page->background_color = g_strdup (get_background_color ());
+    }
+
+  for (; list; list = list->next)
+    {
+      AnnotateSavepoint *savepoint = (AnnotateSavepoint *) list->data;
+
+      if (!savepoint->paths)
+        {
+          /* It is copied; the canvas can delete it meanwhile. */
+          page->base = canvas_savepoint_copy (savepoint);
+          break;
+        }
+
+      if (canvas_savepoint_erases (savepoint))
+        {
+          cairo_surface_t *surface = canvas_savepoint_render (list, canvas->width, canvas->height);
+          GBytes *png = canvas_surface_to_png (surface);
+
+          page->base = canvas_savepoint_new ((gchar *) NULL, png);
+          g_bytes_unref (png);
+          cairo_surface_destroy (surface);
+          break;
+        }
+
+      page->paths = g_slist_prepend (page->paths, g_ptr_array_ref (savepoint->paths));
+    }
+}
+
+
+/* Add the screenshot to pdf. */
+void
+add_pdf_page (GtkWindow *parent)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+  PdfPage *page = (PdfPage *) NULL;
+
+  /*
+   * Without a background the desktop is shown and it is taken by the
+   * screenshot; the paper lines are composed in the page image.
+   */
+  gboolean vector = (pdf_vector) && ((get_background_type () == 1) || (get_background_type () == 2));
+
+  /* The vector page does not need the screenshot; the first one is the preview of the dialog. */
+  if ((!vector) || (pdf_data == NULL))
+    {
+      pixbuf = grab_screenshot ();
+    }
+
+  if (pdf_data == NULL)
+    {
+      if (!init_pdf_saver (parent, pixbuf))
+        {
+          g_object_unref (pixbuf);
+          pdf_data_free (pdf_data);
+          pdf_data = NULL;
+          return;
+        }
+
+      pdf_data->queue = g_async_queue_new ();
+      pdf_data->thread = g_thread_new ("pdf-writer", (GThreadFunc) pdf_writer, pdf_data);
+    }
+
+  page = g_malloc0 ((gsize) sizeof (PdfPage));
+  page->width = pixbuf ? gdk_pixbuf_get_width (pixbuf) : canvas->width;
+  page->height = pixbuf ? gdk_pixbuf_get_height (pixbuf) : canvas->height;
+  page->codec = pdf_codec;
+
+  /* The background is known only here. */
+  if (page->codec == PDF_CODEC_AUTO)
+    {
+      page->codec = (get_background_type () == 2) ? PDF_CODEC_JPEG : PDF_CODEC_DEFLATE;
+    }
+
+  if (vector)
+    {
+      take_vector_page (page);
+
+      if (pixbuf)
+        {
+          g_object_unref (pixbuf);
+          pixbuf = (GdkPixbuf *) NULL;
+        }
+    }
+  else
+    {
+      page->pixbuf = pixbuf;
+      page->size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) * page->height;
+
+      /* Too many raw screenshots are waiting; keep this one compressed. */
+      if (g_atomic_int_get (&pdf_data->queued_bytes) + page->size > PDF_QUEUE_MAX_BYTES)
+        {
+          page->image = encode_page_image (pixbuf, page->codec);
+          g_object_unref (page->pixbuf);
+          page->pixbuf = (GdkPixbuf *) NULL;
+          page->size = page->image ? page->image->len : 0;
+        }
+    }
+
+  g_atomic_int_add (&pdf_data->queued_bytes, (gint) page->size);
+
+  /* Only the new page is written; the thread takes the page. */
+  g_async_queue_push (pdf_data->queue, page);
+}
+
+
+/* A board state of the history export. */
+typedef struct
+{
+
+  /* The link of the save-point in the copied list, newest first. */
+  GSList *link;
+
+  /* Has the emptiness been checked? */
+  gboolean classified;
+
+  /* Is the board empty e.g. just after a clear? */
+  gboolean empty;
+
+  /* Is the page image ready? */
+  gboolean ready;
+
+  /* The page image; NULL if it is not encoded. */
+  GByteArray *image;
+
+} PdfHistoryState;
+
+
+/* The export of the session history running in background. */
+typedef struct
+{
+
+  /* The pdf written by the export. */
+  PdfData *pdf;
+
+  /* Which states are exported. */
+  PdfHistoryPages mode;
+
+  /* The codec of the page images. */
+  PdfCodec codec;
+
+  gint width;
+  gint height;
+
+  /* The background taken at the start; NULL for the desktop. */
+  gchar *background_color;
+  gchar *background_image;
+  gchar *background_paper;
+
+  /* The background surface and the png of the empty board, made by the writer. */
+  cairo_surface_t *background;
+  GBytes *empty_png;
+
+  /* The copies of the save-points taken at the start, newest first. */
+  GSList *savepoints;
+
+  /* The states, oldest first, and the ones selected as pages. */
+  GPtrArray *states;
+  GPtrArray *pages;
+
+  /* Protect the flags of the states. */
+  GMutex mutex;
+  GCond cond;
+
+  /* Number of pages selected and written; they are read by the progress timeout. */
+  gint total;
+  gint written;
+
+  /* Has the writer finished? */
+  gint done;
+
+  /* Has the export been cancelled? */
+  gint cancelled;
+
+  /* Has the pdf been written? */
+  gboolean saved;
+
+  /* The threads rendering the pages and writing the pdf. */
+  GThreadPool *pool;
+  GThread *writer;
+
+  /* The progress timeout. */
+  guint timeout;
+
+  /* Called in the main loop while the export runs and at the end. */
+  PdfHistoryProgress progress;
+  PdfHistoryDone done_callback;
+  gpointer user_data;
+
+} PdfHistory;
+
+
+/* The history export running in background, if any. */
+static PdfHistory *running_history = (PdfHistory *) NULL;
+
+
+/* Is the board of the state empty? */
+static gboolean
+is_empty_state (PdfHistory      *history,
+                PdfHistoryState *state)
+{
+  AnnotateSavepoint *savepoint = (AnnotateSavepoint *) state->link->data;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  gboolean empty = FALSE;
+
+  if ((savepoint->paths) && (savepoint->paths->len > 0) && (!canvas_savepoint_erases (savepoint)))
+    {
+      return FALSE;
+    }
+
+  /* The boards cleared share the png of the empty canvas. */
+  if ((savepoint->png) && (g_bytes_equal (savepoint->png, history->empty_png)))
+    {
+      return TRUE;
+    }
+
+  surface = canvas_savepoint_render (state->link, history->width, history->height);
+
+  if (!surface)
+    {
+      return TRUE;
+    }
+
+  empty = (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) || (is_transparent (surface));
+  cairo_surface_destroy (surface);
+
+  return empty;
+}
+
+
+/*
+ * Check if the board is empty or, for the selected states, compose
+ * the board with the background and encode it; it runs in the pool.
+ */
+static void
+process_history_state (PdfHistoryState *state,
+                       PdfHistory      *history)
+{
+  gboolean classify = !state->classified;
+  gboolean empty = FALSE;
+  GByteArray *image = (GByteArray *) NULL;
+
+  /* The writer stops at the next page. */
+  if (!g_atomic_int_get (&history->cancelled))
+    {
+      if (classify)
+        {
+          empty = is_empty_state (history, state);
+        }
+      else
+        {
+          cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+          TRACE_BEGIN ("render_pdf_history_page");
+          surface = canvas_savepoint_render (state->link, history->width, history->height);
+
+          if ((surface) && (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS))
+            {
+              cairo_surface_destroy (surface);
+              surface = (cairo_surface_t *) NULL;
+            }
+
+          image = encode_composed_image (history->background, surface, history->codec);
+
+          if (surface)
+            {
+              cairo_surface_destroy (surface);
+            }
+
+          TRACE_END ("render_pdf_history_page");
+        }
+    }
+
+  g_mutex_lock (&history->mutex);
+
+  if (classify)
+    {
+      state->empty = empty;
+      state->classified = TRUE;
+    }
+  else
+    {
+      state->image = image;
+      state->ready = TRUE;
+    }
+
+  g_cond_broadcast (&history->cond);
+  g_mutex_unlock (&history->mutex);
+}
+
+
+/* Create the png of the empty board; it has the same bytes of the one made by the canvas. */
+static GBytes *
+create_empty_png (gint width,
+                  gint height)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  GBytes *png = canvas_surface_to_png (surface);
+  cairo_surface_destroy (surface);
+  return png;
+}
+
+
+/*
+ * Select the states exported as pages: the boards before each clear
+ * and the last one, or all the boards; the empty boards are skipped.
+ */
+static void
+select_history_pages (PdfHistory *history)
+{
+  guint i = 0;
+
+  g_mutex_lock (&history->mutex);
+
+  for (i = 0; i < history->states->len; i++)
+    {
+      PdfHistoryState *state = (PdfHistoryState *) g_ptr_array_index (history->states, i);
+
+      while ((!state->classified) && (!g_atomic_int_get (&history->cancelled)))
+        {
+          g_cond_wait (&history->cond, &history->mutex);
+        }
+    }
+
+  g_mutex_unlock (&history->mutex);
+
+  for (i = 0; i < history->states->len; i++)
+    {
+      PdfHistoryState *state = (PdfHistoryState *) g_ptr_array_index (history->states, i);
+      PdfHistoryState *next = (PdfHistoryState *) NULL;
+
+      if (state->empty)
+        {
+          continue;
+        }
+
+      if (i + 1 < history->states->len)
+        {
+          next = (PdfHistoryState *) g_ptr_array_index (history->states, i + 1);
+        }
+
+      if ((history->mode == PDF_HISTORY_SAVEPOINTS) || (!next) || (next->empty))
+        {
+          g_ptr_array_add (history->pages, state);
+        }
+    }
+
+  g_atomic_int_set (&history->total, history->pages->len);
+}
+
+
+/*
+ * The thread writing the history export: the boards are checked and
+ * then the selected ones are rendered by the pool while the pages are
+ * appended in order.
+ */
+static gpointer
+write_pdf_history (PdfHistory *history)
+{
+  guint i = 0;
+
+  TRACE_BEGIN ("export_pdf_history");
+
+  history->background = create_background_surface (history->background_color,
+                                                   history->background_image,
+                                                   history->background_paper,
+                                                   history->width,
+                                                   history->height);
+
+  history->empty_png = create_empty_png (history->width, history->height);
+
+  for (i = 0; i < history->states->len; i++)
+    {
+      g_thread_pool_push (history->pool, g_ptr_array_index (history->states, i), NULL);
+    }
+
+  select_history_pages (history);
+
+  for (i = 0; i < history->pages->len; i++)
+    {
+      g_thread_pool_push (history->pool, g_ptr_array_index (history->pages, i), NULL);
+    }
+
+  if ((history->pages->len > 0) && (pdf_open (history->pdf)))
+    {
+      for (i = 0; i < history->pages->len; i++)
+        {
+          PdfHistoryState *state = (PdfHistoryState *) g_ptr_array_index (history->pages, i);
+          guint first_object = history->pdf->objects;
+          guint image_object = 0;
+          gchar *content = (gchar *) NULL;
+          gchar *resources = (gchar *) NULL;
+
+          g_mutex_lock (&history->mutex);
+
+          while ((!state->ready) && (!g_atomic_int_get (&history->cancelled)))
+            {
+              g_cond_wait (&history->cond, &history->mutex);
+            }
+
+          g_mutex_unlock (&history->mutex);
+
+          if (g_atomic_int_get (&history->cancelled))
+            {
+              break;
+            }
+
+          if (state->image)
+            {
+              image_object = pdf_write_image (history->pdf, state->image, history->codec, history->width, history->height);
+              content = g_strdup_printf ("q %d 0 0 %d 0 0 cm /Im0 Do Q\n", history->width, history->height);
+              resources = g_strdup_printf ("/XObject << /Im0 %u 0 R >>", image_object);
+              pdf_write_page (history->pdf, first_object, history->width, history->height, content, resources);
+              g_free (content);
+              g_free (resources);
+
+              /* The encoded page is not needed anymore. */
+              g_byte_array_unref (state->image);
+              state->image = (GByteArray *) NULL;
+            }
+
+          g_atomic_int_inc (&history->written);
+        }
+
+      history->saved = (history->pdf->kids->len > 0) && (!g_atomic_int_get (&history->cancelled));
+      pdf_close (history->pdf);
+    }
+
+  TRACE_END ("export_pdf_history");
+
+  g_atomic_int_set (&history->done, 1);
+  return NULL;
+}
+
+
+/* Free the state. */
+static void
+pdf_history_state_free (PdfHistoryState *state)
+{
+  if (state->image)
+    {
+      g_byte_array_unref (state->image);
+    }
+
+  g_free (state);
+}
+
+
+/* Join the threads and notify the end of the history export. */
+static void
+finish_pdf_history (PdfHistory *history)
+{
+  g_thread_join (history->writer);
+  g_thread_pool_free (history->pool, TRUE, TRUE);
+
+  if (history->saved)
+    {
+      /* Add to the list of the artefacts created in the session. */
+      add_artifact (history->pdf->filename);
+    }
+  else if (history->pdf->length > 0)
+    {
+      /* The pages written before the cancel are removed. */
+      g_remove (history->pdf->filename);
+    }
+
+  running_history = (PdfHistory *) NULL;
+
+  if (history->done_callback)
+    {
+      history->done_callback (history->saved, history->user_data);
+    }
+
+  if (history->background)
+    {
+      cairo_surface_destroy (history->background);
+    }
+
+  if (history->empty_png)
+    {
+      g_bytes_unref (history->empty_png);
+    }
+
+  g_slist_free_full (history->savepoints, (GDestroyNotify) canvas_savepoint_free);
+  g_ptr_array_free (history->pages, TRUE);
+  g_ptr_array_free (history->states, TRUE);
+  pdf_data_free (history->pdf);
+  g_mutex_clear (&history->mutex);
+  g_cond_clear (&history->cond);
+  g_free (history->background_color);
+  g_free (history->background_image);
+  g_free (history->background_paper);
+  g_free (history);
+}
+
+
+/* Report the progress and finish the history export when the writer is done. */
+static gboolean
+on_pdf_history_progress (PdfHistory *history)
+{
+  if (g_atomic_int_get (&history->done))
+    {
+      finish_pdf_history (history);
+      return FALSE;
+    }
+
+  if (history->progress)
+    {
+      history->progress ((gdouble) g_atomic_int_get (&history->written) / MAX (g_atomic_int_get (&history->total), 1),
+                         history->user_data);
+    }
+
+  return TRUE;
+}
+
+
+/* Create the widget to choose the pages of the history export. */
+static GtkWidget *
+create_history_pages_combo ()
+{
+  GtkWidget *combo = gtk_combo_box_text_new ();
+
+  gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo), gettext ("A page for each board cleared"));
+  gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo), gettext ("A page for each save-point"));
+  gtk_combo_box_set_active (GTK_COMBO_BOX (combo), PDF_HISTORY_CLEARS);
+  gtk_widget_show (combo);
+
+  return combo;
+}
+
+
+/*
+ * Export the boards of the session as the pages of a new pdf; the
+ * save-points are copied then the painting can go on meanwhile.
+ * Return FALSE if the export has not been started.
+ */
+gboolean
+start_pdf_history_export (GtkWindow          *parent,
+                          PdfHistoryProgress  progress,
+                          PdfHistoryDone      done,
+                          gpointer            user_data)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+  GtkWidget *combo = (GtkWidget *) NULL;
+  PdfHistory *history = (PdfHistory *) NULL;
+  GSList *list = (GSList *) NULL;
+  guint count = 0;
+  guint i = 0;
+
+  if (running_history)
+    {
+      return FALSE;
+    }
+
+  history = g_malloc0 ((gsize) sizeof (PdfHistory));
+  history->pdf = pdf_data_new ();
+
+  pixbuf = grab_screenshot ();
+  combo = create_history_pages_combo ();
+  g_object_ref_sink (combo);
+
+  if (!start_save_pdf_dialog (parent, pixbuf, history->pdf, combo))
+    {
+      g_object_unref (pixbuf);
+      g_object_unref (combo);
+      pdf_data_free (history->pdf);
+      g_free (history);
+      return FALSE;
+    }
+
+  history->mode = (PdfHistoryPages) gtk_combo_box_get_active (GTK_COMBO_BOX (combo));
+  g_object_unref (combo);
+
+  history->width = gdk_pixbuf_get_width (pixbuf);
+  history->height = gdk_pixbuf_get_height (pixbuf);
+  g_object_unref (pixbuf);
+
+  history->codec = pdf_codec;
+
+  /* The background is known only here; the desktop is not and the boards are on the paper. */
+  if (get_background_type () == 2)
+    {
+      history->background_image = g_strdup (get_background_image ());
+    }
+  else if (get_background_type () == 1)
+    {
+      history->background_color = g_strdup (get_background_color ());
+    }
+  else if (get_background_type () == 3)
+    {
+      history->background_paper = g_strdup (get_background_paper ());
+    }
+
+  if (history->codec == PDF_CODEC_AUTO)
+    {
+      history->codec = (history->background_image) ? PDF_CODEC_JPEG : PDF_CODEC_DEFLATE;
+    }
+
+  /*
+   * The states undone are not exported; the save-points are copied
+   * because they can be deleted while the export runs.
+   */
+  for (list = g_slist_nth (canvas->savepoint_list, canvas->current_save_index); list; list = list->next)
+    {
+      history->savepoints = g_slist_prepend (history->savepoints, canvas_savepoint_copy ((AnnotateSavepoint *) list->data));
+    }
+
+  history->savepoints = g_slist_reverse (history->savepoints);
+
+  /* The list starts with the last save-point; the states with the oldest one. */
+  count = g_slist_length (history->savepoints);
+  history->states = g_ptr_array_new_with_free_func ((GDestroyNotify) pdf_history_state_free);
+  g_ptr_array_set_size (history->states, count);
+
+  for (list = history->savepoints, i = 0; list; list = list->next, i++)
+    {
+      PdfHistoryState *state = g_malloc0 ((gsize) sizeof (PdfHistoryState));
+      state->link = list;
+      g_ptr_array_index (history->states, count - 1 - i) = state;
+    }
+
+  history->pages = g_ptr_array_new ();
+  history->progress = progress;
+  history->done_callback = done;
+  history->user_data = user_data;
+  g_mutex_init (&history->mutex);
+  g_cond_init (&history->cond);
+
+  history->pool = g_thread_pool_new ((GFunc) process_history_state,
+                                     history,
+                                     g_get_num_processors (),
+                                     FALSE,
+                                     NULL);
+
+  history->writer = g_thread_new ("pdf-history", (GThreadFunc) write_pdf_history, history);
+
+  running_history = history;
+  history->timeout = g_timeout_add (100, (GSourceFunc) on_pdf_history_progress, history);
+
+  return TRUE;
+}
+
+
+/* Cancel the running history export; the pdf is removed. */
+void
+cancel_pdf_history_export ()
+{
+  if (running_history)
+    {
+      g_atomic_int_set (&running_history->cancelled, 1);
+
+      /* Wake up the writer waiting for a page. */
+      g_mutex_lock (&running_history->mutex);
+      g_cond_broadcast (&running_history->cond);
+      g_mutex_unlock (&running_history->mutex);
+    }
+}
+
+
+/* Is a history export running? */
+gboolean
+is_pdf_history_export_running ()
+{
+  return (running_history != NULL);
+}
+
+
+/* Quit the pdf saver. */
+void
+quit_pdf_saver ()
+{
+  if (pdf_data)
+    {
+      /* The pages already added are written before to stop. */
+      if (pdf_data->thread)
+        {
+          g_async_queue_push (pdf_data->queue, &stop_request);
+          g_thread_join (pdf_data->thread);
+          pdf_data->thread = NULL;
+        }
+
+      if (pdf_data->queue)
+        {
+          g_async_queue_unref (pdf_data->queue);
+          pdf_data->queue = NULL;
+        }
+
+      pdf_data_free (pdf_data);
+      pdf_data = NULL;
+    }
+
+  /* The history export is cancelled and it is waited. */
+  if (running_history)
+    {
+      g_source_remove (running_history->timeout);
+      cancel_pdf_history_export ();
+      finish_pdf_history (running_history);
+    }
+}
+
@@ -22,34 +22,177 @@
  */
 
 
+/*
+ * Export the screenshots as the pages of a pdf.
+ *
+ * The pdf is written incrementally by a thread: each page is appended
+ * with an incremental update made of the image, the page, the new pages
+ * tree and a cross-reference section; the cost of a page does not depend
+ * on the pages already written and after each update the file is synced
+ * and it is a complete pdf. The screenshots are kept in memory until
+ * they are written and then compressed with the configured codec.
+ *
+ * In vector mode a page is made of the background, whose image is
+ * shared by the pages, and of the strokes of the canvas as pdf paths;
+ * the annotations that are not strokes, e.g. the fills and the texts,
+ * are composed with the background in an image under the paths.
+ *
+ * The history export writes the boards of the whole session in a new
+ * pdf: the save-points are rendered with the background and encoded by
+ * a thread pool and a thread appends the pages in order.
+ */
+
+
+#include <stdio.h>
+
 #include <glib.h>
 
 #include <gtk/gtk.h>
 
-#include <cairo.h>
-#include <cairo-pdf.h>
+
+/*
+ * Bytes of the screenshots waiting to be written above which the new
+ * ones are compressed before to be queued.
+ */
+#define PDF_QUEUE_MAX_BYTES (64 * 1024 * 1024)
+
+/*
+ * Number of pages appended between two syncs of the file; each page
+ * is flushed, the file is synced also when it is closed.
+ */
+#define PDF_SYNC_PAGES 8
+
+/* Quality of the jpeg pages. */
+#define PDF_JPEG_QUALITY "90"
+
+
+/* How the page images are compressed. */
+typedef enum
+  {
+
+    /* Jpeg if the background is a photo, deflate otherwise. */
+    PDF_CODEC_AUTO,
+
+    /* Lossless; it fits the annotations and the text. */
+    PDF_CODEC_DEFLATE,
+
+    /* Lossy and smaller; it fits the photos. */
+    PDF_CODEC_JPEG,
+
+  } PdfCodec;
+
+
+/* The boards of the session exported as pages; the empty ones are skipped. */
+typedef enum
+  {
+
+    /* The board before each clear and the last one. */
+    PDF_HISTORY_CLEARS,
+
+    /* The board at each save-point. */
+    PDF_HISTORY_SAVEPOINTS,
+
+  } PdfHistoryPages;
+
+
+/* Called in the main loop with the fraction of the history pages written. */
+typedef void (*PdfHistoryProgress) (gdouble   fraction,
+                                    gpointer  user_data);
+
+
+/* Called in the main loop at the end of the history export. */
+typedef void (*PdfHistoryDone)     (gboolean  saved,
+                                    gpointer  user_data);
 
 
 typedef struct
 {
 
-  /* The current pdf save thread. */
+  /* The thread appending the pages to the pdf. */
   GThread  *thread;  
 
-  /* The list contains the file name of all the input pdf pages saved. */
-  GSList *input_filelist;
+  /* The screenshots waiting to be appended. */
+  GAsyncQueue *queue;
+
+  /* Bytes of the queued screenshots. */
+  gint queued_bytes;
 
   /* The file name where store the pdf. */
   gchar *filename;
 
+  /* The pdf file; it is used only by the thread. */
+  FILE *fp;
+
+  /* Number of bytes written in the file. */
+  gint64 length;
+
+  /* The offset of each object in the file indexed by the object number. */
+  GArray *offsets;
+
+  /* The number of the next object. */
+  guint objects;
+
+  /* The page objects. */
+  GArray *kids;
+
+  /* The image of the last background written and its object. */
+  gchar *background_image;
+  guint background_object;
+
+  /* The last annotations image composed on the background and its object. */
+  GBytes *base_png;
+  gchar *base_background;
+  guint base_object;
+
+  /* Offset of the last cross-reference section; zero before the first one. */
+  gint64 xref_offset;
+
+  /* The pages appended since the last sync of the file. */
+  guint unsynced_pages;
+
 }PdfData;
 
 
+/* Set the codec of the page images. */
+void
+set_pdf_codec (PdfCodec codec);
+
+
+/*
+ * Export the pages with the background image written once and the
+ * annotations as vector paths instead of the screenshot.
+ */
+void
+set_pdf_vector (gboolean vector);
+
+
 /* Add the screenshot to pdf. */
 void
 add_pdf_page (GtkWindow *parent);
 
 
+/*
+ * Export the boards of the session as the pages of a new pdf; the
+ * save-points are copied then the painting can go on meanwhile.
+ * Return FALSE if the export has not been started.
+ */
+gboolean
+start_pdf_history_export (GtkWindow          *parent,
+                          PdfHistoryProgress  progress,
+                          PdfHistoryDone      done,
+                          gpointer            user_data);
+
+
+/* Cancel the running history export; the pdf is removed. */
+void
+cancel_pdf_history_export ();
+
+
+/* Is a history export running? */
+gboolean
+is_pdf_history_export_running ();
+
+
 /* Quit the pdf saver. */
 void
 quit_pdf_saver ();
@@ -31,6 +31,7 @@
 #include <background_window.h>
 #include <annotation_window.h>
 #include <keyboard.h>
+#include <paper.h>
 
 
 /* Show the permission denied to access to file dialog. */
@@ -71,6 +72,8 @@ start_preference_dialog      (GtkWindow *parent)
   GtkFileFilter *filter = (GtkFileFilter *) NULL;
   GObject *bg_color_obj = (GObject *) NULL;
   GtkWidget *color_button = (GtkWidget *) NULL;
+  PaperKind paper_kind = PAPER_SQUARED;
+  gint paper_spacing = PAPER_DEFAULT_SPACING;
 
   PreferenceData *preference_data = (PreferenceData *) NULL;
 
@@ -105,8 +108,8 @@ start_preference_dialog      (GtkWindow *parent)
 
   /* Put the file filter for the supported formats. */
   filter = gtk_file_filter_new ();
-  gtk_file_filter_set_name (filter, "PNG");
-  gtk_file_filter_add_mime_type (filter, "image/png");
+  gtk_file_filter_set_name (filter, "Images");
+  gtk_file_filter_add_pixbuf_formats (filter);
   gtk_file_chooser_add_filter (chooser, filter);
 
   preference_data->preview = gtk_image_new ();
@@ -118,6 +121,18 @@ start_preference_dialog      (GtkWindow *parent)
   color_button = GTK_WIDGET (bg_color_obj);
   gtk_color_button_set_use_alpha (GTK_COLOR_BUTTON (color_button), TRUE);
 
+  if (paper_spec_parse (get_background_paper (), &paper_kind, &paper_spacing))
+    {
+      GObject *combo_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
+                                                   "paperComboBox");
+      GObject *spin_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
+                                                  "paperSpacingSpinButton");
+
+      /* The last paper is shown; the signals are not connected yet. */
+      gtk_combo_box_set_active (GTK_COMBO_BOX (combo_obj), paper_kind);
+      gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin_obj), paper_spacing);
+    }
+
   /* Connect all signals by reflection. */
   gtk_builder_connect_signals (preference_data->preference_dialog_gtk_builder,
                                (gpointer) preference_data);
@@ -140,6 +155,13 @@ start_preference_dialog      (GtkWindow *parent)
       GtkToggleButton *image_tool_button = GTK_TOGGLE_BUTTON (file_obj);
       gtk_toggle_button_set_active (image_tool_button, TRUE);
     }
+  else if (background_type == 3)
+    {
+      GObject *paper_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
+                                                   "paper");
+
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (paper_obj), TRUE);
+    }
 
   gchar *rgba = get_background_color ();
   if (rgba)
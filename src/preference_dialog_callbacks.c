@@ -25,6 +25,7 @@
 #include <utils.h>
 #include <preference_dialog.h>
 #include <background_window.h>
+#include <paper.h>
 
 
 /* Update the preview image. */
@@ -83,6 +84,18 @@ on_background_color_button_color_set (GtkButton *buton,
 }
 
 
+/* Shot when the kind or the spacing of the paper change. */
+G_MODULE_EXPORT void
+on_paper_changed (GtkWidget *widget,
+                  gpointer   data)
+{
+  PreferenceData *preference_data = (PreferenceData *) data;
+  GObject *paper_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder, "paper");
+  GtkToggleButton *paper_tool_button = GTK_TOGGLE_BUTTON (paper_obj);
+  gtk_toggle_button_set_active (paper_tool_button, TRUE);
+}
+
+
 /* Shot when the ok button in preference dialog is pushed. */
 G_MODULE_EXPORT void
 on_preference_ok_button_clicked (GtkButton *buton,
@@ -94,6 +107,8 @@ on_preference_ok_button_clicked (GtkButton *buton,
   gchar *rgba = NULL;
   GObject *color_tool_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder, "color");
   GtkToggleButton *color_tool_button = GTK_TOGGLE_BUTTON (color_tool_obj);
+  GObject *paper_tool_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder, "paper");
+  GtkToggleButton *paper_tool_button = GTK_TOGGLE_BUTTON (paper_tool_obj);
 
   if (gtk_toggle_button_get_active (color_tool_button))
     {
@@ -117,13 +132,27 @@ on_preference_ok_button_clicked (GtkButton *buton,
       g_free (gdkcolor);
       set_background_type (1);
     }
+  else if (gtk_toggle_button_get_active (paper_tool_button))
+    {
+      /* procedural paper */
+      GObject *combo_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
+                                                   "paperComboBox");
+      GObject *spin_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
+                                                  "paperSpacingSpinButton");
+      gchar *paper = paper_spec_new ((PaperKind) gtk_combo_box_get_active (GTK_COMBO_BOX (combo_obj)),
+                                     gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_obj)));
+
+      update_background_paper (paper);
+      set_background_type (3);
+      g_free (paper);
+    }
   else
     {
       GObject *file_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder, "file");
       GtkToggleButton *image_tool_button = GTK_TOGGLE_BUTTON (file_obj);
       if (gtk_toggle_button_get_active (image_tool_button))
         {
-          /* background png from file */
+          /* background image from file */
           GObject *image_obj = gtk_builder_get_object (preference_data->preference_dialog_gtk_builder,
                                                        "imageChooserButton");
           GtkFileChooserButton *image_chooser_button = GTK_FILE_CHOOSER_BUTTON (image_obj);
@@ -58,14 +58,6 @@ start_project_dialog ()
   gtk_window_set_modal (GTK_WINDOW (project_dialog), TRUE);
   gtk_window_set_keep_above (GTK_WINDOW (project_dialog), TRUE);
 
-#ifdef _WIN32
-  /* 
-   * In Windows the parent bar go above the dialog;
-   * to avoid this behaviour I put the parent keep above to false.
-   */
-  gtk_window_set_keep_above (GTK_WINDOW (parent), FALSE);
-#endif
-
   dialog_obj = gtk_builder_get_object (project_data->project_dialog_gtk_builder, "projectDialogEntry");
   dialog_entry = GTK_WIDGET (dialog_obj);
 
@@ -30,41 +30,719 @@
 #include <recorder.h>
 #include <utils.h>
 #include <keyboard.h>
+#include <annotation_window.h>
+#include <background_window.h>
+#include <trace.h>
+#include <video_encoder.h>
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#  include <X11/Xlib.h>
+#endif
+
+
+/*
+ * A patch of the screen changed at a frame; the encoder keeps the
+ * whole frame and the patch is copied over it.
+ */
+typedef struct
+{
+
+  /* The content of the area; NULL marks the end of the video. */
+  cairo_surface_t *surface;
+
+  /* The position of the area on the screen. */
+  gint x;
+  gint y;
+
+  /* The position of the frame in the video timeline. */
+  gint64 index;
+
+} RecorderPatch;
+
+
+/* The state shared by the main loop, the capture and the encoder threads. */
+typedef struct
+{
+
+  gchar *filename;
+
+  gint width;
+  gint height;
+
+  /* Record only the board composing the layers instead of the screen. */
+  gboolean board;
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+  /* The capture thread uses its own connection to the server. */
+  gchar *display_name;
+  Display *display;
+  cairo_surface_t *root_surface;
+#endif
+
+  /* The copy of the screen last sent used to find the changed rows. */
+  cairo_surface_t *mirror;
+
+  /* The background composed with the board and what it has been made from. */
+  cairo_surface_t *background;
+  gchar *background_key;
+
+  /* The source of the main loop tick. */
+  guint tick;
+
+  /* The next frame where the desktop is read in full. */
+  gint64 refresh_index;
+
+  /* Protect the state below and wake up the capture thread. */
+  GMutex mutex;
+  GCond cond;
+
+  gboolean running;
+  gboolean paused;
+
+  /* The timeline in microseconds; the pauses are cut out. */
+  gint64 start_time;
+  gint64 paused_time;
+  gint64 pause_start;
+
+  /* The area to be read by the capture thread and its frame. */
+  cairo_region_t *damage;
+  gboolean refresh;
+  gint64 damage_index;
+
+  /* The patches for the encoder thread. */
+  GAsyncQueue *queue;
+
+  GThread *capture_thread;
+  GThread *encoder_thread;
+
+} Recorder;
+
+
+/* Record only the board? */
+static gboolean record_board = FALSE;
+
+/* The running recorder; NULL if it is not started. */
+static Recorder *recorder = (Recorder *) NULL;
+
+/* Record with the vlc script? */
+static gboolean record_script = FALSE;
+
+/* Is the recording of the script started and paused. */
+static gboolean script_started = FALSE;
+static gboolean script_paused = FALSE;
+
+
+/* Open the screen in the capture thread; return false if it can not be read. */
+static gboolean
+open_screen             (Recorder  *rec)
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+  rec->display = XOpenDisplay (rec->display_name);
+
+  if (!rec->display)
+    {
+      g_warning ("Cannot open the display %s to record the screen", rec->display_name);
+      return FALSE;
+    }
+
+  rec->root_surface = cairo_xlib_surface_create (rec->display,
+                                                 DefaultRootWindow (rec->display),
+                                                 DefaultVisual (rec->display, DefaultScreen (rec->display)),
+                                                 rec->width,
+                                                 rec->height);
+#endif
+
+  return TRUE;
+}
+
+
+/* Release what open_screen has taken. */
+static void
+close_screen            (Recorder  *rec)
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+  if (rec->root_surface)
+    {
+      cairo_surface_destroy (rec->root_surface);
+      rec->root_surface = (cairo_surface_t *) NULL;
+    }
+
+  if (rec->display)
+    {
+      XCloseDisplay (rec->display);
+      rec->display = (Display *) NULL;
+    }
+#endif
+}
+
+
+/*
+ * Read the area of the screen in an image surface; it runs in the
+ * capture thread then it does not touch gdk.
+ */
+static cairo_surface_t *
+grab_screen             (Recorder              *rec,
+                         cairo_rectangle_int_t *area)
+{
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+#ifdef _WIN32
+  HDC screen_dc = GetDC (NULL);
+  cairo_surface_t *dib = cairo_win32_surface_create_with_dib (CAIRO_FORMAT_RGB24, area->width, area->height);
+  cairo_t *cr = (cairo_t *) NULL;
+
+  cairo_surface_flush (dib);
+  BitBlt (cairo_win32_surface_get_dc (dib), 0, 0, area->width, area->height, screen_dc, area->x, area->y, SRCCOPY);
+  cairo_surface_mark_dirty (dib);
+  ReleaseDC (NULL, screen_dc);
 
-/* pid of the recording process. */
-static GPid recorder_pid;
+  /* The rows are compared then an image surface is returned. */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, area->width, area->height);
+  cr = cairo_create (surface);
+  cairo_set_source_surface (cr, dib, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  cairo_surface_destroy (dib);
+#elif defined(__APPLE__)
+  CGImageRef image = CGDisplayCreateImageForRect (CGMainDisplayID (),
+                                                  CGRectMake (area->x, area->y, area->width, area->height));
+  CGColorSpaceRef color_space = CGColorSpaceCreateDeviceRGB ();
+  CGContextRef context = (CGContextRef) NULL;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, area->width, area->height);
+  cairo_surface_flush (surface);
+  context = CGBitmapContextCreate (cairo_image_surface_get_data (surface),
+                                   area->width,
+                                   area->height,
+                                   8,
+                                   cairo_image_surface_get_stride (surface),
+                                   color_space,
+                                   kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Host);
+
+  CGContextDrawImage (context, CGRectMake (0, 0, area->width, area->height), image);
+  cairo_surface_mark_dirty (surface);
+
+  CGContextRelease (context);
+  CGColorSpaceRelease (color_space);
+  CGImageRelease (image);
+#else
+  /* Cairo reads only the area of the root window, with the shared memory if available. */
+  cairo_t *cr = (cairo_t *) NULL;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, area->width, area->height);
+  cr = cairo_create (surface);
+  cairo_set_source_surface (cr, rec->root_surface, -area->x, -area->y);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+#endif
 
-/* is the recorder started */
-static gboolean started = FALSE;
+  return surface;
+}
+
+
+/* Paint the surface in the area of the destination. */
+static void
+paint_area              (cairo_surface_t        *destination,
+                         cairo_surface_t        *surface,
+                         cairo_rectangle_int_t  *area,
+                         gint                    x,
+                         gint                    y)
+{
+  cairo_t *cr = cairo_create (destination);
+  cairo_rectangle (cr, area->x, area->y, area->width, area->height);
+  cairo_clip (cr);
+  cairo_set_source_surface (cr, surface, x, y);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+}
+
+
+/* Queue the patch to the encoder. */
+static void
+push_patch              (Recorder         *rec,
+                         cairo_surface_t  *surface,
+                         gint              x,
+                         gint              y,
+                         gint64            index)
+{
+  RecorderPatch *patch = g_malloc ((gsize) sizeof (RecorderPatch));
+  patch->surface = surface;
+  patch->x = x;
+  patch->y = y;
+  patch->index = index;
+  g_async_queue_push (rec->queue, patch);
+}
 
-/* is the recorder paused */
-static gboolean paused = FALSE;
 
 /*
- * Create a recorder process; it return the pid
+ * Compare the full screen with the copy last sent and queue only the
+ * band of the rows changed; nothing is queued if the screen is the same.
  */
-static GPid
-call_recorder (gchar *filename,
-               gchar *option)
+static void
+push_changed_rows       (Recorder         *rec,
+                         cairo_surface_t  *screen,
+                         gint64            index)
+{
+  guchar *data = cairo_image_surface_get_data (screen);
+  guchar *mirror_data = cairo_image_surface_get_data (rec->mirror);
+  gint stride = cairo_image_surface_get_stride (screen);
+  gsize row_size = (gsize) rec->width * 4;
+  gint first = 0;
+  gint last = rec->height - 1;
+  cairo_rectangle_int_t band;
+
+  cairo_surface_flush (screen);
+  cairo_surface_flush (rec->mirror);
+
+  while ((first <= last) && (memcmp (data + first * stride, mirror_data + first * stride, row_size) == 0))
+    {
+      first++;
+    }
+
+  while ((last >= first) && (memcmp (data + last * stride, mirror_data + last * stride, row_size) == 0))
+    {
+      last--;
+    }
+
+  if (first > last)
+    {
+      return;
+    }
+
+  /* The chroma is shared by two rows. */
+  band.x = 0;
+  band.y = first & ~1;
+  band.width = rec->width;
+  band.height = MIN ((last + 2) & ~1, rec->height) - band.y;
+
+  paint_area (rec->mirror, screen, &band, 0, 0);
+  push_patch (rec, cairo_surface_create_for_rectangle (screen, band.x, band.y, band.width, band.height), band.x, band.y, index);
+}
+
+
+/* The active time of the timeline in microseconds; it stops during the pause. */
+static gint64
+get_timeline_time       (Recorder  *rec)
+{
+  gint64 now = rec->paused ? rec->pause_start : g_get_monotonic_time ();
+  return now - rec->start_time - rec->paused_time;
+}
+
+
+/* The frame of the timeline shown now. */
+static gint64
+get_frame_index         (Recorder  *rec)
+{
+  return get_timeline_time (rec) * RECORDER_FPS / G_USEC_PER_SEC;
+}
+
+
+/*
+ * The capture thread of the desktop; it reads the areas damaged in
+ * the last tick and, at each refresh, the full screen to catch what
+ * the other programs changed. It sleeps when nothing changes.
+ */
+static gpointer
+capture_run             (Recorder  *rec)
+{
+  gboolean opened = open_screen (rec);
+
+  g_mutex_lock (&rec->mutex);
+
+  while ((opened) && (rec->running))
+    {
+      cairo_region_t *damage = (cairo_region_t *) NULL;
+      gboolean refresh = FALSE;
+      gint64 index = 0;
+      gint i = 0;
+
+      if ((cairo_region_is_empty (rec->damage)) && (!rec->refresh))
+        {
+          g_cond_wait (&rec->cond, &rec->mutex);
+          continue;
+        }
+
+      /* The encoder is late; the damage is merged with the next one. */
+      if (g_async_queue_length (rec->queue) >= RECORDER_QUEUE_LENGTH)
+        {
+          g_cond_wait_until (&rec->cond, &rec->mutex, g_get_monotonic_time () + G_USEC_PER_SEC / RECORDER_FPS);
+          continue;
+        }
+
+      damage = rec->damage;
+      rec->damage = cairo_region_create ();
+      refresh = rec->refresh;
+      rec->refresh = FALSE;
+      index = rec->damage_index;
+
+      g_mutex_unlock (&rec->mutex);
+
+      TRACE_BEGIN ("grab_frame");
+
+      if (refresh)
+        {
+          cairo_rectangle_int_t screen_area = { 0, 0, rec->width, rec->height };
+          cairo_surface_t *screen = grab_screen (rec, &screen_area);
+          push_changed_rows (rec, screen, index);
+          cairo_surface_destroy (screen);
+        }
+      else
+        {
+          for (i = 0; i < cairo_region_num_rectangles (damage); i++)
+            {
+              cairo_rectangle_int_t area;
+              cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+              cairo_region_get_rectangle (damage, i, &area);
+              surface = grab_screen (rec, &area);
+              paint_area (rec->mirror, surface, &area, area.x, area.y);
+              push_patch (rec, surface, area.x, area.y, index);
+            }
+        }
+
+      TRACE_END ("grab_frame");
+
+      cairo_region_destroy (damage);
+
+      g_mutex_lock (&rec->mutex);
+    }
+
+  g_mutex_unlock (&rec->mutex);
+
+  close_screen (rec);
+
+  return NULL;
+}
+
+
+/*
+ * Make the area aligned to the chroma blocks and inside the screen;
+ * when there are too many rectangles they are merged in one.
+ */
+static cairo_region_t *
+align_damage            (Recorder        *rec,
+                         cairo_region_t  *damage)
+{
+  cairo_region_t *aligned = cairo_region_create ();
+  cairo_rectangle_int_t screen_area = { 0, 0, rec->width, rec->height };
+  gint count = cairo_region_num_rectangles (damage);
+  gint i = 0;
+
+  for (i = 0; i < count; i++)
+    {
+      cairo_rectangle_int_t area;
+
+      if (count > RECORDER_MAX_PATCHES)
+        {
+          cairo_region_get_extents (damage, &area);
+          i = count;
+        }
+      else
+        {
+          cairo_region_get_rectangle (damage, i, &area);
+        }
+
+      area.width = ((area.x + area.width + 1) & ~1) - (area.x & ~1);
+      area.height = ((area.y + area.height + 1) & ~1) - (area.y & ~1);
+      area.x &= ~1;
+      area.y &= ~1;
+
+      cairo_region_union_rectangle (aligned, &area);
+    }
+
+  cairo_region_intersect_rectangle (aligned, &screen_area);
+
+  return aligned;
+}
+
+
+/*
+ * Get the background of the board; it is made again when it changes
+ * and then all the board is damaged.
+ */
+static gboolean
+update_board_background (Recorder  *rec)
+{
+  gchar *color = get_background_color ();
+  gchar *image = get_background_image ();
+  gchar *paper = get_background_paper ();
+  gchar *key = g_strdup_printf ("%d %s %s %s",
+                                get_background_type (),
+                                color ? color : "",
+                                image ? image : "",
+                                paper ? paper : "");
+
+  if (g_strcmp0 (key, rec->background_key) == 0)
+    {
+      g_free (key);
+      return FALSE;
+    }
+
+  g_free (rec->background_key);
+  rec->background_key = key;
+
+  if (rec->background)
+    {
+      cairo_surface_destroy (rec->background);
+    }
+
+  /* With the desktop background the annotations are on white paper. */
+  rec->background = create_background_surface ((get_background_type () == 1) ? color : (gchar *) NULL,
+                                               (get_background_type () == 2) ? image : (gchar *) NULL,
+                                               (get_background_type () == 3) ? paper : (gchar *) NULL,
+                                               rec->width,
+                                               rec->height);
+
+  return TRUE;
+}
+
+
+/* Compose the area of the board from the background and the annotations. */
+static cairo_surface_t *
+compose_board           (Recorder               *rec,
+                         AnnotateCanvas         *canvas,
+                         cairo_rectangle_int_t  *area)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, area->width, area->height);
+  cairo_t *cr = cairo_create (surface);
+
+  cairo_set_source_surface (cr, rec->background, -area->x, -area->y);
+  cairo_paint (cr);
+
+  /* Only the area of the annotation window is read back. */
+  if (canvas->cr)
+    {
+      cairo_set_source_surface (cr, cairo_get_target (canvas->cr), -area->x, -area->y);
+      cairo_paint (cr);
+    }
+
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+
+/*
+ * The tick of the frame rate in the main loop; it takes the damage of
+ * the annotation window and it composes the board or it passes the
+ * damage to the capture thread. A frame without damage is not sent
+ * and the encoder repeats the previous one.
+ */
+static gboolean
+on_recorder_tick        (gpointer  user_data)
+{
+  Recorder *rec = (Recorder *) user_data;
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  cairo_region_t *damage = (cairo_region_t *) NULL;
+  cairo_region_t *aligned = (cairo_region_t *) NULL;
+  gboolean refresh = FALSE;
+  gint64 index = 0;
+  gint i = 0;
+
+  /* The encoder is late; the damage is left in the canvas for the next tick. */
+  if ((rec->paused) || (g_async_queue_length (rec->queue) >= RECORDER_QUEUE_LENGTH))
+    {
+      return TRUE;
+    }
+
+  index = get_frame_index (rec);
+  damage = canvas_take_damage (canvas);
+
+  if (rec->board)
+    {
+      if (update_board_background (rec))
+        {
+          canvas_damage_all (canvas);
+          cairo_region_destroy (damage);
+          damage = canvas_take_damage (canvas);
+        }
+    }
+  else if (index >= rec->refresh_index)
+    {
+      refresh = TRUE;
+      rec->refresh_index = index + RECORDER_REFRESH_FRAMES;
+    }
+
+  if ((cairo_region_is_empty (damage)) && (!refresh))
+    {
+      cairo_region_destroy (damage);
+      return TRUE;
+    }
+
+  aligned = align_damage (rec, damage);
+  cairo_region_destroy (damage);
+
+  if (rec->board)
+    {
+      TRACE_BEGIN ("compose_frame");
+
+      for (i = 0; i < cairo_region_num_rectangles (aligned); i++)
+        {
+          cairo_rectangle_int_t area;
+          cairo_region_get_rectangle (aligned, i, &area);
+          push_patch (rec, compose_board (rec, canvas, &area), area.x, area.y, index);
+        }
+
+      TRACE_END ("compose_frame");
+
+      cairo_region_destroy (aligned);
+    }
+  else
+    {
+      g_mutex_lock (&rec->mutex);
+      cairo_region_union (rec->damage, aligned);
+      rec->refresh = (rec->refresh) || (refresh);
+      rec->damage_index = index;
+      g_cond_signal (&rec->cond);
+      g_mutex_unlock (&rec->mutex);
+
+      cairo_region_destroy (aligned);
+    }
+
+  return TRUE;
+}
+
+
+/*
+ * The encoder thread; it keeps the whole frame and copies the patches
+ * over it. The frame is encoded when a patch of a later frame arrives
+ * because its duration is the distance between their indexes.
+ */
+static gpointer
+encoder_run             (Recorder  *rec)
+{
+  VideoEncoder *video = video_encoder_new (rec->filename,
+                                           rec->width,
+                                           rec->height,
+                                           RECORDER_FPS,
+                                           RECORDER_QUALITY,
+                                           TRUE);
+
+  /* The frame is black until the first patch. */
+  VideoFrame *frame = video_frame_new (rec->width, rec->height);
+  gint64 index = 0;
+
+  if (!video)
+    {
+      g_warning ("Cannot record the screencast in %s", rec->filename);
+    }
+
+  while (TRUE)
+    {
+      RecorderPatch *patch = (RecorderPatch *) g_async_queue_pop (rec->queue);
+      gboolean last = (patch->surface == NULL);
+
+      if ((video) && (patch->index > index))
+        {
+          TRACE_BEGIN ("encode_frame");
+          video_encoder_write (video, frame, patch->index - index, last);
+          TRACE_END ("encode_frame");
+        }
+
+      index = MAX (index, patch->index);
+
+      if (last)
+        {
+          g_free (patch);
+          break;
+        }
+
+      /* The patch is aligned to the 2x2 blocks of the chroma. */
+      video_frame_convert (frame, patch->surface, patch->x, patch->y);
+      cairo_surface_destroy (patch->surface);
+      g_free (patch);
+    }
+
+  video_encoder_free (video);
+  video_frame_free (frame);
+
+  return NULL;
+}
+
+
+/*
+ * Call the vlc script with the option start, pause, resume or stop;
+ * return false if it can not be spawned.
+ */
+static gboolean
+call_recorder_script    (gchar  *filename,
+                         gchar  *option)
 {
   GPid pid = (GPid) 0;
-  gchar *argv[4] = {RECORDER_FILE, option, filename, (gchar *) 0};
+  gchar *argv[4] = {RECORDER_FILE, option, filename, (gchar *) NULL};
+
+  if (!g_spawn_async (NULL /*working_directory*/,
+                      argv,
+                      NULL /*envp*/,
+                      G_SPAWN_SEARCH_PATH,
+                      NULL /*child_setup*/,
+                      NULL /*user_data*/,
+                      &pid /*child_pid*/,
+                      NULL /*error*/))
+    {
+      g_warning ("Cannot run the screencast script %s", RECORDER_FILE);
+      return FALSE;
+    }
+
+  g_spawn_close_pid (pid);
+  return TRUE;
+}
+
+
+/* Start to record the screen in the file. */
+static void
+start_recorder          (gchar  *filename)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+
+  recorder = g_malloc0 ((gsize) sizeof (Recorder));
+  recorder->filename = g_strdup (filename);
+  recorder->width = gdk_screen_width ();
+  recorder->height = gdk_screen_height ();
+  recorder->board = record_board;
+#if !defined(_WIN32) && !defined(__APPLE__)
+  recorder->display_name = g_strdup (gdk_display_get_name (gdk_display_get_default ()));
+#endif
+
+  g_mutex_init (&recorder->mutex);
+  g_cond_init (&recorder->cond);
+  recorder->running = TRUE;
+  recorder->paused = FALSE;
+  recorder->start_time = g_get_monotonic_time ();
+  recorder->damage = cairo_region_create ();
+  recorder->queue = g_async_queue_new ();
+
+  /* The first frame is sent in full. */
+  canvas_track_damage (canvas, TRUE);
+  canvas_damage_all (canvas);
 
-  if (
-      g_spawn_async (NULL /*working_directory*/,
-                     argv,
-                     NULL /*envp*/,
-                     G_SPAWN_SEARCH_PATH,
-                     NULL /*child_setup*/,
-                     NULL /*user_data*/,
-                     &pid /*child_pid*/,
-                     NULL /*error*/))
+  recorder->encoder_thread = g_thread_new ("screencast-encoder", (GThreadFunc) encoder_run, recorder);
+
+  if (!recorder->board)
     {
-      started = TRUE;
+      /* The mirror starts black as the frame of the encoder. */
+      recorder->mirror = cairo_image_surface_create (CAIRO_FORMAT_RGB24, recorder->width, recorder->height);
+      recorder->capture_thread = g_thread_new ("screencast-capture", (GThreadFunc) capture_run, recorder);
     }
 
-  return pid;
+  recorder->tick = g_timeout_add (1000 / RECORDER_FPS, on_recorder_tick, recorder);
+}
+
+
+/* Record only the board composing the background and the annotations. */
+void
+set_recorder_board (gboolean board)
+{
+  record_board = board;
+}
+
+
+/* Record with the vlc script, that records the sound too, instead of in Ardesia. */
+void
+set_recorder_script (gboolean script)
+{
+  record_script = script;
 }
 
 
@@ -72,40 +750,37 @@ call_recorder (gchar *filename,
 gboolean
 is_recorder_available ()
 {
-  gchar *argv[5] = {"vlc", "-I", "dummy", "--dummy-quiet", (gchar *) 0};
+#if !defined(_WIN32) && !defined(__APPLE__)
+  Display *display = (Display *) NULL;
+#endif
 
-#ifdef _WIN32
-  gchar *videolan = "\\VideoLAN\\VLC";
-  gchar *programfile= getenv ("PROGRAMFILES");
-  gchar *file = g_strdup_printf ("%s\\%s", programfile, videolan);
-  gboolean ret = file_exists (file);
+  /* The script runs vlc that must be in the path. */
+  if (record_script)
+    {
+      gchar *vlc = g_find_program_in_path ("vlc");
+      gboolean ret = (vlc != NULL);
+      g_free (vlc);
+      return ret;
+    }
 
-  if (ret) {
-    return TRUE;
-  }
+#if !defined(_WIN32) && !defined(__APPLE__)
+  /* The board is composed in memory and the screen is not read. */
+  if (record_board)
+    {
+      return TRUE;
+    }
 
-  g_free (programfile);
-  g_free (file);
-  programfile = getenv ("PROGRAMFILES (X86)");
-  file = g_strdup_printf ("%s\\%s", programfile, videolan);
-  ret = file_exists (file);
-  g_free (programfile);
-  g_free (file);
+  display = XOpenDisplay (gdk_display_get_name (gdk_display_get_default ()));
 
-  if (ret)
+  if (!display)
     {
-      return TRUE;
+      return FALSE;
     }
+
+  XCloseDisplay (display);
 #endif
 
-  return g_spawn_async (NULL /*working_directory*/,
-                        argv,
-                        NULL /*envp*/,
-                        G_SPAWN_SEARCH_PATH,
-                        NULL /*child_setup*/,
-                        NULL /*user_data*/,
-                        NULL /*child_pid*/,
-                        NULL /*error*/);
+  return TRUE;
 }
 
 
@@ -113,7 +788,12 @@ is_recorder_available ()
 gboolean
 is_started ()
 {
-  return started;
+  if (record_script)
+    {
+      return script_started;
+    }
+
+  return (recorder != NULL);
 }
 
 
@@ -121,17 +801,28 @@ is_started ()
 gboolean
 is_paused ()
 {
-  return paused;
+  if (record_script)
+    {
+      return script_started && script_paused;
+    }
+
+  return (recorder) && (recorder->paused);
 }
 
 
-/* Pause the recorder. */
+/* Pause the recorder; the pause is cut out of the video. */
 void pause_recorder ()
 {
-  if (is_started ())
+  if ((record_script) && (is_started ()) && (!is_paused ()))
     {
-      recorder_pid = call_recorder (NULL, "pause");
-      paused = TRUE;
+      script_paused = call_recorder_script ((gchar *) NULL, "pause");
+    }
+  else if ((is_started ()) && (!is_paused ()))
+    {
+      g_mutex_lock (&recorder->mutex);
+      recorder->pause_start = g_get_monotonic_time ();
+      recorder->paused = TRUE;
+      g_mutex_unlock (&recorder->mutex);
     }
 }
 
@@ -139,24 +830,71 @@ void pause_recorder ()
 /* Resume the recorder. */
 void resume_recorder ()
 {
-  if (is_started ())
+  if ((record_script) && (is_paused ()))
     {
-      recorder_pid = call_recorder (NULL, "resume");
-      paused = FALSE;
+      script_paused = !call_recorder_script ((gchar *) NULL, "resume");
+    }
+  else if (is_paused ())
+    {
+      g_mutex_lock (&recorder->mutex);
+      recorder->paused_time += g_get_monotonic_time () - recorder->pause_start;
+      recorder->paused = FALSE;
+      g_mutex_unlock (&recorder->mutex);
     }
 }
 
 
-/* Stop the recorder. */
+/* Stop the recorder waiting that the frames grabbed are encoded. */
 void
 stop_recorder ()
 {
-  if (is_started ())
+  if ((record_script) && (is_started ()))
     {
-      g_spawn_close_pid (recorder_pid);
-      recorder_pid = call_recorder (NULL, "stop");
-      g_spawn_close_pid (recorder_pid);
-      started = FALSE;
+      call_recorder_script ((gchar *) NULL, "stop");
+      script_started = FALSE;
+      script_paused = FALSE;
+    }
+  else if (is_started ())
+    {
+      g_source_remove (recorder->tick);
+      canvas_track_damage (get_annotation_data ()->canvas, FALSE);
+
+      g_mutex_lock (&recorder->mutex);
+      recorder->running = FALSE;
+      g_cond_signal (&recorder->cond);
+      g_mutex_unlock (&recorder->mutex);
+
+      if (recorder->capture_thread)
+        {
+          g_thread_join (recorder->capture_thread);
+        }
+
+      /* The end is after the last frame shown. */
+      push_patch (recorder, (cairo_surface_t *) NULL, 0, 0, get_frame_index (recorder) + 1);
+      g_thread_join (recorder->encoder_thread);
+
+      g_async_queue_unref (recorder->queue);
+      cairo_region_destroy (recorder->damage);
+      g_cond_clear (&recorder->cond);
+      g_mutex_clear (&recorder->mutex);
+
+      if (recorder->mirror)
+        {
+          cairo_surface_destroy (recorder->mirror);
+        }
+
+      if (recorder->background)
+        {
+          cairo_surface_destroy (recorder->background);
+        }
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+      g_free (recorder->display_name);
+#endif
+      g_free (recorder->background_key);
+      g_free (recorder->filename);
+      g_free (recorder);
+      recorder = (Recorder *) NULL;
     }
 }
 
@@ -171,7 +909,9 @@ visualize_missing_recorder_program_dialog (GtkWindow *parent)
                                         GTK_DIALOG_MODAL,
                                         GTK_MESSAGE_ERROR,
                                         GTK_BUTTONS_OK,
-                                        gettext ("In order to record with Ardesia you must install the vlc program and add it to the PATH environment variable"));
+                                        record_script ?
+                                        gettext ("In order to record with Ardesia you must install the vlc program and add it to the PATH environment variable") :
+                                        gettext ("The screen cannot be read to record it"));
 
   //gtk_window_set_keep_above (GTK_WINDOW (miss_dialog), TRUE);
 
@@ -260,8 +1000,16 @@ gboolean start_save_video_dialog (GtkToolButton *toolbutton,
             }
         }
 
-      recorder_pid = call_recorder (filename, "start");
-      status = (recorder_pid > 0);
+      if (record_script)
+        {
+          script_started = call_recorder_script (filename, "start");
+          status = script_started;
+        }
+      else
+        {
+          start_recorder (filename);
+          status = TRUE;
+        }
     }
   stop_virtual_keyboard ();
 
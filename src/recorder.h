@@ -28,9 +28,28 @@
 #ifdef _WIN32
 #  include <windows.h>
 #  define RECORDER_FILE "..\\share\\ardesia\\scripts\\screencast.bat"
-#else  
+#else
 #  define RECORDER_FILE PACKAGE_DATA_DIR"/ardesia/scripts/screencast.sh"
-#endif 
+#endif
+
+
+/* The frames per second of the screencast. */
+#define RECORDER_FPS 12
+
+/* The quality of the video from 0 to 63. */
+#define RECORDER_QUALITY 32
+
+/* The patches waiting the encoder; when it is late the damage is merged with the next one. */
+#define RECORDER_QUEUE_LENGTH 16
+
+/* The damaged rectangles sent for a frame; if more they are merged in one. */
+#define RECORDER_MAX_PATCHES 8
+
+/*
+ * The frames between two reads of the full desktop; what the other
+ * programs change is seen only at these reads.
+ */
+#define RECORDER_REFRESH_FRAMES 12
 
 
 /*
@@ -69,6 +88,16 @@ gboolean
 is_paused ();
 
 
+/* Record only the board composing the background and the annotations. */
+void
+set_recorder_board (gboolean board);
+
+
+/* Record with the vlc script, that records the sound too, instead of in Ardesia. */
+void
+set_recorder_script (gboolean script);
+
+
 /* Is the recorder available. */
 gboolean
 is_recorder_available ();
@@ -29,6 +29,9 @@
 #include <saver.h>
 #include <utils.h>
 #include <keyboard.h>
+#include <trace.h>
+
+#include <cairo-pdf.h>
 
 
 /* Confirm to override file dialog. */
@@ -80,13 +83,139 @@ show_could_not_write_dialog (GtkWindow *parent_window)
 }
 
 
+/* The image to be written by the thread. */
+typedef struct
+{
+
+  /* The screenshot; it belongs to the thread. */
+  cairo_surface_t *surface;
+
+  gchar *filename;
+
+  /* Write a one page pdf instead of a png. */
+  gboolean pdf;
+
+  /* The thread writing the file; it is joined at quit. */
+  GThread *thread;
+
+} PngJob;
+
+
+/* The screenshots written in background during the session. */
+static GPtrArray *png_jobs = (GPtrArray *) NULL;
+
+
+/* Write the screenshot in a one page pdf sized as the screenshot. */
+static cairo_status_t
+write_pdf_page          (cairo_surface_t  *surface,
+                         const gchar      *filename)
+{
+  cairo_surface_t *pdf_surface = cairo_pdf_surface_create (filename,
+                                                           cairo_image_surface_get_width (surface),
+                                                           cairo_image_surface_get_height (surface));
+  cairo_t *cr = cairo_create (pdf_surface);
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_paint (cr);
+  cairo_show_page (cr);
+  cairo_destroy (cr);
+
+  cairo_surface_finish (pdf_surface);
+  status = cairo_surface_status (pdf_surface);
+  cairo_surface_destroy (pdf_surface);
+
+  return status;
+}
+
+
+/*
+ * Write the screenshot as png or pdf; it runs in its own thread.
+ * The file is written aside and renamed only when it is complete,
+ * then the thread returns if the screenshot has been saved.
+ */
+static gpointer
+write_png_file          (PngJob  *job)
+{
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  gchar *tmp_filename = g_strdup_printf ("%s.tmp", job->filename);
+  gboolean saved = FALSE;
+
+  TRACE_BEGIN ("write_screenshot");
+
+  if (job->pdf)
+    {
+      status = write_pdf_page (job->surface, tmp_filename);
+    }
+  else
+    {
+      status = cairo_surface_write_to_png (job->surface, tmp_filename);
+    }
+
+  TRACE_END ("write_screenshot");
+
+  cairo_surface_destroy (job->surface);
+  job->surface = (cairo_surface_t *) NULL;
+
+  if (status != CAIRO_STATUS_SUCCESS)
+    {
+      g_warning ("Error writing the screenshot %s: %s", job->filename, cairo_status_to_string (status));
+    }
+  else
+    {
+      saved = replace_file (tmp_filename, job->filename);
+
+      if (!saved)
+        {
+          g_warning ("Error renaming %s in %s", tmp_filename, job->filename);
+        }
+    }
+
+  if (!saved)
+    {
+      g_remove (tmp_filename);
+    }
+
+  g_free (tmp_filename);
+
+  return GINT_TO_POINTER (saved);
+}
+
+
+/* Scale the screenshot to the preview. */
+static GdkPixbuf *
+create_preview_pixbuf   (cairo_surface_t  *surface,
+                         gint              width,
+                         gint              height)
+{
+  cairo_surface_t *preview = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+  cairo_t *cr = cairo_create (preview);
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+
+  cairo_scale (cr,
+               (gdouble) width / cairo_image_surface_get_width (surface),
+               (gdouble) height / cairo_image_surface_get_height (surface));
+
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  pixbuf = gdk_pixbuf_get_from_surface (preview, 0, 0, width, height);
+  cairo_surface_destroy (preview);
+
+  return pixbuf;
+}
+
+
 /*
  * Start the dialog that ask to the user where save the image
- * containing the screenshot.
+ * containing the screenshot of the area, or of the full screen
+ * if the area is NULL; a name ending with .pdf is saved as pdf.
  */
 void
 start_save_image_dialog (GtkToolButton *toolbutton,
-                         GtkWindow     *parent)
+                         GtkWindow     *parent,
+                         GdkRectangle  *area)
 {
 
   GtkWidget *preview = NULL;
@@ -98,7 +227,18 @@ start_save_image_dialog (GtkToolButton *toolbutton,
   gchar *supported_extension = ".pdf";
   gint run_status = GTK_RESPONSE_NO;
   gboolean screenshot = FALSE;
-  GdkPixbuf *buf = grab_screenshot ();
+  gboolean pdf = FALSE;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+  /* Only the area is read and composed. */
+  if (area)
+    {
+      surface = grab_screenshot_area (area->x, area->y, area->width, area->height);
+    }
+  else
+    {
+      surface = grab_screenshot_surface ();
+    }
 
   GtkWidget *chooser = gtk_file_chooser_dialog_new (gettext ("Export as pdf"),
                                                     parent,
@@ -116,7 +256,7 @@ start_save_image_dialog (GtkToolButton *toolbutton,
 
   /* Save the preview in a buffer. */
   preview = gtk_image_new ();
-  preview_pixbuf = gdk_pixbuf_scale_simple (buf, preview_width, preview_height, GDK_INTERP_BILINEAR);
+  preview_pixbuf = create_preview_pixbuf (surface, preview_width, preview_height);
   gtk_image_set_from_pixbuf (GTK_IMAGE (preview), preview_pixbuf);
   
   gtk_file_chooser_set_preview_widget (GTK_FILE_CHOOSER (chooser), preview);
@@ -138,7 +278,12 @@ start_save_image_dialog (GtkToolButton *toolbutton,
       filename_copy = g_strdup_printf ("%s", filename);
 
       screenshot = TRUE;
-      supported_extension = ".png";
+      pdf = g_str_has_suffix (filename, supported_extension);
+
+      if (!pdf)
+        {
+          supported_extension = ".png";
+        }
 
       if (!g_str_has_suffix (filename, supported_extension))
         {
@@ -159,7 +304,9 @@ start_save_image_dialog (GtkToolButton *toolbutton,
         }
       else
         {
-           FILE *stream = g_fopen (filename, "w");
+           /* Try the file written aside; the real one appears when complete. */
+           gchar *tmp_filename = g_strdup_printf ("%s.tmp", filename);
+           FILE *stream = g_fopen (tmp_filename, "w");
            if (stream == NULL)
             {
               show_could_not_write_dialog (GTK_WINDOW (chooser));
@@ -167,7 +314,9 @@ start_save_image_dialog (GtkToolButton *toolbutton,
            else
             {
               fclose (stream);
+              g_remove (tmp_filename);
             }
+           g_free (tmp_filename);
         }
     }
   stop_virtual_keyboard ();
@@ -180,16 +329,57 @@ start_save_image_dialog (GtkToolButton *toolbutton,
     }
   if (screenshot)
     {
-      /* Store the buffer on file. */
-      save_pixbuf_on_png_file (buf, filename);
-      /* Add to the list of the artefacts created in the session. */
-      add_artifact (filename);
+      PngJob *job = g_malloc ((gsize) sizeof (PngJob));
+      job->surface = surface;
+      job->filename = g_strdup (filename);
+      job->pdf = pdf;
+
+      if (!png_jobs)
+        {
+          png_jobs = g_ptr_array_new ();
+        }
+
+      /* The image is encoded in background and the button returns at once. */
+      job->thread = g_thread_new ("png-writer", (GThreadFunc) write_png_file, job);
+      g_ptr_array_add (png_jobs, job);
+    }
+  else
+    {
+      cairo_surface_destroy (surface);
     }
 
   g_free (filename);
   filename = NULL;
-  g_object_unref (buf);
-  buf = NULL;
 }
 
 
+/*
+ * Wait the screenshots still being written and add
+ * the saved ones to the artefacts created in the session.
+ */
+void
+quit_saver              ()
+{
+  guint i = 0;
+
+  if (!png_jobs)
+    {
+      return;
+    }
+
+  for (i = 0; i < png_jobs->len; i++)
+    {
+      PngJob *job = (PngJob *) g_ptr_array_index (png_jobs, i);
+
+      if (GPOINTER_TO_INT (g_thread_join (job->thread)))
+        {
+          add_artifact (job->filename);
+        }
+
+      g_free (job->filename);
+      g_free (job);
+    }
+
+  g_ptr_array_free (png_jobs, TRUE);
+  png_jobs = (GPtrArray *) NULL;
+}
@@ -54,10 +54,18 @@ show_could_not_write_dialog (GtkWindow *parent_window);
 
 /*
  * Start the dialog that ask to the user where save the image
- * containing the screenshot.
+ * containing the screenshot of the area, or of the full screen
+ * if the area is NULL; a name ending with .pdf is saved as pdf.
  */
 void
 start_save_image_dialog (GtkToolButton *toolbutton,
-			 GtkWindow *parent);
+			 GtkWindow *parent,
+			 GdkRectangle *area);
 
 
+/*
+ * Wait the screenshots still being written and add
+ * the saved ones to the artefacts created in the session.
+ */
+void
+quit_saver              ();
@@ -0,0 +1,379 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include <session_recorder.h>
+#include <stroke_record.h>
+#include <annotation_window.h>
+#include <background_window.h>
+
+
+/* An event queued to the writer thread. */
+typedef struct
+{
+
+  /* The milliseconds from the start and spent painting. */
+  guint32 time;
+  guint32 duration;
+
+  /* The encoded record; NULL with no text stops the writer. */
+  GByteArray *record;
+
+  /* The image file to be appended to the record of a background. */
+  gchar *image;
+
+  /* The text layer to be encoded as the record; NULL for the other events. */
+  cairo_surface_t *text;
+
+} SessionEvent;
+
+
+/* The events for the writer thread; NULL if the session is not recorded. */
+static GAsyncQueue *session_queue = (GAsyncQueue *) NULL;
+
+/* The writer thread. */
+static GThread *session_writer = (GThread *) NULL;
+
+/* The size of the recorded screen. */
+static gint session_width = 0;
+static gint session_height = 0;
+
+/* The start of the recording in microseconds. */
+static gint64 session_start = 0;
+
+/* When the pen has been pressed; -1 if no stroke is in progress. */
+static gint64 stroke_start = -1;
+
+/* What the last background recorded has been made from. */
+static gchar *background_key = (gchar *) NULL;
+
+
+/* Write the event to the file. */
+static void
+write_event                  (FILE          *fp,
+                              SessionEvent  *event)
+{
+  GByteArray *header = g_byte_array_new ();
+
+  /* The png of the text is encoded here to keep it out of the ui thread. */
+  if (event->text)
+    {
+      event->record = stroke_record_new_text (event->text);
+    }
+
+  /* The image is read here to keep the disk out of the ui thread. */
+  if (event->image)
+    {
+      gchar *contents = (gchar *) NULL;
+      gsize length = 0;
+
+      if (!g_file_get_contents (event->image, &contents, &length, NULL))
+        {
+          g_warning ("Unable to read the background %s for the session recording", event->image);
+        }
+
+      stroke_record_append_data (event->record, contents, contents ? length : 0);
+      g_free (contents);
+    }
+
+  stroke_record_append_u32 (header, event->time);
+  stroke_record_append_u32 (header, event->duration);
+  stroke_record_append_u32 (header, event->record->len);
+
+  fwrite (header->data, 1, header->len, fp);
+  fwrite (event->record->data, 1, event->record->len, fp);
+  g_byte_array_unref (header);
+}
+
+
+/* The writer thread; the file is opened and written only here. */
+static gpointer
+session_writer_run           (gchar  *filename)
+{
+  guint16 version = GUINT16_TO_LE (SESSION_RECORDER_VERSION);
+  guint16 reserved = 0;
+  guint32 width = GUINT32_TO_LE ((guint32) session_width);
+  guint32 height = GUINT32_TO_LE ((guint32) session_height);
+  FILE *fp = g_fopen (filename, "wb");
+
+  if (!fp)
+    {
+      g_warning ("Unable to record the session in %s", filename);
+    }
+  else
+    {
+      fwrite (SESSION_RECORDER_MAGIC, sizeof (gchar), strlen (SESSION_RECORDER_MAGIC), fp);
+      fwrite (&version, sizeof (version), 1, fp);
+      fwrite (&reserved, sizeof (reserved), 1, fp);
+      fwrite (&width, sizeof (width), 1, fp);
+      fwrite (&height, sizeof (height), 1, fp);
+    }
+
+  while (TRUE)
+    {
+      SessionEvent *event = (SessionEvent *) g_async_queue_pop (session_queue);
+
+      if ((!event->record) && (!event->text))
+        {
+          g_free (event);
+          break;
+        }
+
+      if (fp)
+        {
+          write_event (fp, event);
+        }
+
+      if (event->record)
+        {
+          g_byte_array_unref (event->record);
+        }
+
+      if (event->text)
+        {
+          cairo_surface_destroy (event->text);
+        }
+
+      g_free (event->image);
+      g_free (event);
+    }
+
+  if (fp)
+    {
+      fclose (fp);
+    }
+
+  g_free (filename);
+  return NULL;
+}
+
+
+/* The milliseconds from the start of the recording. */
+static guint32
+get_session_time             (gint64  time)
+{
+  return (guint32) ((time - session_start) / 1000);
+}
+
+
+/* Queue the event to the writer taking the record or the text. */
+static void
+push_event                   (GByteArray       *record,
+                              cairo_surface_t  *text,
+                              guint32           time,
+                              guint32           duration,
+                              const gchar      *image)
+{
+  SessionEvent *event = g_malloc ((gsize) sizeof (SessionEvent));
+  event->time = time;
+  event->duration = duration;
+  event->record = record;
+  event->text = text;
+  event->image = g_strdup (image);
+  g_async_queue_push (session_queue, event);
+}
+
+
+/* Append the canvas shown at the start as a text covering the screen. */
+static void
+record_initial_canvas        ()
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  GSList *link = g_slist_nth (canvas->savepoint_list, canvas->current_save_index);
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+  if (!link)
+    {
+      return;
+    }
+
+  surface = canvas_savepoint_render (link, canvas->width, canvas->height);
+
+  if (!surface)
+    {
+      return;
+    }
+
+  push_event ((GByteArray *) NULL, surface, 0, 0, (gchar *) NULL);
+}
+
+
+/* Start to record the session in the file. */
+void
+start_session_recorder       (const gchar  *filename)
+{
+  stop_session_recorder ();
+
+  session_width = gdk_screen_width ();
+  session_height = gdk_screen_height ();
+  session_start = g_get_monotonic_time ();
+  stroke_start = -1;
+  session_queue = g_async_queue_new ();
+  session_writer = g_thread_new ("session-recorder",
+                                 (GThreadFunc) session_writer_run,
+                                 g_strdup (filename));
+
+  record_session_background ();
+  record_initial_canvas ();
+}
+
+
+/* Stop the recording writing the pending events. */
+void
+stop_session_recorder        ()
+{
+  if (!session_queue)
+    {
+      return;
+    }
+
+  push_event ((GByteArray *) NULL, (cairo_surface_t *) NULL, 0, 0, (gchar *) NULL);
+  g_thread_join (session_writer);
+  session_writer = (GThread *) NULL;
+
+  g_async_queue_unref (session_queue);
+  session_queue = (GAsyncQueue *) NULL;
+
+  g_free (background_key);
+  background_key = (gchar *) NULL;
+}
+
+
+/* Is the session recorded? */
+gboolean
+is_session_recording         ()
+{
+  return (session_queue != NULL);
+}
+
+
+/* The pen has been pressed; the stroke committed next started now. */
+void
+mark_session_stroke          ()
+{
+  if (session_queue)
+    {
+      stroke_start = g_get_monotonic_time ();
+    }
+}
+
+
+/* Append a record of the stroke journal; a reference is taken. */
+void
+record_session_action        (GByteArray   *record)
+{
+  gint64 now = 0;
+  guint32 duration = 0;
+
+  if (!session_queue)
+    {
+      return;
+    }
+
+  now = g_get_monotonic_time ();
+
+  /* The stroke is animated from the press of the pen when it is rendered. */
+  if ((record->data[0] == STROKE_JOURNAL_RECORD_STROKE) && (stroke_start >= 0))
+    {
+      duration = (guint32) ((now - stroke_start) / 1000);
+      stroke_start = -1;
+    }
+
+  push_event (g_byte_array_ref (record), (cairo_surface_t *) NULL, get_session_time (now), duration, (gchar *) NULL);
+}
+
+
+/* Append the text layer copied by stroke_record_copy_text; a reference is taken. */
+void
+record_session_text          (cairo_surface_t  *text)
+{
+  if (!session_queue)
+    {
+      return;
+    }
+
+  push_event ((GByteArray *) NULL,
+              cairo_surface_reference (text),
+              get_session_time (g_get_monotonic_time ()),
+              0,
+              (gchar *) NULL);
+}
+
+
+/* Append the background if it has been changed. */
+void
+record_session_background    ()
+{
+  gint type = 0;
+  gchar *color = (gchar *) NULL;
+  gchar *image = (gchar *) NULL;
+  gchar *paper = (gchar *) NULL;
+  gchar *key = (gchar *) NULL;
+  GByteArray *record = (GByteArray *) NULL;
+
+  if (!session_queue)
+    {
+      return;
+    }
+
+  type = get_background_type ();
+  color = (type == 1) ? get_background_color () : (gchar *) NULL;
+  image = (type == 2) ? get_background_image () : (gchar *) NULL;
+  paper = (type == 3) ? get_background_paper () : (gchar *) NULL;
+
+  /* Only what is shown matters; the setters are called more times. */
+  key = g_strdup_printf ("%d %s %s %s", type, color ? color : "", image ? image : "", paper ? paper : "");
+
+  if (g_strcmp0 (key, background_key) == 0)
+    {
+      g_free (key);
+      return;
+    }
+
+  g_free (background_key);
+  background_key = key;
+
+  record = g_byte_array_new ();
+  stroke_record_append_u8 (record, SESSION_RECORD_BACKGROUND);
+  stroke_record_append_u8 (record, (guint8) type);
+  stroke_record_append_color (record, color);
+
+  /* The writer appends the image file. */
+  if (paper)
+    {
+      stroke_record_append_data (record, paper, strlen (paper));
+    }
+  else if (!image)
+    {
+      stroke_record_append_data (record, NULL, 0);
+    }
+
+  push_event (record, (cairo_surface_t *) NULL, get_session_time (g_get_monotonic_time ()), 0, image);
+}
+
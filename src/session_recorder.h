@@ -0,0 +1,107 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Vector recording of the session.
+ *
+ * Instead of the pixels the session recording keeps the painting
+ * actions with their time: the strokes, fills, texts, clears, undo,
+ * redo and the changes of background are appended by a writer thread
+ * to a compact file, reusing the records of the stroke journal, then
+ * the live session pays only the encoding of each action. The video is
+ * rendered later, at any resolution and on any machine, by the
+ * ardesia-render command.
+ *
+ * The file starts with the SESSION_RECORDER_MAGIC string followed by
+ * the format version (16 bit), a reserved 16 bit field and the width
+ * and the height (32 bit) of the recorded screen. Then the events
+ * follow, each one made of the milliseconds from the start (32 bit)
+ * when the action has been committed, the milliseconds spent painting
+ * it (32 bit), e.g. from the press to the release of the pen, the size
+ * of the record (32 bit) and a record as encoded in stroke_record.h or
+ * a SESSION_RECORD_BACKGROUND. All the numbers are stored in little
+ * endian; a truncated event at the end is ignored.
+ */
+
+
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <glib.h>
+#include <cairo.h>
+
+
+/* Magic string at the beginning of the session recording. */
+#define SESSION_RECORDER_MAGIC "ARSN"
+
+/* Version of the session recording format. */
+#define SESSION_RECORDER_VERSION 1
+
+/*
+ * The record of a change of background: the type (8 bit, 0 for the
+ * desktop, 1 for a colour, 2 for an image and 3 for a paper), the
+ * colour (8 hex digits), the size (32 bit) and the content of the
+ * image file or the description of the paper as in paper.h.
+ */
+#define SESSION_RECORD_BACKGROUND 16
+
+
+/* Start to record the session in the file. */
+void
+start_session_recorder       (const gchar  *filename);
+
+
+/* Stop the recording writing the pending events. */
+void
+stop_session_recorder        ();
+
+
+/* Is the session recorded? */
+gboolean
+is_session_recording         ();
+
+
+/* The pen has been pressed; the stroke committed next started now. */
+void
+mark_session_stroke          ();
+
+
+/* Append a record of the stroke journal; a reference is taken. */
+void
+record_session_action        (GByteArray   *record);
+
+
+/* Append the text layer copied by stroke_record_copy_text; a reference is taken. */
+void
+record_session_text          (cairo_surface_t  *text);
+
+
+/* Append the background if it has been changed. */
+void
+record_session_background    ();
+
+
+#endif
+
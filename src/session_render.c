@@ -0,0 +1,836 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Offline rendering of a session recording in a video.
+ *
+ * The painting actions recorded with --record-session are replayed on
+ * an offscreen canvas at the size of the video, then the strokes stay
+ * sharp at any resolution; the pen strokes are animated for the time
+ * they have taken to be painted. Only the frames where something
+ * changes are rendered: one thread replays the session once and takes
+ * a snapshot of the picture at each frame, a pool with one worker per
+ * core paints the strokes in progress on the snapshots and converts
+ * them in the planes of the encoder, while the main thread encodes
+ * them in order and codes the frames without changes as duplicates.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <glib/gprintf.h>
+#include <gdk/gdk.h>
+
+#include <canvas.h>
+#include <stroke_record.h>
+#include <paper.h>
+#include <session_recorder.h>
+#include <video_encoder.h>
+
+
+/* Default frames per second of the video. */
+#define RENDER_FPS 25
+
+/* Default quality of the video from 0 to 63. */
+#define RENDER_QUALITY 48
+
+/* The frames being rendered or waiting the encoder for each worker. */
+#define RENDER_FRAMES_PER_WORKER 2
+
+/* The seconds the last picture is shown. */
+#define RENDER_TAIL_SECONDS 2
+
+
+/* An event of the session. */
+typedef struct
+{
+
+  /* When the action has been committed and started, in milliseconds. */
+  gint64 time;
+  gint64 start;
+
+  /* The record in the session file. */
+  const guchar *record;
+  gsize size;
+
+  /* The scaled path of an animated pen stroke; NULL if not animated. */
+  gchar *path;
+  gchar color[9];
+  gdouble thickness;
+
+} RenderEvent;
+
+
+/* The state shared by the workers and the encoder. */
+typedef struct
+{
+
+  /* The events sorted by time and the longest stroke. */
+  GArray *events;
+  gint64 max_duration;
+
+  gint width;
+  gint height;
+  gdouble scale_x;
+  gdouble scale_y;
+  gint fps;
+  gint quality;
+
+  /* The frames with changes and the total number of frames. */
+  GArray *frames;
+  gint64 frame_count;
+
+  guint jobs;
+
+  /* The pool painting the strokes in progress and converting the frames. */
+  GThreadPool *pool;
+
+  /* The rendered frames, indexed by position modulo the window. */
+  GMutex mutex;
+  GCond cond;
+  VideoFrame **slots;
+  guint window;
+
+  /* The position of the next frame to be encoded. */
+  guint next;
+
+} Render;
+
+
+/* A frame given by the replay to the pool. */
+typedef struct
+{
+
+  /* The position in the frames with changes and its time. */
+  guint position;
+  gint64 time;
+
+  /* The first event not yet applied at the time. */
+  guint next_event;
+
+  /* The background and the canvas composed at the time. */
+  cairo_surface_t *picture;
+
+} RenderJob;
+
+
+/* The time of the frame in milliseconds. */
+static gint64
+get_frame_time     (Render  *render,
+                    gint64   index)
+{
+  return index * 1000 / render->fps;
+}
+
+
+/* The first frame shown at the time or later. */
+static gint64
+get_frame_index    (Render  *render,
+                    gint64   time)
+{
+  return (time * render->fps + 999) / 1000;
+}
+
+
+/* Keep the path of a pen stroke painted in some time to animate it. */
+static void
+load_animation     (Render       *render,
+                    RenderEvent  *event)
+{
+  const guchar *cursor = event->record;
+  const guchar *end = event->record + event->size;
+  guint8 type = 0;
+  guint8 tool = 0;
+  gchar *path = (gchar *) NULL;
+
+  if ((event->start == event->time)                                          ||
+      (!stroke_record_read_bytes (&cursor, end, &type, sizeof (type)))       ||
+      (type != STROKE_JOURNAL_RECORD_STROKE)                                 ||
+      (!stroke_record_read_bytes (&cursor, end, &tool, sizeof (tool)))       ||
+      (tool != 0)                                                            ||
+      (!stroke_record_read_f64 (&cursor, end, &event->thickness))            ||
+      (!stroke_record_read_color (&cursor, end, event->color))               ||
+      (!(path = stroke_record_read_string (&cursor, end))))
+    {
+      return;
+    }
+
+  event->path = canvas_scale_path_data (path, render->scale_x, render->scale_y);
+  event->thickness *= sqrt (render->scale_x * render->scale_y);
+  render->max_duration = MAX (render->max_duration, event->time - event->start);
+  g_free (path);
+}
+
+
+/* Read the events of the session; return false if it is not valid. */
+static gboolean
+load_session       (Render        *render,
+                    const guchar  *data,
+                    gsize          length,
+                    gint          *source_width,
+                    gint          *source_height)
+{
+  const guchar *cursor = data;
+  const guchar *end = data + length;
+  gchar magic[4];
+  guint16 version = 0;
+  guint16 reserved = 0;
+  guint32 width = 0;
+  guint32 height = 0;
+
+  if ((!stroke_record_read_bytes (&cursor, end, magic, sizeof (magic)))        ||
+      (memcmp (magic, SESSION_RECORDER_MAGIC, sizeof (magic)) != 0)              ||
+      (!stroke_record_read_bytes (&cursor, end, &version, sizeof (version)))     ||
+      (GUINT16_FROM_LE (version) > SESSION_RECORDER_VERSION)                     ||
+      (!stroke_record_read_bytes (&cursor, end, &reserved, sizeof (reserved)))   ||
+      (!stroke_record_read_u32 (&cursor, end, &width))                           ||
+      (!stroke_record_read_u32 (&cursor, end, &height))                          ||
+      (width == 0) || (height == 0))
+    {
+      return FALSE;
+    }
+
+  *source_width = (gint) width;
+  *source_height = (gint) height;
+
+  while (cursor < end)
+    {
+      guint32 time = 0;
+      guint32 duration = 0;
+      guint32 size = 0;
+      RenderEvent event;
+
+      /* A recording interrupted by a crash ends with a truncated event. */
+      if ((!stroke_record_read_u32 (&cursor, end, &time))      ||
+          (!stroke_record_read_u32 (&cursor, end, &duration))  ||
+          (!stroke_record_read_u32 (&cursor, end, &size))      ||
+          (size == 0)                                          ||
+          ((gsize) (end - cursor) < size))
+        {
+          break;
+        }
+
+      event.time = time;
+      event.start = MAX ((gint64) time - duration, 0);
+      event.record = cursor;
+      event.size = size;
+      event.path = (gchar *) NULL;
+      cursor += size;
+
+      g_array_append_val (render->events, event);
+    }
+
+  return TRUE;
+}
+
+
+/* Find the frames where something changes. */
+static void
+plan_frames        (Render  *render)
+{
+  gint64 last_time = 0;
+  gint64 index = 0;
+  guint8 *changed = (guint8 *) NULL;
+  guint i = 0;
+
+  if (render->events->len > 0)
+    {
+      last_time = g_array_index (render->events, RenderEvent, render->events->len - 1).time;
+    }
+
+  render->frame_count = get_frame_index (render, last_time) + RENDER_TAIL_SECONDS * render->fps;
+  changed = g_malloc0 ((gsize) render->frame_count);
+  changed[0] = 1;
+
+  for (i = 0; i < render->events->len; i++)
+    {
+      RenderEvent *event = &g_array_index (render->events, RenderEvent, i);
+      gint64 first = (event->path) ? get_frame_index (render, event->start) : get_frame_index (render, event->time);
+
+      for (index = first; index <= get_frame_index (render, event->time); index++)
+        {
+          changed[index] = 1;
+        }
+    }
+
+  for (index = 0; index < render->frame_count; index++)
+    {
+      if (changed[index])
+        {
+          g_array_append_val (render->frames, index);
+        }
+    }
+
+  g_free (changed);
+}
+
+
+/* Decode the image file kept in memory; NULL if it is not valid. */
+static GdkPixbuf *
+decode_image       (const guchar  *data,
+                    gsize          size)
+{
+  GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+  GdkPixbuf *pixbuf = (GdkPixbuf *) NULL;
+  gboolean written = gdk_pixbuf_loader_write (loader, data, size, NULL);
+
+  if ((gdk_pixbuf_loader_close (loader, NULL)) && (written))
+    {
+      pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+    }
+
+  if (pixbuf)
+    {
+      g_object_ref (pixbuf);
+    }
+
+  g_object_unref (loader);
+  return pixbuf;
+}
+
+
+/* Compose the background of a background record on white paper. */
+static void
+paint_background   (Render           *render,
+                    cairo_surface_t  *background,
+                    const guchar     *cursor,
+                    const guchar     *end)
+{
+  cairo_t *cr = cairo_create (background);
+  guint8 type = 0;
+  gchar color[9] = "FFFFFFFF";
+  guint32 size = 0;
+  GdkPixbuf *image = (GdkPixbuf *) NULL;
+  gchar *paper = (gchar *) NULL;
+
+  /* The desktop is not recorded; it is replaced by white paper. */
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_paint (cr);
+
+  if ((stroke_record_read_bytes (&cursor, end, &type, sizeof (type)))   &&
+      (stroke_record_read_color (&cursor, end, color))                  &&
+      (stroke_record_read_u32 (&cursor, end, &size))                    &&
+      (size > 0) && ((gsize) (end - cursor) >= size))
+    {
+      if (type == 3)
+        {
+          paper = g_strndup ((const gchar *) cursor, size);
+        }
+      else
+        {
+          image = decode_image (cursor, size);
+        }
+    }
+
+  if (type == 1)
+    {
+      cairo_set_source_color_from_string (cr, color);
+      cairo_paint (cr);
+    }
+  else if ((type == 2) && (image))
+    {
+      /* The image is stretched on the screen as in the background window. */
+      GdkPixbuf *scaled = gdk_pixbuf_scale_simple (image, render->width, render->height, GDK_INTERP_BILINEAR);
+
+      gdk_cairo_set_source_pixbuf (cr, scaled, 0, 0);
+      cairo_paint (cr);
+      g_object_unref (scaled);
+    }
+  else if ((type == 3) && (paper))
+    {
+      /* The paper is rendered again at the scale of the video to stay sharp. */
+      paper_paint (cr, paper, sqrt (render->scale_x * render->scale_y));
+    }
+
+  if (image)
+    {
+      g_object_unref (image);
+    }
+
+  g_free (paper);
+
+  cairo_destroy (cr);
+}
+
+
+/* Apply the event to the canvas or to the background. */
+static void
+apply_event        (Render           *render,
+                    RenderEvent      *event,
+                    AnnotateCanvas   *canvas,
+                    cairo_surface_t  *background)
+{
+  const guchar *cursor = event->record;
+  const guchar *end = event->record + event->size;
+
+  if (event->record[0] == SESSION_RECORD_BACKGROUND)
+    {
+      paint_background (render, background, cursor + 1, end);
+      return;
+    }
+
+  if (!stroke_record_replay (canvas, &cursor, end, render->scale_x, render->scale_y))
+    {
+      g_warning ("Skipped an invalid record at %" G_GINT64_FORMAT " ms", event->time);
+    }
+}
+
+
+/* The length of the flattened path. */
+static gdouble
+get_path_length    (cairo_path_t  *path)
+{
+  gdouble length = 0;
+  gdouble x = 0;
+  gdouble y = 0;
+  gdouble start_x = 0;
+  gdouble start_y = 0;
+  gint i = 0;
+
+  for (i = 0; i < path->num_data; i += path->data[i].header.length)
+    {
+      cairo_path_data_t *data = &path->data[i];
+
+      switch (data->header.type)
+        {
+        case CAIRO_PATH_MOVE_TO:
+          x = start_x = data[1].point.x;
+          y = start_y = data[1].point.y;
+          break;
+
+        case CAIRO_PATH_LINE_TO:
+          length += get_distance (x, y, data[1].point.x, data[1].point.y);
+          x = data[1].point.x;
+          y = data[1].point.y;
+          break;
+
+        case CAIRO_PATH_CLOSE_PATH:
+          length += get_distance (x, y, start_x, start_y);
+          x = start_x;
+          y = start_y;
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  return length;
+}
+
+
+/* Paint the part of the stroke drawn until the time. */
+static void
+paint_partial_stroke (cairo_t      *cr,
+                      RenderEvent  *event,
+                      gint64        time)
+{
+  gdouble fraction = (gdouble) (time - event->start) / (event->time - event->start);
+  cairo_path_t *flat = (cairo_path_t *) NULL;
+  gdouble dashes[2];
+
+  cairo_new_path (cr);
+  canvas_draw_path_data (cr, event->path);
+  flat = cairo_copy_path_flat (cr);
+  dashes[1] = get_path_length (flat);
+  dashes[0] = dashes[1] * fraction;
+  cairo_path_destroy (flat);
+
+  if (dashes[0] <= 0)
+    {
+      cairo_new_path (cr);
+      return;
+    }
+
+  /* A single dash as long as the part drawn. */
+  cairo_save (cr);
+  cairo_set_dash (cr, dashes, 2, 0);
+  cairo_set_source_color_from_string (cr, event->color);
+  cairo_set_line_width (cr, event->thickness);
+  cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+  cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+  cairo_stroke (cr);
+  cairo_restore (cr);
+}
+
+
+/* Give the frame at the position to the encoder, waiting if it is late. */
+static void
+push_frame         (Render      *render,
+                    guint        position,
+                    VideoFrame  *frame)
+{
+  g_mutex_lock (&render->mutex);
+
+  while (position >= render->next + render->window)
+    {
+      g_cond_wait (&render->cond, &render->mutex);
+    }
+
+  render->slots[position % render->window] = frame;
+  g_cond_broadcast (&render->cond);
+  g_mutex_unlock (&render->mutex);
+}
+
+
+/* Take the frame at the position, waiting for its worker. */
+static VideoFrame *
+pop_frame          (Render  *render,
+                    guint    position)
+{
+  VideoFrame *frame = (VideoFrame *) NULL;
+
+  g_mutex_lock (&render->mutex);
+
+  while (!render->slots[position % render->window])
+    {
+      g_cond_wait (&render->cond, &render->mutex);
+    }
+
+  frame = render->slots[position % render->window];
+  render->slots[position % render->window] = (VideoFrame *) NULL;
+  render->next = position + 1;
+  g_cond_broadcast (&render->cond);
+  g_mutex_unlock (&render->mutex);
+
+  return frame;
+}
+
+
+/* Wait until the frame at the position fits in the window of the encoder. */
+static void
+wait_window        (Render  *render,
+                    guint    position)
+{
+  g_mutex_lock (&render->mutex);
+
+  while (position >= render->next + render->window)
+    {
+      g_cond_wait (&render->cond, &render->mutex);
+    }
+
+  g_mutex_unlock (&render->mutex);
+}
+
+
+/*
+ * Paint the strokes in progress on the snapshot and convert it; it
+ * runs in the pool.
+ */
+static void
+render_frame       (RenderJob  *job,
+                    Render     *render)
+{
+  VideoFrame *frame = video_frame_new (render->width, render->height);
+  cairo_t *picture_cr = cairo_create (job->picture);
+  guint i = 0;
+
+  /* The strokes in progress; they are committed later. */
+  for (i = job->next_event; i < render->events->len; i++)
+    {
+      RenderEvent *event = &g_array_index (render->events, RenderEvent, i);
+
+      if (event->time > job->time + render->max_duration)
+        {
+          break;
+        }
+
+      if ((event->path) && (event->start <= job->time))
+        {
+          paint_partial_stroke (picture_cr, event, job->time);
+        }
+    }
+
+  cairo_destroy (picture_cr);
+  cairo_surface_flush (job->picture);
+  video_frame_convert (frame, job->picture, 0, 0);
+  push_frame (render, job->position, frame);
+
+  cairo_surface_destroy (job->picture);
+  g_free (job);
+}
+
+
+/*
+ * The replay thread; it applies the events once on its canvas and
+ * gives a snapshot of each frame with changes to the pool. It is never
+ * further than the window from the encoder, then the snapshots waiting
+ * are bounded.
+ */
+static gpointer
+replay_run         (Render  *render)
+{
+  gchar *savepoint_dir = g_dir_make_tmp ("ardesia-render-XXXXXX", NULL);
+  cairo_surface_t *layer = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, render->width, render->height);
+  cairo_surface_t *background = cairo_image_surface_create (CAIRO_FORMAT_RGB24, render->width, render->height);
+  cairo_t *layer_cr = cairo_create (layer);
+  AnnotateCanvas *canvas = canvas_new (render->width, render->height, savepoint_dir);
+  guint next_event = 0;
+  guint position = 0;
+
+  canvas_set_cairo_context (canvas, layer_cr);
+  paint_background (render, background, (const guchar *) NULL, (const guchar *) NULL);
+
+  for (position = 0; position < render->frames->len; position++)
+    {
+      RenderJob *job = g_malloc ((gsize) sizeof (RenderJob));
+      cairo_t *picture_cr = (cairo_t *) NULL;
+
+      job->position = position;
+      job->time = get_frame_time (render, g_array_index (render->frames, gint64, position));
+
+      while ((next_event < render->events->len) &&
+             (g_array_index (render->events, RenderEvent, next_event).time <= job->time))
+        {
+          apply_event (render, &g_array_index (render->events, RenderEvent, next_event), canvas, background);
+          next_event++;
+        }
+
+      job->next_event = next_event;
+
+      wait_window (render, position);
+
+      job->picture = cairo_image_surface_create (CAIRO_FORMAT_RGB24, render->width, render->height);
+      picture_cr = cairo_create (job->picture);
+      cairo_set_source_surface (picture_cr, background, 0, 0);
+      cairo_paint (picture_cr);
+      cairo_set_source_surface (picture_cr, layer, 0, 0);
+      cairo_paint (picture_cr);
+      cairo_destroy (picture_cr);
+
+      g_thread_pool_push (render->pool, job, NULL);
+    }
+
+  canvas_free (canvas);
+  cairo_destroy (layer_cr);
+  cairo_surface_destroy (layer);
+  cairo_surface_destroy (background);
+
+  if (savepoint_dir)
+    {
+      g_rmdir (savepoint_dir);
+      g_free (savepoint_dir);
+    }
+
+  return NULL;
+}
+
+
+/* Render the session in the video file; return false on failure. */
+static gboolean
+render_session     (Render       *render,
+                    const gchar  *filename)
+{
+  VideoEncoder *video = video_encoder_new (filename, render->width, render->height, render->fps, render->quality, FALSE);
+  GThread *replay = (GThread *) NULL;
+  guint position = 0;
+
+  if (!video)
+    {
+      g_printerr ("Cannot write the video %s\n", filename);
+      return FALSE;
+    }
+
+  render->window = render->jobs * RENDER_FRAMES_PER_WORKER;
+  render->slots = g_new0 (VideoFrame *, render->window);
+  render->next = 0;
+  g_mutex_init (&render->mutex);
+  g_cond_init (&render->cond);
+
+  render->pool = g_thread_pool_new ((GFunc) render_frame,
+                                    render,
+                                    render->jobs,
+                                    FALSE,
+                                    NULL);
+
+  replay = g_thread_new ("session-replay", (GThreadFunc) replay_run, render);
+
+  for (position = 0; position < render->frames->len; position++)
+    {
+      VideoFrame *frame = pop_frame (render, position);
+      gboolean last = (position + 1 == render->frames->len);
+      gint64 next_index = last ? render->frame_count : g_array_index (render->frames, gint64, position + 1);
+
+      video_encoder_write (video, frame, next_index - g_array_index (render->frames, gint64, position), last);
+      video_frame_free (frame);
+    }
+
+  g_thread_join (replay);
+  g_thread_pool_free (render->pool, FALSE, TRUE);
+
+  video_encoder_free (video);
+  g_free (render->slots);
+  g_cond_clear (&render->cond);
+  g_mutex_clear (&render->mutex);
+
+  return TRUE;
+}
+
+
+/* Print the command line help. */
+static void
+print_help         ()
+{
+  g_printf ("Usage: ardesia-render [options] session video\n\n");
+  g_printf ("Render the session recorded with ardesia --record-session in an ogg theora video\n\n");
+  g_printf ("options:\n");
+  g_printf ("  --size,\t-s\t\tThe size of the video as WIDTHxHEIGHT [default the recorded screen]\n");
+  g_printf ("  --fps,\t-f\t\tThe frames per second [default %d]\n", RENDER_FPS);
+  g_printf ("  --quality,\t-q\t\tThe quality of the video from 0 to 63 [default %d]\n", RENDER_QUALITY);
+  g_printf ("  --jobs,\t-j\t\tThe frames rendered in parallel [default the number of cores]\n");
+  g_printf ("  --help,\t-h\t\tShows the help screen\n");
+  exit (EXIT_SUCCESS);
+}
+
+
+int
+main               (int    argc,
+                    char  *argv[])
+{
+  Render render;
+  gint width = 0;
+  gint height = 0;
+  gint source_width = 0;
+  gint source_height = 0;
+  gchar *contents = (gchar *) NULL;
+  gsize length = 0;
+  GError *error = (GError *) NULL;
+  gint64 start_time = 0;
+  gboolean done = FALSE;
+  guint i = 0;
+  gint c = 0;
+
+  memset (&render, 0, sizeof (render));
+  render.fps = RENDER_FPS;
+  render.quality = RENDER_QUALITY;
+  render.jobs = g_get_num_processors ();
+
+  while (1)
+    {
+      static struct option long_options[] =
+      {
+      {"help", no_argument,          0, 'h'},
+      {"size", required_argument,    0, 's'},
+      {"fps", required_argument,     0, 'f'},
+      {"quality", required_argument, 0, 'q'},
+      {"jobs", required_argument,    0, 'j'},
+      {0, 0, 0, 0}
+      };
+
+      gint option_index = 0;
+      c = getopt_long (argc, argv, "hs:f:q:j:", long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+        {
+          break;
+        }
+
+      switch (c)
+        {
+          case 's':
+            if ((sscanf (optarg, "%dx%d", &width, &height) != 2) || (width <= 0) || (height <= 0))
+              {
+                print_help ();
+              }
+            break;
+          case 'f':
+            render.fps = CLAMP (atoi (optarg), 1, 120);
+            break;
+          case 'q':
+            render.quality = CLAMP (atoi (optarg), 0, 63);
+            break;
+          case 'j':
+            render.jobs = MAX (atoi (optarg), 1);
+            break;
+          default:
+            print_help ();
+        }
+    }
+
+  if (argc - optind != 2)
+    {
+      print_help ();
+    }
+
+  if (!g_file_get_contents (argv[optind], &contents, &length, &error))
+    {
+      g_printerr ("Unable to read the session %s: %s\n", argv[optind], error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  render.events = g_array_new (FALSE, FALSE, sizeof (RenderEvent));
+  render.frames = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  if (!load_session (&render, (const guchar *) contents, length, &source_width, &source_height))
+    {
+      g_printerr ("The file %s is not a valid session recording\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+
+  /* The chroma planes need an even size. */
+  render.width = (width ? width : source_width) & ~1;
+  render.height = (height ? height : source_height) & ~1;
+  render.scale_x = (gdouble) render.width / source_width;
+  render.scale_y = (gdouble) render.height / source_height;
+
+  for (i = 0; i < render.events->len; i++)
+    {
+      load_animation (&render, &g_array_index (render.events, RenderEvent, i));
+    }
+
+  plan_frames (&render);
+
+  start_time = g_get_monotonic_time ();
+  done = render_session (&render, argv[optind + 1]);
+
+  if (done)
+    {
+      g_printerr ("Rendered %u events in %u of %" G_GINT64_FORMAT " frames of %dx%d in %.1f seconds\n",
+                  render.events->len,
+                  render.frames->len,
+                  render.frame_count,
+                  render.width,
+                  render.height,
+                  (g_get_monotonic_time () - start_time) / 1e6);
+    }
+
+  for (i = 0; i < render.events->len; i++)
+    {
+      g_free (g_array_index (render.events, RenderEvent, i).path);
+    }
+
+  g_array_free (render.events, TRUE);
+  g_array_free (render.frames, TRUE);
+  g_free (contents);
+
+  return done ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
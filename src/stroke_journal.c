@@ -0,0 +1,480 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+#include <utils.h>
+#include <stroke_journal.h>
+#include <annotation_window.h>
+#include <iwb_saver.h>
+#include <session_recorder.h>
+#include <trace.h>
+
+
+/* What the writer thread has to do. */
+typedef enum
+  {
+
+    /* Append the record. */
+    JOURNAL_COMMAND_WRITE,
+
+    /* Wait the sync of the base file and truncate the journal. */
+    JOURNAL_COMMAND_REBASE,
+
+    /* Flush the pending records and exit. */
+    JOURNAL_COMMAND_STOP,
+
+  } JournalCommandType;
+
+
+/* A command queued to the writer thread. */
+typedef struct
+{
+
+  JournalCommandType type;
+
+  /* The encoded record to be written. */
+  GByteArray *record;
+
+  /* The text layer to be encoded in the record; it is NULL for the others. */
+  cairo_surface_t *text;
+
+  /* Where the autosave writer tells if the base file has been synced. */
+  GAsyncQueue *synced;
+
+} JournalCommand;
+
+
+/* The journal file name. */
+static gchar *journal_filename = (gchar *) NULL;
+
+/* The commands for the writer thread. */
+static GAsyncQueue *journal_queue = (GAsyncQueue *) NULL;
+
+/* The writer thread. */
+static GThread *journal_writer = (GThread *) NULL;
+
+
+/* Make the data written so far durable. */
+static void
+sync_fd                 (gint  fd)
+{
+#ifdef _WIN32
+  _commit (fd);
+#elif defined (HAVE_FDATASYNC)
+  fdatasync (fd);
+#else
+  fsync (fd);
+#endif
+}
+
+
+/* Create the journal, or open the existing one for append, writing the header if it is empty. */
+static FILE *
+open_journal            (const gchar  *mode)
+{
+  guint16 version = GUINT16_TO_LE (STROKE_JOURNAL_VERSION);
+  guint16 reserved = 0;
+  FILE *fp = g_fopen (journal_filename, mode);
+
+  if (!fp)
+    {
+      g_warning ("Unable to open the stroke journal %s", journal_filename);
+      return (FILE *) NULL;
+    }
+
+  fseek (fp, 0, SEEK_END);
+
+  if (ftell (fp) == 0)
+    {
+      fwrite (STROKE_JOURNAL_MAGIC, sizeof (gchar), strlen (STROKE_JOURNAL_MAGIC), fp);
+      fwrite (&version, sizeof (version), 1, fp);
+      fwrite (&reserved, sizeof (reserved), 1, fp);
+    }
+
+  return fp;
+}
+
+
+/* Free the command. */
+static void
+journal_command_free    (JournalCommand  *command)
+{
+  if (command->record)
+    {
+      g_byte_array_unref (command->record);
+    }
+
+  if (command->text)
+    {
+      cairo_surface_destroy (command->text);
+    }
+
+  if (command->synced)
+    {
+      g_async_queue_unref (command->synced);
+    }
+
+  g_free (command);
+}
+
+
+/*
+ * The writer thread; it takes all the commands queued while it was busy
+ * and syncs them once, then the cost of the sync is shared by the batch.
+ */
+static gpointer
+journal_writer_run      (gpointer  user_data)
+{
+  FILE *fp = open_journal ("ab");
+  gboolean stop = FALSE;
+
+  while (!stop)
+    {
+      JournalCommand *command = g_async_queue_pop (journal_queue);
+      gboolean dirty = FALSE;
+
+      while (command)
+        {
+          switch (command->type)
+            {
+            case JOURNAL_COMMAND_WRITE:
+              /* The png of the text is encoded here to keep it out of the ui thread. */
+              if ((fp) && (command->text))
+                {
+                  command->record = stroke_record_new_text (command->text);
+                }
+
+              if ((fp) && (command->record))
+                {
+                  fwrite (command->record->data, 1, command->record->len, fp);
+                  dirty = TRUE;
+                }
+              break;
+
+            case JOURNAL_COMMAND_REBASE:
+              /* The records written until now are in the base file, if it has been synced. */
+              if (GPOINTER_TO_INT (g_async_queue_pop (command->synced)) > 0)
+                {
+                  if (fp)
+                    {
+                      fclose (fp);
+                    }
+
+                  fp = open_journal ("wb");
+                  dirty = TRUE;
+                }
+              break;
+
+            case JOURNAL_COMMAND_STOP:
+              stop = TRUE;
+              break;
+            }
+
+          journal_command_free (command);
+          command = stop ? (JournalCommand *) NULL : g_async_queue_try_pop (journal_queue);
+        }
+
+      if ((dirty) && (fp))
+        {
+          fflush (fp);
+          sync_fd (fileno (fp));
+        }
+    }
+
+  if (fp)
+    {
+      fclose (fp);
+    }
+
+  return NULL;
+}
+
+
+/* Queue a command to the writer taking the record, the text or the synced queue. */
+static void
+push_command            (JournalCommandType  type,
+                         GByteArray         *record,
+                         cairo_surface_t    *text,
+                         GAsyncQueue        *synced)
+{
+  JournalCommand *command = g_malloc ((gsize) sizeof (JournalCommand));
+  command->type = type;
+  command->record = record;
+  command->text = text;
+  command->synced = synced;
+  g_async_queue_push (journal_queue, command);
+}
+
+
+/*
+ * Replay on the canvas the journal left by a crashed session, if any;
+ * it must be called when the autosave has been recovered.
+ */
+void
+replay_stroke_journal  ()
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  gchar *iwb_file = get_iwb_export_filename (get_iwb_filename ());
+  GError *error = (GError *) NULL;
+  gchar *contents = (gchar *) NULL;
+  gsize length = 0;
+  const guchar *cursor = (const guchar *) NULL;
+  const guchar *end = (const guchar *) NULL;
+  gchar magic[4];
+  guint16 version = 0;
+  guint16 reserved = 0;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+  cairo_t *old_cr = (cairo_t *) NULL;
+  AnnotatePaintContext *old_context = (AnnotatePaintContext *) NULL;
+  gchar *old_color = (gchar *) NULL;
+  gdouble old_thickness = 0;
+  guint replayed = 0;
+
+  g_free (journal_filename);
+  journal_filename = g_strdup_printf ("%s.strokes", iwb_file);
+  g_free (iwb_file);
+
+  if (!file_exists (journal_filename))
+    {
+      return;
+    }
+
+  if (!g_file_get_contents (journal_filename, &contents, &length, &error))
+    {
+      g_warning ("Unable to read the stroke journal %s: %s", journal_filename, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  cursor = (const guchar *) contents;
+  end = cursor + length;
+
+  if ((!stroke_record_read_bytes (&cursor, end, magic, sizeof (magic)))        ||
+      (memcmp (magic, STROKE_JOURNAL_MAGIC, sizeof (magic)) != 0)                ||
+      (!stroke_record_read_bytes (&cursor, end, &version, sizeof (version)))     ||
+      (GUINT16_FROM_LE (version) > STROKE_JOURNAL_VERSION)                       ||
+      (!stroke_record_read_bytes (&cursor, end, &reserved, sizeof (reserved))))
+    {
+      g_warning ("The file %s is not a valid stroke journal", journal_filename);
+      g_free (contents);
+      return;
+    }
+
+  TRACE_BEGIN ("replay_stroke_journal");
+
+  /* Paint offscreen; the window shows the result at the first draw. */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, canvas->width, canvas->height);
+  cr = cairo_create (surface);
+
+  old_cr = canvas->cr;
+  old_context = canvas->cur_context;
+  old_color = g_strdup (canvas->color);
+  old_thickness = canvas->thickness;
+
+  canvas_set_cairo_context (canvas, cr);
+  canvas_restore_surface (canvas);
+
+  while (cursor < end)
+    {
+      /* The last record has been truncated by the crash. */
+      if (!stroke_record_replay (canvas, &cursor, end, 1.0, 1.0))
+        {
+          break;
+        }
+
+      replayed++;
+    }
+
+  canvas->cur_context = old_context;
+  canvas->thickness = old_thickness;
+  g_free (canvas->color);
+  canvas->color = old_color;
+  canvas_set_cairo_context (canvas, old_cr);
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+  g_free (contents);
+
+  TRACE_COUNTER ("replayed_strokes", replayed);
+  TRACE_END ("replay_stroke_journal");
+
+  if (get_annotation_data ()->debug)
+    {
+      g_printerr ("Replayed %u actions from the stroke journal %s\n", replayed, journal_filename);
+    }
+}
+
+
+/* Start the writer of the journal appending to the replayed one. */
+void
+start_stroke_journal   ()
+{
+  if (!journal_filename)
+    {
+      gchar *iwb_file = get_iwb_export_filename (get_iwb_filename ());
+      journal_filename = g_strdup_printf ("%s.strokes", iwb_file);
+      g_free (iwb_file);
+    }
+
+  journal_queue = g_async_queue_new ();
+  journal_writer = g_thread_new ("stroke-journal", journal_writer_run, NULL);
+}
+
+
+/* Queue the record to the writer and to the session recording. */
+static void
+write_record           (GByteArray      *record)
+{
+  record_session_action (record);
+
+  if (journal_queue)
+    {
+      push_command (JOURNAL_COMMAND_WRITE, record, (cairo_surface_t *) NULL, (GAsyncQueue *) NULL);
+    }
+  else
+    {
+      g_byte_array_unref (record);
+    }
+}
+
+
+/* Append the stroke that is going to be committed on the canvas. */
+void
+journal_stroke         (AnnotateCanvas  *canvas)
+{
+  if ((journal_queue) || (is_session_recording ()))
+    {
+      write_record (stroke_record_new_stroke (canvas));
+    }
+}
+
+
+/* Append the fill at x, y. */
+void
+journal_fill           (AnnotateCanvas  *canvas,
+                        gdouble          x,
+                        gdouble          y)
+{
+  if ((journal_queue) || (is_session_recording ()))
+    {
+      write_record (stroke_record_new_fill (canvas, x, y));
+    }
+}
+
+
+/* Append the text that is going to be painted over the canvas. */
+void
+journal_text           (cairo_t         *cr)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  cairo_surface_t *text = (cairo_surface_t *) NULL;
+
+  if ((!journal_queue) && (!is_session_recording ()))
+    {
+      return;
+    }
+
+  /* Only the copy is made here; the writers encode the png. */
+  text = stroke_record_copy_text (cr, canvas->width, canvas->height);
+  record_session_text (text);
+
+  if (journal_queue)
+    {
+      push_command (JOURNAL_COMMAND_WRITE, (GByteArray *) NULL, cairo_surface_reference (text), (GAsyncQueue *) NULL);
+    }
+
+  cairo_surface_destroy (text);
+}
+
+
+/* Append a record without payload: clear, undo or redo. */
+void
+journal_action         (StrokeJournalRecordType  type)
+{
+  if ((journal_queue) || (is_session_recording ()))
+    {
+      write_record (stroke_record_new_action (type));
+    }
+}
+
+
+/*
+ * Truncate the journal when the autosave containing everything
+ * painted so far has been synced; the autosave writer pushes on
+ * the synced queue a positive value if it succeeded, a negative one
+ * otherwise and the journal is kept.
+ */
+void
+rebase_stroke_journal  (GAsyncQueue     *synced)
+{
+  if (!journal_queue)
+    {
+      return;
+    }
+
+  push_command (JOURNAL_COMMAND_REBASE, (GByteArray *) NULL, (cairo_surface_t *) NULL, g_async_queue_ref (synced));
+}
+
+
+/*
+ * Stop the writer flushing the pending records; if the project has been
+ * compacted in the iwb file the journal is removed.
+ */
+void
+stop_stroke_journal    (gboolean         compacted)
+{
+  if (journal_writer)
+    {
+      push_command (JOURNAL_COMMAND_STOP, (GByteArray *) NULL, (cairo_surface_t *) NULL, (GAsyncQueue *) NULL);
+      g_thread_join (journal_writer);
+      journal_writer = (GThread *) NULL;
+    }
+
+  if (journal_queue)
+    {
+      g_async_queue_unref (journal_queue);
+      journal_queue = (GAsyncQueue *) NULL;
+    }
+
+  if ((compacted) && (journal_filename))
+    {
+      g_remove (journal_filename);
+    }
+
+  g_free (journal_filename);
+  journal_filename = (gchar *) NULL;
+}
+
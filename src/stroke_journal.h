@@ -0,0 +1,118 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Crash-safe journal of the painting actions.
+ *
+ * Each committed stroke, fill, text, clear, undo and redo is encoded as
+ * a small record and appended by a writer thread to a journal beside
+ * the iwb file; only the png of a text is encoded by the writer, from a
+ * copy of the layer taken on the ui thread. The writer takes all the
+ * records queued meanwhile and makes them durable with a single data
+ * sync, then the painting never waits for the disk. The journal holds only what has
+ * been done after the last autosave and it is truncated when an
+ * autosave is written; after a crash it is replayed at the next start
+ * painting the strokes as vectors. The same records are given to the
+ * session recording, see session_recorder.h. The journal is written
+ * only when the autosave is on.
+ *
+ * The journal starts with the STROKE_JOURNAL_MAGIC string followed by
+ * the format version (16 bit) and a reserved 16 bit field; then the
+ * records follow as encoded in stroke_record.h. A truncated record at
+ * the end is ignored.
+ */
+
+
+#ifndef STROKE_JOURNAL_H
+#define STROKE_JOURNAL_H
+
+#include <stdio.h>
+
+#include <canvas.h>
+#include <stroke_record.h>
+
+
+/* Magic string at the beginning of the stroke journal. */
+#define STROKE_JOURNAL_MAGIC "ARDS"
+
+/* Version of the stroke journal format. */
+#define STROKE_JOURNAL_VERSION 1
+
+
+/*
+ * Replay on the canvas the journal left by a crashed session, if any;
+ * it must be called when the autosave has been recovered.
+ */
+void
+replay_stroke_journal  ();
+
+
+/* Start the writer of the journal appending to the replayed one. */
+void
+start_stroke_journal   ();
+
+
+/* Append the stroke that is going to be committed on the canvas. */
+void
+journal_stroke         (AnnotateCanvas  *canvas);
+
+
+/* Append the fill at x, y. */
+void
+journal_fill           (AnnotateCanvas  *canvas,
+                        gdouble          x,
+                        gdouble          y);
+
+
+/* Append the text that is going to be painted over the canvas. */
+void
+journal_text           (cairo_t         *cr);
+
+
+/* Append a record without payload: clear, undo or redo. */
+void
+journal_action         (StrokeJournalRecordType  type);
+
+
+/*
+ * Truncate the journal when the autosave containing everything
+ * painted so far has been synced; the autosave writer pushes on
+ * the synced queue a positive value if it succeeded, a negative one
+ * otherwise and the journal is kept.
+ */
+void
+rebase_stroke_journal  (GAsyncQueue     *synced);
+
+
+/*
+ * Stop the writer flushing the pending records; if the project has been
+ * compacted in the iwb file the journal is removed.
+ */
+void
+stop_stroke_journal    (gboolean         compacted);
+
+
+#endif
+
@@ -0,0 +1,540 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stroke_record.h>
+
+
+/* Cursor used to decode a png kept in memory. */
+typedef struct
+{
+  const guchar *data;
+  gsize size;
+  gsize offset;
+} PngReader;
+
+
+/* Append the png data produced by cairo to the byte array. */
+static cairo_status_t
+png_write_to_byte_array      (void                *closure,
+                              const unsigned char *data,
+                              unsigned int         length)
+{
+  g_byte_array_append ((GByteArray *) closure, data, length);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+
+/* Feed cairo with the png data kept in memory. */
+static cairo_status_t
+png_read_from_bytes          (void          *closure,
+                              unsigned char *data,
+                              unsigned int   length)
+{
+  PngReader *reader = (PngReader *) closure;
+
+  if (reader->offset + length > reader->size)
+    {
+      return CAIRO_STATUS_READ_ERROR;
+    }
+
+  memcpy (data, reader->data + reader->offset, length);
+  reader->offset += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+
+/* Append a byte. */
+void
+stroke_record_append_u8      (GByteArray      *record,
+                              guint8           value)
+{
+  g_byte_array_append (record, &value, sizeof (value));
+}
+
+
+/* Append a 32 bit integer. */
+void
+stroke_record_append_u32     (GByteArray      *record,
+                              guint32          value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+  g_byte_array_append (record, (const guint8 *) &le_value, sizeof (le_value));
+}
+
+
+/* Append a 64 bit float. */
+void
+stroke_record_append_f64     (GByteArray      *record,
+                              gdouble          value)
+{
+  guint64 bits = 0;
+  memcpy (&bits, &value, sizeof (bits));
+  bits = GUINT64_TO_LE (bits);
+  g_byte_array_append (record, (const guint8 *) &bits, sizeof (bits));
+}
+
+
+/* Append the colour as 8 hex digits. */
+void
+stroke_record_append_color   (GByteArray      *record,
+                              const gchar     *color)
+{
+  gchar digits[8] = { 'F', 'F', 'F', 'F', 'F', 'F', 'F', 'F' };
+
+  if (color)
+    {
+      memcpy (digits, color, MIN (strlen (color), sizeof (digits)));
+    }
+
+  g_byte_array_append (record, (const guint8 *) digits, sizeof (digits));
+}
+
+
+/* Append the size (32 bit) and the data. */
+void
+stroke_record_append_data    (GByteArray      *record,
+                              gconstpointer    data,
+                              gsize            size)
+{
+  stroke_record_append_u32 (record, (guint32) size);
+
+  if (size > 0)
+    {
+      g_byte_array_append (record, (const guint8 *) data, size);
+    }
+}
+
+
+/* Read size bytes moving the cursor; return false at the end of buffer. */
+gboolean
+stroke_record_read_bytes     (const guchar   **cursor,
+                              const guchar    *end,
+                              gpointer         dest,
+                              gsize            size)
+{
+  if ((gsize) (end - *cursor) < size)
+    {
+      return FALSE;
+    }
+
+  memcpy (dest, *cursor, size);
+  *cursor = *cursor + size;
+  return TRUE;
+}
+
+
+/* Read a 32 bit integer. */
+gboolean
+stroke_record_read_u32       (const guchar   **cursor,
+                              const guchar    *end,
+                              guint32         *value)
+{
+  if (!stroke_record_read_bytes (cursor, end, value, sizeof (guint32)))
+    {
+      return FALSE;
+    }
+
+  *value = GUINT32_FROM_LE (*value);
+  return TRUE;
+}
+
+
+/* Read a 64 bit float. */
+gboolean
+stroke_record_read_f64       (const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble         *value)
+{
+  guint64 bits = 0;
+
+  if (!stroke_record_read_bytes (cursor, end, &bits, sizeof (bits)))
+    {
+      return FALSE;
+    }
+
+  bits = GUINT64_FROM_LE (bits);
+  memcpy (value, &bits, sizeof (bits));
+  return TRUE;
+}
+
+
+/* Read the colour stored as 8 hex digits. */
+gboolean
+stroke_record_read_color     (const guchar   **cursor,
+                              const guchar    *end,
+                              gchar            color[9])
+{
+  if (!stroke_record_read_bytes (cursor, end, color, 8))
+    {
+      return FALSE;
+    }
+
+  color[8] = '\0';
+  return TRUE;
+}
+
+
+/* Read the size and the data of a string; NULL if it is truncated. */
+gchar *
+stroke_record_read_string    (const guchar   **cursor,
+                              const guchar    *end)
+{
+  guint32 size = 0;
+  gchar *string = (gchar *) NULL;
+
+  if ((!stroke_record_read_u32 (cursor, end, &size)) ||
+      ((gsize) (end - *cursor) < size))
+    {
+      return (gchar *) NULL;
+    }
+
+  string = g_strndup ((const gchar *) *cursor, size);
+  *cursor = *cursor + size;
+  return string;
+}
+
+
+/*
+ * Read the size and the data of a png and decode it; NULL if it is
+ * truncated. The surface status tells if the png is valid.
+ */
+cairo_surface_t *
+stroke_record_read_png       (const guchar   **cursor,
+                              const guchar    *end)
+{
+  guint32 size = 0;
+  PngReader reader;
+
+  if ((!stroke_record_read_u32 (cursor, end, &size)) ||
+      ((gsize) (end - *cursor) < size))
+    {
+      return (cairo_surface_t *) NULL;
+    }
+
+  reader.data = *cursor;
+  reader.size = size;
+  reader.offset = 0;
+  *cursor = *cursor + size;
+
+  return cairo_image_surface_create_from_png_stream (png_read_from_bytes, &reader);
+}
+
+
+/* Encode the stroke that is going to be committed on the canvas. */
+GByteArray *
+stroke_record_new_stroke     (AnnotateCanvas  *canvas)
+{
+  GByteArray *record = g_byte_array_new ();
+
+  stroke_record_append_u8 (record, STROKE_JOURNAL_RECORD_STROKE);
+  stroke_record_append_u8 (record, (canvas->cur_context->type == ANNOTATE_ERASER) ? 1 : 0);
+  stroke_record_append_f64 (record, canvas->thickness);
+  stroke_record_append_color (record, canvas->color);
+  stroke_record_append_data (record, canvas->path->str, canvas->path->len);
+  stroke_record_append_data (record, canvas->arrow_path->str, canvas->arrow_path->len);
+  return record;
+}
+
+
+/* Encode the fill at x, y. */
+GByteArray *
+stroke_record_new_fill       (AnnotateCanvas  *canvas,
+                              gdouble          x,
+                              gdouble          y)
+{
+  GByteArray *record = g_byte_array_new ();
+
+  stroke_record_append_u8 (record, STROKE_JOURNAL_RECORD_FILL);
+  stroke_record_append_f64 (record, x);
+  stroke_record_append_f64 (record, y);
+  stroke_record_append_color (record, canvas->color);
+  return record;
+}
+
+
+/*
+ * Copy the text layer of the given size that is going to be painted over
+ * the canvas; the copy is encoded by stroke_record_new_text out of the
+ * ui thread.
+ */
+cairo_surface_t *
+stroke_record_copy_text      (cairo_t         *cr,
+                              gint             width,
+                              gint             height)
+{
+  cairo_surface_t *source = cairo_get_target (cr);
+  cairo_surface_t *layer = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *layer_cr = (cairo_t *) NULL;
+
+  cairo_surface_flush (source);
+
+  layer_cr = cairo_create (layer);
+  cairo_set_operator (layer_cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface (layer_cr, source, 0, 0);
+  cairo_paint (layer_cr);
+  cairo_destroy (layer_cr);
+
+  return layer;
+}
+
+
+/* Encode the text layer as a png. */
+GByteArray *
+stroke_record_new_text       (cairo_surface_t *layer)
+{
+  GByteArray *record = g_byte_array_new ();
+  GByteArray *png = g_byte_array_new ();
+
+  /* Only the text layer is stored; it is mostly transparent and small. */
+  cairo_surface_write_to_png_stream (layer, png_write_to_byte_array, png);
+
+  stroke_record_append_u8 (record, STROKE_JOURNAL_RECORD_TEXT);
+  stroke_record_append_data (record, png->data, png->len);
+  g_byte_array_unref (png);
+  return record;
+}
+
+
+/* Encode a record without payload: clear, undo or redo. */
+GByteArray *
+stroke_record_new_action     (StrokeJournalRecordType  type)
+{
+  GByteArray *record = g_byte_array_new ();
+
+  stroke_record_append_u8 (record, type);
+  return record;
+}
+
+
+/* Set the pen colour of the canvas. */
+static void
+set_color                    (AnnotateCanvas  *canvas,
+                              const gchar     *color)
+{
+  g_free (canvas->color);
+  canvas->color = g_strdup (color);
+}
+
+
+/* Paint the svg path data scaled. */
+static void
+paint_scaled_path            (AnnotateCanvas  *canvas,
+                              const gchar     *data,
+                              gboolean         filled,
+                              gdouble          scale_x,
+                              gdouble          scale_y)
+{
+  gchar *scaled = (gchar *) NULL;
+
+  if ((scale_x == 1.0) && (scale_y == 1.0))
+    {
+      canvas_paint_path (canvas, data, filled);
+      return;
+    }
+
+  scaled = canvas_scale_path_data (data, scale_x, scale_y);
+  canvas_paint_path (canvas, scaled, filled);
+  g_free (scaled);
+}
+
+
+/* Replay a stroke record; false if it is truncated. */
+static gboolean
+replay_stroke                (AnnotateCanvas  *canvas,
+                              const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble          scale_x,
+                              gdouble          scale_y)
+{
+  guint8 tool = 0;
+  gdouble thickness = 0;
+  gchar color[9];
+  gchar *path = (gchar *) NULL;
+  gchar *arrow = (gchar *) NULL;
+
+  if ((!stroke_record_read_bytes (cursor, end, &tool, sizeof (tool))) ||
+      (!stroke_record_read_f64 (cursor, end, &thickness)) ||
+      (!stroke_record_read_color (cursor, end, color)) ||
+      (!(path = stroke_record_read_string (cursor, end))) ||
+      (!(arrow = stroke_record_read_string (cursor, end))))
+    {
+      g_free (path);
+      return FALSE;
+    }
+
+  canvas->cur_context = tool ? canvas->default_eraser : canvas->default_pen;
+  canvas->thickness = thickness * sqrt (scale_x * scale_y);
+  set_color (canvas, color);
+
+  if (path[0])
+    {
+      paint_scaled_path (canvas, path, FALSE, scale_x, scale_y);
+    }
+
+  if (arrow[0])
+    {
+      paint_scaled_path (canvas, arrow, TRUE, scale_x, scale_y);
+    }
+
+  /* The pen and the eraser strokes stay vectors; no image needs to be encoded. */
+  canvas_add_vector_savepoint (canvas);
+
+  g_free (path);
+  g_free (arrow);
+  return TRUE;
+}
+
+
+/* Replay a fill record; false if it is truncated. */
+static gboolean
+replay_fill                  (AnnotateCanvas  *canvas,
+                              const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble          scale_x,
+                              gdouble          scale_y)
+{
+  gdouble x = 0;
+  gdouble y = 0;
+  gchar color[9];
+
+  if ((!stroke_record_read_f64 (cursor, end, &x)) ||
+      (!stroke_record_read_f64 (cursor, end, &y)) ||
+      (!stroke_record_read_color (cursor, end, color)))
+    {
+      return FALSE;
+    }
+
+  canvas->cur_context = canvas->default_filler;
+  set_color (canvas, color);
+  canvas_fill (canvas, x * scale_x, y * scale_y);
+  return TRUE;
+}
+
+
+/* Replay a text record; false if it is truncated. */
+static gboolean
+replay_text                  (AnnotateCanvas  *canvas,
+                              const guchar   **cursor,
+                              const guchar    *end)
+{
+  cairo_surface_t *surface = stroke_record_read_png (cursor, end);
+
+  if (!surface)
+    {
+      return FALSE;
+    }
+
+  if (cairo_surface_status (surface) == CAIRO_STATUS_SUCCESS)
+    {
+      gint width = cairo_image_surface_get_width (surface);
+      gint height = cairo_image_surface_get_height (surface);
+      cairo_t *text_cr = (cairo_t *) NULL;
+
+      /* The layer has the size of the screen where it has been typed. */
+      if ((width != canvas->width) || (height != canvas->height))
+        {
+          cairo_surface_t *stretched = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                                   canvas->width,
+                                                                   canvas->height);
+
+          text_cr = cairo_create (stretched);
+          cairo_scale (text_cr,
+                       (gdouble) canvas->width / width,
+                       (gdouble) canvas->height / height);
+          cairo_set_source_surface (text_cr, surface, 0, 0);
+          cairo_paint (text_cr);
+          cairo_surface_destroy (stretched);
+          cairo_identity_matrix (text_cr);
+        }
+      else
+        {
+          text_cr = cairo_create (surface);
+        }
+
+      canvas_push_context (canvas, text_cr);
+      cairo_destroy (text_cr);
+    }
+  else
+    {
+      g_warning ("Unable to decode a text record");
+    }
+
+  cairo_surface_destroy (surface);
+  return TRUE;
+}
+
+
+/*
+ * Replay the record at the cursor on the canvas moving the cursor after
+ * it; the coordinates are scaled by scale_x and scale_y and the texts
+ * are stretched to the canvas. Return false if the record is truncated
+ * or unknown.
+ */
+gboolean
+stroke_record_replay         (AnnotateCanvas  *canvas,
+                              const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble          scale_x,
+                              gdouble          scale_y)
+{
+  guint8 type = 0;
+
+  if (!stroke_record_read_bytes (cursor, end, &type, sizeof (type)))
+    {
+      return FALSE;
+    }
+
+  switch (type)
+    {
+    case STROKE_JOURNAL_RECORD_STROKE:
+      return replay_stroke (canvas, cursor, end, scale_x, scale_y);
+
+    case STROKE_JOURNAL_RECORD_FILL:
+      return replay_fill (canvas, cursor, end, scale_x, scale_y);
+
+    case STROKE_JOURNAL_RECORD_TEXT:
+      return replay_text (canvas, cursor, end);
+
+    case STROKE_JOURNAL_RECORD_CLEAR:
+      canvas_clear (canvas);
+      return TRUE;
+
+    case STROKE_JOURNAL_RECORD_UNDO:
+      canvas_undo (canvas);
+      return TRUE;
+
+    case STROKE_JOURNAL_RECORD_REDO:
+      canvas_redo (canvas);
+      return TRUE;
+
+    default:
+      g_warning ("Unknown record %u", type);
+      return FALSE;
+    }
+}
+
@@ -0,0 +1,195 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Encoding of the painting actions as small binary records.
+ *
+ * The records are shared by the stroke journal and by the session
+ * recording; each one starts with its StrokeJournalRecordType byte
+ * and it is replayed on any canvas, also without a display. All the
+ * numbers are stored in little endian.
+ */
+
+
+#ifndef STROKE_RECORD_H
+#define STROKE_RECORD_H
+
+#include <canvas.h>
+
+
+/* Kind of record. */
+typedef enum
+  {
+
+    /*
+     * A stroke: the tool (8 bit, 0 for the pen and 1 for the eraser),
+     * the thickness (64 bit float), the colour (8 hex digits), the size
+     * (32 bit) and the svg data of the path followed by the size (32 bit)
+     * and the svg data of the arrow head.
+     */
+    STROKE_JOURNAL_RECORD_STROKE = 1,
+
+    /* A fill at x, y (64 bit float) with the colour (8 hex digits). */
+    STROKE_JOURNAL_RECORD_FILL,
+
+    /* A text painted over the canvas: the png size (32 bit) and data. */
+    STROKE_JOURNAL_RECORD_TEXT,
+
+    /* The canvas has been cleared. */
+    STROKE_JOURNAL_RECORD_CLEAR,
+
+    /* Undo. */
+    STROKE_JOURNAL_RECORD_UNDO,
+
+    /* Redo. */
+    STROKE_JOURNAL_RECORD_REDO,
+
+  } StrokeJournalRecordType;
+
+
+/* Append a byte. */
+void
+stroke_record_append_u8      (GByteArray      *record,
+                              guint8           value);
+
+
+/* Append a 32 bit integer. */
+void
+stroke_record_append_u32     (GByteArray      *record,
+                              guint32          value);
+
+
+/* Append a 64 bit float. */
+void
+stroke_record_append_f64     (GByteArray      *record,
+                              gdouble          value);
+
+
+/* Append the colour as 8 hex digits. */
+void
+stroke_record_append_color   (GByteArray      *record,
+                              const gchar     *color);
+
+
+/* Append the size (32 bit) and the data. */
+void
+stroke_record_append_data    (GByteArray      *record,
+                              gconstpointer    data,
+                              gsize            size);
+
+
+/* Read size bytes moving the cursor; return false at the end of buffer. */
+gboolean
+stroke_record_read_bytes     (const guchar   **cursor,
+                              const guchar    *end,
+                              gpointer         dest,
+                              gsize            size);
+
+
+/* Read a 32 bit integer. */
+gboolean
+stroke_record_read_u32       (const guchar   **cursor,
+                              const guchar    *end,
+                              guint32         *value);
+
+
+/* Read a 64 bit float. */
+gboolean
+stroke_record_read_f64       (const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble         *value);
+
+
+/* Read the colour stored as 8 hex digits. */
+gboolean
+stroke_record_read_color     (const guchar   **cursor,
+                              const guchar    *end,
+                              gchar            color[9]);
+
+
+/* Read the size and the data of a string; NULL if it is truncated. */
+gchar *
+stroke_record_read_string    (const guchar   **cursor,
+                              const guchar    *end);
+
+
+/*
+ * Read the size and the data of a png and decode it; NULL if it is
+ * truncated. The surface status tells if the png is valid.
+ */
+cairo_surface_t *
+stroke_record_read_png       (const guchar   **cursor,
+                              const guchar    *end);
+
+
+/* Encode the stroke that is going to be committed on the canvas. */
+GByteArray *
+stroke_record_new_stroke     (AnnotateCanvas  *canvas);
+
+
+/* Encode the fill at x, y. */
+GByteArray *
+stroke_record_new_fill       (AnnotateCanvas  *canvas,
+                              gdouble          x,
+                              gdouble          y);
+
+
+/*
+ * Copy the text layer of the given size that is going to be painted over
+ * the canvas; the copy is encoded by stroke_record_new_text out of the
+ * ui thread.
+ */
+cairo_surface_t *
+stroke_record_copy_text      (cairo_t         *cr,
+                              gint             width,
+                              gint             height);
+
+
+/* Encode the text layer as a png. */
+GByteArray *
+stroke_record_new_text       (cairo_surface_t *layer);
+
+
+/* Encode a record without payload: clear, undo or redo. */
+GByteArray *
+stroke_record_new_action     (StrokeJournalRecordType  type);
+
+
+/*
+ * Replay the record at the cursor on the canvas moving the cursor after
+ * it; the coordinates are scaled by scale_x and scale_y and the texts
+ * are stretched to the canvas. Return false if the record is truncated
+ * or unknown.
+ */
+gboolean
+stroke_record_replay         (AnnotateCanvas  *canvas,
+                              const guchar   **cursor,
+                              const guchar    *end,
+                              gdouble          scale_x,
+                              gdouble          scale_y);
+
+
+#endif
+
@@ -0,0 +1,136 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Checks of the svg path data parser of the canvas; run them with "make check". */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <canvas.h>
+
+
+/* Count the elements of the cairo path of the given type. */
+static gint
+count_path_elements     (cairo_path_t           *path,
+                         cairo_path_data_type_t  type)
+{
+  gint count = 0;
+  gint i = 0;
+
+  for (i = 0; i < path->num_data; i += path->data[i].header.length)
+    {
+      if (path->data[i].header.type == type)
+        {
+          count++;
+        }
+    }
+
+  return count;
+}
+
+
+/* Build the path of the data on a small surface and return it. */
+static cairo_path_t *
+parse_path_data         (const gchar  *data)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 16, 16);
+  cairo_t *cr = cairo_create (surface);
+  cairo_path_t *path = (cairo_path_t *) NULL;
+
+  canvas_draw_path_data (cr, data);
+  path = cairo_copy_path (cr);
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+  return path;
+}
+
+
+/* A plain stroke with the line pairs following the move. */
+static void
+test_lines              (void)
+{
+  cairo_path_t *path = parse_path_data ("M0 0 L1 1 2 2 3,3");
+
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_MOVE_TO), ==, 1);
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_LINE_TO), ==, 3);
+
+  cairo_path_destroy (path);
+}
+
+
+/* A number after the close is an error; the parser stops there. */
+static void
+test_number_after_close (void)
+{
+  cairo_path_t *path = parse_path_data ("M0 0 L1 1 Z 5");
+
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_LINE_TO), ==, 1);
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_CLOSE_PATH), ==, 1);
+
+  cairo_path_destroy (path);
+}
+
+
+/* A command after the close goes on normally. */
+static void
+test_move_after_close   (void)
+{
+  cairo_path_t *path = parse_path_data ("M0 0 L1 1 Z M2 2 C3 3 4 4 5 5");
+
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_CLOSE_PATH), ==, 1);
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_CURVE_TO), ==, 1);
+
+  cairo_path_destroy (path);
+}
+
+
+/* A truncated pair stops the parser without a partial segment. */
+static void
+test_truncated          (void)
+{
+  cairo_path_t *path = parse_path_data ("M0 0 L1");
+
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_MOVE_TO), ==, 1);
+  g_assert_cmpint (count_path_elements (path, CAIRO_PATH_LINE_TO), ==, 0);
+
+  cairo_path_destroy (path);
+}
+
+
+int
+main                    (int    argc,
+                         char  *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/canvas/path-data/lines", test_lines);
+  g_test_add_func ("/canvas/path-data/number-after-close", test_number_after_close);
+  g_test_add_func ("/canvas/path-data/move-after-close", test_move_after_close);
+  g_test_add_func ("/canvas/path-data/truncated", test_truncated);
+
+  return g_test_run ();
+}
@@ -32,6 +32,7 @@
 #include <annotation_window.h>
 #include <text_window.h>
 #include <keyboard.h>
+#include <input.h>
 
 #ifdef _WIN32
 #  include <windows_utils.h>
@@ -0,0 +1,348 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <trace.h>
+
+
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+
+
+/* A binary trace event. */
+typedef struct
+{
+
+  /* Time in micro-seconds since the start of the trace. */
+  gint64 timestamp;
+
+  /* Static name of the event. */
+  const gchar *name;
+
+  /* Chrome trace-event phase: 'B', 'E', 'i' or 'C'. */
+  gchar phase;
+
+  /* Optional numeric arguments; the names are static or NULL. */
+  const gchar *arg0_name;
+  gdouble arg0;
+  const gchar *arg1_name;
+  gdouble arg1;
+
+} TraceEvent;
+
+
+/* The ring buffer owned by a thread. */
+typedef struct
+{
+
+  /* Sequential identifier of the thread. */
+  gint tid;
+
+  /*
+   * Number of events written so far; only the owner thread writes it,
+   * the event is complete when the counter has been incremented.
+   */
+  gint written;
+
+  TraceEvent events[TRACE_BUFFER_SIZE];
+
+} TraceBuffer;
+
+
+/* Read by the TRACE macros. */
+gint trace_enabled = 0;
+
+/* The file where the trace will be written. */
+static gchar *trace_filename = (gchar *) NULL;
+
+/* Monotonic time of the trace start. */
+static gint64 trace_start_time = 0;
+
+static void retire_buffer (gpointer data);
+
+/* The buffer of the calling thread; it is retired when the thread exits. */
+static GPrivate trace_buffer_key = G_PRIVATE_INIT (retire_buffer);
+
+/*
+ * The buffers of the running threads and the ones of the threads exited
+ * while tracing, kept until trace_stop; the lock is taken only when a
+ * thread is registered or exits.
+ */
+static GSList *trace_buffers = (GSList *) NULL;
+static GSList *trace_retired = (GSList *) NULL;
+G_LOCK_DEFINE_STATIC (trace_buffers);
+
+/* The buffer of the thread that started the trace. */
+static TraceBuffer *trace_main_buffer = (TraceBuffer *) NULL;
+
+/* Last thread identifier given. */
+static gint trace_last_tid = 0;
+
+
+/* Allocate and register the buffer of the calling thread. */
+static TraceBuffer *
+register_buffer ()
+{
+  TraceBuffer *buffer = g_new0 (TraceBuffer, 1);
+  buffer->tid = g_atomic_int_add (&trace_last_tid, 1) + 1;
+  g_private_set (&trace_buffer_key, buffer);
+
+  G_LOCK (trace_buffers);
+  trace_buffers = g_slist_append (trace_buffers, buffer);
+  G_UNLOCK (trace_buffers);
+
+  return buffer;
+}
+
+
+/*
+ * Called when a thread exits; its events are kept until trace_stop
+ * writes them, the buffer is freed at once if nobody traces.
+ */
+static void
+retire_buffer (gpointer data)
+{
+  TraceBuffer *buffer = (TraceBuffer *) data;
+
+  G_LOCK (trace_buffers);
+
+  trace_buffers = g_slist_remove (trace_buffers, buffer);
+
+  if (trace_filename)
+    {
+      trace_retired = g_slist_prepend (trace_retired, buffer);
+    }
+  else
+    {
+      g_free (buffer);
+    }
+
+  G_UNLOCK (trace_buffers);
+}
+
+
+/* Write the arguments of the event in the json file. */
+static void
+write_args (FILE        *file,
+            TraceEvent  *event)
+{
+  if (!event->arg0_name)
+    {
+      return;
+    }
+
+  fprintf (file, ",\"args\":{\"%s\":%.17g", event->arg0_name, event->arg0);
+
+  if (event->arg1_name)
+    {
+      fprintf (file, ",\"%s\":%.17g", event->arg1_name, event->arg1);
+    }
+
+  fprintf (file, "}");
+}
+
+
+/* Write the events stored in the buffer in the json file. */
+static void
+write_buffer (FILE         *file,
+              TraceBuffer  *buffer,
+              gboolean     *first)
+{
+  guint written = (guint) g_atomic_int_get (&buffer->written);
+  guint start = 0;
+  guint i = 0;
+
+  /* The oldest events have been overwritten. */
+  if (written > TRACE_BUFFER_SIZE)
+    {
+      start = written - TRACE_BUFFER_SIZE;
+    }
+
+  fprintf (file,
+           "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+           "\"args\":{\"name\":\"%s %d\"}}",
+           *first ? "" : ",",
+           buffer->tid,
+           buffer == trace_main_buffer ? "main" : "thread",
+           buffer->tid);
+
+  *first = FALSE;
+
+  for (i = start; i < written; i++)
+    {
+      TraceEvent *event = &buffer->events[i & TRACE_BUFFER_MASK];
+
+      fprintf (file,
+               ",\n{\"name\":\"%s\",\"cat\":\"ardesia\",\"ph\":\"%c\","
+               "\"ts\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%d",
+               event->name,
+               event->phase,
+               event->timestamp,
+               buffer->tid);
+
+      /* The instant events are scoped to the thread. */
+      if (event->phase == 'i')
+        {
+          fprintf (file, ",\"s\":\"t\"");
+        }
+
+      write_args (file, event);
+      fprintf (file, "}");
+    }
+}
+
+
+/*
+ * Start to trace; the events will be written in filename by trace_stop.
+ * The calling thread is named main in the trace.
+ */
+void
+trace_start (const gchar  *filename)
+{
+  TraceBuffer *buffer = (TraceBuffer *) g_private_get (&trace_buffer_key);
+
+  G_LOCK (trace_buffers);
+  g_free (trace_filename);
+  trace_filename = g_strdup (filename);
+  G_UNLOCK (trace_buffers);
+
+  trace_main_buffer = buffer ? buffer : register_buffer ();
+  trace_start_time = g_get_monotonic_time ();
+  g_atomic_int_set (&trace_enabled, 1);
+}
+
+
+/* Store an event in the ring buffer of the calling thread. */
+void
+trace_event (const gchar  *name,
+             gchar         phase,
+             const gchar  *arg0_name,
+             gdouble       arg0,
+             const gchar  *arg1_name,
+             gdouble       arg1)
+{
+  TraceBuffer *buffer = (TraceBuffer *) g_private_get (&trace_buffer_key);
+  TraceEvent *event = (TraceEvent *) NULL;
+  gint written = 0;
+
+  if (!buffer)
+    {
+      buffer = register_buffer ();
+    }
+
+  written = buffer->written;
+  event = &buffer->events[(guint) written & TRACE_BUFFER_MASK];
+
+  event->timestamp = g_get_monotonic_time () - trace_start_time;
+  event->name = name;
+  event->phase = phase;
+  event->arg0_name = arg0_name;
+  event->arg0 = arg0;
+  event->arg1_name = arg1_name;
+  event->arg1 = arg1;
+
+  /* Publish the event. */
+  g_atomic_int_set (&buffer->written, written + 1);
+}
+
+
+/*
+ * Stop to trace and write the events in the Chrome trace-event format;
+ * it must be called when the other threads do not trace anymore.
+ */
+void
+trace_stop ()
+{
+  FILE *file = (FILE *) NULL;
+  GSList *list = (GSList *) NULL;
+  gboolean first = TRUE;
+
+  if (!trace_filename)
+    {
+      return;
+    }
+
+  g_atomic_int_set (&trace_enabled, 0);
+
+  /* The lock is kept until the end; the exiting threads wait to retire their buffers. */
+  G_LOCK (trace_buffers);
+
+  file = g_fopen (trace_filename, "w");
+
+  if (file)
+    {
+      fprintf (file, "{\"traceEvents\":[");
+
+      for (list = trace_buffers; list; list = list->next)
+        {
+          write_buffer (file, (TraceBuffer *) list->data, &first);
+        }
+
+      for (list = trace_retired; list; list = list->next)
+        {
+          write_buffer (file, (TraceBuffer *) list->data, &first);
+        }
+
+      fprintf (file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+      fclose (file);
+    }
+  else
+    {
+      g_warning ("Unable to write the trace file %s", trace_filename);
+    }
+
+  g_slist_free_full (trace_retired, g_free);
+  trace_retired = (GSList *) NULL;
+
+  /* The buffer of the calling thread is freed; it is registered again if the trace is restarted. */
+  if (trace_main_buffer == (TraceBuffer *) g_private_get (&trace_buffer_key))
+    {
+      trace_buffers = g_slist_remove (trace_buffers, trace_main_buffer);
+      g_free (trace_main_buffer);
+      g_private_set (&trace_buffer_key, NULL);
+    }
+
+  trace_main_buffer = (TraceBuffer *) NULL;
+
+  /*
+   * The buffers of the running threads are freed when they exit
+   * and they will be reused if the trace is restarted.
+   */
+  for (list = trace_buffers; list; list = list->next)
+    {
+      g_atomic_int_set (&((TraceBuffer *) list->data)->written, 0);
+    }
+
+  g_free (trace_filename);
+  trace_filename = (gchar *) NULL;
+
+  G_UNLOCK (trace_buffers);
+}
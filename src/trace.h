@@ -0,0 +1,113 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Low overhead tracing.
+ *
+ * Each thread stores binary events in its own ring buffer without
+ * locks; when the tracing is stopped the buffers are written in the
+ * Chrome trace-event JSON format (chrome://tracing, Perfetto).
+ * When the tracing is disabled each trace point costs a single test.
+ *
+ * The event and argument names must be static strings.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+
+/* Number of events stored for each thread; it must be a power of two. */
+#define TRACE_BUFFER_SIZE 65536
+
+
+/* Is the tracing enabled? Use the TRACE macros instead to read it. */
+extern gint trace_enabled;
+
+
+/* Start a duration event. */
+#define TRACE_BEGIN(name)                                               \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_event ((name), 'B', NULL, 0, NULL, 0);                      \
+  } G_STMT_END
+
+/* End the duration event started with TRACE_BEGIN. */
+#define TRACE_END(name)                                                 \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_event ((name), 'E', NULL, 0, NULL, 0);                      \
+  } G_STMT_END
+
+/* An instant event. */
+#define TRACE_INSTANT(name)                                             \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_event ((name), 'i', NULL, 0, NULL, 0);                      \
+  } G_STMT_END
+
+/* An instant event with two numeric arguments. */
+#define TRACE_INSTANT_ARGS(name, arg0_name, arg0, arg1_name, arg1)      \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_event ((name), 'i', (arg0_name), (arg0), (arg1_name), (arg1)); \
+  } G_STMT_END
+
+/* The value of a counter. */
+#define TRACE_COUNTER(name, value)                                      \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_event ((name), 'C', "value", (value), NULL, 0);             \
+  } G_STMT_END
+
+
+/*
+ * Start to trace; the events will be written in filename by trace_stop.
+ * The calling thread is named main in the trace.
+ */
+void
+trace_start        (const gchar  *filename);
+
+
+/* Store an event in the ring buffer of the calling thread. */
+void
+trace_event        (const gchar  *name,
+                    gchar         phase,
+                    const gchar  *arg0_name,
+                    gdouble       arg0,
+                    const gchar  *arg1_name,
+                    gdouble       arg1);
+
+
+/*
+ * Stop to trace and write the events in the Chrome trace-event format;
+ * it must be called when the other threads do not trace anymore.
+ */
+void
+trace_stop         ();
+
+
+#endif
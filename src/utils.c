@@ -27,9 +27,18 @@
 #endif
 
 #include <utils.h>
+#include <annotation_window.h>
+#include <background_window.h>
+#include <background_cache.h>
+#include <paper.h>
+#include <trace.h>
 
 #ifdef _WIN32
 #  include <windows_utils.h>
+#else
+#  ifndef __APPLE__
+#    include <gdk/gdkx.h>
+#  endif
 #endif
 
 /* The name of the current project. */
@@ -105,7 +114,15 @@ get_artifacts      ()
 void
 add_artifact       (gchar *path)
 {
-  gchar *copied_path = g_strdup_printf ("%s", path);
+  gchar *copied_path = (gchar *) NULL;
+
+  /* The iwb file is saved more times in a session. */
+  if (g_slist_find_custom (artifacts, path, (GCompareFunc) g_strcmp0))
+    {
+      return;
+    }
+
+  copied_path = g_strdup_printf ("%s", path);
   artifacts = g_slist_prepend (artifacts, copied_path);
 }
 
@@ -126,22 +143,6 @@ get_bar_widget ()
 }
 
 
-/** Get the distance between two points. */
-gdouble
-get_distance       (gdouble x1,
-                    gdouble y1,
-                    gdouble x2,
-                    gdouble y2)
-{
-  /* Apply the Pitagora theorem to calculate the distance. */
-  gdouble x_delta = fabs (x2-x1);
-  gdouble y_delta = fabs (y2-y1);
-  gdouble quad_sum = pow (x_delta, 2);
-  quad_sum = quad_sum + pow (y_delta, 2);
-  return sqrt (quad_sum);
-}
-
-
 /* Take a GdkColor and return the equivalent RGBA string. */
 gchar *
 gdkcolor_to_rgb    (GdkColor *gdkcolor)
@@ -178,98 +179,209 @@ rgba_to_gdkcolor   (gchar  *rgba)
 }
 
 
-/* Clear cairo context. */
-void
-clear_cairo_context     (cairo_t  *cr)
+/* Load the background image scaled to the screen as the background window does. */
+GdkPixbuf *
+load_background_pixbuf       (const gchar  *filename,
+                              gint          width,
+                              gint          height)
 {
-  if (cr)
+  GError *err = (GError *) NULL;
+  GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale (filename, width, height, FALSE, &err);
+
+  if (!pixbuf)
     {
-      cairo_save (cr);
-      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
-      cairo_paint (cr);
-      cairo_restore (cr);
+      g_warning ("Error loading the background %s: %s", filename, err->message);
+      g_error_free (err);
     }
+
+  return pixbuf;
 }
 
 
-/* Scale the surface with the width and height requested */
+/*
+ * Create the surface with the background: the image if any, otherwise
+ * the colour in RGBA format over the white paper.
+ */
 cairo_surface_t *
-scale_surface      (cairo_surface_t  *surface,
-                    gdouble           width,
-                    gdouble           height)
-{
-  gdouble old_width = cairo_image_surface_get_width (surface);
-  gdouble old_height = cairo_image_surface_get_height (surface);
-	
-  cairo_surface_t *new_surface = cairo_surface_create_similar (surface,
-                                                               CAIRO_CONTENT_COLOR_ALPHA,
-                                                               width,
-                                                               height);
-
-  cairo_t *cr = cairo_create (new_surface);
-
-  /* Scale *before* setting the source surface (1) */
-  cairo_scale (cr, width / old_width, height / old_height);
-  cairo_set_source_surface (cr, surface, 0, 0);
-
-  /* To avoid getting the edge pixels blended with 0 alpha, which would 
-   * occur with the default EXTEND_NONE. Use EXTEND_PAD for 1.2 or newer (2)
-   */
-  cairo_pattern_set_extend (cairo_get_source(cr), CAIRO_EXTEND_REFLECT); 
-
-  /* Replace the destination with the source instead of overlaying */
-  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+create_background_surface    (const gchar  *color,
+                              const gchar  *image,
+                              const gchar  *paper,
+                              gint          width,
+                              gint          height)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create (surface);
 
-  /* Do the actual drawing */
+  cairo_set_source_rgb (cr, 1, 1, 1);
   cairo_paint (cr);
 
-  cairo_destroy (cr);
+  if (image)
+    {
+      cairo_surface_t *scaled = load_background_surface (image, width, height);
+
+      if (scaled)
+        {
+          cairo_set_source_surface (cr, scaled, 0, 0);
+          cairo_paint (cr);
+          cairo_surface_destroy (scaled);
+        }
+    }
+  else if (paper)
+    {
+      paper_paint (cr, paper, 1.0);
+    }
+  else if (color)
+    {
+      guint r = 0;
+      guint g = 0;
+      guint b = 0;
+      guint a = 0;
+
+      sscanf (color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+      cairo_set_source_rgba (cr, r / 255.0, g / 255.0, b / 255.0, a / 255.0);
+      cairo_paint (cr);
+    }
 
-  return new_surface;
+  cairo_destroy (cr);
+  return surface;
 }
 
 
-/* Set the cairo surface colour to the RGBA string. */
-void
-cairo_set_source_color_from_string     (cairo_t  *cr,
-                                        gchar    *color)
-{
-  if (cr)
+/*
+ * Compose the area of the board in memory: the background and the
+ * current save-point of the canvas; no window is read back from the server.
+ */
+static cairo_surface_t *
+grab_board              (gint  x,
+                         gint  y,
+                         gint  width,
+                         gint  height)
+{
+  AnnotateCanvas *canvas = get_annotation_data ()->canvas;
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+  cairo_surface_t *board = (cairo_surface_t *) NULL;
+  cairo_t *cr = (cairo_t *) NULL;
+
+  if (get_background_type () == 2)
     {
-      guint r,g,b,a;
-      sscanf (color, "%02X%02X%02X%02X", &r, &g, &b, &a);
+      /* The image is stretched to the screen as the background window does. */
+      cairo_surface_t *image = load_background_surface (get_background_image (),
+                                                        gdk_screen_width (),
+                                                        gdk_screen_height ());
 
-      cairo_set_source_rgba (cr,
-                             1.0 * r / 255,
-                             1.0 * g / 255,
-                             1.0 * b / 255,
-                             1.0 * a / 255);
+      surface = create_background_surface ((gchar *) NULL, (gchar *) NULL, (gchar *) NULL, width, height);
 
+      if (image)
+        {
+          cr = cairo_create (surface);
+          cairo_set_source_surface (cr, image, -x, -y);
+          cairo_paint (cr);
+          cairo_destroy (cr);
+          cairo_surface_destroy (image);
+        }
+    }
+  else if (get_background_type () == 3)
+    {
+      /* The paper is anchored to the screen as in the background window. */
+      surface = create_background_surface ((gchar *) NULL, (gchar *) NULL, (gchar *) NULL, width, height);
+      cr = cairo_create (surface);
+      cairo_translate (cr, -x, -y);
+      paper_paint (cr, get_background_paper (), 1.0);
+      cairo_destroy (cr);
+    }
+  else
+    {
+      surface = create_background_surface (get_background_color (), (gchar *) NULL, (gchar *) NULL, width, height);
     }
-}
 
+  board = canvas_savepoint_render (g_slist_nth (canvas->savepoint_list, canvas->current_save_index),
+                                   canvas->width,
+                                   canvas->height);
 
-/* Save the contents of the pixbuf in the file with name file name. */
-gboolean
-save_pixbuf_on_png_file      (GdkPixbuf    *pixbuf,
-                              const gchar  *filename)
-{
-  gint width = gdk_pixbuf_get_width (pixbuf);
-  gint height = gdk_pixbuf_get_height (pixbuf);
+  if (board)
+    {
+      cr = cairo_create (surface);
+      cairo_set_source_surface (cr, board, -x, -y);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+      cairo_surface_destroy (board);
+    }
+
+  return surface;
+}
 
-  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                                         width,
-                                                         height);
 
+/*
+ * Read the area of the desktop; on X the root window is read by cairo
+ * that uses the shared memory extension when the server supports it
+ * and only the area is transferred.
+ */
+static cairo_surface_t *
+grab_desktop            (gint  x,
+                         gint  y,
+                         gint  width,
+                         gint  height)
+{
+  GdkWindow *root_window = gdk_get_default_root_window ();
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
   cairo_t *cr = cairo_create (surface);
-  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+
+#if defined(_WIN32) || defined(__APPLE__)
+  gdk_cairo_set_source_window (cr, root_window, -x, -y);
   cairo_paint (cr);
+#else
+  GdkScreen *screen = gdk_window_get_screen (root_window);
+  cairo_surface_t *root_surface = cairo_xlib_surface_create (GDK_SCREEN_XDISPLAY (screen),
+                                                             GDK_WINDOW_XID (root_window),
+                                                             gdk_x11_visual_get_xvisual (gdk_screen_get_system_visual (screen)),
+                                                             gdk_screen_width (),
+                                                             gdk_screen_height ());
+
+  cairo_set_source_surface (cr, root_surface, -x, -y);
+  cairo_paint (cr);
+  cairo_surface_destroy (root_surface);
+#endif
 
-  /* Write to the png surface. */
-  cairo_surface_write_to_png (surface, filename);
   cairo_destroy (cr);
-  cairo_surface_destroy (surface);
-  return TRUE;
+  return surface;
+}
+
+
+/*
+ * Grab the area of the screen in an image surface: the board composed
+ * in memory when there is a background, otherwise the desktop; the cost
+ * depends on the area size.
+ */
+cairo_surface_t *
+grab_screenshot_area    (gint  x,
+                         gint  y,
+                         gint  width,
+                         gint  height)
+{
+  cairo_surface_t *surface = (cairo_surface_t *) NULL;
+
+  TRACE_BEGIN ("grab_screenshot");
+
+  if (get_background_type () != 0)
+    {
+      surface = grab_board (x, y, width, height);
+    }
+  else
+    {
+      surface = grab_desktop (x, y, width, height);
+    }
+
+  TRACE_END ("grab_screenshot");
+
+  return surface;
+}
+
+
+/* Grab the full screen in an image surface, see grab_screenshot_area. */
+cairo_surface_t *
+grab_screenshot_surface ()
+{
+  return grab_screenshot_area (0, 0, gdk_screen_width (), gdk_screen_height ());
 }
 
 
@@ -277,17 +389,15 @@ save_pixbuf_on_png_file      (GdkPixbuf    *pixbuf,
 GdkPixbuf *
 grab_screenshot    ()
 {
-  gint height = gdk_screen_height ();
-  gint width = gdk_screen_width ();
-
-  GdkWindow *root_window = gdk_get_default_root_window ();
-
-  return gdk_pixbuf_get_from_window (root_window,
-                                     0,
-                                     0,
-                                     width,
-                                     height);
+  cairo_surface_t *surface = grab_screenshot_surface ();
+  GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface (surface,
+                                                   0,
+                                                   0,
+                                                   cairo_image_surface_get_width (surface),
+                                                   cairo_image_surface_get_height (surface));
 
+  cairo_surface_destroy (surface);
+  return pixbuf;
 }
 
 
@@ -398,6 +508,35 @@ file_exists        (gchar *filename)
 }
 
 
+/*
+ * Move the source file over the destination;
+ * if it fails the destination is left as it was.
+ */
+gboolean
+replace_file       (const gchar  *source,
+                    const gchar  *destination)
+{
+#ifdef _WIN32
+  gunichar2 *utf16_source = g_utf8_to_utf16 (source, -1, NULL, NULL, NULL);
+  gunichar2 *utf16_destination = g_utf8_to_utf16 (destination, -1, NULL, NULL, NULL);
+  gboolean replaced = FALSE;
+
+  /* The rename of the c runtime refuses to replace an existing file. */
+  replaced = MoveFileExW (utf16_source,
+                          utf16_destination,
+                          MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+  g_free (utf16_source);
+  g_free (utf16_destination);
+
+  return replaced;
+#else
+  /* The rename replaces the old file atomically. */
+  return (g_rename (source, destination) == 0);
+#endif
+}
+
+
 /* 
  * Return a file name containing
  * the project name and the current date.
@@ -511,22 +650,6 @@ remove_dir_if_empty     (gchar* dir_path)
 }
 
 
-/* Allocate a new point belonging to the stroke passing the values. */
-AnnotatePoint *
-allocate_point     (gdouble  x,
-                    gdouble  y,
-                    gdouble  width,
-                    gdouble  pressure)
-{
-  AnnotatePoint *point =  g_malloc ( (gsize) sizeof (AnnotatePoint));
-  point->x = x;
-  point->y = y;
-  point->width = width;
-  point->pressure = pressure;
-  return point;
-}
-
-
 /* Send an email. */
 void
 send_email         (gchar   *to,
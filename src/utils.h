@@ -48,6 +48,8 @@
 
 #include <config.h>
 
+#include <canvas.h>
+
 /*
  * Standard gettext macros.
  */
@@ -59,7 +61,7 @@
 
 
 /* The gtk builder object of the bar window */
-GtkBuilder *bar_gtk_builder;
+extern GtkBuilder *bar_gtk_builder;
 
 		
 #define PROGRAM_NAME "Ardesia"
@@ -73,16 +75,6 @@ GtkBuilder *bar_gtk_builder;
 #define BLUE "0000FF"
 
 
-/* Struct to store the painted point. */
-typedef struct
-{
-  gdouble x;
-  gdouble y;
-  gdouble width;
-  gdouble pressure;
-} AnnotatePoint;
-
-
 /* Get the name of the current project. */
 gchar *
 get_project_name        ();
@@ -137,37 +129,11 @@ gchar *
 gdkcolor_to_rgb         (GdkColor *gdkcolor);
 
 
-/* Scale the surface with the width and height requested */
-cairo_surface_t *
-scale_surface           (cairo_surface_t  *surface,
-                         gdouble           width,
-                         gdouble           height);
-				
-				
-/* Set the cairo surface color to the RGBA string. */
-void
-cairo_set_source_color_from_string     (cairo_t  *cr,
-                                        gchar    *color);
-                              
-
 /* Set the cairo surface color to transparent. */
 void
 cairo_set_transparent_color       (cairo_t  *cr);
 
 
-/* Distance between two points using the Pitagora theorem. */
-gdouble
-get_distance            (gdouble  x1,
-                         gdouble  y1,
-                         gdouble  x2,
-                         gdouble  y2);
-
-
-/* Clear cairo context. */
-void
-clear_cairo_context     (cairo_t  *cr);
-
-
 /*
  * This is function return if the point (x,y) in inside the ardesia bar window.
  */
@@ -189,10 +155,41 @@ GdkColor *
 rgba_to_gdkcolor        (gchar  *rgb);
 
 
-/* Save the contents of the pixbuf in the file with name file name. */
-gboolean
-save_pixbuf_on_png_file      (GdkPixbuf    *pixbuf,
-                              const gchar  *filename);
+/* Load the background image scaled to the screen as the background window does. */
+GdkPixbuf *
+load_background_pixbuf       (const gchar  *filename,
+                              gint          width,
+                              gint          height);
+
+
+/*
+ * Create the surface with the background: the image if any, otherwise
+ * the paper described as in paper.h or the colour in RGBA format over
+ * the white paper.
+ */
+cairo_surface_t *
+create_background_surface    (const gchar  *color,
+                              const gchar  *image,
+                              const gchar  *paper,
+                              gint          width,
+                              gint          height);
+
+
+/*
+ * Grab the area of the screen in an image surface: the board composed
+ * in memory when there is a background, otherwise the desktop; the cost
+ * depends on the area size.
+ */
+cairo_surface_t *
+grab_screenshot_area    (gint  x,
+                         gint  y,
+                         gint  width,
+                         gint  height);
+
+
+/* Grab the full screen in an image surface, see grab_screenshot_area. */
+cairo_surface_t *
+grab_screenshot_surface ();
 
 
 /* Grab the screenshoot and put it in the image buffer. */
@@ -222,6 +219,15 @@ gboolean
 file_exists        (gchar*  filename);
 
 
+/*
+ * Move the source file over the destination;
+ * if it fails the destination is left as it was.
+ */
+gboolean
+replace_file       (const gchar  *source,
+                    const gchar  *destination);
+
+
 /*
  * Get the home directory.
  */
@@ -253,14 +259,6 @@ void
 remove_dir_if_empty     (gchar  *dir_path);
 
 
-/* Allocate a new point belonging to the path passing the values. */
-AnnotatePoint *
-allocate_point     (gdouble  x,
-                    gdouble  y,
-                    gdouble  width,
-                    gdouble  pressure);
-
-
 /* Send an email. */
 void
 send_email         (gchar   *to,
@@ -0,0 +1,303 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <video_encoder.h>
+
+
+/* Allocate a black frame. */
+VideoFrame *
+video_frame_new              (gint              width,
+                              gint              height)
+{
+  VideoFrame *frame = g_malloc ((gsize) sizeof (VideoFrame));
+  gint plane = 0;
+
+  frame->width = width;
+  frame->height = height;
+
+  for (plane = 0; plane < 3; plane++)
+    {
+      frame->ycbcr[plane].width = ((width + 15) & ~15) >> (plane ? 1 : 0);
+      frame->ycbcr[plane].height = ((height + 15) & ~15) >> (plane ? 1 : 0);
+      frame->ycbcr[plane].stride = frame->ycbcr[plane].width;
+      frame->ycbcr[plane].data = g_malloc ((gsize) frame->ycbcr[plane].stride * frame->ycbcr[plane].height);
+
+      memset (frame->ycbcr[plane].data,
+              plane ? 128 : 16,
+              (gsize) frame->ycbcr[plane].stride * frame->ycbcr[plane].height);
+    }
+
+  return frame;
+}
+
+
+/* Free the frame. */
+void
+video_frame_free             (VideoFrame       *frame)
+{
+  gint plane = 0;
+
+  for (plane = 0; plane < 3; plane++)
+    {
+      g_free (frame->ycbcr[plane].data);
+    }
+
+  g_free (frame);
+}
+
+
+/*
+ * Convert the surface in the frame placing it at x, y; the area
+ * must be aligned to the 2x2 blocks of the chroma.
+ */
+void
+video_frame_convert          (VideoFrame       *frame,
+                              cairo_surface_t  *surface,
+                              gint              x,
+                              gint              y)
+{
+  cairo_surface_t *image = (cairo_surface_t *) NULL;
+  gint width = 0;
+  gint height = 0;
+  gint stride = 0;
+  guchar *data = (guchar *) NULL;
+  gint i = 0;
+  gint j = 0;
+
+  /* A sub-surface is mapped to reach its pixels. */
+  image = cairo_surface_map_to_image (surface, (cairo_rectangle_int_t *) NULL);
+  width = cairo_image_surface_get_width (image);
+  height = cairo_image_surface_get_height (image);
+  stride = cairo_image_surface_get_stride (image);
+  data = cairo_image_surface_get_data (image);
+
+  for (j = 0; j < height; j++)
+    {
+      guint32 *row = (guint32 *) (data + j * stride);
+      guchar *luma = frame->ycbcr[0].data + (y + j) * frame->ycbcr[0].stride + x;
+
+      for (i = 0; i < width; i++)
+        {
+          gint r = (row[i] >> 16) & 0xff;
+          gint g = (row[i] >> 8) & 0xff;
+          gint b = row[i] & 0xff;
+
+          luma[i] = (guchar) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+    }
+
+  /* The chroma is the average of each 2x2 block. */
+  for (j = 0; j < height; j += 2)
+    {
+      guint32 *row = (guint32 *) (data + j * stride);
+      guint32 *next_row = (guint32 *) (data + MIN (j + 1, height - 1) * stride);
+      guchar *cb = frame->ycbcr[1].data + ((y + j) / 2) * frame->ycbcr[1].stride + x / 2;
+      guchar *cr = frame->ycbcr[2].data + ((y + j) / 2) * frame->ycbcr[2].stride + x / 2;
+
+      for (i = 0; i < width; i += 2)
+        {
+          gint next_i = MIN (i + 1, width - 1);
+          guint32 pixels[4] = { row[i], row[next_i], next_row[i], next_row[next_i] };
+          gint r = 0;
+          gint g = 0;
+          gint b = 0;
+          gint k = 0;
+
+          for (k = 0; k < 4; k++)
+            {
+              r += (pixels[k] >> 16) & 0xff;
+              g += (pixels[k] >> 8) & 0xff;
+              b += pixels[k] & 0xff;
+            }
+
+          r /= 4;
+          g /= 4;
+          b /= 4;
+
+          cb[i / 2] = (guchar) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+          cr[i / 2] = (guchar) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+  cairo_surface_unmap_image (surface, image);
+}
+
+
+/* Write the pages completed; all the pages if flush is true. */
+static void
+write_pages                  (VideoEncoder     *video,
+                              gboolean          flush)
+{
+  ogg_page page;
+
+  while (flush ? ogg_stream_flush (&video->stream, &page) : ogg_stream_pageout (&video->stream, &page))
+    {
+      fwrite (page.header, 1, page.header_len, video->fp);
+      fwrite (page.body, 1, page.body_len, video->fp);
+    }
+}
+
+
+/*
+ * Create the video file and write the headers; quality goes from 0
+ * to 63. A realtime encoder uses the fastest speed level. Return
+ * NULL if the file can not be written.
+ */
+VideoEncoder *
+video_encoder_new            (const gchar      *filename,
+                              gint              width,
+                              gint              height,
+                              gint              fps,
+                              gint              quality,
+                              gboolean          realtime)
+{
+  VideoEncoder *video = (VideoEncoder *) NULL;
+  th_info info;
+  th_comment comment;
+  ogg_packet packet;
+  ogg_uint32_t keyframe_frequency = VIDEO_ENCODER_KEYFRAME_FREQUENCY;
+  FILE *fp = g_fopen (filename, "wb");
+
+  if (!fp)
+    {
+      return video;
+    }
+
+  th_info_init (&info);
+
+  /* The frame is a multiple of 16 and the picture is cropped. */
+  info.frame_width = (width + 15) & ~15;
+  info.frame_height = (height + 15) & ~15;
+  info.pic_width = width;
+  info.pic_height = height;
+  info.pic_x = 0;
+  info.pic_y = 0;
+  info.colorspace = TH_CS_UNSPECIFIED;
+  info.pixel_fmt = TH_PF_420;
+  info.fps_numerator = fps;
+  info.fps_denominator = 1;
+  info.aspect_numerator = 1;
+  info.aspect_denominator = 1;
+  info.target_bitrate = 0;
+  info.quality = quality;
+  info.keyframe_granule_shift = g_bit_storage (VIDEO_ENCODER_KEYFRAME_FREQUENCY - 1);
+
+  video = g_malloc ((gsize) sizeof (VideoEncoder));
+  video->fp = fp;
+  video->encoder = th_encode_alloc (&info);
+  th_info_clear (&info);
+
+  if (!video->encoder)
+    {
+      fclose (fp);
+      g_free (video);
+      return (VideoEncoder *) NULL;
+    }
+
+  ogg_stream_init (&video->stream, g_random_int ());
+
+  th_encode_ctl (video->encoder,
+                 TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+                 &keyframe_frequency,
+                 sizeof (keyframe_frequency));
+
+  if (realtime)
+    {
+      gint speed_level = 0;
+
+      th_encode_ctl (video->encoder, TH_ENCCTL_GET_SPLEVEL_MAX, &speed_level, sizeof (speed_level));
+      th_encode_ctl (video->encoder, TH_ENCCTL_SET_SPLEVEL, &speed_level, sizeof (speed_level));
+    }
+
+  th_comment_init (&comment);
+
+  while (th_encode_flushheader (video->encoder, &comment, &packet) > 0)
+    {
+      ogg_stream_packetin (&video->stream, &packet);
+    }
+
+  th_comment_clear (&comment);
+
+  /* The headers must be in their own pages. */
+  write_pages (video, TRUE);
+
+  return video;
+}
+
+
+/*
+ * Encode the frame shown count times; the repetitions are coded as
+ * duplicate frames that cost a few bytes and no encoding time.
+ */
+void
+video_encoder_write          (VideoEncoder     *video,
+                              VideoFrame       *frame,
+                              gint64            count,
+                              gboolean          last)
+{
+  ogg_packet packet;
+
+  while (count > 0)
+    {
+      /* The encoder duplicates at most until the next key frame. */
+      gint duplicates = (gint) MIN (count, VIDEO_ENCODER_KEYFRAME_FREQUENCY) - 1;
+
+      th_encode_ctl (video->encoder, TH_ENCCTL_SET_DUP_FRAMES, &duplicates, sizeof (duplicates));
+      th_encode_ycbcr_in (video->encoder, frame->ycbcr);
+      count -= duplicates + 1;
+
+      while (th_encode_packetout (video->encoder, (last) && (count == 0), &packet) > 0)
+        {
+          ogg_stream_packetin (&video->stream, &packet);
+        }
+
+      write_pages (video, FALSE);
+    }
+}
+
+
+/* Flush the pages and close the file. */
+void
+video_encoder_free           (VideoEncoder     *video)
+{
+  if (!video)
+    {
+      return;
+    }
+
+  write_pages (video, TRUE);
+  th_encode_free (video->encoder);
+  ogg_stream_clear (&video->stream);
+  fclose (video->fp);
+  g_free (video);
+}
+
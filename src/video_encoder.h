@@ -0,0 +1,132 @@
+/*
+ * Ardesia -- a program for painting on the screen
+ * with this program you can play, draw, learn and teach
+ * This program has been written such as a freedom sonet
+ * We believe in the freedom and in the freedom of education
+ *
+ * Copyright (C) 2009 Pilolli Pietro <pilolli.pietro@gmail.com>
+ *
+ * Ardesia is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ardesia is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/*
+ * Theora video in an Ogg file.
+ *
+ * The frames are kept in the Y'CbCr 4:2:0 planes of the encoder; the
+ * cairo surfaces are converted in any area of a frame and a frame shown
+ * for many ticks is coded once followed by duplicates. It depends only
+ * on glib, cairo, theora and ogg and it is shared by the screencast and
+ * by the offline rendering of the sessions.
+ */
+
+
+#ifndef VIDEO_ENCODER_H
+#define VIDEO_ENCODER_H
+
+#include <stdio.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+#include <ogg/ogg.h>
+#include <theora/theoraenc.h>
+
+
+/* The maximum distance in frames between two key frames. */
+#define VIDEO_ENCODER_KEYFRAME_FREQUENCY 64
+
+
+/* A frame in the planes of the encoder. */
+typedef struct
+{
+
+  gint width;
+  gint height;
+
+  /* The planes are as large as the encoded frame, a multiple of 16. */
+  th_ycbcr_buffer ycbcr;
+
+} VideoFrame;
+
+
+/* The encoder writing the video file. */
+typedef struct
+{
+
+  FILE *fp;
+
+  ogg_stream_state stream;
+
+  th_enc_ctx *encoder;
+
+} VideoEncoder;
+
+
+/* Allocate a black frame. */
+VideoFrame *
+video_frame_new              (gint              width,
+                              gint              height);
+
+
+/* Free the frame. */
+void
+video_frame_free             (VideoFrame       *frame);
+
+
+/*
+ * Convert the surface in the frame placing it at x, y; the area
+ * must be aligned to the 2x2 blocks of the chroma.
+ */
+void
+video_frame_convert          (VideoFrame       *frame,
+                              cairo_surface_t  *surface,
+                              gint              x,
+                              gint              y);
+
+
+/*
+ * Create the video file and write the headers; quality goes from 0
+ * to 63. A realtime encoder uses the fastest speed level. Return
+ * NULL if the file can not be written.
+ */
+VideoEncoder *
+video_encoder_new            (const gchar      *filename,
+                              gint              width,
+                              gint              height,
+                              gint              fps,
+                              gint              quality,
+                              gboolean          realtime);
+
+
+/*
+ * Encode the frame shown count times; the repetitions are coded as
+ * duplicate frames that cost a few bytes and no encoding time.
+ */
+void
+video_encoder_write          (VideoEncoder     *video,
+                              VideoFrame       *frame,
+                              gint64            count,
+                              gboolean          last);
+
+
+/* Flush the pages and close the file. */
+void
+video_encoder_free           (VideoEncoder     *video);
+
+
+#endif
+